@@ -1,8 +1,12 @@
 #include "ast.h"
 
-Arena ast_arena;
+// per thread so declarations can be parsed in parallel without locking
+THREAD_LOCAL Arena ast_arena;
 
-size_t ast_memory_usage;
+THREAD_LOCAL size_t ast_memory_usage;
+
+// fold literal-only unary/binary expressions as they are constructed
+bool flag_fold_constants = true;
 
 static void *
 ast_alloc(size_t size) {
@@ -42,6 +46,12 @@ new_expr_paren(SrcPos pos, Expr *expr) {
 
 static Expr *
 new_expr_binary(SrcPos pos, TokenKind op, Expr *left, Expr *right) {
+    if (flag_fold_constants) {
+        Expr *folded = fold_expr_binary(pos, op, left, right);
+        if (folded) {
+            return folded;
+        }
+    }
     Expr *e = new_expr(EXPR_BINARY, pos);
     e->binary.op = op;
     e->binary.left = left;
@@ -94,6 +104,12 @@ new_expr_modify(SrcPos pos, TokenKind op, bool post, Expr *expr) {
 
 static Expr *
 new_expr_unary(SrcPos pos, TokenKind op, Expr *expr) {
+    if (flag_fold_constants) {
+        Expr *folded = fold_expr_unary(pos, op, expr);
+        if (folded) {
+            return folded;
+        }
+    }
     Expr *e = new_expr(EXPR_UNARY, pos);
     e->unary.op = op;
     e->unary.expr = expr;
@@ -143,17 +159,207 @@ new_decl(DeclKind kind, SrcPos pos, const char *name) {
 }
 
 static Decl *
-new_decl_func(SrcPos pos, const char *name, FuncParam *params, size_t num_params, Typespec *ret_type) {
+new_decl_func(SrcPos pos, const char *name, GenericParam *generics, size_t num_generics, FuncParam *params, size_t num_params, Typespec *ret_type, StmtList block) {
     Decl *d = new_decl(DECL_FUNC, pos, name);
+    d->fn.generics = AST_DUP(generics);
+    d->fn.num_generics = num_generics;
     d->fn.params = AST_DUP(params);
     d->fn.num_params = num_params;
     d->fn.ret_type = ret_type;
     //d->fn.has_varargs = has_varargs;
     //d->fn.varargs_type = varargs_type;
-    //d->fn.block = block;
+    d->fn.block = block;
+    return d;
+}
+
+static Decl *
+new_decl_const(SrcPos pos, const char *name, Typespec *type, Expr *expr) {
+    Decl *d = new_decl(DECL_CONST, pos, name);
+    d->const_decl.type = type;
+    d->const_decl.expr = expr;
     return d;
 }
 
+static Decl *
+new_decl_var(SrcPos pos, const char *name, Typespec *type, Expr *expr) {
+    Decl *d = new_decl(DECL_VAR, pos, name);
+    d->var.type = type;
+    d->var.expr = expr;
+    return d;
+}
+
+static Decl *
+new_decl_enum(SrcPos pos, const char *name, Typespec *type, EnumItem *items, size_t num_items) {
+    Decl *d = new_decl(DECL_ENUM, pos, name);
+    d->enum_decl.type = type;
+    d->enum_decl.items = AST_DUP(items);
+    d->enum_decl.num_items = num_items;
+    return d;
+}
+
+static Aggregate *
+new_aggregate(SrcPos pos, AggregateKind kind, AggregateItem *items, size_t num_items) {
+    Aggregate *aggregate = ast_alloc(sizeof(Aggregate));
+    aggregate->pos = pos;
+    aggregate->kind = kind;
+    aggregate->items = AST_DUP(items);
+    aggregate->num_items = num_items;
+    return aggregate;
+}
+
+static Decl *
+new_decl_aggregate(SrcPos pos, DeclKind kind, const char *name, Aggregate *aggregate) {
+    assert(kind == DECL_STRUCT || kind == DECL_UNION);
+    Decl *d = new_decl(kind, pos, name);
+    d->aggregate = aggregate;
+    return d;
+}
+
+static Notes
+new_notes(Note *notes, size_t num_notes) {
+    return (Notes){AST_DUP(notes), num_notes};
+}
+
+static Note *
+get_decl_note(Decl *decl, const char *name) {
+    for (size_t i = 0; i < decl->notes.num_notes; i++) {
+        if (decl->notes.notes[i].name == name) {
+            return &decl->notes.notes[i];
+        }
+    }
+    return NULL;
+}
+
+static Decl *
+new_decl_import(SrcPos pos, bool is_relative, const char **names, size_t num_names, bool import_all, ImportItem *items, size_t num_items) {
+    Decl *d = new_decl(DECL_IMPORT, pos, NULL);
+    d->import.is_relative = is_relative;
+    d->import.names = AST_DUP(names);
+    d->import.num_names = num_names;
+    d->import.import_all = import_all;
+    d->import.items = AST_DUP(items);
+    d->import.num_items = num_items;
+    return d;
+}
+
+static Decls *
+new_decls(Decl **decls, size_t num_decls) {
+    Decls *d = ast_alloc(sizeof(Decls));
+    d->decls = AST_DUP(decls);
+    d->num_decls = num_decls;
+    return d;
+}
+
+static StmtList
+new_stmt_list(SrcPos pos, Stmt **stmts, size_t num_stmts) {
+    return (StmtList){pos, AST_DUP(stmts), num_stmts};
+}
+
+static Stmt *
+new_stmt(StmtKind kind, SrcPos pos) {
+    Stmt *s = ast_alloc(sizeof(Stmt));
+    s->kind = kind;
+    s->pos = pos;
+    return s;
+}
+
+static Stmt *
+new_stmt_return(SrcPos pos, Expr *expr) {
+    Stmt *s = new_stmt(STMT_RETURN, pos);
+    s->expr = expr;
+    return s;
+}
+
+static Stmt *
+new_stmt_block(SrcPos pos, StmtList block) {
+    Stmt *s = new_stmt(STMT_BLOCK, pos);
+    s->block = block;
+    return s;
+}
+
+static Stmt *
+new_stmt_if(SrcPos pos, Expr *cond, StmtList then_block, ElseIf *elseifs, size_t num_elseifs, StmtList else_block) {
+    Stmt *s = new_stmt(STMT_IF, pos);
+    s->if_stmt.cond = cond;
+    s->if_stmt.then_block = then_block;
+    s->if_stmt.elseifs = AST_DUP(elseifs);
+    s->if_stmt.num_elseifs = num_elseifs;
+    s->if_stmt.else_block = else_block;
+    return s;
+}
+
+static Stmt *
+new_stmt_while(SrcPos pos, Expr *cond, StmtList block) {
+    Stmt *s = new_stmt(STMT_WHILE, pos);
+    s->while_stmt.cond = cond;
+    s->while_stmt.block = block;
+    return s;
+}
+
+static Stmt *
+new_stmt_for(SrcPos pos, Stmt *init, Expr *cond, Stmt *next, StmtList block) {
+    Stmt *s = new_stmt(STMT_FOR, pos);
+    s->for_stmt.init = init;
+    s->for_stmt.cond = cond;
+    s->for_stmt.next = next;
+    s->for_stmt.block = block;
+    return s;
+}
+
+static Stmt *
+new_stmt_assign(SrcPos pos, TokenKind op, Expr *left, Expr *right) {
+    Stmt *s = new_stmt(STMT_ASSIGN, pos);
+    s->assign.op = op;
+    s->assign.left = left;
+    s->assign.right = right;
+    return s;
+}
+
+static Stmt *
+new_stmt_init(SrcPos pos, const char *name, Typespec *type, Expr *expr) {
+    Stmt *s = new_stmt(STMT_INIT, pos);
+    s->init.name = name;
+    s->init.type = type;
+    s->init.expr = expr;
+    return s;
+}
+
+static EnumItem *
+find_enum_item(Decl *decl, const char *name) {
+    for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+        if (decl->enum_decl.items[i].name == name) {
+            return &decl->enum_decl.items[i];
+        }
+    }
+    return NULL;
+}
+
+// `_` in a switch pattern
+static bool
+is_pattern_wildcard(Expr *pattern) {
+    return pattern->kind == EXPR_NAME && pattern->name[0] == '_' && !pattern->name[1];
+}
+
+static Stmt *
+new_stmt_switch(SrcPos pos, Expr *expr, SwitchCase *cases, size_t num_cases) {
+    Stmt *s = new_stmt(STMT_SWITCH, pos);
+    s->switch_stmt.expr = expr;
+    s->switch_stmt.cases = AST_DUP(cases);
+    for (size_t i = 0; i < num_cases; i++) {
+        SwitchCase *c = &s->switch_stmt.cases[i];
+        c->patterns = ast_dup(c->patterns, c->num_patterns * sizeof(*c->patterns));
+    }
+    s->switch_stmt.num_cases = num_cases;
+    return s;
+}
+
+static Stmt *
+new_stmt_expr(SrcPos pos, Expr *expr) {
+    Stmt *s = new_stmt(STMT_EXPR, pos);
+    s->expr = expr;
+    return s;
+}
+
 static Typespec *
 new_typespec(TypespecKind kind, SrcPos pos) {
     Typespec *t = ast_alloc(sizeof(Typespec));
@@ -170,10 +376,474 @@ new_typespec_name(SrcPos pos, const char **names, size_t num_names) {
     return t;
 }
 
+static Typespec *
+new_typespec_ptr(SrcPos pos, Typespec *base) {
+    Typespec *t = new_typespec(TYPESPEC_PTR, pos);
+    t->base = base;
+    return t;
+}
+
+static Typespec *
+new_typespec_array(SrcPos pos, Typespec *base, Expr *num_elems) {
+    Typespec *t = new_typespec(TYPESPEC_ARRAY, pos);
+    t->base = base;
+    t->num_elems = num_elems;
+    return t;
+}
+
 static Typespec *
 new_typespec_tuple(SrcPos pos, Typespec **fields, size_t num_fields) {
     Typespec *t = new_typespec(TYPESPEC_TUPLE, pos);
     t->tuple.fields = AST_DUP(fields);
     t->tuple.num_fields = num_fields;
     return t;
-}
\ No newline at end of file
+}
+
+// Constant folding
+//
+// Literal types follow C: an unsuffixed literal is an int if it fits, otherwise
+// unsigned (hex/binary only) or long long. int is 32 bits and long and long
+// long are 64, the widths of the language's integer types on every host.
+// Folded values are computed in a Val of that type with two's complement
+// wraparound, and the result replaces the left operand in place, so a folded
+// subtree costs no extra nodes.
+
+typedef enum FoldType {
+    FOLD_NONE,
+    FOLD_INT,
+    FOLD_UINT,
+    FOLD_LONG,
+    FOLD_ULONG,
+    FOLD_LLONG,
+    FOLD_ULLONG,
+    FOLD_FLOAT,
+    FOLD_DOUBLE,
+} FoldType;
+
+static TokenSuffix fold_type_suffixes[] = {
+    [FOLD_INT] = SUFFIX_NONE,
+    [FOLD_UINT] = SUFFIX_U,
+    [FOLD_LONG] = SUFFIX_L,
+    [FOLD_ULONG] = SUFFIX_UL,
+    [FOLD_LLONG] = SUFFIX_LL,
+    [FOLD_ULLONG] = SUFFIX_ULL,
+    [FOLD_FLOAT] = SUFFIX_NONE,
+    [FOLD_DOUBLE] = SUFFIX_D,
+};
+
+static FoldType fold_suffix_types[] = {
+    [SUFFIX_NONE] = FOLD_INT,
+    [SUFFIX_U] = FOLD_UINT,
+    [SUFFIX_L] = FOLD_LONG,
+    [SUFFIX_UL] = FOLD_ULONG,
+    [SUFFIX_LL] = FOLD_LLONG,
+    [SUFFIX_ULL] = FOLD_ULLONG,
+};
+
+static bool
+fold_is_float(FoldType type) {
+    return type == FOLD_FLOAT || type == FOLD_DOUBLE;
+}
+
+static bool
+fold_is_signed(FoldType type) {
+    return type == FOLD_INT || type == FOLD_LONG || type == FOLD_LLONG;
+}
+
+// The widths of the language's i32/u32 and i64/u64, whatever the host's C
+// types are: an l literal is 64 bits, as on LP64 targets.
+static int
+fold_int_bits(FoldType type) {
+    switch (type) {
+    case FOLD_INT: case FOLD_UINT:
+        return 32;
+    default:
+        return 64;
+    }
+}
+
+static unsigned long long
+fold_truncate(unsigned long long bits, int num_bits, bool is_signed) {
+    if (num_bits >= 64) {
+        return bits;
+    }
+    unsigned long long mask = (1ull << num_bits) - 1;
+    bits &= mask;
+    if (is_signed && (bits >> (num_bits - 1))) {
+        bits |= ~mask;
+    }
+    return bits;
+}
+
+// Integer values are kept as their bits in val.ull, truncated to the type's
+// width and sign-extended to 64 bits when it's signed.
+static unsigned long long
+fold_get_bits(Val val, FoldType type) {
+    assert(!fold_is_float(type) && type != FOLD_NONE);
+    return val.ull;
+}
+
+static Val
+fold_set_bits(FoldType type, unsigned long long bits) {
+    assert(!fold_is_float(type) && type != FOLD_NONE);
+    return (Val){.ull = fold_truncate(bits, fold_int_bits(type), fold_is_signed(type))};
+}
+
+static double
+fold_get_double(Val val, FoldType type) {
+    if (type == FOLD_FLOAT) {
+        return val.f;
+    } else if (type == FOLD_DOUBLE) {
+        return val.d;
+    } else if (fold_is_signed(type)) {
+        return (double)(long long)fold_get_bits(val, type);
+    } else {
+        return (double)fold_get_bits(val, type);
+    }
+}
+
+static Val
+fold_convert(Val val, FoldType from, FoldType to) {
+    if (from == to) {
+        return val;
+    }
+    Val result = {0};
+    if (to == FOLD_FLOAT) {
+        result.f = (float)fold_get_double(val, from);
+    } else if (to == FOLD_DOUBLE) {
+        result.d = fold_get_double(val, from);
+    } else {
+        assert(!fold_is_float(from));
+        result = fold_set_bits(to, fold_get_bits(val, from));
+    }
+    return result;
+}
+
+static FoldType
+fold_literal(Expr *expr, Val *val) {
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    if (expr->kind == EXPR_FLOAT) {
+        if (expr->float_lit.suffix == SUFFIX_D) {
+            val->d = expr->float_lit.val;
+            return FOLD_DOUBLE;
+        }
+        val->f = (float)expr->float_lit.val;
+        return FOLD_FLOAT;
+    }
+    if (expr->kind != EXPR_INT) {
+        return FOLD_NONE;
+    }
+    unsigned long long v = expr->int_lit.val;
+    FoldType type = FOLD_NONE;
+    if (expr->int_lit.folded) {
+        type = fold_suffix_types[expr->int_lit.suffix];
+    } else {
+        bool is_based = expr->int_lit.mod == MOD_HEX || expr->int_lit.mod == MOD_BIN;
+        switch (expr->int_lit.suffix) {
+        case SUFFIX_NONE:
+            if (v <= INT32_MAX) {
+                type = FOLD_INT;
+            } else if (is_based && v <= UINT32_MAX) {
+                type = FOLD_UINT;
+            } else if (v <= INT64_MAX) {
+                type = FOLD_LLONG;
+            } else {
+                type = FOLD_ULLONG;
+            }
+            break;
+        case SUFFIX_U:
+            type = v <= UINT32_MAX ? FOLD_UINT : FOLD_ULLONG;
+            break;
+        case SUFFIX_L:
+            if (v <= INT64_MAX) {
+                type = FOLD_LONG;
+            } else {
+                type = is_based ? FOLD_ULONG : FOLD_ULLONG;
+            }
+            break;
+        case SUFFIX_UL:
+            type = FOLD_ULONG;
+            break;
+        case SUFFIX_LL:
+            type = v <= INT64_MAX ? FOLD_LLONG : FOLD_ULLONG;
+            break;
+        case SUFFIX_ULL:
+            type = FOLD_ULLONG;
+            break;
+        default:
+            return FOLD_NONE;
+        }
+    }
+    *val = fold_set_bits(type, v);
+    return type;
+}
+
+static int
+fold_int_rank(FoldType type) {
+    return (type - FOLD_INT)/2;
+}
+
+// usual arithmetic conversions
+static FoldType
+fold_common_type(FoldType left, FoldType right) {
+    if (fold_is_float(left) || fold_is_float(right)) {
+        return left == FOLD_DOUBLE || right == FOLD_DOUBLE ? FOLD_DOUBLE : FOLD_FLOAT;
+    }
+    if (fold_is_signed(left) == fold_is_signed(right)) {
+        return fold_int_rank(left) >= fold_int_rank(right) ? left : right;
+    }
+    FoldType sig = fold_is_signed(left) ? left : right;
+    FoldType unsig = fold_is_signed(left) ? right : left;
+    if (fold_int_rank(unsig) >= fold_int_rank(sig)) {
+        return unsig;
+    } else if (fold_int_bits(sig) > fold_int_bits(unsig)) {
+        return sig;
+    } else {
+        return sig + 1;
+    }
+}
+
+static Expr *
+fold_result(Expr *dest, SrcPos pos, FoldType type, Val val) {
+    while (dest->kind == EXPR_PAREN) {
+        dest = dest->paren.expr;
+    }
+    dest->pos = pos;
+    if (fold_is_float(type)) {
+        dest->kind = EXPR_FLOAT;
+        dest->float_lit.start = NULL;
+        dest->float_lit.end = NULL;
+        dest->float_lit.val = fold_get_double(val, type);
+        dest->float_lit.suffix = fold_type_suffixes[type];
+    } else {
+        dest->kind = EXPR_INT;
+        dest->int_lit.val = fold_get_bits(val, type);
+        dest->int_lit.mod = MOD_NONE;
+        dest->int_lit.suffix = fold_type_suffixes[type];
+        dest->int_lit.folded = true;
+    }
+    return dest;
+}
+
+static Expr *
+fold_bool_result(Expr *dest, SrcPos pos, bool b) {
+    return fold_result(dest, pos, FOLD_INT, fold_set_bits(FOLD_INT, b));
+}
+
+static bool
+fold_is_true(Val val, FoldType type) {
+    return fold_is_float(type) ? fold_get_double(val, type) != 0 : fold_get_bits(val, type) != 0;
+}
+
+static Expr *
+fold_expr_unary(SrcPos pos, TokenKind op, Expr *expr) {
+    Val val;
+    FoldType type = fold_literal(expr, &val);
+    if (type == FOLD_NONE) {
+        return NULL;
+    }
+    if (op == TOKEN_NOT) {
+        return fold_bool_result(expr, pos, !fold_is_true(val, type));
+    }
+    if (type == FOLD_FLOAT) {
+        switch (op) {
+        case TOKEN_ADD:
+            return fold_result(expr, pos, type, val);
+        case TOKEN_SUB:
+            val.f = -val.f;
+            return fold_result(expr, pos, type, val);
+        default:
+            return NULL;
+        }
+    } else if (type == FOLD_DOUBLE) {
+        switch (op) {
+        case TOKEN_ADD:
+            return fold_result(expr, pos, type, val);
+        case TOKEN_SUB:
+            val.d = -val.d;
+            return fold_result(expr, pos, type, val);
+        default:
+            return NULL;
+        }
+    }
+    int num_bits = fold_int_bits(type);
+    bool is_signed = fold_is_signed(type);
+    unsigned long long x = fold_get_bits(val, type);
+    unsigned long long r;
+    switch (op) {
+    case TOKEN_ADD:
+        r = x;
+        break;
+    case TOKEN_SUB:
+        r = fold_truncate(0 - x, num_bits, is_signed);
+        if (is_signed && x != 0 && r == x) {
+            warning(pos, "Integer overflow in constant expression");
+        }
+        break;
+    case TOKEN_NEG:
+        r = fold_truncate(~x, num_bits, is_signed);
+        break;
+    default:
+        return NULL;
+    }
+    return fold_result(expr, pos, type, fold_set_bits(type, r));
+}
+
+static Expr *
+fold_expr_binary_float(SrcPos pos, TokenKind op, Expr *left, FoldType type, double a, double b) {
+    Val val = {0};
+    double r;
+    switch (op) {
+    case TOKEN_ADD:
+        r = a + b;
+        break;
+    case TOKEN_SUB:
+        r = a - b;
+        break;
+    case TOKEN_MUL:
+        r = a * b;
+        break;
+    case TOKEN_DIV:
+        r = a / b;
+        break;
+    case TOKEN_EQ:
+        return fold_bool_result(left, pos, a == b);
+    case TOKEN_NOTEQ:
+        return fold_bool_result(left, pos, a != b);
+    case TOKEN_LT:
+        return fold_bool_result(left, pos, a < b);
+    case TOKEN_GT:
+        return fold_bool_result(left, pos, a > b);
+    case TOKEN_LTEQ:
+        return fold_bool_result(left, pos, a <= b);
+    case TOKEN_GTEQ:
+        return fold_bool_result(left, pos, a >= b);
+    default:
+        return NULL;
+    }
+    if (type == FOLD_FLOAT) {
+        val.f = (float)r;
+    } else {
+        val.d = r;
+    }
+    return fold_result(left, pos, type, val);
+}
+
+static Expr *
+fold_expr_binary(SrcPos pos, TokenKind op, Expr *left, Expr *right) {
+    Val left_val, right_val;
+    FoldType left_type = fold_literal(left, &left_val);
+    if (left_type == FOLD_NONE) {
+        return NULL;
+    }
+    FoldType right_type = fold_literal(right, &right_val);
+    if (right_type == FOLD_NONE) {
+        return NULL;
+    }
+    if (op == TOKEN_AND_AND) {
+        return fold_bool_result(left, pos, fold_is_true(left_val, left_type) && fold_is_true(right_val, right_type));
+    } else if (op == TOKEN_OR_OR) {
+        return fold_bool_result(left, pos, fold_is_true(left_val, left_type) || fold_is_true(right_val, right_type));
+    }
+    FoldType type;
+    if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        // shifts take the type of the left operand
+        if (fold_is_float(left_type) || fold_is_float(right_type)) {
+            return NULL;
+        }
+        type = left_type;
+    } else {
+        type = fold_common_type(left_type, right_type);
+        left_val = fold_convert(left_val, left_type, type);
+        right_val = fold_convert(right_val, right_type, type);
+    }
+    if (fold_is_float(type)) {
+        return fold_expr_binary_float(pos, op, left, type, fold_get_double(left_val, type), fold_get_double(right_val, type));
+    }
+    int num_bits = fold_int_bits(type);
+    bool is_signed = fold_is_signed(type);
+    unsigned long long a = fold_get_bits(left_val, type);
+    bool is_shift = op == TOKEN_LSHIFT || op == TOKEN_RSHIFT;
+    unsigned long long b = fold_get_bits(right_val, is_shift ? right_type : type);
+    long long sa = (long long)a;
+    long long sb = (long long)b;
+    unsigned long long min_bits = fold_truncate(1ull << (num_bits - 1), num_bits, true);
+    unsigned long long r;
+    bool overflow = false;
+    switch (op) {
+    case TOKEN_ADD:
+        r = fold_truncate(a + b, num_bits, is_signed);
+        overflow = is_signed && (long long)((a ^ r) & (b ^ r)) < 0;
+        break;
+    case TOKEN_SUB:
+        r = fold_truncate(a - b, num_bits, is_signed);
+        overflow = is_signed && (long long)((a ^ b) & (a ^ r)) < 0;
+        break;
+    case TOKEN_MUL:
+        r = fold_truncate(a * b, num_bits, is_signed);
+        if (is_signed && sa != 0) {
+            overflow = sa == -1 ? b == min_bits : (long long)r / sa != sb;
+        }
+        break;
+    case TOKEN_DIV:
+    case TOKEN_MOD:
+        if (b == 0) {
+            // an error node, so evaluating the const doesn't report it again
+            error(pos, "Division by zero in constant expression");
+            return new_expr(EXPR_ERROR, pos);
+        }
+        if (is_signed) {
+            if (a == min_bits && sb == -1) {
+                overflow = op == TOKEN_DIV;
+                r = op == TOKEN_DIV ? a : 0;
+            } else {
+                r = (unsigned long long)(op == TOKEN_DIV ? sa / sb : sa % sb);
+            }
+        } else {
+            r = op == TOKEN_DIV ? a / b : a % b;
+        }
+        break;
+    case TOKEN_LSHIFT:
+    case TOKEN_RSHIFT:
+        if ((fold_is_signed(right_type) && sb < 0) || b >= (unsigned long long)num_bits) {
+            warning(pos, "Shift count %lld out of range for %d-bit operand", sb, num_bits);
+            return NULL;
+        }
+        if (op == TOKEN_LSHIFT) {
+            r = fold_truncate(a << b, num_bits, is_signed);
+            overflow = is_signed && (long long)r >> b != sa;
+        } else {
+            r = is_signed ? (unsigned long long)(sa >> b) : a >> b;
+        }
+        break;
+    case TOKEN_AND:
+        r = a & b;
+        break;
+    case TOKEN_OR:
+        r = a | b;
+        break;
+    case TOKEN_XOR:
+        r = a ^ b;
+        break;
+    case TOKEN_EQ:
+        return fold_bool_result(left, pos, a == b);
+    case TOKEN_NOTEQ:
+        return fold_bool_result(left, pos, a != b);
+    case TOKEN_LT:
+        return fold_bool_result(left, pos, is_signed ? sa < sb : a < b);
+    case TOKEN_GT:
+        return fold_bool_result(left, pos, is_signed ? sa > sb : a > b);
+    case TOKEN_LTEQ:
+        return fold_bool_result(left, pos, is_signed ? sa <= sb : a <= b);
+    case TOKEN_GTEQ:
+        return fold_bool_result(left, pos, is_signed ? sa >= sb : a >= b);
+    default:
+        return NULL;
+    }
+    if (overflow) {
+        warning(pos, "Integer overflow in constant expression");
+    }
+    return fold_result(left, pos, type, fold_set_bits(type, r));
+}
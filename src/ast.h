@@ -8,6 +8,13 @@ typedef struct Expr Expr;
 typedef struct Stmt Stmt;
 typedef struct Decl Decl;
 typedef struct Typespec Typespec;
+struct BcFunc;
+
+typedef struct StmtList {
+    SrcPos pos;
+    Stmt **stmts;
+    size_t num_stmts;
+} StmtList;
 
 typedef struct GenericParam {
     SrcPos pos;
@@ -56,6 +63,30 @@ typedef struct Aggregate {
     size_t num_items;
 } Aggregate;
 
+typedef struct ImportItem {
+    const char *name;
+    // local name, from `import m {rename = name}`
+    const char *rename;
+} ImportItem;
+
+typedef struct EnumItem {
+    SrcPos pos;
+    const char *name;
+    // as the item's bits; sign extended from the base type when it's signed
+    long long value;
+} EnumItem;
+
+// @name before a declaration
+typedef struct Note {
+    SrcPos pos;
+    const char *name;
+} Note;
+
+typedef struct Notes {
+    Note *notes;
+    size_t num_notes;
+} Notes;
+
 typedef enum DeclKind {
     DECL_NONE,
     DECL_ENUM,
@@ -67,29 +98,40 @@ typedef enum DeclKind {
     DECL_FUNC,
     DECL_NOTE,
     DECL_IMPORT,
+    DECL_ERROR,
 } DeclKind;
 
 struct Decl {
     DeclKind kind;
     SrcPos pos;
     const char *name;
-    //Notes notes;
+    Notes notes;
     //bool is_incomplete;
     union {
         //Note note;
-        //struct {
-        //    Typespec *type;
-        //    EnumItem *items;
-        //    size_t num_items;
-        //} enum_decl;
+        struct {
+            // base type, i32 when not written
+            Typespec *type;
+            EnumItem *items;
+            size_t num_items;
+        } enum_decl;
         Aggregate *aggregate;
         struct {
+            GenericParam *generics;
+            size_t num_generics;
             FuncParam *params;
             size_t num_params;
             Typespec *ret_type;
             bool has_varargs;
             Typespec *varargs_type;
-            //StmtList block;
+            StmtList block;
+            // set when the body was skipped by a lazy parse; the body is
+            // parsed from here by parse_decl_fn_body on first use
+            const char *body_start;
+            const char *body_end;
+            SrcPos body_pos;
+            // bytecode for compile-time evaluation, see bytecode.h
+            struct BcFunc *bc;
         } fn;
         struct {
             Typespec *type;
@@ -107,7 +149,7 @@ struct Decl {
             const char **names;
             size_t num_names;
             bool import_all;
-            //ImportItem *items;
+            ImportItem *items;
             size_t num_items;
         } import;
     };
@@ -126,6 +168,7 @@ typedef enum TypespecKind {
     TYPESPEC_PTR,
     TYPESPEC_CONST,
     TYPESPEC_TUPLE,
+    TYPESPEC_ERROR,
 } TypespecKind;
 
 struct Typespec {
@@ -176,11 +219,14 @@ typedef enum ExprKind {
     EXPR_ALIGNOF_TYPE,
     EXPR_OFFSETOF,
     EXPR_NEW,
+    EXPR_ERROR,
 } ExprKind;
 
 struct Expr {
     ExprKind kind;
     SrcPos pos;
+    // set by the checker for the C backend; not cached
+    struct Type *type;
     union {
         struct {
             Expr *expr;
@@ -189,6 +235,9 @@ struct Expr {
             unsigned long long val;
             TokenMod mod;
             TokenSuffix suffix;
+            // set when the literal came from constant folding: val holds the
+            // sign-extended bits and suffix names the exact type (none = int)
+            bool folded;
         } int_lit;
         struct {
             const char *start;
@@ -264,11 +313,111 @@ struct Expr {
     };
 };
 
+typedef struct ElseIf {
+    Expr *cond;
+    StmtList block;
+} ElseIf;
+
+struct MatchTree;
+
+typedef struct SwitchCase {
+    SrcPos pos;
+    // a pattern is `_`, a constant, an inclusive range `lo..hi`, or a tuple
+    // of patterns matching a tuple scrutinee
+    Expr **patterns;
+    size_t num_patterns;
+    bool is_default;
+    StmtList block;
+} SwitchCase;
+
+typedef enum StmtKind {
+    STMT_NONE,
+    STMT_RETURN,
+    STMT_BREAK,
+    STMT_CONTINUE,
+    STMT_BLOCK,
+    STMT_IF,
+    STMT_WHILE,
+    STMT_FOR,
+    STMT_ASSIGN,
+    STMT_INIT,
+    STMT_EXPR,
+    STMT_SWITCH,
+    STMT_ERROR,
+} StmtKind;
+
+struct Stmt {
+    StmtKind kind;
+    SrcPos pos;
+    union {
+        Expr *expr;
+        StmtList block;
+        struct {
+            Expr *cond;
+            StmtList then_block;
+            ElseIf *elseifs;
+            size_t num_elseifs;
+            StmtList else_block;
+        } if_stmt;
+        struct {
+            Expr *cond;
+            StmtList block;
+        } while_stmt;
+        struct {
+            Stmt *init;
+            Expr *cond;
+            Stmt *next;
+            StmtList block;
+        } for_stmt;
+        struct {
+            TokenKind op;
+            Expr *left;
+            Expr *right;
+        } assign;
+        struct {
+            const char *name;
+            Typespec *type;
+            Expr *expr;
+        } init;
+        struct {
+            Expr *expr;
+            SwitchCase *cases;
+            size_t num_cases;
+            // decision tree built by the checker, see match.h; not cached
+            struct MatchTree *tree;
+        } switch_stmt;
+    };
+};
+
 static void *ast_alloc(size_t size);
 static void *ast_dup(const void *src, size_t size);
 
 static Decl *new_decl(DeclKind kind, SrcPos pos, const char *name);
-static Decl *new_decl_func(SrcPos pos, const char *name, FuncParam *params, size_t num_params, Typespec *ret_type);
+static Decl *new_decl_func(SrcPos pos, const char *name, GenericParam *generics, size_t num_generics, FuncParam *params, size_t num_params, Typespec *ret_type, StmtList block);
+
+static Decl *new_decl_const(SrcPos pos, const char *name, Typespec *type, Expr *expr);
+static Decl *new_decl_var(SrcPos pos, const char *name, Typespec *type, Expr *expr);
+static Decl *new_decl_enum(SrcPos pos, const char *name, Typespec *type, EnumItem *items, size_t num_items);
+static Decl *new_decl_aggregate(SrcPos pos, DeclKind kind, const char *name, Aggregate *aggregate);
+static Aggregate *new_aggregate(SrcPos pos, AggregateKind kind, AggregateItem *items, size_t num_items);
+static Notes new_notes(Note *notes, size_t num_notes);
+static Note *get_decl_note(Decl *decl, const char *name);
+static Decl *new_decl_import(SrcPos pos, bool is_relative, const char **names, size_t num_names, bool import_all, ImportItem *items, size_t num_items);
+static Decls *new_decls(Decl **decls, size_t num_decls);
+
+static StmtList new_stmt_list(SrcPos pos, Stmt **stmts, size_t num_stmts);
+static Stmt *new_stmt(StmtKind kind, SrcPos pos);
+static Stmt *new_stmt_return(SrcPos pos, Expr *expr);
+static Stmt *new_stmt_block(SrcPos pos, StmtList block);
+static Stmt *new_stmt_if(SrcPos pos, Expr *cond, StmtList then_block, ElseIf *elseifs, size_t num_elseifs, StmtList else_block);
+static Stmt *new_stmt_while(SrcPos pos, Expr *cond, StmtList block);
+static Stmt *new_stmt_for(SrcPos pos, Stmt *init, Expr *cond, Stmt *next, StmtList block);
+static Stmt *new_stmt_assign(SrcPos pos, TokenKind op, Expr *left, Expr *right);
+static Stmt *new_stmt_init(SrcPos pos, const char *name, Typespec *type, Expr *expr);
+static Stmt *new_stmt_expr(SrcPos pos, Expr *expr);
+static Stmt *new_stmt_switch(SrcPos pos, Expr *expr, SwitchCase *cases, size_t num_cases);
+static bool is_pattern_wildcard(Expr *pattern);
+static EnumItem *find_enum_item(Decl *decl, const char *name);
 
 static Expr *new_expr(ExprKind kind, SrcPos pos);
 static Expr *new_expr_paren(SrcPos pos, Expr *expr);
@@ -284,7 +433,12 @@ static Expr *new_expr_call(SrcPos pos, Expr *expr, Expr **args, size_t num_args)
 static Expr *new_expr_index(SrcPos pos, Expr *expr, Expr *index);
 static Expr *new_expr_field(SrcPos pos, Expr *expr, const char *name);
 
+static Expr *fold_expr_unary(SrcPos pos, TokenKind op, Expr *expr);
+static Expr *fold_expr_binary(SrcPos pos, TokenKind op, Expr *left, Expr *right);
+
 
 static Typespec *new_typespec(TypespecKind kind, SrcPos pos);
 static Typespec *new_typespec_name(SrcPos pos, const char **names, size_t num_names);
+static Typespec *new_typespec_ptr(SrcPos pos, Typespec *base);
+static Typespec *new_typespec_array(SrcPos pos, Typespec *base, Expr *num_elems);
 static Typespec *new_typespec_tuple(SrcPos pos, Typespec **fields, size_t num_fields);
\ No newline at end of file
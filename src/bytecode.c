@@ -0,0 +1,1684 @@
+#include "bytecode.h"
+
+// register file of the evaluations on this thread
+static THREAD_LOCAL Val *bc_stack;
+
+// guards lowering the fns of modules that are done being checked
+static Mutex bc_mutex = MUTEX_INIT;
+static THREAD_LOCAL bool bc_lock_held;
+
+static THREAD_LOCAL BcFunc **eval_scratch;
+static THREAD_LOCAL size_t eval_depth;
+
+static ConstCacheShard const_cache[CONST_CACHE_SHARDS];
+
+static const char *bc_type_names[] = {
+    [BC_VOID] = "void",
+    [BC_BOOL] = "bool",
+    [BC_I8] = "i8",
+    [BC_I16] = "i16",
+    [BC_I32] = "i32",
+    [BC_I64] = "i64",
+    [BC_U8] = "u8",
+    [BC_U16] = "u16",
+    [BC_U32] = "u32",
+    [BC_U64] = "u64",
+    [BC_F32] = "f32",
+    [BC_F64] = "f64",
+};
+
+static bool
+bc_is_float(BcType type) {
+    return type == BC_F32 || type == BC_F64;
+}
+
+static bool
+bc_is_int(BcType type) {
+    return BC_I8 <= type && type <= BC_U64;
+}
+
+static bool
+bc_is_signed(BcType type) {
+    return BC_I8 <= type && type <= BC_I64;
+}
+
+static int
+bc_type_bits(BcType type) {
+    switch (type) {
+    case BC_BOOL:
+        return 1;
+    case BC_I8: case BC_U8:
+        return 8;
+    case BC_I16: case BC_U16:
+        return 16;
+    case BC_I32: case BC_U32: case BC_F32:
+        return 32;
+    default:
+        return 64;
+    }
+}
+
+// Whether a value with these bits, sign extended when is_signed, is one of
+// type's.
+static bool
+bc_fits(BcType type, u64 bits, bool is_signed) {
+    bool is_negative = is_signed && (long long)bits < 0;
+    int num_bits = bc_type_bits(type);
+    if (type == BC_BOOL) {
+        return bits <= 1;
+    } else if (bc_is_signed(type)) {
+        if (num_bits == 64) {
+            return is_signed || bits <= INT64_MAX;
+        }
+        return is_negative ? (long long)bits >= -(1ll << (num_bits - 1)) : bits < (1ull << (num_bits - 1));
+    }
+    return !is_negative && (num_bits == 64 || bits < (1ull << num_bits));
+}
+
+// Returns NUM_BC_TYPES for types that can't be used at compile time. An
+// enum is its base type; enums are only looked up when there's a scope.
+static BcType
+bc_type_from_typespec(ModuleScope *scope, Typespec *type) {
+    if (!type) {
+        return BC_VOID;
+    }
+    if (type->kind != TYPESPEC_NAME || type->num_names != 1) {
+        return NUM_BC_TYPES;
+    }
+    for (int i = BC_BOOL; i < NUM_BC_TYPES; i++) {
+        if (strcmp(type->names[0], bc_type_names[i]) == 0) {
+            return i;
+        }
+    }
+    if (scope) {
+        Decl *decl = map_get(&scope->decls, type->names[0]);
+        if (!decl) {
+            decl = map_get(&scope->imports, type->names[0]);
+        }
+        if (decl && decl->kind == DECL_ENUM) {
+            return decl->enum_decl.type ? bc_type_from_typespec(NULL, decl->enum_decl.type) : BC_I32;
+        }
+    }
+    return NUM_BC_TYPES;
+}
+
+// integer promotion
+static BcType
+bc_promote(BcType type) {
+    return !bc_is_float(type) && bc_type_bits(type) < 32 ? BC_I32 : type;
+}
+
+// usual arithmetic conversions
+static BcType
+bc_common_type(BcType left, BcType right) {
+    if (bc_is_float(left) || bc_is_float(right)) {
+        return left == BC_F64 || right == BC_F64 ? BC_F64 : BC_F32;
+    }
+    left = bc_promote(left);
+    right = bc_promote(right);
+    if (bc_is_signed(left) == bc_is_signed(right)) {
+        return bc_type_bits(left) >= bc_type_bits(right) ? left : right;
+    }
+    BcType sig = bc_is_signed(left) ? left : right;
+    BcType unsig = bc_is_signed(left) ? right : left;
+    return bc_type_bits(unsig) >= bc_type_bits(sig) ? unsig : sig;
+}
+
+static BcType fold_bc_types[] = {
+    [FOLD_INT] = BC_I32,
+    [FOLD_UINT] = BC_U32,
+    [FOLD_LONG] = BC_I64,
+    [FOLD_ULONG] = BC_U64,
+    [FOLD_LLONG] = BC_I64,
+    [FOLD_ULLONG] = BC_U64,
+    [FOLD_FLOAT] = BC_F32,
+    [FOLD_DOUBLE] = BC_F64,
+};
+
+// Types a literal the way constant folding does and gives its register value.
+static BcType
+bc_literal(Expr *expr, Val *val) {
+    Val fold_val;
+    FoldType fold_type = fold_literal(expr, &fold_val);
+    if (fold_type == FOLD_NONE) {
+        return BC_VOID;
+    }
+    if (fold_is_float(fold_type)) {
+        val->d = fold_get_double(fold_val, fold_type);
+    } else {
+        val->ull = fold_get_bits(fold_val, fold_type);
+    }
+    return fold_bc_types[fold_type];
+}
+
+// Converts a literal's value the way lower_convert's code would, for the
+// conversions that can't fail.
+static bool
+bc_convert_literal(Val *val, BcType from, BcType to) {
+    if (to == BC_VOID || to == from) {
+        return true;
+    }
+    if (bc_is_float(from)) {
+        if (to == BC_F32) {
+            val->d = (float)val->d;
+        }
+        return bc_is_float(to);
+    }
+    if (to == BC_BOOL) {
+        val->ull = val->ull != 0;
+    } else if (bc_is_float(to)) {
+        val->d = bc_is_signed(from) ? (double)val->ll : (double)val->ull;
+        if (to == BC_F32) {
+            val->d = (float)val->d;
+        }
+    } else if (bc_type_bits(to) < 64) {
+        int shift = 64 - bc_type_bits(to);
+        val->ull = bc_is_signed(to) ? (u64)((i64)(val->ull << shift) >> shift) : val->ull & ((1ull << (64 - shift)) - 1);
+    }
+    return true;
+}
+
+// Lowering
+
+static void
+lower_fail(Lowerer *l, SrcPos pos, const char *fmt, ...) {
+    if (l->failed) {
+        return;
+    }
+    l->failed = true;
+    if (fmt) {
+        char message[256];
+        va_list args;
+        va_start(args, fmt);
+        vsnprintf(message, sizeof(message), fmt, args);
+        va_end(args);
+        l->func->fail_pos = pos;
+        l->func->fail_reason = strf("%s", message);
+    }
+}
+
+static size_t
+emit(Lowerer *l, SrcPos pos, Op op, u16 a, u16 b, u16 c) {
+    buf_push(l->func->code, (Instr){.op = op, .a = a, .b = b, .c = c});
+    buf_push(l->func->code_pos, pos);
+    return buf_len(l->func->code) - 1;
+}
+
+static size_t
+emit_k(Lowerer *l, SrcPos pos, Op op, u16 a, i32 k) {
+    buf_push(l->func->code, (Instr){.op = op, .a = a, .k = k});
+    buf_push(l->func->code_pos, pos);
+    return buf_len(l->func->code) - 1;
+}
+
+// Marks the current position as a jump target, so lower_move leaves the
+// instruction before it alone.
+static i32
+lower_label(Lowerer *l) {
+    l->last_label = buf_len(l->func->code);
+    return (i32)l->last_label;
+}
+
+static void
+patch_jump(Lowerer *l, size_t at) {
+    l->func->code[at].k = lower_label(l);
+}
+
+static u16
+alloc_reg(Lowerer *l, SrcPos pos) {
+    if (l->next_reg >= BC_MAX_REGS) {
+        lower_fail(l, pos, "Too many registers");
+        return 0;
+    }
+    u16 reg = (u16)l->next_reg++;
+    if (l->next_reg > l->func->num_regs) {
+        l->func->num_regs = l->next_reg;
+    }
+    return reg;
+}
+
+static bool
+is_temp_reg(Lowerer *l, u16 reg) {
+    return reg >= l->locals_top;
+}
+
+// A register the result of an operation on reg can go to.
+static u16
+temp_reg(Lowerer *l, SrcPos pos, u16 reg) {
+    return is_temp_reg(l, reg) ? reg : alloc_reg(l, pos);
+}
+
+// Moves the value in reg to dest, by making the instruction that computed it
+// write dest directly when that's safe.
+static void
+lower_move(Lowerer *l, SrcPos pos, u16 dest, u16 reg) {
+    if (dest == reg) {
+        return;
+    }
+    size_t len = buf_len(l->func->code);
+    if (is_temp_reg(l, reg) && len > 0 && l->last_label < len) {
+        Instr *last = &l->func->code[len - 1];
+        if (last->op < OP_JMP && last->a == reg) {
+            last->a = dest;
+            return;
+        }
+    }
+    emit(l, pos, OP_MOV, dest, reg, 0);
+}
+
+static u16
+lower_val(Lowerer *l, SrcPos pos, Val val, BcType type) {
+    u16 reg = alloc_reg(l, pos);
+    if (!bc_is_float(type) && val.ll == (i32)val.ll) {
+        emit_k(l, pos, OP_LOADI, reg, (i32)val.ll);
+    } else {
+        buf_push(l->func->consts, val);
+        emit_k(l, pos, OP_LOADK, reg, (i32)buf_len(l->func->consts) - 1);
+    }
+    return reg;
+}
+
+// Brings the result of an arithmetic operation in reg back to the range of
+// its type.
+static void
+lower_wrap(Lowerer *l, SrcPos pos, u16 reg, BcType type) {
+    if (type == BC_F32) {
+        emit(l, pos, OP_F32, reg, reg, 0);
+    } else if (!bc_is_float(type) && bc_type_bits(type) < 64) {
+        emit(l, pos, bc_is_signed(type) ? OP_SEXT : OP_ZEXT, reg, reg, (u16)bc_type_bits(type));
+    }
+}
+
+static u16
+lower_convert(Lowerer *l, SrcPos pos, u16 reg, BcType from, BcType to) {
+    if (from == to || to == BC_VOID) {
+        return reg;
+    }
+    if (from == BC_VOID) {
+        lower_fail(l, pos, "Expression has no value");
+        return reg;
+    }
+    u16 dest = temp_reg(l, pos, reg);
+    if (to == BC_BOOL) {
+        emit(l, pos, bc_is_float(from) ? OP_FNEZ : OP_NEZ, dest, reg, 0);
+    } else if (bc_is_float(to)) {
+        if (bc_is_float(from)) {
+            if (to == BC_F64) {
+                return reg;
+            }
+            emit(l, pos, OP_F32, dest, reg, 0);
+        } else {
+            emit(l, pos, bc_is_signed(from) ? OP_I2F : OP_U2F, dest, reg, 0);
+            if (to == BC_F32) {
+                emit(l, pos, OP_F32, dest, dest, 0);
+            }
+        }
+    } else if (bc_is_float(from)) {
+        emit(l, pos, bc_is_signed(to) ? OP_F2I : OP_F2U, dest, reg, 0);
+        lower_wrap(l, pos, dest, to);
+    } else {
+        int from_bits = bc_type_bits(from);
+        int to_bits = bc_type_bits(to);
+        bool keeps_value = from_bits < to_bits && (bc_is_signed(from) == bc_is_signed(to) || !bc_is_signed(from));
+        if (to_bits == 64 || keeps_value) {
+            return reg;
+        }
+        emit(l, pos, bc_is_signed(to) ? OP_SEXT : OP_ZEXT, dest, reg, (u16)to_bits);
+    }
+    return dest;
+}
+
+static BcLocal *
+find_local(Lowerer *l, const char *name) {
+    for (size_t i = buf_len(l->locals); i > 0; i--) {
+        if (l->locals[i - 1].name == name) {
+            return &l->locals[i - 1];
+        }
+    }
+    return NULL;
+}
+
+static Decl *
+find_decl(Lowerer *l, const char *name, bool *is_imported) {
+    Decl *decl = map_get(&l->scope->decls, name);
+    *is_imported = !decl;
+    return decl ? decl : map_get(&l->scope->imports, name);
+}
+
+static u16
+lower_name(Lowerer *l, Expr *expr, BcType *type) {
+    SrcPos pos = expr->pos;
+    const char *name = expr->name;
+    BcLocal *local = find_local(l, name);
+    if (local) {
+        *type = local->type;
+        return local->reg;
+    }
+    if (strcmp(name, "true") == 0 || strcmp(name, "false") == 0) {
+        *type = BC_BOOL;
+        return lower_val(l, pos, (Val){.ull = name[0] == 't'}, BC_BOOL);
+    }
+    bool is_imported;
+    Decl *decl = find_decl(l, name, &is_imported);
+    *type = BC_I32;
+    if (!decl) {
+        // unknown names have been reported by the resolver
+        lower_fail(l, pos, is_builtin_name(name) ? "'%s' can't be used at compile time" : NULL, name);
+        return 0;
+    }
+    if (decl->kind != DECL_CONST) {
+        lower_fail(l, pos, "'%s' is not a constant", name);
+        return 0;
+    }
+    if (is_imported && const_cache_get(decl, NULL, 0)->state == CONST_UNEVALUATED) {
+        lower_fail(l, pos, "Constant '%s' is in a module on an import cycle", name);
+        return 0;
+    }
+    // failures are reported where the constant is
+    ConstValue *value = eval_const(decl, l->scope);
+    if (!value) {
+        lower_fail(l, pos, NULL);
+        return 0;
+    }
+    *type = value->type;
+    return lower_val(l, pos, value->val, *type);
+}
+
+// Color.Red is the item's value, as the enum's base type
+static u16
+lower_field(Lowerer *l, Expr *expr, BcType *type) {
+    Expr *base = expr->field.expr;
+    bool is_imported;
+    Decl *decl = NULL;
+    if (base->kind == EXPR_NAME && !find_local(l, base->name)) {
+        decl = find_decl(l, base->name, &is_imported);
+    }
+    if (!decl || decl->kind != DECL_ENUM) {
+        lower_fail(l, expr->pos, "Expression can't be evaluated at compile time");
+        return 0;
+    }
+    EnumItem *item = expr->field.name ? find_enum_item(decl, expr->field.name) : NULL;
+    if (!item) {
+        // a missing name has been reported
+        lower_fail(l, expr->pos, expr->field.name ? "'%s' has no item '%s'" : NULL, decl->name, expr->field.name);
+        return 0;
+    }
+    *type = decl->enum_decl.type ? bc_type_from_typespec(NULL, decl->enum_decl.type) : BC_I32;
+    if (*type == NUM_BC_TYPES) {
+        lower_fail(l, expr->pos, NULL);
+        return 0;
+    }
+    return lower_val(l, expr->pos, (Val){.ll = item->value}, *type);
+}
+
+static BcFunc *
+lower_callee(Lowerer *l, Expr *expr) {
+    if (expr->kind != EXPR_NAME) {
+        lower_fail(l, expr->pos, "Only functions can be called at compile time");
+        return NULL;
+    }
+    bool is_imported;
+    Decl *decl = find_decl(l, expr->name, &is_imported);
+    if (!decl && !is_builtin_name(expr->name)) {
+        // reported by the resolver
+        lower_fail(l, expr->pos, NULL);
+        return NULL;
+    }
+    if (!decl || decl->kind != DECL_FUNC) {
+        lower_fail(l, expr->pos, decl ? "'%s' is not a function" : "'%s' can't be called at compile time", expr->name);
+        return NULL;
+    }
+    BcFunc *callee = decl->fn.bc;
+    if (!callee) {
+        lower_fail(l, expr->pos, "Function '%s' is in a module on an import cycle", expr->name);
+        return NULL;
+    }
+    // A fn of an imported module is lowered the first time some module calls
+    // it, and other modules may be doing the same. One still being lowered is
+    // a recursive call, which is checked when it runs.
+    bool lock = callee->scope != l->scope && !bc_lock_held;
+    if (lock) {
+        mutex_lock(&bc_mutex);
+        bc_lock_held = true;
+    }
+    callee = lower_func(decl);
+    if (lock) {
+        bc_lock_held = false;
+        mutex_unlock(&bc_mutex);
+    }
+    if (callee->state == BC_FAILED) {
+        lower_fail(l, expr->pos, "Cannot call '%s' at compile time: %s(%d): %s", callee->name,
+            callee->fail_pos.name, callee->fail_pos.line, callee->fail_reason);
+        return NULL;
+    }
+    return callee;
+}
+
+static u16
+lower_call(Lowerer *l, Expr *expr, BcType *type) {
+    SrcPos pos = expr->pos;
+    *type = BC_I32;
+    BcFunc *callee = lower_callee(l, expr->call.expr);
+    if (!callee) {
+        return 0;
+    }
+    size_t num_params = buf_len(callee->param_types);
+    if (expr->call.num_args != num_params) {
+        lower_fail(l, pos, "'%s' takes %zu arguments, not %zu", callee->name, num_params, expr->call.num_args);
+        return 0;
+    }
+    // arguments go to consecutive registers, which become the callee's frame
+    u16 base = (u16)l->next_reg;
+    for (size_t i = 0; i < num_params || i == 0; i++) {
+        alloc_reg(l, pos);
+    }
+    for (size_t i = 0; i < num_params; i++) {
+        Expr *arg = expr->call.args[i];
+        BcType arg_type;
+        u16 reg = lower_expr(l, arg, &arg_type);
+        reg = lower_convert(l, arg->pos, reg, arg_type, callee->param_types[i]);
+        lower_move(l, arg->pos, base + (u16)i, reg);
+    }
+    buf_push(l->func->callees, callee);
+    emit_k(l, pos, OP_CALL, base, (i32)buf_len(l->func->callees) - 1);
+    l->next_reg = base + 1;
+    *type = callee->ret_type;
+    return base;
+}
+
+static Op float_ops[NUM_TOKEN_KINDS] = {
+    [TOKEN_ADD] = OP_FADD,
+    [TOKEN_SUB] = OP_FSUB,
+    [TOKEN_MUL] = OP_FMUL,
+    [TOKEN_DIV] = OP_FDIV,
+    [TOKEN_EQ] = OP_FEQ,
+    [TOKEN_NOTEQ] = OP_FNE,
+    [TOKEN_LT] = OP_FLT,
+    [TOKEN_GT] = OP_FLT,
+    [TOKEN_LTEQ] = OP_FLE,
+    [TOKEN_GTEQ] = OP_FLE,
+};
+
+static Op signed_ops[NUM_TOKEN_KINDS] = {
+    [TOKEN_ADD] = OP_ADD,
+    [TOKEN_SUB] = OP_SUB,
+    [TOKEN_MUL] = OP_MUL,
+    [TOKEN_DIV] = OP_DIV,
+    [TOKEN_MOD] = OP_MOD,
+    [TOKEN_AND] = OP_AND,
+    [TOKEN_OR] = OP_OR,
+    [TOKEN_XOR] = OP_XOR,
+    [TOKEN_LSHIFT] = OP_SHL,
+    [TOKEN_RSHIFT] = OP_SHR,
+    [TOKEN_EQ] = OP_EQ,
+    [TOKEN_NOTEQ] = OP_NE,
+    [TOKEN_LT] = OP_LT,
+    [TOKEN_GT] = OP_LT,
+    [TOKEN_LTEQ] = OP_LE,
+    [TOKEN_GTEQ] = OP_LE,
+};
+
+static Op unsigned_ops[NUM_TOKEN_KINDS] = {
+    [TOKEN_ADD] = OP_ADD,
+    [TOKEN_SUB] = OP_SUB,
+    [TOKEN_MUL] = OP_MUL,
+    [TOKEN_DIV] = OP_DIVU,
+    [TOKEN_MOD] = OP_MODU,
+    [TOKEN_AND] = OP_AND,
+    [TOKEN_OR] = OP_OR,
+    [TOKEN_XOR] = OP_XOR,
+    [TOKEN_LSHIFT] = OP_SHL,
+    [TOKEN_RSHIFT] = OP_SHRU,
+    [TOKEN_EQ] = OP_EQ,
+    [TOKEN_NOTEQ] = OP_NE,
+    [TOKEN_LT] = OP_LTU,
+    [TOKEN_GT] = OP_LTU,
+    [TOKEN_LTEQ] = OP_LEU,
+    [TOKEN_GTEQ] = OP_LEU,
+};
+
+static bool
+is_cmp_op(TokenKind op) {
+    return TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP;
+}
+
+// Lowers left op right where left is already in a register. Adding or
+// subtracting a small literal becomes a single OP_ADDI.
+static u16
+lower_arith(Lowerer *l, SrcPos pos, TokenKind op, u16 left, BcType left_type, Expr *right, BcType *type) {
+    Val lit;
+    BcType lit_type = bc_literal(right, &lit);
+    if ((op == TOKEN_ADD || op == TOKEN_SUB) && lit_type != BC_VOID && !bc_is_float(lit_type)
+        && !bc_is_float(left_type) && lit.ll >= -INT16_MAX && lit.ll <= INT16_MAX) {
+        *type = bc_common_type(left_type, lit_type);
+        left = lower_convert(l, pos, left, left_type, *type);
+        u16 dest = temp_reg(l, pos, left);
+        i16 imm = (i16)(op == TOKEN_ADD ? lit.ll : -lit.ll);
+        emit(l, pos, OP_ADDI, dest, left, (u16)imm);
+        lower_wrap(l, pos, dest, *type);
+        return dest;
+    }
+    BcType right_type;
+    u16 right_reg = lower_expr(l, right, &right_type);
+    bool is_shift = op == TOKEN_LSHIFT || op == TOKEN_RSHIFT;
+    BcType op_type;
+    if (is_shift) {
+        if (bc_is_float(left_type) || bc_is_float(right_type)) {
+            lower_fail(l, pos, "Shift operands must be integers");
+            return 0;
+        }
+        op_type = bc_promote(left_type);
+    } else {
+        op_type = bc_common_type(left_type, right_type);
+        right_reg = lower_convert(l, pos, right_reg, right_type, op_type);
+    }
+    left = lower_convert(l, pos, left, left_type, op_type);
+    Op bc_op = (bc_is_float(op_type) ? float_ops : bc_is_signed(op_type) ? signed_ops : unsigned_ops)[op];
+    if (!bc_op) {
+        lower_fail(l, pos, "Operator %s can't be used on %s at compile time", token_kind_name(op), bc_type_names[op_type]);
+        return 0;
+    }
+    u16 dest = is_temp_reg(l, left) ? left : temp_reg(l, pos, right_reg);
+    // a > b is b < a
+    if (op == TOKEN_GT || op == TOKEN_GTEQ) {
+        emit(l, pos, bc_op, dest, right_reg, left);
+    } else {
+        emit(l, pos, bc_op, dest, left, right_reg);
+    }
+    if (is_cmp_op(op)) {
+        *type = BC_BOOL;
+    } else {
+        *type = op_type;
+        if (op != TOKEN_AND && op != TOKEN_OR && op != TOKEN_XOR && bc_op != OP_DIVU && bc_op != OP_MODU && bc_op != OP_SHRU) {
+            lower_wrap(l, pos, dest, op_type);
+        }
+    }
+    return dest;
+}
+
+// && and || only evaluate the right side when the left doesn't decide
+static u16
+lower_logical(Lowerer *l, Expr *expr, BcType *type) {
+    SrcPos pos = expr->pos;
+    u16 dest = alloc_reg(l, pos);
+    BcType left_type;
+    u16 left = lower_expr(l, expr->binary.left, &left_type);
+    lower_move(l, pos, dest, lower_convert(l, pos, left, left_type, BC_BOOL));
+    size_t jump = emit_k(l, pos, expr->binary.op == TOKEN_AND_AND ? OP_JZ : OP_JNZ, dest, 0);
+    BcType right_type;
+    u16 right = lower_expr(l, expr->binary.right, &right_type);
+    lower_move(l, pos, dest, lower_convert(l, pos, right, right_type, BC_BOOL));
+    patch_jump(l, jump);
+    *type = BC_BOOL;
+    return dest;
+}
+
+static u16
+lower_unary(Lowerer *l, Expr *expr, BcType *type) {
+    SrcPos pos = expr->pos;
+    TokenKind op = expr->unary.op;
+    BcType operand_type;
+    u16 reg = lower_expr(l, expr->unary.expr, &operand_type);
+    if (op == TOKEN_NOT) {
+        reg = lower_convert(l, pos, reg, operand_type, BC_BOOL);
+        u16 dest = temp_reg(l, pos, reg);
+        emit(l, pos, OP_NOT, dest, reg, 0);
+        *type = BC_BOOL;
+        return dest;
+    }
+    if (op == TOKEN_MUL || op == TOKEN_AND) {
+        lower_fail(l, pos, "Pointers can't be used at compile time");
+        return 0;
+    }
+    *type = bc_promote(operand_type);
+    reg = lower_convert(l, pos, reg, operand_type, *type);
+    if (op == TOKEN_ADD) {
+        return reg;
+    }
+    if (op == TOKEN_NEG && bc_is_float(*type)) {
+        lower_fail(l, pos, "Operator ~ can't be used on %s", bc_type_names[*type]);
+        return 0;
+    }
+    u16 dest = temp_reg(l, pos, reg);
+    if (op == TOKEN_SUB) {
+        emit(l, pos, bc_is_float(*type) ? OP_FNEG : OP_NEG, dest, reg, 0);
+    } else {
+        emit(l, pos, OP_BNOT, dest, reg, 0);
+    }
+    if (!bc_is_float(*type)) {
+        lower_wrap(l, pos, dest, *type);
+    }
+    return dest;
+}
+
+static BcLocal *
+lower_assign_target(Lowerer *l, Expr *expr) {
+    BcLocal *local = expr->kind == EXPR_NAME ? find_local(l, expr->name) : NULL;
+    if (!local) {
+        lower_fail(l, expr->pos, "Only local variables can be assigned at compile time");
+    }
+    return local;
+}
+
+// ++x and --x give the new value, x++ and x-- a copy of the old one
+static u16
+lower_modify(Lowerer *l, Expr *expr, BcType *type) {
+    SrcPos pos = expr->pos;
+    BcLocal *local = lower_assign_target(l, expr->modify.expr);
+    if (!local) {
+        *type = BC_I32;
+        return 0;
+    }
+    *type = local->type;
+    u16 old = local->reg;
+    if (expr->modify.post) {
+        old = alloc_reg(l, pos);
+        emit(l, pos, OP_MOV, old, local->reg, 0);
+    }
+    i16 delta = expr->modify.op == TOKEN_INC ? 1 : -1;
+    if (bc_is_float(local->type)) {
+        u16 one = lower_val(l, pos, (Val){.d = delta}, BC_F64);
+        emit(l, pos, OP_FADD, local->reg, local->reg, one);
+    } else {
+        emit(l, pos, OP_ADDI, local->reg, local->reg, (u16)delta);
+    }
+    lower_wrap(l, pos, local->reg, local->type);
+    return old;
+}
+
+static u16
+lower_expr(Lowerer *l, Expr *expr, BcType *type) {
+    *type = BC_I32;
+    if (l->failed) {
+        return 0;
+    }
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return lower_expr(l, expr->paren.expr, type);
+    case EXPR_INT:
+    case EXPR_FLOAT: {
+        Val val;
+        *type = bc_literal(expr, &val);
+        if (*type == BC_VOID) {
+            lower_fail(l, expr->pos, "Invalid literal");
+            return 0;
+        }
+        return lower_val(l, expr->pos, val, *type);
+    }
+    case EXPR_NAME:
+        return lower_name(l, expr, type);
+    case EXPR_FIELD:
+        return lower_field(l, expr, type);
+    case EXPR_CALL:
+        return lower_call(l, expr, type);
+    case EXPR_UNARY:
+        return lower_unary(l, expr, type);
+    case EXPR_BINARY: {
+        TokenKind op = expr->binary.op;
+        if (op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+            return lower_logical(l, expr, type);
+        }
+        BcType left_type;
+        u16 left = lower_expr(l, expr->binary.left, &left_type);
+        return lower_arith(l, expr->pos, op, left, left_type, expr->binary.right, type);
+    }
+    case EXPR_MODIFY:
+        return lower_modify(l, expr, type);
+    case EXPR_ERROR:
+        lower_fail(l, expr->pos, NULL);
+        return 0;
+    default:
+        lower_fail(l, expr->pos, "Expression can't be evaluated at compile time");
+        return 0;
+    }
+}
+
+static TokenKind assign_ops[NUM_TOKEN_KINDS] = {
+    [TOKEN_ADD_ASSIGN] = TOKEN_ADD,
+    [TOKEN_SUB_ASSIGN] = TOKEN_SUB,
+    [TOKEN_OR_ASSIGN] = TOKEN_OR,
+    [TOKEN_AND_ASSIGN] = TOKEN_AND,
+    [TOKEN_XOR_ASSIGN] = TOKEN_XOR,
+    [TOKEN_LSHIFT_ASSIGN] = TOKEN_LSHIFT,
+    [TOKEN_RSHIFT_ASSIGN] = TOKEN_RSHIFT,
+    [TOKEN_MUL_ASSIGN] = TOKEN_MUL,
+    [TOKEN_DIV_ASSIGN] = TOKEN_DIV,
+    [TOKEN_MOD_ASSIGN] = TOKEN_MOD,
+};
+
+static void
+lower_assign(Lowerer *l, Stmt *stmt) {
+    SrcPos pos = stmt->pos;
+    BcLocal *local = lower_assign_target(l, stmt->assign.left);
+    if (!local) {
+        return;
+    }
+    u16 dest = local->reg;
+    BcType dest_type = local->type;
+    BcType type;
+    u16 reg;
+    if (stmt->assign.op == TOKEN_ASSIGN) {
+        reg = lower_expr(l, stmt->assign.right, &type);
+    } else {
+        reg = lower_arith(l, pos, assign_ops[stmt->assign.op], dest, dest_type, stmt->assign.right, &type);
+    }
+    lower_move(l, pos, dest, lower_convert(l, pos, reg, type, dest_type));
+}
+
+// The local's register is taken before its initializer is lowered, so it
+// sits below the initializer's temporaries, but the name only comes into
+// scope after it.
+static void
+lower_init(Lowerer *l, Stmt *stmt) {
+    SrcPos pos = stmt->pos;
+    BcType type = bc_type_from_typespec(l->scope, stmt->init.type);
+    if (type == NUM_BC_TYPES) {
+        lower_fail(l, stmt->init.type->pos, "Type of '%s' can't be used at compile time", stmt->init.name);
+        return;
+    }
+    u16 dest = alloc_reg(l, pos);
+    l->locals_top = l->next_reg;
+    if (stmt->init.expr) {
+        BcType expr_type;
+        u16 reg = lower_expr(l, stmt->init.expr, &expr_type);
+        if (type == BC_VOID) {
+            type = expr_type;
+        }
+        lower_move(l, pos, dest, lower_convert(l, pos, reg, expr_type, type));
+    } else {
+        emit_k(l, pos, OP_LOADI, dest, 0);
+    }
+    if (type == BC_VOID) {
+        lower_fail(l, pos, "'%s' has no value", stmt->init.name);
+    }
+    buf_push(l->locals, (BcLocal){stmt->init.name, dest, type});
+}
+
+// Lowers cond and emits a jump past the code that follows when it's false.
+static size_t
+lower_cond_jump(Lowerer *l, Expr *cond) {
+    BcType type;
+    u16 reg = lower_expr(l, cond, &type);
+    reg = lower_convert(l, cond->pos, reg, type, BC_BOOL);
+    size_t jump = emit_k(l, cond->pos, OP_JZ, reg, 0);
+    l->next_reg = l->locals_top;
+    return jump;
+}
+
+static void
+lower_if(Lowerer *l, Stmt *stmt) {
+    size_t *end_jumps = NULL;
+    size_t jump = lower_cond_jump(l, stmt->if_stmt.cond);
+    lower_block(l, stmt->if_stmt.then_block);
+    for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+        ElseIf *elseif = &stmt->if_stmt.elseifs[i];
+        buf_push(end_jumps, emit_k(l, stmt->pos, OP_JMP, 0, 0));
+        patch_jump(l, jump);
+        jump = lower_cond_jump(l, elseif->cond);
+        lower_block(l, elseif->block);
+    }
+    if (stmt->if_stmt.else_block.num_stmts) {
+        buf_push(end_jumps, emit_k(l, stmt->pos, OP_JMP, 0, 0));
+        patch_jump(l, jump);
+        lower_block(l, stmt->if_stmt.else_block);
+    } else {
+        patch_jump(l, jump);
+    }
+    for (size_t i = 0; i < buf_len(end_jumps); i++) {
+        patch_jump(l, end_jumps[i]);
+    }
+    buf_free(end_jumps);
+}
+
+// Jumps to fail_jumps unless the value in reg matches pattern.
+static void
+lower_pattern(Lowerer *l, u16 reg, BcType type, Expr *pattern, size_t **fail_jumps) {
+    if (is_pattern_wildcard(pattern)) {
+        return;
+    }
+    SrcPos pos = pattern->pos;
+    BcType cmp_type;
+    u16 cmp;
+    if (pattern->kind == EXPR_BINARY && pattern->binary.op == TOKEN_DOTDOT) {
+        cmp = lower_arith(l, pos, TOKEN_GTEQ, reg, type, pattern->binary.left, &cmp_type);
+        buf_push(*fail_jumps, emit_k(l, pos, OP_JZ, cmp, 0));
+        l->next_reg = l->locals_top;
+        cmp = lower_arith(l, pos, TOKEN_LTEQ, reg, type, pattern->binary.right, &cmp_type);
+    } else {
+        cmp = lower_arith(l, pos, TOKEN_EQ, reg, type, pattern, &cmp_type);
+    }
+    buf_push(*fail_jumps, emit_k(l, pos, OP_JZ, cmp, 0));
+    l->next_reg = l->locals_top;
+}
+
+// Tests the cases one after the other; the decision tree is only for the
+// generated code, where it pays off.
+static void
+lower_switch(Lowerer *l, Stmt *stmt) {
+    u32 locals_top = l->locals_top;
+    Expr *expr = stmt->switch_stmt.expr;
+    bool is_tuple = expr->kind == EXPR_TUPLE;
+    size_t num_columns = is_tuple ? expr->tuple.num_args : 1;
+    u16 *regs = NULL;
+    BcType *types = NULL;
+    for (size_t i = 0; i < num_columns; i++) {
+        Expr *column = is_tuple ? expr->tuple.args[i] : expr;
+        u16 dest = alloc_reg(l, column->pos);
+        BcType type;
+        u16 reg = lower_expr(l, column, &type);
+        lower_move(l, column->pos, dest, reg);
+        l->locals_top = l->next_reg = dest + 1;
+        buf_push(regs, dest);
+        buf_push(types, type);
+    }
+    size_t *end_jumps = NULL;
+    SwitchCase *default_case = NULL;
+    for (size_t i = 0; i < stmt->switch_stmt.num_cases && !l->failed; i++) {
+        SwitchCase *c = &stmt->switch_stmt.cases[i];
+        if (c->is_default) {
+            default_case = c;
+            continue;
+        }
+        size_t *match_jumps = NULL;
+        for (size_t j = 0; j < c->num_patterns; j++) {
+            Expr *pattern = c->patterns[j];
+            size_t *fail_jumps = NULL;
+            if (is_pattern_wildcard(pattern)) {
+                buf_push(match_jumps, emit_k(l, pattern->pos, OP_JMP, 0, 0));
+                continue;
+            }
+            if (is_tuple != (pattern->kind == EXPR_TUPLE) || (is_tuple && pattern->tuple.num_args != num_columns)) {
+                // reported by the checker
+                lower_fail(l, pattern->pos, NULL);
+                break;
+            }
+            for (size_t k = 0; k < num_columns; k++) {
+                lower_pattern(l, regs[k], types[k], is_tuple ? pattern->tuple.args[k] : pattern, &fail_jumps);
+            }
+            buf_push(match_jumps, emit_k(l, pattern->pos, OP_JMP, 0, 0));
+            for (size_t k = 0; k < buf_len(fail_jumps); k++) {
+                patch_jump(l, fail_jumps[k]);
+            }
+            buf_free(fail_jumps);
+        }
+        size_t next_jump = emit_k(l, c->pos, OP_JMP, 0, 0);
+        for (size_t j = 0; j < buf_len(match_jumps); j++) {
+            patch_jump(l, match_jumps[j]);
+        }
+        buf_free(match_jumps);
+        lower_block(l, c->block);
+        buf_push(end_jumps, emit_k(l, c->pos, OP_JMP, 0, 0));
+        patch_jump(l, next_jump);
+    }
+    if (default_case) {
+        lower_block(l, default_case->block);
+    }
+    for (size_t i = 0; i < buf_len(end_jumps); i++) {
+        patch_jump(l, end_jumps[i]);
+    }
+    buf_free(end_jumps);
+    buf_free(regs);
+    buf_free(types);
+    l->locals_top = locals_top;
+    l->next_reg = locals_top;
+}
+
+// while and for loops; init and next are only there for a for
+static void
+lower_loop(Lowerer *l, SrcPos pos, Stmt *init, Expr *cond, Stmt *next, StmtList block) {
+    size_t num_locals = buf_len(l->locals);
+    u32 locals_top = l->locals_top;
+    if (init) {
+        lower_stmt(l, init);
+    }
+    i32 start = lower_label(l);
+    size_t exit_jump = cond ? lower_cond_jump(l, cond) : SIZE_MAX;
+    buf_push(l->loops, (BcLoop){0});
+    lower_block(l, block);
+    BcLoop loop = buf_pop(l->loops);
+    for (size_t i = 0; i < buf_len(loop.continues); i++) {
+        patch_jump(l, loop.continues[i]);
+    }
+    if (next) {
+        lower_stmt(l, next);
+    }
+    emit_k(l, pos, OP_LOOP, 0, start);
+    if (exit_jump != SIZE_MAX) {
+        patch_jump(l, exit_jump);
+    }
+    for (size_t i = 0; i < buf_len(loop.breaks); i++) {
+        patch_jump(l, loop.breaks[i]);
+    }
+    buf_free(loop.continues);
+    buf_free(loop.breaks);
+    if (l->locals) {
+        buf__hdr(l->locals)->len = num_locals;
+    }
+    l->locals_top = locals_top;
+    l->next_reg = locals_top;
+}
+
+static void
+lower_stmt(Lowerer *l, Stmt *stmt) {
+    if (l->failed) {
+        return;
+    }
+    SrcPos pos = stmt->pos;
+    switch (stmt->kind) {
+    case STMT_RETURN: {
+        BcType ret_type = l->func->ret_type;
+        if (!stmt->expr) {
+            if (ret_type != BC_VOID) {
+                lower_fail(l, pos, "Missing return value");
+            }
+            emit(l, pos, OP_RETV, 0, 0, 0);
+            break;
+        }
+        BcType type;
+        u16 reg = lower_expr(l, stmt->expr, &type);
+        if (ret_type == BC_VOID) {
+            lower_fail(l, pos, "Function '%s' doesn't return a value", l->func->name);
+        }
+        emit(l, pos, OP_RET, lower_convert(l, pos, reg, type, ret_type), 0, 0);
+        break;
+    }
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+        if (!l->loops) {
+            lower_fail(l, pos, "%s outside of a loop", stmt->kind == STMT_BREAK ? "break" : "continue");
+        } else {
+            BcLoop *loop = &l->loops[buf_len(l->loops) - 1];
+            size_t jump = emit_k(l, pos, OP_JMP, 0, 0);
+            if (stmt->kind == STMT_BREAK) {
+                buf_push(loop->breaks, jump);
+            } else {
+                buf_push(loop->continues, jump);
+            }
+        }
+        break;
+    case STMT_BLOCK:
+        lower_block(l, stmt->block);
+        break;
+    case STMT_IF:
+        lower_if(l, stmt);
+        break;
+    case STMT_WHILE:
+        lower_loop(l, pos, NULL, stmt->while_stmt.cond, NULL, stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        lower_loop(l, pos, stmt->for_stmt.init, stmt->for_stmt.cond, stmt->for_stmt.next, stmt->for_stmt.block);
+        break;
+    case STMT_ASSIGN:
+        lower_assign(l, stmt);
+        break;
+    case STMT_INIT:
+        lower_init(l, stmt);
+        break;
+    case STMT_SWITCH:
+        lower_switch(l, stmt);
+        break;
+    case STMT_EXPR: {
+        BcType type;
+        lower_expr(l, stmt->expr, &type);
+        break;
+    }
+    case STMT_ERROR:
+        lower_fail(l, pos, NULL);
+        break;
+    default:
+        lower_fail(l, pos, "Statement can't be evaluated at compile time");
+        break;
+    }
+    // temporaries die with their statement
+    l->next_reg = l->locals_top;
+}
+
+static void
+lower_block(Lowerer *l, StmtList block) {
+    size_t num_locals = buf_len(l->locals);
+    u32 locals_top = l->locals_top;
+    for (size_t i = 0; i < block.num_stmts && !l->failed; i++) {
+        lower_stmt(l, block.stmts[i]);
+    }
+    if (l->locals) {
+        buf__hdr(l->locals)->len = num_locals;
+    }
+    l->locals_top = locals_top;
+    l->next_reg = locals_top;
+}
+
+static void
+free_bc_code(BcFunc *func) {
+    buf_free(func->code);
+    buf_free(func->code_pos);
+    buf_free(func->consts);
+    buf_free(func->callees);
+}
+
+static void
+free_lowerer(Lowerer *l) {
+    buf_free(l->locals);
+    for (size_t i = 0; i < buf_len(l->loops); i++) {
+        buf_free(l->loops[i].breaks);
+        buf_free(l->loops[i].continues);
+    }
+    buf_free(l->loops);
+}
+
+// Lowers a fn the first time it's called from a const or from another fn
+// being lowered, so fns that never run at compile time cost nothing.
+static BcFunc *
+lower_func(Decl *decl) {
+    BcFunc *func = decl->fn.bc;
+    if (func->state != BC_UNLOWERED) {
+        return func;
+    }
+    func->state = BC_LOWERING;
+    Lowerer l = {.func = func, .scope = func->scope};
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        FuncParam *param = &decl->fn.params[i];
+        BcType type = bc_type_from_typespec(l.scope, param->type);
+        if (type == NUM_BC_TYPES || type == BC_VOID) {
+            lower_fail(&l, param->pos, "Type of parameter '%s' can't be used at compile time", param->name);
+            type = BC_I32;
+        }
+        buf_push(func->param_types, type);
+        buf_push(l.locals, (BcLocal){param->name, alloc_reg(&l, param->pos), type});
+    }
+    l.locals_top = l.next_reg;
+    func->ret_type = bc_type_from_typespec(l.scope, decl->fn.ret_type);
+    if (func->ret_type == NUM_BC_TYPES) {
+        lower_fail(&l, decl->fn.ret_type->pos, "Return type of '%s' can't be used at compile time", func->name);
+    }
+    StmtList *block = parse_decl_fn_body(decl);
+    lower_block(&l, *block);
+    emit(&l, block->pos, OP_RETV, 0, 0, 0);
+    free_lowerer(&l);
+    if (l.failed) {
+        free_bc_code(func);
+        if (!func->fail_reason) {
+            func->fail_pos = decl->pos;
+            func->fail_reason = strf("'%s' has errors", func->name);
+        }
+        func->state = BC_FAILED;
+    } else {
+        bc_exec(func, NULL, NULL, true);
+        func->state = BC_READY;
+        STATS_ADD(bc_funcs, 1);
+        STATS_ADD(bc_instrs, buf_len(func->code));
+    }
+    return func;
+}
+
+// Const cache
+
+static void
+const_cache_init(void) {
+    for (size_t i = 0; i < CONST_CACHE_SHARDS; i++) {
+        const_cache[i].mutex = (Mutex)MUTEX_INIT;
+    }
+}
+
+// Finds the entry for decl instantiated with args, adding an unevaluated one
+// if there is none. args are interned, so they compare by pointer.
+static ConstValue *
+const_cache_get(Decl *decl, const char **args, size_t num_args) {
+    uint64_t hash = hash_ptr(decl);
+    for (size_t i = 0; i < num_args; i++) {
+        hash = hash_mix(hash, hash_ptr(args[i]));
+    }
+    hash |= 1;
+    ConstCacheShard *shard = &const_cache[(hash >> 32) % CONST_CACHE_SHARDS];
+    mutex_lock(&shard->mutex);
+    ConstValue *first = map_get_from_uint64(&shard->values, hash);
+    for (ConstValue *it = first; it; it = it->next) {
+        if (it->decl == decl && it->num_args == num_args
+            && (num_args == 0 || memcmp(it->args, args, num_args * sizeof(const char *)) == 0)) {
+            mutex_unlock(&shard->mutex);
+            return it;
+        }
+    }
+    ConstValue *value = arena_alloc(&shard->arena, sizeof(ConstValue));
+    *value = (ConstValue){.decl = decl, .num_args = num_args, .next = first};
+    if (num_args) {
+        value->args = arena_alloc(&shard->arena, num_args * sizeof(const char *));
+        memcpy(value->args, args, num_args * sizeof(const char *));
+    }
+    map_put_from_uint64(&shard->values, hash, value);
+    mutex_unlock(&shard->mutex);
+    return value;
+}
+
+// Evaluation
+
+// Whether a const's value of type from is one of its type's, which is
+// reported if not. Only integers are checked.
+static bool
+eval_fits(Decl *decl, BcType from, BcType to, Val val) {
+    if (!bc_is_int(from) || !bc_is_int(to) || bc_fits(to, val.ull, bc_is_signed(from))) {
+        return true;
+    }
+    error(decl->const_decl.expr->pos, "Value of '%s' doesn't fit in %s", decl->name, bc_type_names[to]);
+    return false;
+}
+
+// Returns the const's entry in the cache, or NULL if it can't be evaluated.
+static ConstValue *
+eval_const(Decl *decl, ModuleScope *scope) {
+    ConstValue *value = const_cache_get(decl, NULL, 0);
+    switch (value->state) {
+    case CONST_EVALUATED:
+        return value;
+    case CONST_FAILED:
+        return NULL;
+    case CONST_EVALUATING:
+        error(decl->pos, "Constant '%s' depends on itself", decl->name);
+        value->state = CONST_FAILED;
+        return NULL;
+    default:
+        break;
+    }
+    value->state = CONST_EVALUATING;
+    STATS_ADD(consts_evaluated, 1);
+    Expr *expr = decl->const_decl.expr;
+    BcType type = bc_type_from_typespec(scope, decl->const_decl.type);
+    if (type == NUM_BC_TYPES) {
+        error(decl->const_decl.type->pos, "Type of constant '%s' can't be used at compile time", decl->name);
+        value->state = CONST_FAILED;
+        return NULL;
+    }
+    // most table entries are literals, which need no code
+    Val val = {0};
+    BcType lit_type = bc_literal(expr, &val);
+    if (lit_type != BC_VOID && !eval_fits(decl, lit_type, type, val)) {
+        value->state = CONST_FAILED;
+        return NULL;
+    }
+    if (lit_type != BC_VOID && bc_convert_literal(&val, lit_type, type)) {
+        value->val = val;
+        value->type = (u8)(type == BC_VOID ? lit_type : type);
+        value->state = CONST_EVALUATED;
+        return value;
+    }
+    // the code is built in a scratch fn, one per nesting level, whose
+    // buffers are reused from one const to the next
+    if (eval_depth == buf_len(eval_scratch)) {
+        buf_push(eval_scratch, xcalloc(1, sizeof(BcFunc)));
+    }
+    BcFunc *func = eval_scratch[eval_depth++];
+    buf_clear(func->code);
+    buf_clear(func->code_pos);
+    buf_clear(func->consts);
+    buf_clear(func->callees);
+    func->name = decl->name;
+    func->decl = decl;
+    func->state = BC_LOWERING;
+    func->scope = scope;
+    func->num_regs = 0;
+    Lowerer l = {.func = func, .scope = scope};
+    BcType expr_type;
+    u16 reg = lower_expr(&l, expr, &expr_type);
+    if (type == BC_VOID) {
+        type = expr_type;
+    }
+    // an integer is converted once it's known, so one the type can't hold is
+    // caught rather than wrapped; a float is first made a 64-bit integer
+    BcType int_type = expr_type;
+    if (bc_is_int(type) && bc_is_float(expr_type)) {
+        int_type = bc_is_signed(type) ? BC_I64 : BC_U64;
+    }
+    bool is_int_convert = bc_is_int(int_type) && bc_is_int(type);
+    reg = lower_convert(&l, expr->pos, reg, expr_type, is_int_convert ? int_type : type);
+    emit(&l, expr->pos, OP_RET, reg, 0, 0);
+    bool ok = false;
+    if (l.failed) {
+        if (func->fail_reason) {
+            error(func->fail_pos, "%s", func->fail_reason);
+            free(func->fail_reason);
+            func->fail_reason = NULL;
+        }
+    } else if (type == BC_VOID) {
+        error(expr->pos, "Constant '%s' has no value", decl->name);
+    } else {
+        bc_exec(func, NULL, NULL, true);
+        ok = bc_exec(func, NULL, &val, false);
+    }
+    eval_depth--;
+    if (value->state == CONST_FAILED) {
+        return NULL;
+    }
+    if (ok && is_int_convert) {
+        ok = eval_fits(decl, int_type, type, val);
+        bc_convert_literal(&val, int_type, type);
+    }
+    value->state = ok ? CONST_EVALUATED : CONST_FAILED;
+    value->val = val;
+    value->type = (u8)type;
+    return ok ? value : NULL;
+}
+
+// Evaluates the consts of a module whose imports have all been checked. The
+// scope has to live as long as the module's fns may be lowered.
+static void
+eval_module(Decls *decls, ModuleScope *scope) {
+    phase_push(PHASE_EVAL);
+    for (size_t i = 0; i < decls->num_decls; i++) {
+        Decl *decl = decls->decls[i];
+        if (decl->kind == DECL_FUNC) {
+            BcFunc *func = xcalloc(1, sizeof(BcFunc));
+            func->name = decl->name;
+            func->decl = decl;
+            func->scope = scope;
+            decl->fn.bc = func;
+        }
+    }
+    for (size_t i = 0; i < decls->num_decls; i++) {
+        if (decls->decls[i]->kind == DECL_CONST) {
+            eval_const(decls->decls[i], scope);
+        }
+    }
+    phase_pop();
+}
+
+// Interpreter
+
+typedef struct BcFrame {
+    BcFunc *func;
+    Instr *ret_ip;
+    Val *regs;
+} BcFrame;
+
+#if BC_DIRECT_THREADED
+#define CASE(op) L_##op:
+#define BEGIN_DISPATCH() goto *ip->label;
+#define END_DISPATCH()
+#define DISPATCH() goto *ip->label
+#else
+#define CASE(op) case op:
+#define BEGIN_DISPATCH() for (;;) switch (ip->op) {
+#define END_DISPATCH() default: assert(0); return false; }
+#define DISPATCH() continue
+#endif
+#define NEXT() { ip++; DISPATCH(); }
+
+// Runs func, or when thread_code is set, only stores the address of each
+// instruction's handler in it.
+static bool
+bc_exec(BcFunc *func, Val *args, Val *result, bool thread_code) {
+#if BC_DIRECT_THREADED
+    static const void *const labels[NUM_OPS] = {
+        [OP_LOADK] = &&L_OP_LOADK,
+        [OP_LOADI] = &&L_OP_LOADI,
+        [OP_MOV] = &&L_OP_MOV,
+        [OP_ADD] = &&L_OP_ADD,
+        [OP_SUB] = &&L_OP_SUB,
+        [OP_MUL] = &&L_OP_MUL,
+        [OP_DIV] = &&L_OP_DIV,
+        [OP_DIVU] = &&L_OP_DIVU,
+        [OP_MOD] = &&L_OP_MOD,
+        [OP_MODU] = &&L_OP_MODU,
+        [OP_AND] = &&L_OP_AND,
+        [OP_OR] = &&L_OP_OR,
+        [OP_XOR] = &&L_OP_XOR,
+        [OP_SHL] = &&L_OP_SHL,
+        [OP_SHR] = &&L_OP_SHR,
+        [OP_SHRU] = &&L_OP_SHRU,
+        [OP_ADDI] = &&L_OP_ADDI,
+        [OP_EQ] = &&L_OP_EQ,
+        [OP_NE] = &&L_OP_NE,
+        [OP_LT] = &&L_OP_LT,
+        [OP_LTU] = &&L_OP_LTU,
+        [OP_LE] = &&L_OP_LE,
+        [OP_LEU] = &&L_OP_LEU,
+        [OP_NEG] = &&L_OP_NEG,
+        [OP_BNOT] = &&L_OP_BNOT,
+        [OP_NOT] = &&L_OP_NOT,
+        [OP_FADD] = &&L_OP_FADD,
+        [OP_FSUB] = &&L_OP_FSUB,
+        [OP_FMUL] = &&L_OP_FMUL,
+        [OP_FDIV] = &&L_OP_FDIV,
+        [OP_FEQ] = &&L_OP_FEQ,
+        [OP_FNE] = &&L_OP_FNE,
+        [OP_FLT] = &&L_OP_FLT,
+        [OP_FLE] = &&L_OP_FLE,
+        [OP_FNEG] = &&L_OP_FNEG,
+        [OP_SEXT] = &&L_OP_SEXT,
+        [OP_ZEXT] = &&L_OP_ZEXT,
+        [OP_NEZ] = &&L_OP_NEZ,
+        [OP_FNEZ] = &&L_OP_FNEZ,
+        [OP_I2F] = &&L_OP_I2F,
+        [OP_U2F] = &&L_OP_U2F,
+        [OP_F2I] = &&L_OP_F2I,
+        [OP_F2U] = &&L_OP_F2U,
+        [OP_F32] = &&L_OP_F32,
+        [OP_JMP] = &&L_OP_JMP,
+        [OP_LOOP] = &&L_OP_LOOP,
+        [OP_JZ] = &&L_OP_JZ,
+        [OP_JNZ] = &&L_OP_JNZ,
+        [OP_CALL] = &&L_OP_CALL,
+        [OP_RET] = &&L_OP_RET,
+        [OP_RETV] = &&L_OP_RETV,
+    };
+    if (thread_code) {
+        for (Instr *it = func->code; it != buf_end(func->code); it++) {
+            assert(labels[it->op]);
+            it->label = labels[it->op];
+        }
+        return true;
+    }
+#else
+    if (thread_code) {
+        return true;
+    }
+#endif
+    if (!bc_stack) {
+        bc_stack = xmalloc(BC_STACK_SIZE * sizeof(Val));
+    }
+    BcFrame frames[BC_MAX_DEPTH];
+    int depth = 0;
+    Val *r = bc_stack;
+    Val *stack_end = bc_stack + BC_STACK_SIZE;
+    if (r + func->num_regs > stack_end) {
+        error(func->decl->pos, "Compile-time evaluation of '%s' needs too many registers", func->name);
+        return false;
+    }
+    if (args) {
+        memcpy(r, args, buf_len(func->param_types) * sizeof(Val));
+    }
+    Instr *code = func->code;
+    Val *k = func->consts;
+    Instr *ip = code;
+    int64_t steps = BC_MAX_STEPS;
+    BcFunc *callee = NULL;
+
+    BEGIN_DISPATCH()
+    CASE(OP_LOADK)
+        r[ip->a] = k[ip->k];
+        NEXT();
+    CASE(OP_LOADI)
+        r[ip->a].ll = ip->k;
+        NEXT();
+    CASE(OP_MOV)
+        r[ip->a] = r[ip->b];
+        NEXT();
+    CASE(OP_ADD)
+        r[ip->a].ull = r[ip->b].ull + r[ip->c].ull;
+        NEXT();
+    CASE(OP_SUB)
+        r[ip->a].ull = r[ip->b].ull - r[ip->c].ull;
+        NEXT();
+    CASE(OP_MUL)
+        r[ip->a].ull = r[ip->b].ull * r[ip->c].ull;
+        NEXT();
+    CASE(OP_DIV)
+        if (r[ip->c].ll == 0) {
+            goto div_by_zero;
+        }
+        r[ip->a].ll = r[ip->c].ll == -1 ? (i64)(0 - r[ip->b].ull) : r[ip->b].ll / r[ip->c].ll;
+        NEXT();
+    CASE(OP_DIVU)
+        if (r[ip->c].ull == 0) {
+            goto div_by_zero;
+        }
+        r[ip->a].ull = r[ip->b].ull / r[ip->c].ull;
+        NEXT();
+    CASE(OP_MOD)
+        if (r[ip->c].ll == 0) {
+            goto div_by_zero;
+        }
+        r[ip->a].ll = r[ip->c].ll == -1 ? 0 : r[ip->b].ll % r[ip->c].ll;
+        NEXT();
+    CASE(OP_MODU)
+        if (r[ip->c].ull == 0) {
+            goto div_by_zero;
+        }
+        r[ip->a].ull = r[ip->b].ull % r[ip->c].ull;
+        NEXT();
+    CASE(OP_AND)
+        r[ip->a].ull = r[ip->b].ull & r[ip->c].ull;
+        NEXT();
+    CASE(OP_OR)
+        r[ip->a].ull = r[ip->b].ull | r[ip->c].ull;
+        NEXT();
+    CASE(OP_XOR)
+        r[ip->a].ull = r[ip->b].ull ^ r[ip->c].ull;
+        NEXT();
+    CASE(OP_SHL)
+        if (r[ip->c].ull >= 64) {
+            goto bad_shift;
+        }
+        r[ip->a].ull = r[ip->b].ull << r[ip->c].ull;
+        NEXT();
+    CASE(OP_SHR)
+        if (r[ip->c].ull >= 64) {
+            goto bad_shift;
+        }
+        r[ip->a].ll = r[ip->b].ll >> r[ip->c].ull;
+        NEXT();
+    CASE(OP_SHRU)
+        if (r[ip->c].ull >= 64) {
+            goto bad_shift;
+        }
+        r[ip->a].ull = r[ip->b].ull >> r[ip->c].ull;
+        NEXT();
+    CASE(OP_ADDI)
+        r[ip->a].ull = r[ip->b].ull + (u64)(i64)(i16)ip->c;
+        NEXT();
+    CASE(OP_EQ)
+        r[ip->a].ull = r[ip->b].ull == r[ip->c].ull;
+        NEXT();
+    CASE(OP_NE)
+        r[ip->a].ull = r[ip->b].ull != r[ip->c].ull;
+        NEXT();
+    CASE(OP_LT)
+        r[ip->a].ull = r[ip->b].ll < r[ip->c].ll;
+        NEXT();
+    CASE(OP_LTU)
+        r[ip->a].ull = r[ip->b].ull < r[ip->c].ull;
+        NEXT();
+    CASE(OP_LE)
+        r[ip->a].ull = r[ip->b].ll <= r[ip->c].ll;
+        NEXT();
+    CASE(OP_LEU)
+        r[ip->a].ull = r[ip->b].ull <= r[ip->c].ull;
+        NEXT();
+    CASE(OP_NEG)
+        r[ip->a].ull = 0 - r[ip->b].ull;
+        NEXT();
+    CASE(OP_BNOT)
+        r[ip->a].ull = ~r[ip->b].ull;
+        NEXT();
+    CASE(OP_NOT)
+        r[ip->a].ull = r[ip->b].ull == 0;
+        NEXT();
+    CASE(OP_FADD)
+        r[ip->a].d = r[ip->b].d + r[ip->c].d;
+        NEXT();
+    CASE(OP_FSUB)
+        r[ip->a].d = r[ip->b].d - r[ip->c].d;
+        NEXT();
+    CASE(OP_FMUL)
+        r[ip->a].d = r[ip->b].d * r[ip->c].d;
+        NEXT();
+    CASE(OP_FDIV)
+        r[ip->a].d = r[ip->b].d / r[ip->c].d;
+        NEXT();
+    CASE(OP_FEQ)
+        r[ip->a].ull = r[ip->b].d == r[ip->c].d;
+        NEXT();
+    CASE(OP_FNE)
+        r[ip->a].ull = r[ip->b].d != r[ip->c].d;
+        NEXT();
+    CASE(OP_FLT)
+        r[ip->a].ull = r[ip->b].d < r[ip->c].d;
+        NEXT();
+    CASE(OP_FLE)
+        r[ip->a].ull = r[ip->b].d <= r[ip->c].d;
+        NEXT();
+    CASE(OP_FNEG)
+        r[ip->a].d = -r[ip->b].d;
+        NEXT();
+    CASE(OP_SEXT) {
+        int shift = 64 - ip->c;
+        r[ip->a].ll = (i64)(r[ip->b].ull << shift) >> shift;
+        NEXT();
+    }
+    CASE(OP_ZEXT)
+        r[ip->a].ull = r[ip->b].ull & ((1ull << ip->c) - 1);
+        NEXT();
+    CASE(OP_NEZ)
+        r[ip->a].ull = r[ip->b].ull != 0;
+        NEXT();
+    CASE(OP_FNEZ)
+        r[ip->a].ull = r[ip->b].d != 0;
+        NEXT();
+    CASE(OP_I2F)
+        r[ip->a].d = (double)r[ip->b].ll;
+        NEXT();
+    CASE(OP_U2F)
+        r[ip->a].d = (double)r[ip->b].ull;
+        NEXT();
+    CASE(OP_F2I)
+        if (!(r[ip->b].d > -9223372036854775809.0 && r[ip->b].d < 9223372036854775808.0)) {
+            goto bad_convert;
+        }
+        r[ip->a].ll = (i64)r[ip->b].d;
+        NEXT();
+    CASE(OP_F2U)
+        if (!(r[ip->b].d > -1.0 && r[ip->b].d < 18446744073709551616.0)) {
+            goto bad_convert;
+        }
+        r[ip->a].ull = (u64)r[ip->b].d;
+        NEXT();
+    CASE(OP_F32)
+        r[ip->a].d = (float)r[ip->b].d;
+        NEXT();
+    CASE(OP_JMP)
+        ip = code + ip->k;
+        DISPATCH();
+    CASE(OP_LOOP)
+        if (--steps == 0) {
+            goto too_long;
+        }
+        ip = code + ip->k;
+        DISPATCH();
+    CASE(OP_JZ)
+        if (!r[ip->a].ull) {
+            ip = code + ip->k;
+            DISPATCH();
+        }
+        NEXT();
+    CASE(OP_JNZ)
+        if (r[ip->a].ull) {
+            ip = code + ip->k;
+            DISPATCH();
+        }
+        NEXT();
+    CASE(OP_CALL) {
+        callee = func->callees[ip->k];
+        if (callee->state != BC_READY) {
+            goto bad_call;
+        }
+        if (--steps == 0) {
+            goto too_long;
+        }
+        Val *regs = r + ip->a;
+        if (depth == BC_MAX_DEPTH || regs + callee->num_regs > stack_end) {
+            goto too_deep;
+        }
+        frames[depth++] = (BcFrame){func, ip + 1, r};
+        func = callee;
+        code = func->code;
+        k = func->consts;
+        r = regs;
+        ip = code;
+        DISPATCH();
+    }
+    CASE(OP_RET)
+    CASE(OP_RETV) {
+        Val val = ip->op == OP_RET ? r[ip->a] : (Val){0};
+        if (depth == 0) {
+            *result = val;
+            return true;
+        }
+        BcFrame *frame = &frames[--depth];
+        func = frame->func;
+        code = func->code;
+        k = func->consts;
+        r = frame->regs;
+        ip = frame->ret_ip;
+        r[ip[-1].a] = val;
+        DISPATCH();
+    }
+    END_DISPATCH()
+
+    SrcPos pos;
+div_by_zero:
+    pos = func->code_pos[ip - code];
+    error(pos, "Division by zero in compile-time evaluation");
+    return false;
+bad_shift:
+    pos = func->code_pos[ip - code];
+    error(pos, "Shift count %lld out of range in compile-time evaluation", r[ip->c].ll);
+    return false;
+bad_convert:
+    pos = func->code_pos[ip - code];
+    error(pos, "Value %g out of range of integer type in compile-time evaluation", r[ip->b].d);
+    return false;
+too_long:
+    pos = func->code_pos[ip - code];
+    error(pos, "Compile-time evaluation took more than %d steps", BC_MAX_STEPS);
+    return false;
+too_deep:
+    pos = func->code_pos[ip - code];
+    error(pos, "Compile-time evaluation nested too deeply calling '%s'", callee->name);
+    return false;
+bad_call:
+    pos = func->code_pos[ip - code];
+    error(pos, "Cannot call '%s' at compile time: %s(%d): %s", callee->name,
+        callee->fail_pos.name, callee->fail_pos.line, callee->fail_reason);
+    return false;
+}
+
+#undef CASE
+#undef BEGIN_DISPATCH
+#undef END_DISPATCH
+#undef DISPATCH
+#undef NEXT
+
+static void
+bc_free_thread(void) {
+    free(bc_stack);
+    bc_stack = NULL;
+    for (size_t i = 0; i < buf_len(eval_scratch); i++) {
+        free_bc_code(eval_scratch[i]);
+        free(eval_scratch[i]);
+    }
+    buf_free(eval_scratch);
+}
+
+static void
+print_consts(char **out, Decls *decls) {
+    for (size_t i = 0; decls && i < decls->num_decls; i++) {
+        Decl *decl = decls->decls[i];
+        if (decl->kind != DECL_CONST) {
+            continue;
+        }
+        ConstValue *value = const_cache_get(decl, NULL, 0);
+        if (value->state != CONST_EVALUATED) {
+            continue;
+        }
+        BcType type = value->type;
+        Val val = value->val;
+        buf_printf(*out, "%s(%d): const %s: %s = ", decl->pos.name, decl->pos.line, decl->name, bc_type_names[type]);
+        if (type == BC_BOOL) {
+            buf_printf(*out, "%s\n", val.ull ? "true" : "false");
+        } else if (bc_is_float(type)) {
+            buf_printf(*out, "%.*g\n", type == BC_F32 ? 9 : 17, val.d);
+        } else if (bc_is_signed(type)) {
+            buf_printf(*out, "%lld\n", val.ll);
+        } else {
+            buf_printf(*out, "%llu\n", val.ull);
+        }
+    }
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "error.h"
+#include "lex.h"
+#include "stats.h"
+#include "ast.h"
+
+// Compile-time evaluation. Every top-level const is evaluated when its module
+// is checked, by lowering the expression, and any fn it calls, to a compact
+// register bytecode and running it. Modules are checked after the modules they
+// import, so imported consts already have their values.
+//
+// Each fn gets a frame of registers holding Vals. Integers are kept in 64 bits,
+// truncated to the width of their type and then sign or zero extended, so most
+// operations don't need to know the type; floats are kept as doubles and f32
+// results are rounded with OP_F32. Arguments are passed like in Lua: the caller
+// puts them in consecutive registers and the callee's frame starts at the
+// first one, which also receives the result.
+//
+// Instructions are dispatched with computed goto where the compiler has it
+// (every Instr stores the address of its handler, so dispatch is one indirect
+// jump) and with a switch otherwise.
+
+#if defined(__GNUC__) || defined(__clang__)
+#define BC_DIRECT_THREADED 1
+#else
+#define BC_DIRECT_THREADED 0
+#endif
+
+// Loop iterations and calls a single evaluation may take.
+#define BC_MAX_STEPS 100000000
+#define BC_MAX_DEPTH 1024
+#define BC_STACK_SIZE (1024 * 1024)
+#define BC_MAX_REGS UINT16_MAX
+
+typedef enum BcType {
+    BC_VOID,
+    BC_BOOL,
+    BC_I8,
+    BC_I16,
+    BC_I32,
+    BC_I64,
+    BC_U8,
+    BC_U16,
+    BC_U32,
+    BC_U64,
+    BC_F32,
+    BC_F64,
+    NUM_BC_TYPES,
+} BcType;
+
+typedef enum Op {
+    // a = consts[k], a = k
+    OP_LOADK,
+    OP_LOADI,
+    OP_MOV,
+    // integer a = b op c
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_DIVU,
+    OP_MOD,
+    OP_MODU,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+    OP_SHRU,
+    // a = b + (i16)c
+    OP_ADDI,
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LTU,
+    OP_LE,
+    OP_LEU,
+    // a = op b
+    OP_NEG,
+    OP_BNOT,
+    OP_NOT,
+    // float a = b op c
+    OP_FADD,
+    OP_FSUB,
+    OP_FMUL,
+    OP_FDIV,
+    OP_FEQ,
+    OP_FNE,
+    OP_FLT,
+    OP_FLE,
+    OP_FNEG,
+    // conversions; SEXT and ZEXT truncate b to c bits
+    OP_SEXT,
+    OP_ZEXT,
+    OP_NEZ,
+    OP_FNEZ,
+    OP_I2F,
+    OP_U2F,
+    OP_F2I,
+    OP_F2U,
+    OP_F32,
+    // jump to k; OP_LOOP jumps backwards and counts a step
+    OP_JMP,
+    OP_LOOP,
+    OP_JZ,
+    OP_JNZ,
+    // call callees[k] with arguments from a up, result in a
+    OP_CALL,
+    OP_RET,
+    OP_RETV,
+    NUM_OPS,
+} Op;
+
+typedef struct Instr {
+#if BC_DIRECT_THREADED
+    const void *label;
+#endif
+    u8 op;
+    u16 a;
+    union {
+        struct {
+            u16 b;
+            u16 c;
+        };
+        i32 k;
+    };
+} Instr;
+
+typedef enum BcState {
+    BC_UNLOWERED,
+    BC_LOWERING,
+    BC_READY,
+    BC_FAILED,
+} BcState;
+
+typedef struct BcFunc {
+    const char *name;
+    Decl *decl;
+    BcState state;
+    // names visible in the module the fn is in
+    struct ModuleScope *scope;
+    Instr *code;
+    // position of each instruction, for runtime errors
+    SrcPos *code_pos;
+    Val *consts;
+    struct BcFunc **callees;
+    BcType *param_types;
+    BcType ret_type;
+    u32 num_regs;
+    // why the fn can't be evaluated, when state is BC_FAILED
+    SrcPos fail_pos;
+    char *fail_reason;
+} BcFunc;
+
+typedef enum ConstState {
+    CONST_UNEVALUATED,
+    CONST_EVALUATING,
+    CONST_EVALUATED,
+    CONST_FAILED,
+} ConstState;
+
+// Evaluated constants are kept in a table shared by the whole compilation,
+// keyed by the const's Decl and its generic arguments, given as interned
+// canonical type names, so every instantiation is evaluated once however many
+// modules refer to it. The table is split into shards, each with its own lock
+// and arena, and lookups from different threads rarely meet. A value only
+// changes on the thread checking the const's module, and other modules see it
+// after that module is checked.
+typedef struct ConstValue {
+    Decl *decl;
+    const char **args;
+    size_t num_args;
+    Val val;
+    u8 type;
+    u8 state;
+    // next entry with the same hash
+    struct ConstValue *next;
+} ConstValue;
+
+#define CONST_CACHE_SHARDS 64
+
+typedef struct ConstCacheShard {
+    Mutex mutex;
+    // hash of (decl, args) to ConstValue chain
+    Map values;
+    Arena arena;
+} ConstCacheShard;
+
+// Names visible at the top level of a module: its own declarations, and the
+// ones it imports by name, which come from modules checked before it.
+typedef struct ModuleScope {
+    Map decls;
+    Map imports;
+} ModuleScope;
+
+typedef struct BcLocal {
+    const char *name;
+    u16 reg;
+    BcType type;
+} BcLocal;
+
+typedef struct BcLoop {
+    // jumps to patch to the loop's exit and next iteration
+    size_t *breaks;
+    size_t *continues;
+} BcLoop;
+
+typedef struct Lowerer {
+    BcFunc *func;
+    ModuleScope *scope;
+    BcLocal *locals;
+    BcLoop *loops;
+    // registers below locals_top belong to locals, the rest are temporaries
+    u32 locals_top;
+    u32 next_reg;
+    // last jump target, which instructions must not be merged across
+    size_t last_label;
+    bool failed;
+} Lowerer;
+
+bool flag_print_consts = false;
+
+static void const_cache_init(void);
+static ConstValue *const_cache_get(Decl *decl, const char **args, size_t num_args);
+static void eval_module(Decls *decls, ModuleScope *scope);
+static ConstValue *eval_const(Decl *decl, ModuleScope *scope);
+static BcFunc *lower_func(Decl *decl);
+static u16 lower_expr(Lowerer *l, Expr *expr, BcType *type);
+static void lower_stmt(Lowerer *l, Stmt *stmt);
+static void lower_block(Lowerer *l, StmtList block);
+static bool bc_exec(BcFunc *func, Val *args, Val *result, bool thread_code);
+static void bc_free_thread(void);
+static void print_consts(char **out, Decls *decls);
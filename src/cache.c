@@ -0,0 +1,1302 @@
+#include "cache.h"
+
+const char *flag_cache_dir = NULL;
+size_t flag_cache_size_mb = 256;
+
+static Mutex cache_mutex = MUTEX_INIT;
+static uint64_t cache_temp_counter;
+
+static uint64_t
+cache_options_hash(void) {
+    uint64_t hash = hash_bytes(COMPILER_VERSION, strlen(COMPILER_VERSION));
+    hash = hash_mix(hash, CACHE_FORMAT_VERSION);
+    // everything that changes the AST built from the same source
+    hash = hash_mix(hash, flag_fold_constants);
+    return hash;
+}
+
+// 0 if the file can't be found
+static uint64_t
+cache_stat_key(const char *path) {
+    FileStat st;
+    char *full_path = os_full_path(path);
+    if (!full_path || !os_stat(full_path, &st)) {
+        free(full_path);
+        return 0;
+    }
+    uint64_t hash = hash_bytes(full_path, strlen(full_path));
+    free(full_path);
+    hash = hash_mix(hash, hash_mix(st.mtime_ns, st.size));
+    return hash_mix(hash, cache_options_hash());
+}
+
+static uint64_t
+cache_content_key(const char *buf, size_t len) {
+    return hash_mix(hash_mix(hash_bytes(buf, len), len), cache_options_hash());
+}
+
+static char *
+cache_path(uint64_t key, const char *ext) {
+    return strf("%s/%016" PRIx64 ".%s", flag_cache_dir, key, ext);
+}
+
+// Reads the entry at path, marking it used so eviction keeps it over the ones
+// that haven't been hit lately.
+static char *
+cache_read(const char *path, size_t *len) {
+    char *buf = read_file_len(path, len);
+    if (buf) {
+        os_touch(path);
+    }
+    return buf;
+}
+
+// Writes to a unique temporary file and renames it over path. If the rename
+// fails because another process got there first, its copy is just as good.
+static bool
+cache_write_atomic(const char *path, const char *buf, size_t len) {
+    mutex_lock(&cache_mutex);
+    uint64_t counter = cache_temp_counter++;
+    mutex_unlock(&cache_mutex);
+    uint64_t unique = hash_mix(hash_mix(os_time_ns(), counter), hash_ptr(&counter));
+    char *temp_path = strf("%s/tmp-%016" PRIx64, flag_cache_dir, unique);
+    FILE *file = fopen(temp_path, "wb");
+    bool ok = file != NULL;
+    if (file) {
+        ok = (len == 0 || fwrite(buf, len, 1, file) == 1);
+        ok = fclose(file) == 0 && ok;
+    }
+    if (ok && rename(temp_path, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        remove(temp_path);
+    }
+    free(temp_path);
+    return ok;
+}
+
+// Serialization. u32s are LEB128 varints, since most are small line numbers,
+// counts and indices; u64s are two u32s. Strings are a u32 length (~0 for
+// NULL) and their bytes, and node pointers start with kind + 1 (0 for NULL).
+// Positions store line, column and offset; the file name comes from the
+// reader.
+
+static void
+write_u8(CacheWriter *w, uint8_t val) {
+    buf_push(w->buf, (char)val);
+}
+
+static void
+write_u32(CacheWriter *w, uint32_t val) {
+    while (val >= 0x80) {
+        buf_push(w->buf, (char)(val | 0x80));
+        val >>= 7;
+    }
+    buf_push(w->buf, (char)val);
+}
+
+static void
+write_u64(CacheWriter *w, uint64_t val) {
+    write_u32(w, (uint32_t)val);
+    write_u32(w, (uint32_t)(val >> 32));
+}
+
+static void
+write_f64(CacheWriter *w, double val) {
+    uint64_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    write_u64(w, bits);
+}
+
+static void
+write_raw(CacheWriter *w, const char *start, size_t len) {
+    buf_fit(w->buf, buf_len(w->buf) + len);
+    memcpy(w->buf + buf_len(w->buf), start, len);
+    buf__hdr(w->buf)->len += len;
+}
+
+static void
+write_bytes(CacheWriter *w, const char *start, size_t len) {
+    write_u32(w, (uint32_t)len);
+    write_raw(w, start, len);
+}
+
+static void
+write_str(CacheWriter *w, const char *str) {
+    if (!str) {
+        write_u32(w, UINT32_MAX);
+        return;
+    }
+    write_bytes(w, str, strlen(str));
+}
+
+// Names are interned, so each distinct one is stored once in the blob's name
+// table and referred to by index, which also saves interning it again on
+// every use when the blob is read.
+static void
+write_name(CacheWriter *w, const char *name) {
+    if (!name) {
+        write_u32(w, UINT32_MAX);
+        return;
+    }
+    uint64_t index = map_get_uint64(&w->name_indices, (void *)name);
+    if (!index) {
+        buf_push(w->names, name);
+        index = buf_len(w->names);
+        map_put_uint64(&w->name_indices, (void *)name, index);
+    }
+    write_u32(w, (uint32_t)(index - 1));
+}
+
+static void
+write_pos(CacheWriter *w, SrcPos pos) {
+    write_u32(w, pos.line);
+    write_u32(w, pos.col);
+    write_u32(w, pos.offset);
+}
+
+static void
+write_names(CacheWriter *w, const char **names, size_t num_names) {
+    write_u32(w, (uint32_t)num_names);
+    for (size_t i = 0; i < num_names; i++) {
+        write_name(w, names[i]);
+    }
+}
+
+static void
+write_exprs(CacheWriter *w, Expr **exprs, size_t num_exprs) {
+    write_u32(w, (uint32_t)num_exprs);
+    for (size_t i = 0; i < num_exprs; i++) {
+        write_expr(w, exprs[i]);
+    }
+}
+
+static void
+write_typespec(CacheWriter *w, Typespec *type) {
+    if (!type) {
+        write_u8(w, 0);
+        return;
+    }
+    write_u8(w, type->kind + 1);
+    write_pos(w, type->pos);
+    write_typespec(w, type->base);
+    switch (type->kind) {
+    case TYPESPEC_NAME:
+        write_names(w, type->names, type->num_names);
+        break;
+    case TYPESPEC_FUNC:
+        write_u32(w, (uint32_t)type->fn.num_args);
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            write_typespec(w, type->fn.args[i]);
+        }
+        write_u8(w, type->fn.has_varargs);
+        write_typespec(w, type->fn.ret);
+        break;
+    case TYPESPEC_ARRAY:
+        write_expr(w, type->num_elems);
+        break;
+    case TYPESPEC_TUPLE:
+        write_u32(w, (uint32_t)type->tuple.num_fields);
+        for (size_t i = 0; i < type->tuple.num_fields; i++) {
+            write_typespec(w, type->tuple.fields[i]);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+write_expr(CacheWriter *w, Expr *expr) {
+    if (!expr) {
+        write_u8(w, 0);
+        return;
+    }
+    write_u8(w, expr->kind + 1);
+    write_pos(w, expr->pos);
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        write_expr(w, expr->paren.expr);
+        break;
+    case EXPR_INT:
+        write_u64(w, expr->int_lit.val);
+        write_u8(w, expr->int_lit.mod);
+        write_u8(w, expr->int_lit.suffix);
+        write_u8(w, expr->int_lit.folded);
+        break;
+    case EXPR_FLOAT:
+        write_bytes(w, expr->float_lit.start, expr->float_lit.end - expr->float_lit.start);
+        write_f64(w, expr->float_lit.val);
+        write_u8(w, expr->float_lit.suffix);
+        break;
+    case EXPR_STR:
+        write_str(w, expr->str_lit.val);
+        write_u8(w, expr->str_lit.mod);
+        break;
+    case EXPR_NAME:
+        write_name(w, expr->name);
+        break;
+    case EXPR_TUPLE:
+        write_exprs(w, expr->tuple.args, expr->tuple.num_args);
+        break;
+    case EXPR_CAST:
+        write_typespec(w, expr->cast.type);
+        write_expr(w, expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        write_expr(w, expr->call.expr);
+        write_exprs(w, expr->call.args, expr->call.num_args);
+        break;
+    case EXPR_INDEX:
+        write_expr(w, expr->index.expr);
+        write_expr(w, expr->index.index);
+        break;
+    case EXPR_FIELD:
+        write_expr(w, expr->field.expr);
+        write_name(w, expr->field.name);
+        break;
+    case EXPR_UNARY:
+        write_u8(w, expr->unary.op);
+        write_expr(w, expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        write_u8(w, expr->binary.op);
+        write_expr(w, expr->binary.left);
+        write_expr(w, expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        write_expr(w, expr->ternary.cond);
+        write_expr(w, expr->ternary.then_expr);
+        write_expr(w, expr->ternary.else_expr);
+        break;
+    case EXPR_MODIFY:
+        write_u8(w, expr->modify.op);
+        write_u8(w, expr->modify.post);
+        write_expr(w, expr->modify.expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        write_expr(w, expr->sizeof_expr);
+        break;
+    case EXPR_SIZEOF_TYPE:
+        write_typespec(w, expr->sizeof_type);
+        break;
+    case EXPR_TYPEOF_EXPR:
+        write_expr(w, expr->typeof_expr);
+        break;
+    case EXPR_TYPEOF_TYPE:
+        write_typespec(w, expr->typeof_type);
+        break;
+    case EXPR_ALIGNOF_EXPR:
+        write_expr(w, expr->alignof_expr);
+        break;
+    case EXPR_ALIGNOF_TYPE:
+        write_typespec(w, expr->alignof_type);
+        break;
+    case EXPR_OFFSETOF:
+        write_typespec(w, expr->offsetof_field.type);
+        write_name(w, expr->offsetof_field.name);
+        break;
+    case EXPR_NEW:
+        write_expr(w, expr->new_expr.alloc);
+        write_expr(w, expr->new_expr.len);
+        write_expr(w, expr->new_expr.arg);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+write_stmt_list(CacheWriter *w, StmtList *block) {
+    write_pos(w, block->pos);
+    write_u32(w, (uint32_t)block->num_stmts);
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        write_stmt(w, block->stmts[i]);
+    }
+}
+
+static void
+write_stmt(CacheWriter *w, Stmt *stmt) {
+    if (!stmt) {
+        write_u8(w, 0);
+        return;
+    }
+    write_u8(w, stmt->kind + 1);
+    write_pos(w, stmt->pos);
+    switch (stmt->kind) {
+    case STMT_RETURN:
+    case STMT_EXPR:
+        write_expr(w, stmt->expr);
+        break;
+    case STMT_BLOCK:
+        write_stmt_list(w, &stmt->block);
+        break;
+    case STMT_IF:
+        write_expr(w, stmt->if_stmt.cond);
+        write_stmt_list(w, &stmt->if_stmt.then_block);
+        write_u32(w, (uint32_t)stmt->if_stmt.num_elseifs);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            write_expr(w, stmt->if_stmt.elseifs[i].cond);
+            write_stmt_list(w, &stmt->if_stmt.elseifs[i].block);
+        }
+        write_stmt_list(w, &stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+        write_expr(w, stmt->while_stmt.cond);
+        write_stmt_list(w, &stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        write_stmt(w, stmt->for_stmt.init);
+        write_expr(w, stmt->for_stmt.cond);
+        write_stmt(w, stmt->for_stmt.next);
+        write_stmt_list(w, &stmt->for_stmt.block);
+        break;
+    case STMT_ASSIGN:
+        write_u8(w, stmt->assign.op);
+        write_expr(w, stmt->assign.left);
+        write_expr(w, stmt->assign.right);
+        break;
+    case STMT_INIT:
+        write_name(w, stmt->init.name);
+        write_typespec(w, stmt->init.type);
+        write_expr(w, stmt->init.expr);
+        break;
+    case STMT_SWITCH:
+        write_expr(w, stmt->switch_stmt.expr);
+        write_u32(w, (uint32_t)stmt->switch_stmt.num_cases);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            write_pos(w, c->pos);
+            write_u8(w, c->is_default);
+            write_u32(w, (uint32_t)c->num_patterns);
+            for (size_t j = 0; j < c->num_patterns; j++) {
+                write_expr(w, c->patterns[j]);
+            }
+            write_stmt_list(w, &c->block);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+write_aggregate(CacheWriter *w, Aggregate *aggregate) {
+    write_pos(w, aggregate->pos);
+    write_u8(w, aggregate->kind);
+    write_u32(w, (uint32_t)aggregate->num_items);
+    for (size_t i = 0; i < aggregate->num_items; i++) {
+        AggregateItem *item = &aggregate->items[i];
+        write_pos(w, item->pos);
+        write_u8(w, item->kind);
+        if (item->kind == AGGREGATE_ITEM_FIELD) {
+            write_names(w, item->names, item->num_names);
+            write_typespec(w, item->type);
+        } else if (item->kind == AGGREGATE_ITEM_SUBAGGREGATE) {
+            write_aggregate(w, item->subaggregate);
+        }
+    }
+}
+
+static void
+write_decl(CacheWriter *w, Decl *decl) {
+    // lazily skipped bodies point into the source, which a cache hit never loads
+    assert(decl->kind != DECL_FUNC || !decl->fn.body_start);
+    write_u8(w, decl->kind + 1);
+    write_pos(w, decl->pos);
+    write_name(w, decl->name);
+    write_u32(w, (uint32_t)decl->notes.num_notes);
+    for (size_t i = 0; i < decl->notes.num_notes; i++) {
+        write_pos(w, decl->notes.notes[i].pos);
+        write_name(w, decl->notes.notes[i].name);
+    }
+    switch (decl->kind) {
+    case DECL_FUNC:
+        write_u32(w, (uint32_t)decl->fn.num_generics);
+        for (size_t i = 0; i < decl->fn.num_generics; i++) {
+            write_pos(w, decl->fn.generics[i].pos);
+            write_u8(w, decl->fn.generics[i].is_const);
+            write_name(w, decl->fn.generics[i].name);
+            write_typespec(w, decl->fn.generics[i].type);
+        }
+        write_u32(w, (uint32_t)decl->fn.num_params);
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            write_pos(w, decl->fn.params[i].pos);
+            write_name(w, decl->fn.params[i].name);
+            write_typespec(w, decl->fn.params[i].type);
+        }
+        write_typespec(w, decl->fn.ret_type);
+        write_u8(w, decl->fn.has_varargs);
+        write_typespec(w, decl->fn.varargs_type);
+        write_stmt_list(w, &decl->fn.block);
+        break;
+    case DECL_VAR:
+        write_typespec(w, decl->var.type);
+        write_expr(w, decl->var.expr);
+        break;
+    case DECL_CONST:
+        write_typespec(w, decl->const_decl.type);
+        write_expr(w, decl->const_decl.expr);
+        break;
+    case DECL_TYPEDEF:
+        write_typespec(w, decl->typedef_decl.type);
+        break;
+    case DECL_ENUM:
+        write_typespec(w, decl->enum_decl.type);
+        write_u32(w, (uint32_t)decl->enum_decl.num_items);
+        for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+            write_pos(w, decl->enum_decl.items[i].pos);
+            write_name(w, decl->enum_decl.items[i].name);
+            write_u64(w, (uint64_t)decl->enum_decl.items[i].value);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        write_aggregate(w, decl->aggregate);
+        break;
+    case DECL_IMPORT:
+        write_u8(w, decl->import.is_relative);
+        write_names(w, decl->import.names, decl->import.num_names);
+        write_u8(w, decl->import.import_all);
+        write_u32(w, (uint32_t)decl->import.num_items);
+        for (size_t i = 0; i < decl->import.num_items; i++) {
+            write_name(w, decl->import.items[i].name);
+            write_name(w, decl->import.items[i].rename);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+write_error(CacheWriter *w, Error *err) {
+    write_u8(w, err->kind);
+    write_pos(w, err->pos);
+    write_u8(w, err->corrected);
+    write_u8(w, err->is_warning);
+    write_str(w, err->found);
+    write_str(w, err->found_text);
+    write_u32(w, err->found_len);
+    switch (err->kind) {
+    case ERROR_EXPECTED:
+        write_u8(w, err->expected.expected_token);
+        write_u8(w, err->expected.found_token);
+        write_u8(w, err->expected.replaced);
+        break;
+    case ERROR_UNEXPECTED:
+        write_u8(w, err->unexpected.found_token);
+        write_str(w, err->unexpected.context);
+        break;
+    case ERROR_MESSAGE:
+        write_str(w, err->message);
+        break;
+    default:
+        break;
+    }
+}
+
+// Deserialization. A truncated or corrupt blob sets r->failed and makes every
+// later read return zero, so the caller just checks once at the end.
+
+static bool
+read_check(CacheReader *r, size_t size) {
+    if (r->failed || (size_t)(r->end - r->ptr) < size) {
+        r->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static uint8_t
+read_u8(CacheReader *r) {
+    if (!read_check(r, 1)) {
+        return 0;
+    }
+    return (uint8_t)*r->ptr++;
+}
+
+static uint32_t
+read_u32(CacheReader *r) {
+    uint32_t val = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t byte = read_u8(r);
+        val |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return val;
+        }
+    }
+    r->failed = true;
+    return 0;
+}
+
+static uint64_t
+read_u64(CacheReader *r) {
+    uint64_t low = read_u32(r);
+    return low | (uint64_t)read_u32(r) << 32;
+}
+
+static double
+read_f64(CacheReader *r) {
+    uint64_t bits = read_u64(r);
+    double val;
+    memcpy(&val, &bits, sizeof(val));
+    return val;
+}
+
+// Strings are copied into arena.
+static const char *
+read_str_len(CacheReader *r, Arena *arena, size_t *len) {
+    uint32_t n = read_u32(r);
+    *len = 0;
+    if (n == UINT32_MAX || !read_check(r, n)) {
+        return NULL;
+    }
+    const char *start = r->ptr;
+    r->ptr += n;
+    *len = n;
+    char *str = arena_alloc(arena, n + 1);
+    memcpy(str, start, n);
+    str[n] = 0;
+    return str;
+}
+
+static const char *
+read_str(CacheReader *r, Arena *arena) {
+    size_t len;
+    return read_str_len(r, arena, &len);
+}
+
+static const char *
+read_name(CacheReader *r) {
+    uint32_t index = read_u32(r);
+    if (index == UINT32_MAX) {
+        return NULL;
+    }
+    if (index >= r->num_names) {
+        r->failed = true;
+        return NULL;
+    }
+    return r->names[index];
+}
+
+static SrcPos
+read_pos(CacheReader *r) {
+    SrcPos pos = {.name = r->name};
+    pos.line = read_u32(r);
+    pos.col = read_u32(r);
+    pos.offset = read_u32(r);
+    return pos;
+}
+
+// Counts are checked against the bytes left, so a corrupt count can't make us
+// allocate gigabytes: every element takes at least one byte.
+static size_t
+read_count(CacheReader *r) {
+    uint32_t n = read_u32(r);
+    if (!read_check(r, n)) {
+        return 0;
+    }
+    return n;
+}
+
+static const char **
+read_names(CacheReader *r, size_t *num_names) {
+    size_t n = read_count(r);
+    const char **names = n ? ast_alloc(n * sizeof(const char *)) : NULL;
+    for (size_t i = 0; i < n; i++) {
+        names[i] = read_name(r);
+    }
+    *num_names = n;
+    return names;
+}
+
+static Expr **
+read_exprs(CacheReader *r, size_t *num_exprs) {
+    size_t n = read_count(r);
+    Expr **exprs = n ? ast_alloc(n * sizeof(Expr *)) : NULL;
+    for (size_t i = 0; i < n; i++) {
+        exprs[i] = read_expr(r);
+    }
+    *num_exprs = n;
+    return exprs;
+}
+
+static Typespec *
+read_typespec(CacheReader *r) {
+    uint8_t tag = read_u8(r);
+    if (!tag || tag - 1 > TYPESPEC_ERROR) {
+        r->failed |= tag != 0;
+        return NULL;
+    }
+    TypespecKind kind = tag - 1;
+    SrcPos pos = read_pos(r);
+    Typespec *type = new_typespec(kind, pos);
+    type->base = read_typespec(r);
+    switch (kind) {
+    case TYPESPEC_NAME:
+        type->names = read_names(r, &type->num_names);
+        break;
+    case TYPESPEC_FUNC: {
+        size_t n = read_count(r);
+        type->fn.args = n ? ast_alloc(n * sizeof(Typespec *)) : NULL;
+        for (size_t i = 0; i < n; i++) {
+            type->fn.args[i] = read_typespec(r);
+        }
+        type->fn.num_args = n;
+        type->fn.has_varargs = read_u8(r);
+        type->fn.ret = read_typespec(r);
+        break;
+    }
+    case TYPESPEC_ARRAY:
+        type->num_elems = read_expr(r);
+        break;
+    case TYPESPEC_TUPLE: {
+        size_t n = read_count(r);
+        type->tuple.fields = n ? ast_alloc(n * sizeof(Typespec *)) : NULL;
+        for (size_t i = 0; i < n; i++) {
+            type->tuple.fields[i] = read_typespec(r);
+        }
+        type->tuple.num_fields = n;
+        break;
+    }
+    default:
+        break;
+    }
+    return type;
+}
+
+static Expr *
+read_expr(CacheReader *r) {
+    uint8_t tag = read_u8(r);
+    if (!tag || tag - 1 > EXPR_ERROR) {
+        r->failed |= tag != 0;
+        return NULL;
+    }
+    ExprKind kind = tag - 1;
+    SrcPos pos = read_pos(r);
+    // built directly rather than through new_expr_* so nothing is folded twice
+    Expr *expr = new_expr(kind, pos);
+    switch (kind) {
+    case EXPR_PAREN:
+        expr->paren.expr = read_expr(r);
+        break;
+    case EXPR_INT:
+        expr->int_lit.val = read_u64(r);
+        expr->int_lit.mod = read_u8(r);
+        expr->int_lit.suffix = read_u8(r);
+        expr->int_lit.folded = read_u8(r);
+        break;
+    case EXPR_FLOAT: {
+        size_t len;
+        expr->float_lit.start = read_str_len(r, &ast_arena, &len);
+        expr->float_lit.end = expr->float_lit.start + len;
+        expr->float_lit.val = read_f64(r);
+        expr->float_lit.suffix = read_u8(r);
+        break;
+    }
+    case EXPR_STR:
+        expr->str_lit.val = read_str(r, &ast_arena);
+        expr->str_lit.mod = read_u8(r);
+        break;
+    case EXPR_NAME:
+        expr->name = read_name(r);
+        break;
+    case EXPR_TUPLE:
+        expr->tuple.args = read_exprs(r, &expr->tuple.num_args);
+        break;
+    case EXPR_CAST:
+        expr->cast.type = read_typespec(r);
+        expr->cast.expr = read_expr(r);
+        break;
+    case EXPR_CALL:
+        expr->call.expr = read_expr(r);
+        expr->call.args = read_exprs(r, &expr->call.num_args);
+        break;
+    case EXPR_INDEX:
+        expr->index.expr = read_expr(r);
+        expr->index.index = read_expr(r);
+        break;
+    case EXPR_FIELD:
+        expr->field.expr = read_expr(r);
+        expr->field.name = read_name(r);
+        break;
+    case EXPR_UNARY:
+        expr->unary.op = read_u8(r);
+        expr->unary.expr = read_expr(r);
+        break;
+    case EXPR_BINARY:
+        expr->binary.op = read_u8(r);
+        expr->binary.left = read_expr(r);
+        expr->binary.right = read_expr(r);
+        break;
+    case EXPR_TERNARY:
+        expr->ternary.cond = read_expr(r);
+        expr->ternary.then_expr = read_expr(r);
+        expr->ternary.else_expr = read_expr(r);
+        break;
+    case EXPR_MODIFY:
+        expr->modify.op = read_u8(r);
+        expr->modify.post = read_u8(r);
+        expr->modify.expr = read_expr(r);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        expr->sizeof_expr = read_expr(r);
+        break;
+    case EXPR_SIZEOF_TYPE:
+        expr->sizeof_type = read_typespec(r);
+        break;
+    case EXPR_TYPEOF_EXPR:
+        expr->typeof_expr = read_expr(r);
+        break;
+    case EXPR_TYPEOF_TYPE:
+        expr->typeof_type = read_typespec(r);
+        break;
+    case EXPR_ALIGNOF_EXPR:
+        expr->alignof_expr = read_expr(r);
+        break;
+    case EXPR_ALIGNOF_TYPE:
+        expr->alignof_type = read_typespec(r);
+        break;
+    case EXPR_OFFSETOF:
+        expr->offsetof_field.type = read_typespec(r);
+        expr->offsetof_field.name = read_name(r);
+        break;
+    case EXPR_NEW:
+        expr->new_expr.alloc = read_expr(r);
+        expr->new_expr.len = read_expr(r);
+        expr->new_expr.arg = read_expr(r);
+        break;
+    default:
+        break;
+    }
+    return expr;
+}
+
+static StmtList
+read_stmt_list(CacheReader *r) {
+    SrcPos pos = read_pos(r);
+    size_t n = read_count(r);
+    Stmt **stmts = n ? ast_alloc(n * sizeof(Stmt *)) : NULL;
+    for (size_t i = 0; i < n; i++) {
+        stmts[i] = read_stmt(r);
+    }
+    return (StmtList){pos, stmts, n};
+}
+
+static Stmt *
+read_stmt(CacheReader *r) {
+    uint8_t tag = read_u8(r);
+    if (!tag || tag - 1 > STMT_ERROR) {
+        r->failed |= tag != 0;
+        return NULL;
+    }
+    StmtKind kind = tag - 1;
+    SrcPos pos = read_pos(r);
+    Stmt *stmt = new_stmt(kind, pos);
+    switch (kind) {
+    case STMT_RETURN:
+    case STMT_EXPR:
+        stmt->expr = read_expr(r);
+        break;
+    case STMT_BLOCK:
+        stmt->block = read_stmt_list(r);
+        break;
+    case STMT_IF: {
+        stmt->if_stmt.cond = read_expr(r);
+        stmt->if_stmt.then_block = read_stmt_list(r);
+        size_t n = read_count(r);
+        stmt->if_stmt.elseifs = n ? ast_alloc(n * sizeof(ElseIf)) : NULL;
+        for (size_t i = 0; i < n; i++) {
+            stmt->if_stmt.elseifs[i].cond = read_expr(r);
+            stmt->if_stmt.elseifs[i].block = read_stmt_list(r);
+        }
+        stmt->if_stmt.num_elseifs = n;
+        stmt->if_stmt.else_block = read_stmt_list(r);
+        break;
+    }
+    case STMT_WHILE:
+        stmt->while_stmt.cond = read_expr(r);
+        stmt->while_stmt.block = read_stmt_list(r);
+        break;
+    case STMT_FOR:
+        stmt->for_stmt.init = read_stmt(r);
+        stmt->for_stmt.cond = read_expr(r);
+        stmt->for_stmt.next = read_stmt(r);
+        stmt->for_stmt.block = read_stmt_list(r);
+        break;
+    case STMT_ASSIGN:
+        stmt->assign.op = read_u8(r);
+        stmt->assign.left = read_expr(r);
+        stmt->assign.right = read_expr(r);
+        break;
+    case STMT_INIT:
+        stmt->init.name = read_name(r);
+        stmt->init.type = read_typespec(r);
+        stmt->init.expr = read_expr(r);
+        break;
+    case STMT_SWITCH: {
+        stmt->switch_stmt.expr = read_expr(r);
+        size_t n = read_count(r);
+        stmt->switch_stmt.cases = n ? ast_alloc(n * sizeof(SwitchCase)) : NULL;
+        stmt->switch_stmt.num_cases = n;
+        for (size_t i = 0; i < n && !r->failed; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            c->pos = read_pos(r);
+            c->is_default = read_u8(r);
+            c->num_patterns = read_count(r);
+            c->patterns = c->num_patterns ? ast_alloc(c->num_patterns * sizeof(Expr *)) : NULL;
+            for (size_t j = 0; j < c->num_patterns; j++) {
+                c->patterns[j] = read_expr(r);
+            }
+            c->block = read_stmt_list(r);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+    return stmt;
+}
+
+static Aggregate *
+read_aggregate(CacheReader *r) {
+    Aggregate *aggregate = ast_alloc(sizeof(Aggregate));
+    aggregate->pos = read_pos(r);
+    aggregate->kind = read_u8(r);
+    size_t n = read_count(r);
+    aggregate->items = n ? ast_alloc(n * sizeof(AggregateItem)) : NULL;
+    aggregate->num_items = n;
+    for (size_t i = 0; i < n && !r->failed; i++) {
+        AggregateItem *item = &aggregate->items[i];
+        item->pos = read_pos(r);
+        item->kind = read_u8(r);
+        if (item->kind == AGGREGATE_ITEM_FIELD) {
+            item->names = read_names(r, &item->num_names);
+            item->type = read_typespec(r);
+        } else if (item->kind == AGGREGATE_ITEM_SUBAGGREGATE) {
+            item->subaggregate = read_aggregate(r);
+        }
+    }
+    return aggregate;
+}
+
+static Decl *
+read_decl(CacheReader *r) {
+    uint8_t tag = read_u8(r);
+    if (!tag || tag - 1 > DECL_ERROR) {
+        r->failed = true;
+        return NULL;
+    }
+    DeclKind kind = tag - 1;
+    SrcPos pos = read_pos(r);
+    Decl *decl = new_decl(kind, pos, read_name(r));
+    decl->notes.num_notes = read_count(r);
+    decl->notes.notes = decl->notes.num_notes ? ast_alloc(decl->notes.num_notes * sizeof(Note)) : NULL;
+    for (size_t i = 0; i < decl->notes.num_notes; i++) {
+        decl->notes.notes[i].pos = read_pos(r);
+        decl->notes.notes[i].name = read_name(r);
+    }
+    switch (kind) {
+    case DECL_FUNC: {
+        size_t num_generics = read_count(r);
+        decl->fn.generics = num_generics ? ast_alloc(num_generics * sizeof(GenericParam)) : NULL;
+        for (size_t i = 0; i < num_generics; i++) {
+            decl->fn.generics[i].pos = read_pos(r);
+            decl->fn.generics[i].is_const = read_u8(r);
+            decl->fn.generics[i].name = read_name(r);
+            decl->fn.generics[i].type = read_typespec(r);
+        }
+        decl->fn.num_generics = num_generics;
+        size_t n = read_count(r);
+        decl->fn.params = n ? ast_alloc(n * sizeof(FuncParam)) : NULL;
+        for (size_t i = 0; i < n; i++) {
+            decl->fn.params[i].pos = read_pos(r);
+            decl->fn.params[i].name = read_name(r);
+            decl->fn.params[i].type = read_typespec(r);
+        }
+        decl->fn.num_params = n;
+        decl->fn.ret_type = read_typespec(r);
+        decl->fn.has_varargs = read_u8(r);
+        decl->fn.varargs_type = read_typespec(r);
+        decl->fn.block = read_stmt_list(r);
+        break;
+    }
+    case DECL_VAR:
+        decl->var.type = read_typespec(r);
+        decl->var.expr = read_expr(r);
+        break;
+    case DECL_CONST:
+        decl->const_decl.type = read_typespec(r);
+        decl->const_decl.expr = read_expr(r);
+        break;
+    case DECL_TYPEDEF:
+        decl->typedef_decl.type = read_typespec(r);
+        break;
+    case DECL_ENUM:
+        decl->enum_decl.type = read_typespec(r);
+        decl->enum_decl.num_items = read_count(r);
+        decl->enum_decl.items = decl->enum_decl.num_items ? ast_alloc(decl->enum_decl.num_items * sizeof(EnumItem)) : NULL;
+        for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+            decl->enum_decl.items[i].pos = read_pos(r);
+            decl->enum_decl.items[i].name = read_name(r);
+            decl->enum_decl.items[i].value = (long long)read_u64(r);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        decl->aggregate = read_aggregate(r);
+        break;
+    case DECL_IMPORT:
+        decl->import.is_relative = read_u8(r);
+        decl->import.names = read_names(r, &decl->import.num_names);
+        decl->import.import_all = read_u8(r);
+        decl->import.num_items = read_count(r);
+        decl->import.items = decl->import.num_items ? ast_alloc(decl->import.num_items * sizeof(ImportItem)) : NULL;
+        for (size_t i = 0; i < decl->import.num_items; i++) {
+            decl->import.items[i].name = read_name(r);
+            decl->import.items[i].rename = read_name(r);
+        }
+        break;
+    default:
+        break;
+    }
+    return decl;
+}
+
+static Error
+read_error(CacheReader *r) {
+    Error err = {0};
+    err.kind = read_u8(r);
+    if (err.kind > ERROR_MESSAGE) {
+        r->failed = true;
+        return err;
+    }
+    err.pos = read_pos(r);
+    err.corrected = read_u8(r);
+    err.is_warning = read_u8(r);
+    err.found = read_str(r, &error_arena);
+    err.found_text = read_str(r, &error_arena);
+    err.found_len = read_u32(r);
+    switch (err.kind) {
+    case ERROR_EXPECTED:
+        err.expected.expected_token = read_u8(r);
+        err.expected.found_token = read_u8(r);
+        err.expected.replaced = read_u8(r);
+        break;
+    case ERROR_UNEXPECTED:
+        err.unexpected.found_token = read_u8(r);
+        err.unexpected.context = read_str(r, &error_arena);
+        break;
+    case ERROR_MESSAGE:
+        err.message = read_str(r, &error_arena);
+        break;
+    default:
+        break;
+    }
+    return err;
+}
+
+// Points section at the section tagged tag in the blob in buf, after checking
+// the header. False if the blob is damaged or has no such section.
+static bool
+cache_find_section(const char *buf, size_t len, uint32_t tag, CacheReader *section) {
+    CacheReader r = {buf, buf + len};
+    bool ok = read_u32(&r) == CACHE_MAGIC && read_u32(&r) == CACHE_FORMAT_VERSION;
+    section->ptr = NULL;
+    while (ok && r.ptr < r.end) {
+        uint32_t section_tag = read_u32(&r);
+        uint64_t size = read_u64(&r);
+        if (r.failed || size > (uint64_t)(r.end - r.ptr)) {
+            return false;
+        }
+        if (section_tag == tag) {
+            section->ptr = r.ptr;
+            section->end = r.ptr + size;
+        }
+        r.ptr += size;
+    }
+    return ok && section->ptr;
+}
+
+// Reads a section's name table, interning every name. The caller frees the
+// table with buf_free(r->names).
+static void
+read_name_table(CacheReader *r) {
+    const char **names = NULL;
+    size_t num_names = read_count(r);
+    for (size_t i = 0; i < num_names && !r->failed; i++) {
+        uint32_t n = read_u32(r);
+        if (read_check(r, n)) {
+            buf_push(names, str_intern_range(r->ptr, r->ptr + n));
+            r->ptr += n;
+        }
+    }
+    r->names = names;
+    r->num_names = buf_len(names);
+}
+
+// Writes a blob of one section: the name table used by body, then body.
+static void
+cache_write_section(const char *path, uint32_t tag, CacheWriter *body) {
+    CacheWriter table = {0};
+    write_u32(&table, (uint32_t)buf_len(body->names));
+    for (size_t i = 0; i < buf_len(body->names); i++) {
+        write_str(&table, body->names[i]);
+    }
+    CacheWriter out = {0};
+    buf_fit(out.buf, buf_len(table.buf) + buf_len(body->buf) + 32);
+    write_u32(&out, CACHE_MAGIC);
+    write_u32(&out, CACHE_FORMAT_VERSION);
+    write_u32(&out, tag);
+    write_u64(&out, buf_len(table.buf) + buf_len(body->buf));
+    write_raw(&out, table.buf, buf_len(table.buf));
+    write_raw(&out, body->buf, buf_len(body->buf));
+    cache_write_atomic(path, out.buf, buf_len(out.buf));
+    buf_free(out.buf);
+    buf_free(table.buf);
+}
+
+// Loads the parse result stored under content_key, with every position in
+// file name. The errors are recorded as if the file had just been parsed and
+// handed back in *errors.
+static bool
+cache_load_blob(uint64_t content_key, const char *name, Decls **decls, Error **errors_out) {
+    char *path = cache_path(content_key, "ast");
+    size_t len;
+    char *buf = cache_read(path, &len);
+    free(path);
+    if (!buf) {
+        return false;
+    }
+    CacheReader section = {0};
+    bool ok = cache_find_section(buf, len, CACHE_SECTION_PARSE, &section);
+    section.name = name;
+    Decl **decl_list = NULL;
+    Error *error_list = NULL;
+    if (ok) {
+        read_name_table(&section);
+        size_t num_decls = read_count(&section);
+        for (size_t i = 0; i < num_decls && !section.failed; i++) {
+            buf_push(decl_list, read_decl(&section));
+        }
+        size_t num_errors = read_count(&section);
+        for (size_t i = 0; i < num_errors && !section.failed; i++) {
+            buf_push(error_list, read_error(&section));
+        }
+        ok = !section.failed;
+    }
+    free(buf);
+    if (ok) {
+        for (Error *it = error_list; it != buf_end(error_list); it++) {
+            record_error(*it);
+        }
+        *decls = new_decls(decl_list, buf_len(decl_list));
+        *errors_out = errors;
+        errors = NULL;
+    }
+    buf_free(error_list);
+    buf_free(decl_list);
+    buf_free(section.names);
+    return ok;
+}
+
+static bool
+cache_load_index(uint64_t stat_key, uint64_t *content_key) {
+    char *path = cache_path(stat_key, "idx");
+    size_t len;
+    char *buf = cache_read(path, &len);
+    free(path);
+    if (!buf) {
+        return false;
+    }
+    CacheReader r = {buf, buf + len};
+    bool ok = read_u32(&r) == CACHE_MAGIC;
+    *content_key = read_u64(&r);
+    ok = ok && !r.failed;
+    free(buf);
+    return ok;
+}
+
+static void
+cache_store_index(uint64_t stat_key, uint64_t content_key) {
+    CacheWriter out = {0};
+    write_u32(&out, CACHE_MAGIC);
+    write_u64(&out, content_key);
+    char *path = cache_path(stat_key, "idx");
+    cache_write_atomic(path, out.buf, buf_len(out.buf));
+    free(path);
+    buf_free(out.buf);
+}
+
+static void
+cache_store_blob(uint64_t content_key, Decls *decls, Error *file_errors, size_t num_errors) {
+    CacheWriter body = {0};
+    write_u32(&body, (uint32_t)decls->num_decls);
+    for (size_t i = 0; i < decls->num_decls; i++) {
+        write_decl(&body, decls->decls[i]);
+    }
+    write_u32(&body, (uint32_t)num_errors);
+    for (size_t i = 0; i < num_errors; i++) {
+        write_error(&body, &file_errors[i]);
+    }
+    char *path = cache_path(content_key, "ast");
+    cache_write_section(path, CACHE_SECTION_PARSE, &body);
+    free(path);
+    buf_free(body.buf);
+    buf_free(body.names);
+    map_free(&body.name_indices);
+}
+
+// Puts the const values stored under const_key in the const cache, for the
+// module whose Decls are decls. Nothing is added unless the whole blob reads
+// back, so a damaged one just means evaluating again.
+static bool
+cache_load_consts(uint64_t const_key, Decls *decls) {
+    char *path = cache_path(const_key, "val");
+    size_t len;
+    char *buf = cache_read(path, &len);
+    free(path);
+    if (!buf) {
+        return false;
+    }
+    CacheReader r = {0};
+    bool ok = cache_find_section(buf, len, CACHE_SECTION_CONSTS, &r);
+    ConstValue *values = NULL;
+    const char ***value_args = NULL;
+    if (ok) {
+        read_name_table(&r);
+        size_t num_values = read_count(&r);
+        for (size_t i = 0; i < num_values && !r.failed; i++) {
+            uint32_t index = read_u32(&r);
+            ConstValue value = {0};
+            if (index < decls->num_decls && decls->decls[index]->kind == DECL_CONST) {
+                value.decl = decls->decls[index];
+            } else {
+                r.failed = true;
+            }
+            size_t num_args = read_count(&r);
+            const char **args = NULL;
+            for (size_t j = 0; j < num_args; j++) {
+                buf_push(args, read_name(&r));
+            }
+            value.num_args = num_args;
+            value.type = read_u8(&r);
+            value.val.ull = read_u64(&r);
+            if (value.type == BC_VOID || value.type >= NUM_BC_TYPES) {
+                r.failed = true;
+            }
+            buf_push(values, value);
+            buf_push(value_args, args);
+        }
+        ok = !r.failed;
+    }
+    free(buf);
+    for (size_t i = 0; i < buf_len(values); i++) {
+        if (ok) {
+            ConstValue *value = const_cache_get(values[i].decl, value_args[i], values[i].num_args);
+            value->val = values[i].val;
+            value->type = values[i].type;
+            value->state = CONST_EVALUATED;
+        }
+        buf_free(value_args[i]);
+    }
+    STATS_ADD(consts_loaded, ok ? buf_len(values) : 0);
+    buf_free(values);
+    buf_free(value_args);
+    buf_free(r.names);
+    return ok;
+}
+
+// Stores the evaluated consts of the module whose Decls are decls.
+static void
+cache_store_consts(uint64_t const_key, Decls *decls) {
+    CacheWriter body = {0};
+    ConstValue **values = NULL;
+    uint32_t *indices = NULL;
+    for (size_t i = 0; i < decls->num_decls; i++) {
+        if (decls->decls[i]->kind != DECL_CONST) {
+            continue;
+        }
+        ConstValue *value = const_cache_get(decls->decls[i], NULL, 0);
+        if (value->state == CONST_EVALUATED) {
+            buf_push(values, value);
+            buf_push(indices, (uint32_t)i);
+        }
+    }
+    write_u32(&body, (uint32_t)buf_len(values));
+    for (size_t i = 0; i < buf_len(values); i++) {
+        ConstValue *value = values[i];
+        write_u32(&body, indices[i]);
+        write_names(&body, value->args, value->num_args);
+        write_u8(&body, value->type);
+        write_u64(&body, value->val.ull);
+    }
+    char *path = cache_path(const_key, "val");
+    cache_write_section(path, CACHE_SECTION_CONSTS, &body);
+    free(path);
+    buf_free(values);
+    buf_free(indices);
+    buf_free(body.buf);
+    buf_free(body.names);
+    map_free(&body.name_indices);
+}
+
+typedef struct CacheEntry {
+    char *path;
+    FileStat stat;
+} CacheEntry;
+
+static int
+compare_cache_entries(const void *a, const void *b) {
+    const CacheEntry *x = a;
+    const CacheEntry *y = b;
+    return x->stat.mtime_ns < y->stat.mtime_ns ? -1 : x->stat.mtime_ns > y->stat.mtime_ns;
+}
+
+// Whether a directory entry is one of the cache's, rather than a file someone
+// else put there or one being written.
+static bool
+is_cache_entry(const char *name) {
+    const char *ext = strrchr(name, '.');
+    return ext && (strcmp(ext, ".ast") == 0 || strcmp(ext, ".idx") == 0 || strcmp(ext, ".val") == 0);
+}
+
+// Keeps the directory under flag_cache_size_mb by removing the entries used
+// least recently, which reading one marks, until it is back to three quarters
+// of the limit, so it isn't trimmed on every run.
+static void
+cache_evict(void) {
+    uint64_t limit = (uint64_t)flag_cache_size_mb * 1024 * 1024;
+    char **names = os_list_dir(flag_cache_dir);
+    CacheEntry *entries = NULL;
+    uint64_t total = 0;
+    for (size_t i = 0; i < buf_len(names); i++) {
+        if (!is_cache_entry(names[i])) {
+            free(names[i]);
+            continue;
+        }
+        CacheEntry entry = {strf("%s/%s", flag_cache_dir, names[i])};
+        if (os_stat(entry.path, &entry.stat)) {
+            buf_push(entries, entry);
+            total += entry.stat.size;
+        } else {
+            free(entry.path);
+        }
+        free(names[i]);
+    }
+    buf_free(names);
+    if (total > limit) {
+        qsort(entries, buf_len(entries), sizeof(CacheEntry), compare_cache_entries);
+        for (size_t i = 0; i < buf_len(entries) && total > limit / 4 * 3; i++) {
+            if (remove(entries[i].path) == 0) {
+                total -= entries[i].stat.size;
+            }
+        }
+    }
+    for (size_t i = 0; i < buf_len(entries); i++) {
+        free(entries[i].path);
+    }
+    buf_free(entries);
+}
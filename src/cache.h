@@ -0,0 +1,86 @@
+#pragma once
+
+#include "stdafx.h"
+#include "os.h"
+#include "common.h"
+#include "error.h"
+#include "lex.h"
+#include "ast.h"
+
+// On-disk compilation cache, enabled with --cache-dir. Results are stored in
+// content-addressed blobs named by hash(source bytes, compiler version,
+// options), so identical files share one blob. Next to them, small index
+// entries named by hash(absolute path, size, mtime, version, options) record
+// which blob a file had, so an untouched file is found from one stat without
+// reading or lexing it. Files are written to a temporary name and renamed
+// into place, so readers never see a partial file, and the directory is
+// trimmed back below --cache-size by dropping the oldest files first.
+//
+// A blob is a header followed by tagged sections, so later passes can add
+// their artifacts next to the parse result:
+//     u32 magic, u32 format version, { u32 tag, u64 size, bytes }*
+// The parse section holds a table of the names used, then the Decls and then
+// the syntax errors.
+//
+// The values of a module's consts go in a blob of their own, since they also
+// depend on the modules it imports. Its key mixes the module's content key
+// with the const keys of its imports, so changing any module reevaluates
+// everything that depends on it. The consts section holds the interned
+// generic arguments as a name table, then for each value the index of its
+// Decl in the file, its arguments, its BcType and its bits.
+
+#define CACHE_MAGIC 0x43535243 // "CRSC"
+#define CACHE_FORMAT_VERSION 8
+#define COMPILER_VERSION "crust 0.1"
+
+typedef enum CacheSection {
+    CACHE_SECTION_NONE,
+    // the Decls and syntax errors of one file
+    CACHE_SECTION_PARSE,
+    // evaluated consts of one module
+    CACHE_SECTION_CONSTS,
+} CacheSection;
+
+typedef struct CacheWriter {
+    char *buf;
+    // the name table, and index + 1 of each name in it
+    const char **names;
+    Map name_indices;
+} CacheWriter;
+
+typedef struct CacheReader {
+    const char *ptr;
+    const char *end;
+    // file name for every SrcPos read
+    const char *name;
+    const char **names;
+    size_t num_names;
+    bool failed;
+} CacheReader;
+
+static uint64_t cache_options_hash(void);
+static uint64_t cache_stat_key(const char *path);
+static uint64_t cache_content_key(const char *buf, size_t len);
+static char *cache_path(uint64_t key, const char *ext);
+static bool cache_write_atomic(const char *path, const char *buf, size_t len);
+static bool cache_load_blob(uint64_t content_key, const char *name, Decls **decls, Error **errors);
+static bool cache_load_index(uint64_t stat_key, uint64_t *content_key);
+static void cache_store_index(uint64_t stat_key, uint64_t content_key);
+static void cache_store_blob(uint64_t content_key, Decls *decls, Error *file_errors, size_t num_errors);
+static bool cache_load_consts(uint64_t const_key, Decls *decls);
+static void cache_store_consts(uint64_t const_key, Decls *decls);
+static void cache_evict(void);
+
+static void write_typespec(CacheWriter *w, Typespec *type);
+static void write_expr(CacheWriter *w, Expr *expr);
+static void write_stmt_list(CacheWriter *w, StmtList *block);
+static void write_stmt(CacheWriter *w, Stmt *stmt);
+static void write_decl(CacheWriter *w, Decl *decl);
+static void write_error(CacheWriter *w, Error *err);
+
+static Typespec *read_typespec(CacheReader *r);
+static Expr *read_expr(CacheReader *r);
+static StmtList read_stmt_list(CacheReader *r);
+static Stmt *read_stmt(CacheReader *r);
+static Decl *read_decl(CacheReader *r);
+static Error read_error(CacheReader *r);
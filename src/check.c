@@ -0,0 +1,1925 @@
+#include "check.h"
+
+static TypeShard type_shards[TYPE_SHARDS];
+static Type type_unknown = {.kind = TYPE_UNKNOWN, .name = "unknown"};
+static Type type_scalars[NUM_BC_TYPES];
+// by lane type and then 16, 32 or 64 bytes
+static Type type_vectors[NUM_BC_TYPES][3];
+// not interned, since the C backend takes an interned vector name to mean
+// the vector type is used
+static char type_vector_names[NUM_BC_TYPES][3][8];
+
+// Filled by the sequential pass and only read while bodies are checked.
+static Map check_fn_types;
+static Map check_var_types;
+// decl to the ModuleScope of its module
+static Map check_decl_scopes;
+// With lazy fn bodies: the fns reached so far, a batch for each, and the pool
+// reached fns go on once the bodies are being checked.
+static CheckReachShard check_reach_shards[CHECK_REACH_SHARDS];
+static Mutex check_reach_mutex;
+static CheckBatch **check_reach_batches;
+static Pool *check_reach_pool;
+
+static void
+check_reach_init(void) {
+    for (size_t i = 0; i < CHECK_REACH_SHARDS; i++) {
+        check_reach_shards[i].mutex = (Mutex)MUTEX_INIT;
+    }
+    check_reach_mutex = (Mutex)MUTEX_INIT;
+}
+
+static void
+type_init(void) {
+    for (size_t i = 0; i < TYPE_SHARDS; i++) {
+        type_shards[i].mutex = (Mutex)MUTEX_INIT;
+    }
+    for (BcType scalar = BC_VOID; scalar < NUM_BC_TYPES; scalar++) {
+        type_scalars[scalar] = (Type){.kind = TYPE_SCALAR, .scalar = scalar, .name = bc_type_names[scalar]};
+    }
+    for (BcType lane = BC_I8; lane < NUM_BC_TYPES; lane++) {
+        for (int size = 0; size < 3; size++) {
+            int num_lanes = (16 << size) * 8 / bc_type_bits(lane);
+            char *name = type_vector_names[lane][size];
+            snprintf(name, sizeof(type_vector_names[lane][size]), "%sx%d", bc_type_names[lane], num_lanes);
+            type_vectors[lane][size] = (Type){
+                .kind = TYPE_VECTOR,
+                .scalar = lane,
+                .base = &type_scalars[lane],
+                .num_elems = num_lanes,
+                .name = name,
+            };
+        }
+    }
+}
+
+static Type *
+type_scalar(BcType scalar) {
+    return &type_scalars[scalar];
+}
+
+static bool
+type_is_scalar(Type *type, BcType scalar) {
+    return type->kind == TYPE_SCALAR && type->scalar == scalar;
+}
+
+// A number, bool or enum, which C converts between freely.
+static bool
+type_is_arithmetic(Type *type) {
+    return (type->kind == TYPE_SCALAR && type->scalar != BC_VOID) || type->kind == TYPE_ENUM;
+}
+
+static bool
+type_is_integer(Type *type) {
+    return type_is_arithmetic(type) && !bc_is_float(type->scalar);
+}
+
+// Arrays are used as a pointer to their first element.
+static bool
+type_is_ptr(Type *type) {
+    return type->kind == TYPE_PTR || type->kind == TYPE_ARRAY;
+}
+
+// Whether a type hasn't been decided, so nothing can be said about it.
+static bool
+type_is_open(Type *type) {
+    return type->kind == TYPE_UNKNOWN || type->kind == TYPE_GENERIC;
+}
+
+static Type *
+type_vector_named(const char *name) {
+    for (BcType lane = BC_I8; lane < NUM_BC_TYPES; lane++) {
+        for (int size = 0; size < 3; size++) {
+            if (strcmp(type_vectors[lane][size].name, name) == 0) {
+                return &type_vectors[lane][size];
+            }
+        }
+    }
+    return NULL;
+}
+
+// The signed integer vector of the same shape, which comparisons give.
+static Type *
+type_vector_mask(Type *vector) {
+    int bits = bc_type_bits(vector->scalar);
+    BcType lane = bits == 8 ? BC_I8 : bits == 16 ? BC_I16 : bits == 32 ? BC_I32 : BC_I64;
+    int size = 0;
+    while (type_vectors[lane][size].num_elems != vector->num_elems) {
+        size++;
+    }
+    return &type_vectors[lane][size];
+}
+
+// Finds or adds the type made of key's parts.
+static Type *
+type_intern(Type *key) {
+    uint64_t hash = hash_mix(hash_mix(hash_uint64(key->kind), hash_ptr(key->base)), hash_mix(key->num_elems, hash_ptr(key->decl)));
+    for (size_t i = 0; i < key->num_params; i++) {
+        hash = hash_mix(hash, hash_ptr(key->params[i]));
+    }
+    hash |= 1;
+    TypeShard *shard = &type_shards[hash % TYPE_SHARDS];
+    mutex_lock(&shard->mutex);
+    Type *first = map_get_from_uint64(&shard->types, hash);
+    for (Type *it = first; it; it = it->next) {
+        if (it->kind == key->kind && it->base == key->base && it->num_elems == key->num_elems && it->decl == key->decl
+            && it->num_params == key->num_params && (!key->num_params || memcmp(it->params, key->params, key->num_params * sizeof(Type *)) == 0)) {
+            mutex_unlock(&shard->mutex);
+            return it;
+        }
+    }
+    Type *type = arena_alloc(&shard->arena, sizeof(Type));
+    *type = *key;
+    if (key->num_params) {
+        type->params = arena_alloc(&shard->arena, key->num_params * sizeof(Type *));
+        memcpy(type->params, key->params, key->num_params * sizeof(Type *));
+    }
+    char *name = NULL;
+    switch (key->kind) {
+    case TYPE_PTR:
+        buf_printf(name, "%s*", key->base->name);
+        break;
+    case TYPE_ARRAY:
+        buf_printf(name, "%s[%u]", key->base->name, key->num_elems);
+        break;
+    case TYPE_FUNC:
+        buf_printf(name, "fn(");
+        for (size_t i = 0; i < key->num_params; i++) {
+            buf_printf(name, "%s%s", i ? ", " : "", key->params[i]->name);
+        }
+        buf_printf(name, type_is_scalar(key->base, BC_VOID) ? ")" : ") -> %s", key->base->name);
+        break;
+    case TYPE_GENERIC:
+        buf_printf(name, "%s", key->decl->fn.generics[key->num_elems].name);
+        break;
+    default:
+        buf_printf(name, "%s", key->decl->name);
+        break;
+    }
+    type->name = str_intern(name);
+    buf_free(name);
+    type->next = first;
+    map_put_from_uint64(&shard->types, hash, type);
+    mutex_unlock(&shard->mutex);
+    return type;
+}
+
+static Type *
+type_ptr(Type *base) {
+    return type_intern(&(Type){.kind = TYPE_PTR, .base = base});
+}
+
+static Type *
+type_array(Type *base, u32 num_elems) {
+    return type_intern(&(Type){.kind = TYPE_ARRAY, .base = base, .num_elems = num_elems});
+}
+
+static Type *
+type_func(Type **params, size_t num_params, Type *ret) {
+    return type_intern(&(Type){.kind = TYPE_FUNC, .base = ret, .params = params, .num_params = num_params});
+}
+
+static Type *
+type_generic(Decl *decl, u32 index) {
+    return type_intern(&(Type){.kind = TYPE_GENERIC, .decl = decl, .num_elems = index});
+}
+
+// type with the generic params of decl replaced by bindings, where known.
+// An enum with a base that isn't an integer type has been reported, and is
+// taken to be an i32.
+static BcType
+type_enum_base(Decl *decl) {
+    BcType base = decl->enum_decl.type ? bc_type_from_typespec(NULL, decl->enum_decl.type) : BC_I32;
+    return base < NUM_BC_TYPES && base > BC_BOOL && !bc_is_float(base) ? base : BC_I32;
+}
+
+static Type *
+type_enum(Decl *decl) {
+    return type_intern(&(Type){.kind = TYPE_ENUM, .scalar = type_enum_base(decl), .decl = decl, .name = decl->name});
+}
+
+static Type *
+type_subst(Type *type, Decl *decl, Type **bindings) {
+    switch (type->kind) {
+    case TYPE_GENERIC:
+        return type->decl == decl && bindings[type->num_elems] ? bindings[type->num_elems] : type;
+    case TYPE_PTR:
+        return type_ptr(type_subst(type->base, decl, bindings));
+    case TYPE_ARRAY:
+        return type_array(type_subst(type->base, decl, bindings), type->num_elems);
+    default:
+        return type;
+    }
+}
+
+// Types
+
+static Decl *
+check_find_decl(ModuleScope *scope, const char *name) {
+    Decl *decl = map_get(&scope->decls, name);
+    if (!decl) {
+        decl = map_get(&scope->imports, name);
+    }
+    if (flag_lazy_fn_bodies && decl && decl->kind == DECL_FUNC) {
+        check_reach(decl);
+    }
+    return decl;
+}
+
+static CheckLocal *
+check_find_local(Checker *c, const char *name) {
+    for (size_t i = buf_len(c->locals); i > 0; i--) {
+        if (c->locals[i - 1].name == name) {
+            return &c->locals[i - 1];
+        }
+    }
+    return NULL;
+}
+
+// The value of an integer literal or const, like array sizes and lane indices
+// must be.
+static bool
+check_const_int(Checker *c, Expr *expr, long long *value) {
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    Val val;
+    if (expr->kind == EXPR_INT) {
+        if (bc_literal(expr, &val) == BC_VOID) {
+            return false;
+        }
+        *value = val.ll;
+        return true;
+    }
+    if (expr->kind != EXPR_NAME || check_find_local(c, expr->name)) {
+        return false;
+    }
+    Decl *decl = check_find_decl(c->scope, expr->name);
+    if (!decl || decl->kind != DECL_CONST) {
+        return false;
+    }
+    ConstValue *const_value = const_cache_get(decl, NULL, 0);
+    if (const_value->state != CONST_EVALUATED || const_value->type == BC_BOOL || bc_is_float(const_value->type)) {
+        return false;
+    }
+    *value = const_value->val.ll;
+    return true;
+}
+
+// Typedefs nest at most this deep, which also ends cycles.
+#define MAX_TYPEDEF_DEPTH 64
+
+static Type *check_typespec_at(Checker *c, Typespec *type, bool decay, int depth);
+
+static Type *
+check_type_name(Checker *c, Typespec *type, int depth) {
+    if (type->num_names != 1) {
+        return &type_unknown;
+    }
+    const char *name = type->names[0];
+    Decl *fn = c->decl;
+    for (size_t i = 0; fn && i < fn->fn.num_generics; i++) {
+        if (fn->fn.generics[i].name == name) {
+            return fn->fn.generics[i].is_const ? &type_unknown : type_generic(fn, (u32)i);
+        }
+    }
+    for (BcType scalar = BC_VOID; scalar < NUM_BC_TYPES; scalar++) {
+        if (strcmp(name, bc_type_names[scalar]) == 0) {
+            return &type_scalars[scalar];
+        }
+    }
+    Type *vector = type_vector_named(name);
+    if (vector) {
+        return vector;
+    }
+    Decl *decl = check_find_decl(c->scope, name);
+    int bits;
+    bool is_signed;
+    if (!decl && layout_bit_type(name, &bits, &is_signed)) {
+        error(type->pos, "'%s' can only be the type of a field", name);
+        return &type_unknown;
+    } else if (!decl) {
+        error(type->pos, "Unknown type '%s'", name);
+        return &type_unknown;
+    }
+    switch (decl->kind) {
+    case DECL_STRUCT:
+    case DECL_UNION:
+        return type_intern(&(Type){.kind = decl->kind == DECL_STRUCT ? TYPE_STRUCT : TYPE_UNION, .decl = decl});
+    case DECL_TYPEDEF: {
+        if (depth >= MAX_TYPEDEF_DEPTH) {
+            error(type->pos, "Type '%s' is defined in terms of itself", name);
+            return &type_unknown;
+        }
+        // in the scope it was declared in, outside any fn
+        Checker typedef_checker = {.scope = map_get(&check_decl_scopes, decl)};
+        if (!typedef_checker.scope) {
+            return &type_unknown;
+        }
+        return check_typespec_at(&typedef_checker, decl->typedef_decl.type, false, depth + 1);
+    }
+    case DECL_ENUM:
+        return type_enum(decl);
+    default:
+        error(type->pos, "'%s' is not a type", name);
+        return &type_unknown;
+    }
+}
+
+// What a Typespec means. With decay, as in a param, an array is a pointer to
+// its first element and its size is left unchecked, since it may be a generic
+// param's.
+static Type *
+check_typespec_at(Checker *c, Typespec *type, bool decay, int depth) {
+    if (!type) {
+        return &type_scalars[BC_VOID];
+    }
+    switch (type->kind) {
+    case TYPESPEC_NAME:
+        return check_type_name(c, type, depth);
+    case TYPESPEC_PTR: {
+        Type *base = check_typespec_at(c, type->base, false, depth);
+        return base->kind == TYPE_UNKNOWN ? base : type_ptr(base);
+    }
+    case TYPESPEC_ARRAY: {
+        Type *base = check_typespec_at(c, type->base, false, depth);
+        if (base->kind == TYPE_UNKNOWN) {
+            return base;
+        }
+        if (decay) {
+            return type_ptr(base);
+        }
+        long long num_elems;
+        if (!check_const_int(c, type->num_elems, &num_elems) || num_elems <= 0 || num_elems > UINT32_MAX) {
+            error(type->num_elems->pos, "Array size must be a positive integer constant");
+            return &type_unknown;
+        }
+        return type_array(base, (u32)num_elems);
+    }
+    case TYPESPEC_FUNC: {
+        Type *params[CHECK_MAX_PARAMS];
+        if (type->fn.num_args > CHECK_MAX_PARAMS || type->fn.has_varargs) {
+            return &type_unknown;
+        }
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            params[i] = check_typespec_at(c, type->fn.args[i], true, depth);
+        }
+        return type_func(params, type->fn.num_args, check_typespec_at(c, type->fn.ret, false, depth));
+    }
+    default:
+        return &type_unknown;
+    }
+}
+
+static Type *
+check_typespec(Checker *c, Typespec *type, bool decay) {
+    return check_typespec_at(c, type, decay, 0);
+}
+
+// The type of a fn as a value, with its generic params as types of their own.
+static Type *
+check_fn_type(Checker *c, Decl *decl) {
+    Type *params[CHECK_MAX_PARAMS];
+    if (decl->fn.num_params > CHECK_MAX_PARAMS) {
+        error(decl->pos, "'%s' has more than %d parameters", decl->name, CHECK_MAX_PARAMS);
+        return &type_unknown;
+    }
+    Checker fn_checker = {.scope = c->scope, .decl = decl};
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        params[i] = check_typespec(&fn_checker, decl->fn.params[i].type, true);
+    }
+    return type_func(params, decl->fn.num_params, check_typespec(&fn_checker, decl->fn.ret_type, false));
+}
+
+static Type *
+check_global_type(Decl *decl) {
+    switch (decl->kind) {
+    case DECL_CONST: {
+        ConstValue *value = const_cache_get(decl, NULL, 0);
+        return value->state == CONST_EVALUATED ? type_scalar(value->type) : &type_unknown;
+    }
+    case DECL_VAR: {
+        Type *type = map_get(&check_var_types, decl);
+        return type ? type : &type_unknown;
+    }
+    case DECL_FUNC: {
+        Type *type = map_get(&check_fn_types, decl);
+        return type ? type : &type_unknown;
+    }
+    default:
+        return &type_unknown;
+    }
+}
+
+// Expressions
+
+static bool
+check_convert(Checker *c, Expr *expr, Type *to, Type *from) {
+    (void)c;
+    if (to == from || type_is_open(to) || type_is_open(from)) {
+        return true;
+    }
+    bool ok;
+    switch (to->kind) {
+    case TYPE_SCALAR:
+        ok = to->scalar != BC_VOID && type_is_arithmetic(from);
+        break;
+    case TYPE_VECTOR:
+        ok = type_is_arithmetic(from) && !(bc_is_float(from->scalar) && !bc_is_float(to->scalar));
+        break;
+    case TYPE_ENUM:
+        // only from its own items, which are to
+        ok = false;
+        break;
+    case TYPE_PTR: {
+        Expr *value = expr;
+        while (value->kind == EXPR_PAREN) {
+            value = value->paren.expr;
+        }
+        // 0 is the null pointer, like in C
+        ok = (type_is_ptr(from) && (from->base == to->base || type_is_open(from->base) || type_is_open(to->base)))
+            || (value->kind == EXPR_INT && value->int_lit.val == 0);
+        break;
+    }
+    default:
+        ok = false;
+        break;
+    }
+    if (!ok) {
+        error(expr->pos, "Can't convert %s to %s", from->name, to->name);
+    }
+    return ok;
+}
+
+// The type of left op right when either is a vector, or NULL if op can't be
+// used on them.
+static Type *
+check_vector_binary(TokenKind op, Type *left, Type *right) {
+    Type *vector = left->kind == TYPE_VECTOR ? left : right;
+    Type *other = left->kind == TYPE_VECTOR ? right : left;
+    bool is_cmp = TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP;
+    bool float_op = op == TOKEN_ADD || op == TOKEN_SUB || op == TOKEN_MUL || op == TOKEN_DIV;
+    bool int_op = float_op || op == TOKEN_MOD || op == TOKEN_AND || op == TOKEN_OR || op == TOKEN_XOR || op == TOKEN_LSHIFT
+        || op == TOKEN_RSHIFT;
+    if (!is_cmp && !int_op) {
+        return NULL;
+    }
+    if (other->kind == TYPE_VECTOR ? other != vector
+                                   : !type_is_arithmetic(other) || (bc_is_float(other->scalar) && !bc_is_float(vector->scalar))) {
+        return NULL;
+    }
+    if (is_cmp) {
+        return type_vector_mask(vector);
+    }
+    return bc_is_float(vector->scalar) && !float_op ? NULL : vector;
+}
+
+// The type of left op right, or NULL if op can't be used on them.
+static Type *
+check_binary_types(TokenKind op, Type *left, Type *right) {
+    if (left->kind == TYPE_UNKNOWN || right->kind == TYPE_UNKNOWN) {
+        return &type_unknown;
+    }
+    bool is_cmp = TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP;
+    if (left->kind == TYPE_GENERIC || right->kind == TYPE_GENERIC) {
+        // a comparison of generics may be a bool or a mask
+        return is_cmp ? &type_unknown : left->kind == TYPE_GENERIC ? left : right;
+    }
+    if (left->kind == TYPE_VECTOR || right->kind == TYPE_VECTOR) {
+        return check_vector_binary(op, left, right);
+    }
+    if (op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+        return (type_is_arithmetic(left) || type_is_ptr(left)) && (type_is_arithmetic(right) || type_is_ptr(right))
+            ? type_scalar(BC_BOOL) : NULL;
+    }
+    if (type_is_ptr(left) || type_is_ptr(right)) {
+        // p + i, i + p, p - i and p - q, and comparisons of pointers, like in C
+        Type *ptr = type_is_ptr(left) ? type_ptr(left->base) : type_ptr(right->base);
+        if (is_cmp) {
+            return type_is_ptr(left) && type_is_ptr(right) && left->base == right->base ? type_scalar(BC_BOOL) : NULL;
+        }
+        if (op == TOKEN_ADD && (type_is_integer(left) || type_is_integer(right))) {
+            return ptr;
+        }
+        if (op == TOKEN_SUB && type_is_ptr(left)) {
+            if (type_is_integer(right)) {
+                return ptr;
+            }
+            return type_is_ptr(right) && left->base == right->base ? type_scalar(BC_I64) : NULL;
+        }
+        return NULL;
+    }
+    if (!type_is_arithmetic(left) || !type_is_arithmetic(right)) {
+        return NULL;
+    }
+    if (is_cmp) {
+        return type_scalar(BC_BOOL);
+    }
+    bool int_only = op == TOKEN_MOD || op == TOKEN_AND || op == TOKEN_OR || op == TOKEN_XOR || op == TOKEN_LSHIFT || op == TOKEN_RSHIFT;
+    if (int_only && (bc_is_float(left->scalar) || bc_is_float(right->scalar))) {
+        return NULL;
+    }
+    if (op == TOKEN_LSHIFT || op == TOKEN_RSHIFT) {
+        return type_scalar(bc_promote(left->scalar));
+    }
+    return type_scalar(bc_common_type(left->scalar, right->scalar));
+}
+
+static Type *
+check_binary(Checker *c, SrcPos pos, TokenKind op, Type *left, Type *right) {
+    (void)c;
+    Type *type = check_binary_types(op, left, right);
+    if (!type) {
+        error(pos, "Operator %s can't be used on %s and %s", token_kind_name(op), left->name, right->name);
+        return &type_unknown;
+    }
+    return type;
+}
+
+// Conditions are scalars or pointers. A vector would compile, but as the value
+// of its first lane.
+static void
+check_cond(Checker *c, Expr *cond) {
+    Type *type = check_expr(c, cond);
+    if (type->kind == TYPE_VECTOR) {
+        error(cond->pos, "A condition can't be %s; use any or all", type->name);
+    } else if (!type_is_open(type) && !type_is_ptr(type) && !type_is_arithmetic(type)) {
+        error(cond->pos, "A condition can't be %s", type->name);
+    }
+}
+
+static void
+check_args(Checker *c, Expr *call, size_t from) {
+    for (size_t i = from; i < call->call.num_args; i++) {
+        check_expr(c, call->call.args[i]);
+    }
+}
+
+// Whether type can't be a scalar operand: a vector, pointer, or no value.
+static bool
+check_is_composite(Type *type) {
+    return !type_is_open(type) && !type_is_arithmetic(type);
+}
+
+static bool
+check_is_generic_param(Decl *decl, Typespec *type) {
+    return type && type->kind == TYPESPEC_NAME && type->num_names == 1 && type->names[0] == decl->fn.generics[0].name;
+}
+
+// The fn given to map or reduce, which must be a fn<T> whose params and result
+// are all T.
+static Decl *
+check_kernel_fn(Checker *c, Expr *expr, const char *builtin) {
+    Decl *decl = NULL;
+    if (expr->kind == EXPR_NAME && !check_find_local(c, expr->name)) {
+        decl = check_find_decl(c->scope, expr->name);
+    }
+    bool ok = decl && decl->kind == DECL_FUNC && decl->fn.num_generics == 1 && !decl->fn.generics[0].is_const
+        && !decl->fn.has_varargs && check_is_generic_param(decl, decl->fn.ret_type);
+    for (size_t i = 0; ok && i < decl->fn.num_params; i++) {
+        ok = check_is_generic_param(decl, decl->fn.params[i].type);
+    }
+    if (!ok) {
+        error(expr->pos, "'%s' takes a fn<T> whose parameters and result are all T", builtin);
+        return NULL;
+    }
+    return decl;
+}
+
+// The element type of the arrays map and reduce go over, which must all point
+// to the same numbers, or NULL.
+static Type *
+check_kernel_arrays(Checker *c, Expr **arrays, Type **types, size_t num_arrays) {
+    (void)c;
+    Type *first = NULL;
+    for (size_t i = 0; i < num_arrays; i++) {
+        Type *type = types[i];
+        if (type_is_open(type)) {
+            return NULL;
+        }
+        if (!type_is_ptr(type) || !type_is_arithmetic(type->base) || type->base->scalar == BC_BOOL) {
+            error(arrays[i]->pos, "Expected a pointer to numbers, not %s", type->name);
+            return NULL;
+        }
+        if (first && type->base != first) {
+            error(arrays[i]->pos, "Expected %s* like the other arrays, not %s", first->name, type->name);
+            return NULL;
+        }
+        first = type->base;
+    }
+    return first;
+}
+
+static Type *
+check_map_reduce(Checker *c, Expr *call, const char *name, Type **arg_types) {
+    Expr **args = call->call.args;
+    size_t num_args = call->call.num_args;
+    bool is_map = name[0] == 'm';
+    if (num_args < 4) {
+        error(call->pos, is_map ? "'%s' takes a fn, the destination, the sources and the count"
+                                : "'%s' takes a fn, the initial value, the source and the count", name);
+        return &type_unknown;
+    }
+    Decl *fn = check_kernel_fn(c, args[0], name);
+    if (!fn) {
+        return &type_unknown;
+    }
+    size_t num_arrays = is_map ? 1 + fn->fn.num_params : 1;
+    if (!is_map && fn->fn.num_params != 2) {
+        error(args[0]->pos, "'%s' takes a fn of 2 parameters, not %zu", name, fn->fn.num_params);
+        return &type_unknown;
+    }
+    if (num_args != 2 + num_arrays + !is_map) {
+        error(call->pos, "'%s' of '%s' takes %zu arguments, not %zu", name, fn->name, 2 + num_arrays + !is_map, num_args);
+        return &type_unknown;
+    }
+    Type *elem = check_kernel_arrays(c, args + 1 + !is_map, arg_types + 1 + !is_map, num_arrays);
+    if (!elem) {
+        return &type_unknown;
+    }
+    Type *count = arg_types[num_args - 1];
+    if (!type_is_open(count) && (!type_is_integer(count) || type_is_scalar(count, BC_BOOL))) {
+        error(args[num_args - 1]->pos, "The count must be an integer, not %s", count->name);
+        return &type_unknown;
+    }
+    if (is_map) {
+        return type_scalar(BC_VOID);
+    }
+    if (check_is_composite(arg_types[1])) {
+        error(args[1]->pos, "Expected %s to start from, not %s", elem->name, arg_types[1]->name);
+        return &type_unknown;
+    }
+    return elem;
+}
+
+// The builtins, with the C backend's rules for their arguments.
+static Type *
+check_builtin_call(Checker *c, Expr *call, const char *name) {
+    Expr **args = call->call.args;
+    size_t num_args = call->call.num_args;
+    Type *arg_types[CHECK_MAX_PARAMS];
+    if (num_args > CHECK_MAX_PARAMS) {
+        check_args(c, call, 0);
+        return &type_unknown;
+    }
+    bool is_kernel = strcmp(name, "map") == 0 || strcmp(name, "reduce") == 0;
+    for (size_t i = 0; i < num_args; i++) {
+        // the fn map and reduce take is only a name, and not a value
+        arg_types[i] = is_kernel && i == 0 ? &type_unknown : check_expr(c, args[i]);
+    }
+    if (is_kernel) {
+        return check_map_reduce(c, call, name, arg_types);
+    }
+    Type *vector = type_vector_named(name);
+    if (vector) {
+        if (num_args != 1 && num_args != vector->num_elems) {
+            error(call->pos, "'%s' takes 1 or %u arguments, not %zu", name, vector->num_elems, num_args);
+            return vector;
+        }
+        for (size_t i = 0; i < num_args; i++) {
+            if (check_is_composite(arg_types[i])) {
+                error(args[i]->pos, "Lanes of %s can't be %s", vector->name, arg_types[i]->name);
+                break;
+            }
+        }
+        return vector;
+    }
+    if (strcmp(name, "select") == 0) {
+        if (num_args != 3) {
+            error(call->pos, "'%s' takes 3 arguments, not %zu", name, num_args);
+            return &type_unknown;
+        }
+        Type *mask = arg_types[0];
+        Type *type = arg_types[1];
+        Type *other = arg_types[2];
+        if (type_is_arithmetic(type)) {
+            if (check_is_composite(mask)) {
+                error(args[0]->pos, "The mask for %s is bool, not %s", type->name, mask->name);
+            } else if (check_is_composite(other)) {
+                error(args[2]->pos, "'%s' can't choose between %s and %s", name, type->name, other->name);
+            }
+            return type;
+        }
+        if (type->kind != TYPE_VECTOR) {
+            if (!type_is_open(type)) {
+                error(args[1]->pos, "'%s' needs a vector, not %s", name, type->name);
+            }
+            return &type_unknown;
+        }
+        if (!type_is_open(mask) && mask != type_vector_mask(type)) {
+            error(args[0]->pos, "The mask for %s is %s, not %s", type->name, type_vector_mask(type)->name, mask->name);
+        } else if (other != type && (check_is_composite(other) || (type_is_arithmetic(other) && bc_is_float(other->scalar) && !bc_is_float(type->scalar)))) {
+            error(args[2]->pos, "'%s' can't choose between %s and %s", name, type->name, other->name);
+        }
+        return type;
+    }
+    if (strcmp(name, "any") == 0 || strcmp(name, "all") == 0) {
+        if (num_args != 1) {
+            error(call->pos, "'%s' takes 1 argument, not %zu", name, num_args);
+        } else if (!type_is_open(arg_types[0]) && !type_is_scalar(arg_types[0], BC_BOOL)
+            && (arg_types[0]->kind != TYPE_VECTOR || bc_is_float(arg_types[0]->scalar))) {
+            error(args[0]->pos, "'%s' needs a mask, not %s", name, arg_types[0]->name);
+        }
+        return type_scalar(BC_BOOL);
+    }
+    if (strcmp(name, "shuffle") == 0) {
+        Type *type = num_args ? arg_types[0] : &type_unknown;
+        if (type->kind != TYPE_VECTOR) {
+            if (!num_args || !type_is_open(type)) {
+                error(call->pos, "'%s' needs a vector, not %s", name, num_args ? type->name : "nothing");
+            }
+            return &type_unknown;
+        }
+        if (num_args != 1 + (size_t)type->num_elems) {
+            error(call->pos, "'%s' of %s takes %u lanes, not %zu", name, type->name, type->num_elems, num_args - 1);
+            return type;
+        }
+        for (size_t i = 1; i < num_args; i++) {
+            long long lane;
+            if (!check_const_int(c, args[i], &lane) || lane < 0 || lane >= type->num_elems) {
+                error(args[i]->pos, "Lanes given to '%s' must be constants below %u", name, type->num_elems);
+                break;
+            }
+        }
+        return type;
+    }
+    // true and false
+    error(call->pos, "'%s' is not a function", name);
+    return &type_unknown;
+}
+
+// Binds the generic params of decl that param_type mentions to what
+// arg_type has there.
+static bool
+check_infer(Checker *c, Expr *arg, Decl *decl, Type *param_type, Type *arg_type, Type **bindings) {
+    (void)c;
+    if (param_type->kind == TYPE_PTR && type_is_ptr(arg_type)) {
+        param_type = param_type->base;
+        arg_type = arg_type->base;
+    }
+    if (param_type->kind != TYPE_GENERIC || param_type->decl != decl || arg_type->kind == TYPE_UNKNOWN || type_is_scalar(arg_type, BC_VOID)) {
+        return true;
+    }
+    Type **binding = &bindings[param_type->num_elems];
+    if (*binding && *binding != arg_type) {
+        error(arg->pos, "Type argument '%s' of '%s' is both %s and %s", param_type->name, decl->name, (*binding)->name, arg_type->name);
+        return false;
+    }
+    *binding = arg_type;
+    return true;
+}
+
+static bool
+check_is_literal(Expr *expr) {
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    return expr->kind == EXPR_INT || expr->kind == EXPR_FLOAT;
+}
+
+static Type *
+check_call(Checker *c, Expr *call) {
+    Expr *callee = call->call.expr;
+    Expr **args = call->call.args;
+    size_t num_args = call->call.num_args;
+    Decl *decl = NULL;
+    if (callee->kind == EXPR_NAME && !check_find_local(c, callee->name)) {
+        decl = check_find_decl(c->scope, callee->name);
+        if (!decl) {
+            // unknown names have been reported by the resolver
+            return is_builtin_name(callee->name) ? check_builtin_call(c, call, callee->name) : (check_args(c, call, 0), &type_unknown);
+        }
+    }
+    Type *fn_type = decl && decl->kind == DECL_FUNC ? check_global_type(decl) : check_expr(c, callee);
+    if (fn_type->kind != TYPE_FUNC) {
+        if (callee->kind == EXPR_NAME && !type_is_open(fn_type)) {
+            error(callee->pos, "'%s' is not a function", callee->name);
+        } else if (!type_is_open(fn_type)) {
+            error(callee->pos, "%s can't be called", fn_type->name);
+        }
+        check_args(c, call, 0);
+        return &type_unknown;
+    }
+    bool has_varargs = decl && decl->kind == DECL_FUNC && decl->fn.has_varargs;
+    if (has_varargs ? num_args < fn_type->num_params : num_args != fn_type->num_params) {
+        const char *name = decl ? decl->name : callee->kind == EXPR_NAME ? callee->name : "fn";
+        error(call->pos, "'%s' takes %s%zu arguments, not %zu", name, has_varargs ? "at least " : "", fn_type->num_params, num_args);
+        check_args(c, call, 0);
+        return &type_unknown;
+    }
+    Type *arg_types[CHECK_MAX_PARAMS];
+    for (size_t i = 0; i < num_args; i++) {
+        Type *type = check_expr(c, args[i]);
+        if (i < fn_type->num_params) {
+            arg_types[i] = type;
+        }
+    }
+    bool is_generic = decl && decl->kind == DECL_FUNC && decl->fn.num_generics;
+    Type *bindings[CHECK_MAX_GENERICS] = {0};
+    if (is_generic) {
+        if (decl->fn.num_generics > CHECK_MAX_GENERICS) {
+            return &type_unknown;
+        }
+        // literals only decide a type argument no other argument does
+        for (int literals = 0; literals < 2; literals++) {
+            for (size_t i = 0; i < fn_type->num_params; i++) {
+                if (check_is_literal(args[i]) != literals) {
+                    continue;
+                }
+                Type *bound = literals ? type_subst(fn_type->params[i], decl, bindings) : fn_type->params[i];
+                if (!check_infer(c, args[i], decl, bound, arg_types[i], bindings)) {
+                    return &type_unknown;
+                }
+            }
+        }
+    }
+    for (size_t i = 0; i < fn_type->num_params; i++) {
+        Type *param_type = is_generic ? type_subst(fn_type->params[i], decl, bindings) : fn_type->params[i];
+        check_convert(c, args[i], param_type, arg_types[i]);
+    }
+    Type *ret = is_generic ? type_subst(fn_type->base, decl, bindings) : fn_type->base;
+    // a generic fn's result is checked for each instantiation
+    return ret->kind == TYPE_GENERIC && ret->decl == decl ? &type_unknown : ret;
+}
+
+static Type *
+check_name(Checker *c, Expr *expr) {
+    CheckLocal *local = check_find_local(c, expr->name);
+    if (local) {
+        return local->type;
+    }
+    Decl *decl = check_find_decl(c->scope, expr->name);
+    if (!decl) {
+        if (strcmp(expr->name, "true") == 0 || strcmp(expr->name, "false") == 0) {
+            return type_scalar(BC_BOOL);
+        }
+        if (is_builtin_name(expr->name)) {
+            error(expr->pos, "Builtin '%s' can only be called", expr->name);
+        }
+        return &type_unknown;
+    }
+    switch (decl->kind) {
+    case DECL_FUNC:
+        if (decl->fn.num_generics) {
+            error(expr->pos, "Generic fn '%s' can only be called", expr->name);
+            return &type_unknown;
+        }
+        return check_global_type(decl);
+    case DECL_CONST:
+    case DECL_VAR:
+        return check_global_type(decl);
+    case DECL_STRUCT:
+    case DECL_UNION:
+    case DECL_TYPEDEF:
+    case DECL_ENUM:
+        error(expr->pos, "'%s' is a type, not a value", expr->name);
+        return &type_unknown;
+    default:
+        return &type_unknown;
+    }
+}
+
+// The type of a field, and the field itself when it's in a struct or union.
+static Type *
+check_field(Checker *c, Expr *expr, LayoutField **field_out) {
+    Expr *base = expr->field.expr;
+    if (!expr->field.name) {
+        // the missing name has been reported
+        return &type_unknown;
+    }
+    if (base->kind == EXPR_NAME && !check_find_local(c, base->name)) {
+        Decl *decl = check_find_decl(c->scope, base->name);
+        if (decl && decl->kind == DECL_ENUM) {
+            if (!find_enum_item(decl, expr->field.name)) {
+                error(expr->pos, "'%s' has no item '%s'", decl->name, expr->field.name);
+                return &type_unknown;
+            }
+            return type_enum(decl);
+        }
+    }
+    Type *type = check_expr(c, base);
+    if (type_is_open(type)) {
+        return &type_unknown;
+    }
+    if (type->kind != TYPE_STRUCT && type->kind != TYPE_UNION) {
+        error(expr->pos, "%s has no field '%s'", type->name, expr->field.name);
+        return &type_unknown;
+    }
+    // none when it contains itself, which has been reported
+    Layout *layout = layout_get(type->decl);
+    LayoutField *field = layout ? layout_find_field(layout, expr->field.name) : NULL;
+    if (!field) {
+        if (layout) {
+            error(expr->pos, "%s has no field '%s'", type->name, expr->field.name);
+        }
+        return &type_unknown;
+    }
+    if (field_out) {
+        *field_out = field;
+    }
+    return field->type;
+}
+
+static Type *
+check_index(Checker *c, Expr *expr) {
+    Type *type = check_expr(c, expr->index.expr);
+    Type *index_type = check_expr(c, expr->index.index);
+    bool bad_index = !type_is_open(index_type) && !type_is_integer(index_type);
+    if (type_is_ptr(type)) {
+        if (bad_index) {
+            error(expr->index.index->pos, "Elements are indexed by integers, not %s", index_type->name);
+        }
+        return type->base;
+    }
+    if (type->kind == TYPE_VECTOR) {
+        long long lane;
+        if (bad_index) {
+            error(expr->index.index->pos, "Lanes are indexed by integers, not %s", index_type->name);
+        } else if (check_const_int(c, expr->index.index, &lane) && (lane < 0 || lane >= type->num_elems)) {
+            error(expr->index.index->pos, "%s has no lane %lld", type->name, lane);
+        }
+        return type->base;
+    }
+    if (!type_is_open(type)) {
+        error(expr->pos, "Only pointers, arrays and vectors can be indexed");
+    }
+    return &type_unknown;
+}
+
+// The type of what's assigned to, and the field it is, if any.
+static Type *
+check_lvalue(Checker *c, Expr *expr, LayoutField **field) {
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    return expr->kind == EXPR_FIELD ? check_field(c, expr, field) : check_expr(c, expr);
+}
+
+static Type *
+check_unary(Checker *c, Expr *expr) {
+    TokenKind op = expr->unary.op;
+    Type *type = check_expr(c, expr->unary.expr);
+    if (type_is_open(type)) {
+        return op == TOKEN_NOT && type->kind == TYPE_UNKNOWN ? type_scalar(BC_BOOL) : &type_unknown;
+    }
+    if (type->kind == TYPE_VECTOR) {
+        if (op == TOKEN_SUB || op == TOKEN_ADD || (op == TOKEN_NEG && !bc_is_float(type->scalar))) {
+            return type;
+        }
+    } else if (op == TOKEN_NOT) {
+        if (type_is_arithmetic(type) || type_is_ptr(type)) {
+            return type_scalar(BC_BOOL);
+        }
+    } else if (type_is_arithmetic(type) && (op != TOKEN_NEG || !bc_is_float(type->scalar))) {
+        return type_scalar(bc_promote(type->scalar));
+    }
+    error(expr->pos, "Operator %s can't be used on %s", token_kind_name(op), type->name);
+    return &type_unknown;
+}
+
+static Type *check_expr_type(Checker *c, Expr *expr);
+
+// Checks expr and records its type on it.
+static Type *
+check_expr(Checker *c, Expr *expr) {
+    Type *type = check_expr_type(c, expr);
+    expr->type = type;
+    return type;
+}
+
+static Type *
+check_ternary(Checker *c, Expr *expr) {
+    check_cond(c, expr->ternary.cond);
+    Type *then_type = check_expr(c, expr->ternary.then_expr);
+    Type *else_type = check_expr(c, expr->ternary.else_expr);
+    if (then_type == else_type) {
+        return then_type;
+    }
+    if (type_is_arithmetic(then_type) && type_is_arithmetic(else_type)) {
+        return type_scalar(bc_common_type(then_type->scalar, else_type->scalar));
+    }
+    return &type_unknown;
+}
+
+static Type *
+check_expr_type(Checker *c, Expr *expr) {
+    Val val;
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return check_expr(c, expr->paren.expr);
+    case EXPR_INT:
+    case EXPR_FLOAT: {
+        BcType type = bc_literal(expr, &val);
+        return type == BC_VOID ? &type_unknown : type_scalar(type);
+    }
+    case EXPR_NAME:
+        return check_name(c, expr);
+    case EXPR_CAST: {
+        Type *type = check_typespec(c, expr->cast.type, false);
+        Type *from = check_expr(c, expr->cast.expr);
+        if (type->kind == TYPE_VECTOR || from->kind == TYPE_VECTOR) {
+            error(expr->pos, "Vectors can't be cast, but can be made with their type's name");
+        }
+        return type;
+    }
+    case EXPR_CALL:
+        return check_call(c, expr);
+    case EXPR_INDEX:
+        return check_index(c, expr);
+    case EXPR_FIELD:
+        return check_field(c, expr, NULL);
+    case EXPR_UNARY:
+        return check_unary(c, expr);
+    case EXPR_MODIFY: {
+        LayoutField *field = NULL;
+        Type *type = check_lvalue(c, expr->modify.expr, &field);
+        if (field && field->bits) {
+            error(expr->pos, "Operator %s can't be used on bit field '%s'", token_kind_name(expr->modify.op), field->name);
+            return &type_unknown;
+        }
+        if (!type_is_open(type) && (!type_is_arithmetic(type) || type->kind == TYPE_ENUM) && type->kind != TYPE_PTR) {
+            error(expr->pos, "Operator %s can't be used on %s", token_kind_name(expr->modify.op), type->name);
+            return &type_unknown;
+        }
+        return type;
+    }
+    case EXPR_BINARY: {
+        Type *left = check_expr(c, expr->binary.left);
+        Type *right = check_expr(c, expr->binary.right);
+        return check_binary(c, expr->pos, expr->binary.op, left, right);
+    }
+    case EXPR_TERNARY:
+        return check_ternary(c, expr);
+    case EXPR_SIZEOF_EXPR:
+        check_expr(c, expr->sizeof_expr);
+        return type_scalar(sizeof(size_t) == 8 ? BC_U64 : BC_U32);
+    case EXPR_ALIGNOF_EXPR:
+        check_expr(c, expr->alignof_expr);
+        return type_scalar(sizeof(size_t) == 8 ? BC_U64 : BC_U32);
+    case EXPR_SIZEOF_TYPE:
+    case EXPR_ALIGNOF_TYPE:
+    case EXPR_OFFSETOF:
+        check_typespec(c, expr->kind == EXPR_OFFSETOF ? expr->offsetof_field.type : expr->sizeof_type, false);
+        return type_scalar(sizeof(size_t) == 8 ? BC_U64 : BC_U32);
+    case EXPR_TUPLE:
+        for (size_t i = 0; i < expr->tuple.num_args; i++) {
+            check_expr(c, expr->tuple.args[i]);
+        }
+        return &type_unknown;
+    default:
+        return &type_unknown;
+    }
+}
+
+// Statements
+
+// Only what names storage can be assigned.
+static bool
+check_assignable(Checker *c, Expr *expr) {
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    if (expr->kind == EXPR_INDEX || expr->kind == EXPR_FIELD) {
+        return true;
+    }
+    if (expr->kind != EXPR_NAME) {
+        error(expr->pos, "Only variables, elements and fields can be assigned");
+        return false;
+    }
+    CheckLocal *local = check_find_local(c, expr->name);
+    Decl *decl = local ? NULL : check_find_decl(c->scope, expr->name);
+    if ((local && local->is_array) || (decl && decl->kind == DECL_VAR && check_global_type(decl)->kind == TYPE_ARRAY)) {
+        error(expr->pos, "Arrays can't be assigned, only their elements");
+    } else if (decl && decl->kind == DECL_CONST) {
+        error(expr->pos, "Constant '%s' can't be assigned", expr->name);
+    } else if (decl && decl->kind != DECL_VAR) {
+        error(expr->pos, "'%s' can't be assigned", expr->name);
+    } else {
+        return true;
+    }
+    return false;
+}
+
+static void
+check_init(Checker *c, Stmt *stmt) {
+    Type *type;
+    if (stmt->init.type) {
+        type = check_typespec(c, stmt->init.type, false);
+        if (type->kind == TYPE_ARRAY && stmt->init.expr) {
+            error(stmt->pos, "Arrays can't be initialized from an expression");
+        }
+        if (stmt->init.expr) {
+            Type *expr_type = check_expr(c, stmt->init.expr);
+            if (type->kind != TYPE_ARRAY) {
+                check_convert(c, stmt->init.expr, type, expr_type);
+            }
+        }
+    } else {
+        type = stmt->init.expr ? check_expr(c, stmt->init.expr) : &type_unknown;
+        if (type_is_scalar(type, BC_VOID)) {
+            error(stmt->pos, "Type of '%s' can't be inferred, give it a type", stmt->init.name);
+            type = &type_unknown;
+        }
+    }
+    // x := x refers to the x outside
+    buf_push(c->locals, (CheckLocal){stmt->init.name, type, type->kind == TYPE_ARRAY});
+}
+
+// A constant stored in a bit field must fit in its bits. An enum field's
+// bits hold every item, so only numbers are checked.
+static void
+check_bit_field_value(Checker *c, Expr *expr, LayoutField *field) {
+    long long value;
+    if (field->type->kind == TYPE_ENUM || !check_const_int(c, expr, &value)) {
+        return;
+    }
+    bool fits = field->is_signed ? value >= -(1ll << (field->bits - 1)) && value < (1ll << (field->bits - 1))
+                                 : value >= 0 && (u64)value < (1ull << field->bits);
+    if (!fits) {
+        error(expr->pos, "%lld doesn't fit in the %d bits of '%s'", value, field->bits, field->name);
+    }
+}
+
+static void
+check_simple_stmt(Checker *c, Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_ASSIGN: {
+        bool assignable = check_assignable(c, stmt->assign.left);
+        LayoutField *field = NULL;
+        Type *left = check_lvalue(c, stmt->assign.left, &field);
+        Type *right = check_expr(c, stmt->assign.right);
+        if (stmt->assign.op != TOKEN_ASSIGN) {
+            right = check_binary(c, stmt->pos, assign_ops[stmt->assign.op], left, right);
+        }
+        if (assignable && field && left->kind == TYPE_ARRAY) {
+            error(stmt->pos, "Arrays can't be assigned, only their elements");
+        } else if (assignable && check_convert(c, stmt->assign.right, left, right) && field && field->bits
+            && stmt->assign.op == TOKEN_ASSIGN) {
+            check_bit_field_value(c, stmt->assign.right, field);
+        }
+        break;
+    }
+    case STMT_INIT:
+        check_init(c, stmt);
+        break;
+    case STMT_EXPR:
+        check_expr(c, stmt->expr);
+        break;
+    default:
+        break;
+    }
+}
+
+// A value of type as a key that sorts like the values do.
+static u64
+check_key(BcType type, u64 bits) {
+    return bc_is_signed(type) ? bits ^ (1ull << 63) : bits;
+}
+
+// Every key a value of type can be, or false if there's no switching on it.
+static bool
+check_switch_domain(Type *type, MatchDomain *domain) {
+    MatchRange *ranges = NULL;
+    if (type->kind == TYPE_ENUM) {
+        for (size_t i = 0; i < type->decl->enum_decl.num_items; i++) {
+            u64 key = check_key(type->scalar, (u64)type->decl->enum_decl.items[i].value);
+            buf_push(ranges, (MatchRange){key, key});
+        }
+        domain->num_ranges = match_merge_ranges(ranges, buf_len(ranges));
+    } else if (type_is_integer(type)) {
+        int num_bits = bc_type_bits(type->scalar);
+        if (type->scalar == BC_BOOL) {
+            buf_push(ranges, (MatchRange){0, 1});
+        } else if (bc_is_signed(type->scalar)) {
+            u64 min = (u64)(num_bits == 64 ? INT64_MIN : -(1ll << (num_bits - 1)));
+            u64 max = num_bits == 64 ? INT64_MAX : (1ull << (num_bits - 1)) - 1;
+            buf_push(ranges, (MatchRange){check_key(type->scalar, min), check_key(type->scalar, max)});
+        } else {
+            buf_push(ranges, (MatchRange){0, num_bits == 64 ? UINT64_MAX : (1ull << num_bits) - 1});
+        }
+        domain->num_ranges = 1;
+    } else {
+        return false;
+    }
+    domain->ranges = ranges;
+    return true;
+}
+
+// The key of the constant a pattern names, as a value of type.
+static bool
+check_pattern_key(Checker *c, Expr *expr, Type *type, u64 *key) {
+    Type *expr_type = check_expr(c, expr);
+    if (expr_type->kind == TYPE_UNKNOWN || !check_convert(c, expr, type, expr_type)) {
+        return false;
+    }
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    Val val = {0};
+    u64 bits;
+    bool is_signed;
+    Decl *decl = expr->kind == EXPR_NAME && !check_find_local(c, expr->name) ? check_find_decl(c->scope, expr->name) : NULL;
+    if (expr->kind == EXPR_INT) {
+        is_signed = bc_is_signed(bc_literal(expr, &val));
+        bits = val.ull;
+    } else if (expr->kind == EXPR_FIELD && expr_type->kind == TYPE_ENUM) {
+        is_signed = bc_is_signed(expr_type->scalar);
+        bits = (u64)find_enum_item(expr_type->decl, expr->field.name)->value;
+    } else if (decl && decl->kind == DECL_CONST) {
+        ConstValue *value = const_cache_get(decl, NULL, 0);
+        is_signed = bc_is_signed(value->type);
+        bits = value->val.ull;
+    } else if (expr->kind == EXPR_NAME && !decl && type_is_scalar(expr_type, BC_BOOL)) {
+        is_signed = false;
+        bits = expr->name[0] == 't';
+    } else {
+        error(expr->pos, "Patterns must be constants");
+        return false;
+    }
+    if (!bc_fits(type->scalar, bits, is_signed)) {
+        error(expr->pos, "Pattern is out of range for %s", type->name);
+        return false;
+    }
+    *key = check_key(type->scalar, bits);
+    return true;
+}
+
+// One value's part of a pattern: `_`, a constant or a range.
+static bool
+check_pattern_cell(Checker *c, Expr *pattern, Type *type, MatchCell *cell) {
+    if (is_pattern_wildcard(pattern)) {
+        cell->any = true;
+        return true;
+    }
+    if (pattern->kind == EXPR_TUPLE) {
+        error(pattern->pos, "Patterns in a tuple can't be tuples");
+        return false;
+    }
+    if (pattern->kind == EXPR_BINARY && pattern->binary.op == TOKEN_DOTDOT) {
+        bool ok = check_pattern_key(c, pattern->binary.left, type, &cell->range.lo);
+        ok = check_pattern_key(c, pattern->binary.right, type, &cell->range.hi) && ok;
+        if (ok && cell->range.lo > cell->range.hi) {
+            error(pattern->pos, "Range is empty");
+            return false;
+        }
+        return ok;
+    }
+    if (!check_pattern_key(c, pattern, type, &cell->range.lo)) {
+        return false;
+    }
+    cell->range.hi = cell->range.lo;
+    return true;
+}
+
+static void
+check_key_text(char **text, Type *type, u64 key) {
+    u64 bits = check_key(type->scalar, key);
+    if (type->kind == TYPE_ENUM) {
+        for (size_t i = 0; i < type->decl->enum_decl.num_items; i++) {
+            EnumItem *item = &type->decl->enum_decl.items[i];
+            if ((u64)item->value == bits) {
+                buf_printf(*text, "%s.%s", type->name, item->name);
+                return;
+            }
+        }
+    }
+    if (type->scalar == BC_BOOL) {
+        buf_printf(*text, "%s", bits ? "true" : "false");
+    } else if (bc_is_signed(type->scalar)) {
+        buf_printf(*text, "%lld", (long long)bits);
+    } else {
+        buf_printf(*text, "%llu", (unsigned long long)bits);
+    }
+}
+
+// Reports what the switch's tree finds. Integers are rarely all covered, so a
+// value the switch misses is only reported when each part of it that matters
+// is a bool or an enum.
+static void
+check_switch_tree(Stmt *stmt, Type **types, Expr **row_patterns, bool has_default) {
+    MatchTree *tree = stmt->switch_stmt.tree;
+    if (tree->too_big) {
+        error(stmt->pos, "Switch needs more than %d decisions; split it", MATCH_MAX_NODES);
+        return;
+    }
+    for (size_t i = 0; i < tree->num_rows; i++) {
+        if (!tree->reached[i] && row_patterns[i]) {
+            bool is_case = stmt->switch_stmt.cases[tree->arms[i]].num_patterns == 1;
+            warning(row_patterns[i]->pos, is_case ? "This case is never reached" : "This pattern is never reached");
+        }
+    }
+    if (tree->is_exhaustive || has_default) {
+        return;
+    }
+    // an enum without items has no values to miss
+    bool is_checked = false;
+    for (size_t i = 0; i < tree->num_columns; i++) {
+        bool is_listed = types[i]->kind == TYPE_ENUM || types[i]->scalar == BC_BOOL;
+        if ((!tree->missing_any[i] && !is_listed) || !tree->domains[i].num_ranges) {
+            return;
+        }
+        is_checked |= is_listed;
+    }
+    if (!is_checked) {
+        return;
+    }
+    char *text = NULL;
+    bool is_tuple = stmt->switch_stmt.expr->kind == EXPR_TUPLE;
+    buf_printf(text, "%s", is_tuple ? "(" : "");
+    for (size_t i = 0; i < tree->num_columns; i++) {
+        buf_printf(text, "%s", i ? ", " : "");
+        if (tree->missing_any[i]) {
+            buf_printf(text, "_");
+        } else {
+            check_key_text(&text, types[i], tree->missing[i]);
+        }
+    }
+    buf_printf(text, "%s", is_tuple ? ")" : "");
+    warning(stmt->pos, "Switch doesn't cover %s", text);
+    buf_free(text);
+}
+
+// Each pattern is a row of the switch's matrix, with a default case's row
+// last since it's only taken when no other case matches.
+static void
+check_switch(Checker *c, Stmt *stmt) {
+    Expr *expr = stmt->switch_stmt.expr;
+    bool is_tuple = expr->kind == EXPR_TUPLE;
+    size_t num_columns = is_tuple ? expr->tuple.num_args : 1;
+    if (num_columns > MATCH_MAX_COLUMNS) {
+        error(expr->pos, "A switch can't be on more than %d values", MATCH_MAX_COLUMNS);
+        return;
+    }
+    Type *types[MATCH_MAX_COLUMNS];
+    MatchDomain domains[MATCH_MAX_COLUMNS] = {0};
+    bool valid[MATCH_MAX_COLUMNS];
+    bool ok = true;
+    for (size_t i = 0; i < num_columns; i++) {
+        Expr *column = is_tuple ? expr->tuple.args[i] : expr;
+        types[i] = check_expr(c, column);
+        valid[i] = types[i]->kind != TYPE_UNKNOWN && check_switch_domain(types[i], &domains[i]);
+        if (!valid[i] && types[i]->kind != TYPE_UNKNOWN) {
+            error(column->pos, "Can't switch on %s", types[i]->name);
+        }
+        ok &= valid[i];
+    }
+    MatchCell *cells = NULL;
+    u32 *arms = NULL;
+    Expr **row_patterns = NULL;
+    SwitchCase *default_case = NULL;
+    u32 default_arm = 0;
+    for (u32 i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        SwitchCase *sc = &stmt->switch_stmt.cases[i];
+        if (sc->is_default) {
+            if (default_case) {
+                error(sc->pos, "A switch can only have one default case");
+            }
+            default_case = sc;
+            default_arm = i;
+        }
+        for (size_t j = 0; j < sc->num_patterns; j++) {
+            Expr *pattern = sc->patterns[j];
+            bool row_ok = true;
+            size_t num_values = pattern->kind == EXPR_TUPLE ? pattern->tuple.num_args : 1;
+            if (!is_pattern_wildcard(pattern) && ((pattern->kind == EXPR_TUPLE) != is_tuple || num_values != num_columns)) {
+                error(pattern->pos, "Pattern has %zu values, but the switch has %zu", num_values, num_columns);
+                ok = false;
+                continue;
+            }
+            for (size_t k = 0; k < num_columns; k++) {
+                MatchCell cell = {.any = true};
+                Expr *part = is_tuple && !is_pattern_wildcard(pattern) ? pattern->tuple.args[k] : pattern;
+                if (valid[k]) {
+                    cell.any = false;
+                    row_ok &= check_pattern_cell(c, part, types[k], &cell);
+                }
+                buf_push(cells, cell);
+            }
+            ok &= row_ok;
+            buf_push(arms, i);
+            buf_push(row_patterns, pattern);
+        }
+        check_block(c, sc->block);
+    }
+    if (default_case) {
+        for (size_t k = 0; k < num_columns; k++) {
+            buf_push(cells, (MatchCell){.any = true});
+        }
+        buf_push(arms, default_arm);
+        buf_push(row_patterns, NULL);
+    }
+    if (ok) {
+        stmt->switch_stmt.tree = match_compile(domains, num_columns, cells, arms, buf_len(arms));
+        check_switch_tree(stmt, types, row_patterns, default_case != NULL);
+    }
+    for (size_t i = 0; i < num_columns; i++) {
+        buf_free(domains[i].ranges);
+    }
+    buf_free(cells);
+    buf_free(arms);
+    buf_free(row_patterns);
+}
+
+static void
+check_stmt(Checker *c, Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        if (stmt->expr) {
+            Type *type = check_expr(c, stmt->expr);
+            if (type_is_scalar(c->ret_type, BC_VOID)) {
+                error(stmt->pos, "'%s' doesn't return a value", c->decl->name);
+            } else {
+                check_convert(c, stmt->expr, c->ret_type, type);
+            }
+        } else if (!type_is_scalar(c->ret_type, BC_VOID) && c->ret_type->kind != TYPE_UNKNOWN) {
+            error(stmt->pos, "'%s' must return %s", c->decl->name, c->ret_type->name);
+        }
+        break;
+    case STMT_BREAK:
+    case STMT_CONTINUE:
+        if (!c->loops) {
+            error(stmt->pos, "'%s' is only allowed in a loop", stmt->kind == STMT_BREAK ? "break" : "continue");
+        }
+        break;
+    case STMT_BLOCK:
+        check_block(c, stmt->block);
+        break;
+    case STMT_IF:
+        check_cond(c, stmt->if_stmt.cond);
+        check_block(c, stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            check_cond(c, stmt->if_stmt.elseifs[i].cond);
+            check_block(c, stmt->if_stmt.elseifs[i].block);
+        }
+        check_block(c, stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+        check_cond(c, stmt->while_stmt.cond);
+        c->loops++;
+        check_block(c, stmt->while_stmt.block);
+        c->loops--;
+        break;
+    case STMT_FOR: {
+        size_t num_locals = buf_len(c->locals);
+        if (stmt->for_stmt.init) {
+            check_simple_stmt(c, stmt->for_stmt.init);
+        }
+        if (stmt->for_stmt.cond) {
+            check_cond(c, stmt->for_stmt.cond);
+        }
+        if (stmt->for_stmt.next) {
+            check_simple_stmt(c, stmt->for_stmt.next);
+        }
+        c->loops++;
+        check_block(c, stmt->for_stmt.block);
+        c->loops--;
+        buf__hdr(c->locals)->len = num_locals;
+        break;
+    }
+    case STMT_ASSIGN:
+    case STMT_INIT:
+    case STMT_EXPR:
+        check_simple_stmt(c, stmt);
+        break;
+    case STMT_SWITCH:
+        check_switch(c, stmt);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+check_block(Checker *c, StmtList block) {
+    size_t num_locals = buf_len(c->locals);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        check_stmt(c, block.stmts[i]);
+    }
+    if (c->locals) {
+        buf__hdr(c->locals)->len = num_locals;
+    }
+}
+
+static void
+check_fn(Checker *c, Decl *decl, ModuleScope *scope) {
+    Type *type = map_get(&check_fn_types, decl);
+    c->scope = scope;
+    c->decl = decl;
+    c->ret_type = type->kind == TYPE_FUNC ? type->base : &type_unknown;
+    buf_clear(c->locals);
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        Type *param_type = type->kind == TYPE_FUNC ? type->params[i] : &type_unknown;
+        buf_push(c->locals, (CheckLocal){decl->fn.params[i].name, param_type, false});
+    }
+    StmtList *block = parse_decl_fn_body(decl);
+    if (flag_lazy_fn_bodies) {
+        resolve_lazy_fn(decl, scope);
+    }
+    check_block(c, *block);
+    buf_clear(c->locals);
+}
+
+// The batch's errors are taken back out of this thread's, which on the
+// calling thread already hold the compile's other diagnostics.
+static void
+check_batch_task(void *arg) {
+    CheckBatch *batch = arg;
+    size_t num_errors_before = buf_len(errors);
+    Checker c = {0};
+    for (size_t i = 0; i < buf_len(batch->fns); i++) {
+        check_fn(&c, batch->fns[i], batch->scopes[i]);
+    }
+    buf_free(c.locals);
+    for (size_t i = num_errors_before; i < buf_len(errors); i++) {
+        buf_push(batch->errors, errors[i]);
+    }
+    if (errors) {
+        buf__hdr(errors)->len = num_errors_before;
+    }
+}
+
+// Queues the body of a fn the first time it's reached.
+static void
+check_reach(Decl *decl) {
+    CheckReachShard *shard = &check_reach_shards[hash_ptr(decl) % CHECK_REACH_SHARDS];
+    mutex_lock(&shard->mutex);
+    bool is_new = !map_get(&shard->fns, decl);
+    if (is_new) {
+        map_put(&shard->fns, decl, decl);
+    }
+    mutex_unlock(&shard->mutex);
+    if (!is_new) {
+        return;
+    }
+    CheckBatch *batch = xcalloc(1, sizeof(CheckBatch));
+    buf_push(batch->fns, decl);
+    buf_push(batch->scopes, map_get(&check_decl_scopes, decl));
+    mutex_lock(&check_reach_mutex);
+    buf_push(check_reach_batches, batch);
+    if (check_reach_pool) {
+        pool_submit(check_reach_pool, check_batch_task, batch);
+    }
+    mutex_unlock(&check_reach_mutex);
+}
+
+static void
+check_var(Checker *c, Decl *decl) {
+    Type *type;
+    if (decl->var.type) {
+        type = check_typespec(c, decl->var.type, false);
+        if (decl->var.expr) {
+            Type *expr_type = check_expr(c, decl->var.expr);
+            if (type->kind == TYPE_ARRAY) {
+                error(decl->pos, "Arrays can't be initialized from an expression");
+            } else {
+                check_convert(c, decl->var.expr, type, expr_type);
+            }
+        }
+    } else {
+        type = decl->var.expr ? check_expr(c, decl->var.expr) : &type_unknown;
+        if (type_is_scalar(type, BC_VOID)) {
+            error(decl->pos, "Type of '%s' can't be inferred, give it a type", decl->name);
+            type = &type_unknown;
+        }
+    }
+    map_put(&check_var_types, decl, type);
+}
+
+// An enum's base must be an integer type that holds every item's value.
+static void
+check_enum(Decl *decl) {
+    BcType base = decl->enum_decl.type ? bc_type_from_typespec(NULL, decl->enum_decl.type) : BC_I32;
+    if (base == NUM_BC_TYPES || base <= BC_BOOL || bc_is_float(base)) {
+        error(decl->enum_decl.type->pos, "Base type of enum '%s' must be an integer type", decl->name);
+        return;
+    }
+    for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+        EnumItem *item = &decl->enum_decl.items[i];
+        if (find_enum_item(decl, item->name) != item) {
+            error(item->pos, "'%s' is already an item of '%s'", item->name, decl->name);
+        } else if (!bc_fits(base, (u64)item->value, bc_is_signed(base))) {
+            error(item->pos, "Value of '%s' doesn't fit in %s", item->name, bc_type_names[base]);
+        }
+    }
+}
+
+// Structs and unions
+
+// decls whose layout is being computed, to catch one that contains itself
+static Map check_layouts_pending;
+
+static Layout *check_layout(Decl *decl);
+
+// The size and alignment of a value of type in memory, or false when it has
+// none.
+static bool
+check_type_size(Type *type, u64 *size, u32 *align) {
+    switch (type->kind) {
+    case TYPE_SCALAR:
+    case TYPE_ENUM:
+        if (type->scalar == BC_VOID) {
+            return false;
+        }
+        *size = *align = (bc_type_bits(type->scalar) + 7) / 8;
+        return true;
+    case TYPE_VECTOR:
+        *size = *align = type->num_elems * bc_type_bits(type->scalar) / 8;
+        return true;
+    case TYPE_PTR:
+    case TYPE_FUNC:
+        // the target is the host
+        *size = *align = sizeof(void *);
+        return true;
+    case TYPE_ARRAY:
+        if (!check_type_size(type->base, size, align)) {
+            return false;
+        }
+        *size *= type->num_elems;
+        return true;
+    case TYPE_STRUCT:
+    case TYPE_UNION: {
+        Layout *layout = check_layout(type->decl);
+        if (!layout) {
+            return false;
+        }
+        *size = layout->root.size;
+        *align = layout->root.align;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+// The fewest bits that hold every item of an enum, if fewer than its base
+// type has.
+static bool
+check_enum_bits(Type *type, int *bits, bool *is_signed) {
+    Decl *decl = type->decl;
+    if (!decl->enum_decl.num_items) {
+        return false;
+    }
+    long long min = 0;
+    long long max = 0;
+    u64 max_bits = 0;
+    for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+        long long value = decl->enum_decl.items[i].value;
+        min = value < min ? value : min;
+        max = value > max ? value : max;
+        max_bits = (u64)value > max_bits ? (u64)value : max_bits;
+    }
+    int n = 1;
+    if (!bc_is_signed(type->scalar) || min >= 0) {
+        min = 0;
+        while (n < 64 && max_bits >= (1ull << n)) {
+            n++;
+        }
+    } else {
+        while (n < 64 && (min < -(1ll << (n - 1)) || max >= (1ll << (n - 1)))) {
+            n++;
+        }
+    }
+    *bits = n;
+    *is_signed = min < 0;
+    return n < bc_type_bits(type->scalar);
+}
+
+// What the layout needs of each field of aggregate, in source order.
+static void
+check_aggregate(Checker *c, Aggregate *aggregate, bool is_ordered, LayoutInput **inputs) {
+    for (size_t i = 0; i < aggregate->num_items; i++) {
+        AggregateItem *item = &aggregate->items[i];
+        if (item->kind == AGGREGATE_ITEM_SUBAGGREGATE) {
+            check_aggregate(c, item->subaggregate, is_ordered, inputs);
+            continue;
+        }
+        Typespec *typespec = item->type;
+        LayoutInput input = {0};
+        int bits;
+        bool is_signed;
+        if (typespec->kind == TYPESPEC_NAME && typespec->num_names == 1 && !check_find_decl(c->scope, typespec->names[0])
+            && layout_bit_type(typespec->names[0], &bits, &is_signed)) {
+            input = (LayoutInput){.type = type_scalar(layout_int_type(bits, is_signed)), .bits = (u8)bits, .is_signed = is_signed};
+        } else {
+            input.type = check_typespec(c, typespec, false);
+            if (!check_type_size(input.type, &input.size, &input.align)) {
+                if (type_is_scalar(input.type, BC_VOID)) {
+                    error(item->pos, "Fields can't be void");
+                }
+                input = (LayoutInput){.type = &type_unknown, .size = 1, .align = 1};
+            } else if (input.type->kind == TYPE_ENUM && aggregate->kind == AGGREGATE_STRUCT && !is_ordered
+                       && check_enum_bits(input.type, &bits, &is_signed)) {
+                input.bits = (u8)bits;
+                input.is_signed = is_signed;
+            }
+        }
+        for (size_t j = 0; j < item->num_names; j++) {
+            buf_push(*inputs, input);
+        }
+    }
+}
+
+// A struct or union's layout, computed once its fields' types have theirs.
+static Layout *
+check_layout(Decl *decl) {
+    Layout *layout = layout_get(decl);
+    if (layout) {
+        return layout;
+    }
+    if (map_get(&check_layouts_pending, decl)) {
+        error(decl->pos, "'%s' contains itself", decl->name);
+        return NULL;
+    }
+    Checker c = {.scope = map_get(&check_decl_scopes, decl)};
+    if (!c.scope) {
+        return NULL;
+    }
+    map_put(&check_layouts_pending, decl, decl);
+    for (size_t i = 0; i < decl->notes.num_notes; i++) {
+        Note *note = &decl->notes.notes[i];
+        if (note->name != ordered_name) {
+            warning(note->pos, "Unknown note '@%s' on '%s'", note->name, decl->name);
+        }
+    }
+    bool is_ordered = get_decl_note(decl, ordered_name) != NULL;
+    LayoutInput *inputs = NULL;
+    check_aggregate(&c, decl->aggregate, is_ordered, &inputs);
+    layout = layout_compute(decl, inputs, buf_len(inputs), is_ordered);
+    buf_free(inputs);
+    for (size_t i = 0; i < layout->num_fields; i++) {
+        LayoutField *field = &layout->fields[i];
+        if (layout_find_field(layout, field->name) != field) {
+            error(field->pos, "'%s' is already a field of '%s'", field->name, decl->name);
+        }
+    }
+    return layout;
+}
+
+static void
+print_layouts(char **out, Decls *decls) {
+    for (size_t i = 0; decls && i < decls->num_decls; i++) {
+        Decl *decl = decls->decls[i];
+        Layout *layout = decl->kind == DECL_STRUCT || decl->kind == DECL_UNION ? layout_get(decl) : NULL;
+        if (!layout) {
+            continue;
+        }
+        buf_printf(*out, "%s(%d): %s %s: size %llu, align %u\n", decl->pos.name, decl->pos.line,
+            decl->kind == DECL_STRUCT ? "struct" : "union", decl->name, (unsigned long long)layout->root.size, layout->root.align);
+        for (size_t j = 0; j < layout->num_fields; j++) {
+            LayoutField *field = &layout->fields[j];
+            buf_printf(*out, "    %s: ", field->name);
+            if (field->bits && field->type->kind != TYPE_ENUM) {
+                buf_printf(*out, "%c%d", field->is_signed ? 'i' : 'u', field->bits);
+            } else {
+                buf_printf(*out, "%s", field->type->name);
+            }
+            buf_printf(*out, " at %llu", (unsigned long long)field->offset);
+            if (field->bits) {
+                buf_printf(*out, ", bits %d..%d", field->shift, field->shift + field->bits - 1);
+            }
+            buf_printf(*out, "\n");
+        }
+    }
+}
+
+// The fns reached with lazy fn bodies before any body is checked: main, or
+// without one every fn that is generated, and the fns whose bodies have been
+// parsed to run at compile time.
+static void
+check_reach_roots(CheckModule *modules, size_t num_modules) {
+    const char *main_name = str_intern("main");
+    Decl *main_decl = NULL;
+    for (size_t i = 0; i < num_modules && modules[i].is_root && !main_decl; i++) {
+        Decl *decl = map_get(&modules[i].scope->decls, main_name);
+        if (decl && decl->kind == DECL_FUNC && !decl->fn.num_generics) {
+            main_decl = decl;
+        }
+    }
+    for (size_t i = 0; i < num_modules; i++) {
+        bool reach_all = !main_decl && (modules[i].is_root || flag_emit_c_path);
+        Decls *decls = modules[i].decls;
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            Decl *decl = decls->decls[j];
+            if (decl->kind == DECL_FUNC && (reach_all || decl == main_decl || !decl->fn.body_start)) {
+                check_reach(decl);
+            }
+        }
+    }
+}
+
+// Checks the reached fns, and the fns they reach in turn.
+static void
+check_reached_fns(int num_threads) {
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < buf_len(check_reach_batches); i++) {
+            check_batch_task(check_reach_batches[i]);
+        }
+    } else {
+        Pool *pool = pool_create(num_threads);
+        mutex_lock(&check_reach_mutex);
+        check_reach_pool = pool;
+        for (size_t i = 0; i < buf_len(check_reach_batches); i++) {
+            pool_submit(pool, check_batch_task, check_reach_batches[i]);
+        }
+        mutex_unlock(&check_reach_mutex);
+        pool_run(pool);
+        mutex_lock(&check_reach_mutex);
+        check_reach_pool = NULL;
+        mutex_unlock(&check_reach_mutex);
+        pool_free(pool);
+    }
+    for (size_t i = 0; i < buf_len(check_reach_batches); i++) {
+        CheckBatch *batch = check_reach_batches[i];
+        for (Error *it = batch->errors; it != buf_end(batch->errors); it++) {
+            buf_push(errors, *it);
+        }
+        buf_free(batch->errors);
+        buf_free(batch->fns);
+        buf_free(batch->scopes);
+        free(batch);
+    }
+    buf_free(check_reach_batches);
+    for (size_t i = 0; i < CHECK_REACH_SHARDS; i++) {
+        map_free(&check_reach_shards[i].fns);
+    }
+}
+
+static void
+check_program(CheckModule *modules, size_t num_modules, int num_threads) {
+    phase_push(PHASE_CHECK);
+    for (size_t i = 0; i < num_modules; i++) {
+        Decls *decls = modules[i].decls;
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            map_put(&check_decl_scopes, decls->decls[j], modules[i].scope);
+        }
+    }
+    // signatures, then vars, whose initializers may call any fn; a var
+    // typed from another var's initializer sees it once that one is done
+    CheckBatch *batches = NULL;
+    CheckBatch batch = {0};
+    for (size_t i = 0; i < num_modules; i++) {
+        Decls *decls = modules[i].decls;
+        Checker c = {.scope = modules[i].scope};
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            Decl *decl = decls->decls[j];
+            if (decl->kind == DECL_ENUM) {
+                check_enum(decl);
+            } else if (decl->kind == DECL_STRUCT || decl->kind == DECL_UNION) {
+                check_layout(decl);
+            }
+            if (decl->kind != DECL_FUNC) {
+                continue;
+            }
+            map_put(&check_fn_types, decl, check_fn_type(&c, decl));
+            if (flag_lazy_fn_bodies) {
+                continue;
+            }
+            buf_push(batch.fns, decl);
+            buf_push(batch.scopes, modules[i].scope);
+            if (buf_len(batch.fns) == CHECK_BATCH_SIZE) {
+                buf_push(batches, batch);
+                batch = (CheckBatch){0};
+            }
+        }
+    }
+    if (batch.fns) {
+        buf_push(batches, batch);
+    }
+    for (size_t i = 0; i < num_modules; i++) {
+        Decls *decls = modules[i].decls;
+        Checker c = {.scope = modules[i].scope};
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            if (decls->decls[j]->kind == DECL_VAR) {
+                check_var(&c, decls->decls[j]);
+            }
+        }
+        buf_free(c.locals);
+    }
+    if (flag_lazy_fn_bodies) {
+        check_reach_roots(modules, num_modules);
+        check_reached_fns(num_threads);
+    }
+
+    if (num_threads <= 1 || buf_len(batches) <= 1) {
+        for (size_t i = 0; i < buf_len(batches); i++) {
+            check_batch_task(&batches[i]);
+        }
+    } else {
+        Pool *pool = pool_create(num_threads);
+        for (size_t i = 0; i < buf_len(batches); i++) {
+            pool_submit(pool, check_batch_task, &batches[i]);
+        }
+        pool_run(pool);
+        pool_free(pool);
+    }
+    for (size_t i = 0; i < buf_len(batches); i++) {
+        for (Error *it = batches[i].errors; it != buf_end(batches[i].errors); it++) {
+            buf_push(errors, *it);
+        }
+        buf_free(batches[i].errors);
+        buf_free(batches[i].fns);
+        buf_free(batches[i].scopes);
+    }
+    buf_free(batches);
+    phase_pop();
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "error.h"
+#include "lex.h"
+#include "stats.h"
+#include "ast.h"
+#include "parse.h"
+#include "bytecode.h"
+#include "pool.h"
+#include "resolve.h"
+#include "match.h"
+#include "layout.h"
+
+// Type checking, once every module's consts are evaluated. A Typespec is what
+// the source wrote; a Type is what it means. Types are interned in one table
+// shared by the whole compilation, so each is made once and two are the same
+// type exactly when they are the same pointer. The scalars and the vector
+// types are made up front; the others are added when first named, under the
+// lock of the table's shard the type hashes to.
+//
+// A sequential pass first gives every fn its signature and every var its
+// type, after which nothing a body can see changes, so the bodies are checked
+// in batches of fns on a pool. Each batch keeps its own diagnostics, which are
+// added to the compile's in declaration order once every batch is done, so
+// what is reported doesn't depend on scheduling.
+//
+// With lazy fn bodies, only the fns that are reached are checked, and so
+// parsed: main, or without one every fn of the root modules (of every module
+// when the program is emitted, since all of them are), the fns that have
+// already run at compile time, and any fn a checked body, signature or var
+// names. check_find_decl queues a fn's body as a batch of its own the first
+// time it finds the fn, on the pool once the bodies are being checked.
+//
+// The rules are the ones the C backend generates code for: C's usual
+// arithmetic conversions for scalars, lane by lane operations on vectors with
+// a scalar operand taken as every lane, and C's pointer arithmetic. Within a
+// generic fn, a generic param is a type of its own that anything can be done
+// with; the instantiations are checked as they are generated. Anything with a
+// type the checker doesn't know, or that has already been reported, has
+// TYPE_UNKNOWN, which is compatible with everything so one mistake is reported
+// once.
+//
+// An enum converts to the numbers like its base type does, but nothing
+// converts to an enum except its own items, so a switch on one can tell which
+// items it misses. A switch gets its decision tree here, see match.h, and the
+// checker reports what the tree finds: cases that are never reached and, when
+// every value that matters is a bool or an enum, values no case matches.
+
+// fns checked by one task
+#define CHECK_BATCH_SIZE 64
+#define TYPE_SHARDS 16
+#define CHECK_REACH_SHARDS 16
+#define CHECK_MAX_PARAMS 64
+#define CHECK_MAX_GENERICS 16
+
+typedef enum TypeKind {
+    TYPE_UNKNOWN,
+    // void, bool and the numbers, by BcType
+    TYPE_SCALAR,
+    TYPE_VECTOR,
+    TYPE_PTR,
+    TYPE_ARRAY,
+    TYPE_FUNC,
+    // a generic param of decl
+    TYPE_GENERIC,
+    TYPE_STRUCT,
+    TYPE_UNION,
+    // an enum of decl, with its base type as the scalar
+    TYPE_ENUM,
+} TypeKind;
+
+typedef struct Type {
+    TypeKind kind;
+    BcType scalar;
+    // element of a vector, pointer or array, or result of a fn
+    struct Type *base;
+    // lanes of a vector, elements of an array, index of a generic param
+    u32 num_elems;
+    struct Type **params;
+    size_t num_params;
+    // struct, union, enum or generic fn
+    Decl *decl;
+    // as the source would write it, for diagnostics; interned
+    const char *name;
+    // next entry with the same hash
+    struct Type *next;
+} Type;
+
+typedef struct TypeShard {
+    Mutex mutex;
+    // hash of a type's parts to Type chain
+    Map types;
+    Arena arena;
+} TypeShard;
+
+typedef struct CheckModule {
+    Decls *decls;
+    ModuleScope *scope;
+    // named on the command line, so its main is the program's
+    bool is_root;
+} CheckModule;
+
+typedef struct CheckLocal {
+    const char *name;
+    Type *type;
+    // declared with its elements, so it can't be assigned
+    bool is_array;
+} CheckLocal;
+
+typedef struct Checker {
+    ModuleScope *scope;
+    // fn being checked
+    Decl *decl;
+    Type *ret_type;
+    // loops the statement being checked is in
+    int loops;
+    // params and locals in scope, innermost last
+    CheckLocal *locals;
+} Checker;
+
+typedef struct CheckBatch {
+    Decl **fns;
+    ModuleScope **scopes;
+    Error *errors;
+} CheckBatch;
+
+// fns reached with lazy fn bodies, as a set keyed by the decl
+typedef struct CheckReachShard {
+    Mutex mutex;
+    Map fns;
+} CheckReachShard;
+
+bool flag_print_layouts = false;
+
+static void type_init(void);
+static void check_reach_init(void);
+static Type *type_scalar(BcType scalar);
+static Type *type_ptr(Type *base);
+static Type *type_array(Type *base, u32 num_elems);
+static Type *type_func(Type **params, size_t num_params, Type *ret);
+static void check_program(CheckModule *modules, size_t num_modules, int num_threads);
+static void check_reach(Decl *decl);
+static void check_reach_roots(CheckModule *modules, size_t num_modules);
+static void check_reached_fns(int num_threads);
+static Type *check_expr(Checker *c, Expr *expr);
+static Type *check_global_type(Decl *decl);
+static void check_stmt(Checker *c, Stmt *stmt);
+static void check_block(Checker *c, StmtList block);
+static void print_layouts(char **out, Decls *decls);
@@ -67,6 +67,11 @@ char *strf(const char *fmt, ...) {
 }
 
 char *read_file(const char *path) {
+    size_t len;
+    return read_file_len(path, &len);
+}
+
+char *read_file_len(const char *path, size_t *out_len) {
     FILE *file = fopen(path, "rb");
     if (!file) {
         return NULL;
@@ -74,6 +79,10 @@ char *read_file(const char *path) {
     fseek(file, 0, SEEK_END);
     long len = ftell(file);
     fseek(file, 0, SEEK_SET);
+    if (len < 0) {
+        fclose(file);
+        return NULL;
+    }
     char *buf = xmalloc(len + 1);
     if (len && fread(buf, len, 1, file) != 1) {
         fclose(file);
@@ -82,6 +91,7 @@ char *read_file(const char *path) {
     }
     fclose(file);   
     buf[len] = 0;
+    *out_len = len;
     return buf;
 }
 
@@ -140,6 +150,7 @@ void arena_grow(Arena *arena, size_t min_size) {
     assert(arena->ptr == ALIGN_DOWN_PTR(arena->ptr, ARENA_ALIGNMENT));
     arena->end = arena->ptr + size;
     buf_push(arena->blocks, arena->ptr);
+    STATS_ADD(arena_blocks, 1);
 }
 
 void *arena_alloc(Arena *arena, size_t size) {
@@ -149,6 +160,7 @@ void *arena_alloc(Arena *arena, size_t size) {
     }
     void *ptr = arena->ptr;
     arena->ptr = ALIGN_UP_PTR(arena->ptr + size, ARENA_ALIGNMENT);
+    STATS_ADD(arena_bytes, size);
     assert(arena->ptr <= arena->end);
     assert(ptr == ALIGN_DOWN_PTR(ptr, ARENA_ALIGNMENT));
     return ptr;
@@ -213,6 +225,7 @@ uint64_t map_get_uint64_from_uint64(Map *map, uint64_t key) {
 void map_put_uint64_from_uint64(Map *map, uint64_t key, uint64_t val);
 
 void map_grow(Map *map, size_t new_cap) {
+    STATS_ADD(map_grows, 1);
     new_cap = CLAMP_MIN(new_cap, 16);
     Map new_map = {
         .keys = xcalloc(new_cap, sizeof(uint64_t)),
@@ -229,6 +242,12 @@ void map_grow(Map *map, size_t new_cap) {
     *map = new_map;
 }
 
+void map_free(Map *map) {
+    free(map->keys);
+    free(map->vals);
+    *map = (Map){0};
+}
+
 void map_put_uint64_from_uint64(Map *map, uint64_t key, uint64_t val) {
     assert(key);
     if (!val) {
@@ -281,31 +300,62 @@ void map_put_uint64(Map *map, void *key, uint64_t val) {
 
 // String interning
 
+static Intern *intern_find(Intern *intern, const char *start, size_t len) {
+    for (Intern *it = intern; it; it = it->next) {
+        if (it->len == len && strncmp(it->str, start, len) == 0) {
+            return it;
+        }
+    }
+    return NULL;
+}
+
 const char *str_intern_range(const char *start, const char *end) {
     size_t len = end - start;
     uint64_t hash = hash_bytes(start, len);
     uint64_t key = hash ? hash : 1;
+    Intern *found = intern_find(map_get_from_uint64(&intern_cache, key), start, len);
+    if (found) {
+        STATS_ADD(intern_cache_hits, 1);
+        return found->str;
+    }
+    mutex_lock(&intern_mutex);
     Intern *intern = map_get_from_uint64(&interns, key);
-    for (Intern *it = intern; it; it = it->next) {
-        if (it->len == len && strncmp(it->str, start, len) == 0) {
-            return it->str;
-        }
+    found = intern_find(intern, start, len);
+    if (found) {
+        STATS_ADD(intern_hits, 1);
+    } else {
+        STATS_ADD(intern_misses, 1);
+        // Intern didn't exist so we made it here
+        found = arena_alloc(&intern_arena, offsetof(Intern, str) + len + 1);
+        found->len = len;
+        found->next = intern;
+        memcpy(found->str, start, len);
+        found->str[len] = 0;
+        map_put_from_uint64(&interns, key, found);
+        intern_memory_usage += sizeof(Intern) + len + 1 + 16; /* 16 is estimate of hash table cost */
     }
-    // Intern didn't exist so we made it here
-    Intern *new_intern = arena_alloc(&intern_arena, offsetof(Intern, str) + len + 1);
-    new_intern->len = len;
-    new_intern->next = intern;
-    memcpy(new_intern->str, start, len);
-    new_intern->str[len] = 0;
-    map_put_from_uint64(&interns, key, new_intern);
-    intern_memory_usage += sizeof(Intern) + len + 1 + 16; /* 16 is estimate of hash table cost */
-    return new_intern->str;
+    Intern *chain = map_get_from_uint64(&interns, key);
+    mutex_unlock(&intern_mutex);
+    map_put_from_uint64(&intern_cache, key, chain);
+    return found->str;
 }
 
 const char *str_intern(const char *str) {
     return str_intern_range(str, str + strlen(str));
 }
 
+// The interned copy of str, or NULL if no name like it has been interned. Unlike
+// str_intern this never adds one.
+const char *str_interned(const char *str) {
+    size_t len = strlen(str);
+    uint64_t hash = hash_bytes(str, len);
+    uint64_t key = hash ? hash : 1;
+    mutex_lock(&intern_mutex);
+    Intern *found = intern_find(map_get_from_uint64(&interns, key), str, len);
+    mutex_unlock(&intern_mutex);
+    return found ? found->str : NULL;
+}
+
 bool str_islower(const char *str) {
     while (*str) {
         if (isalpha(*str) && !islower(*str)) {
@@ -315,21 +365,3 @@ bool str_islower(const char *str) {
     }
     return true;
 }
-
-// Value union
-
-typedef union Val {
-    bool b;
-    char c;
-    unsigned char uc;
-    signed char sc;
-    short s;
-    unsigned short us;
-    int i;
-    unsigned u;
-    long l;
-    unsigned long ul;
-    long long ll;
-    unsigned long long ull;
-    uintptr_t p;
-} Val;
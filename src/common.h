@@ -1,6 +1,7 @@
 #pragma once
 
 #include "stdafx.h"
+#include "os.h"
 
 void fatal(const char *fmt, ...);
 
@@ -13,6 +14,8 @@ void *memdup(void *src, size_t size);
 char *strf(const char *fmt, ...);
 
 char *read_file(const char *path);
+// also gives the length, for files that may contain zero bytes
+char *read_file_len(const char *path, size_t *len);
 bool write_file(const char *path, const char *buf, size_t len);
 
 // Stretchy buffers, invented (?) by Sean Barrett
@@ -35,6 +38,7 @@ typedef struct BufHdr {
 #define buf_push(b, ...) (buf_fit((b), 1 + buf_len(b)), (b)[buf__hdr(b)->len++] = (__VA_ARGS__))
 #define buf_printf(b, ...) ((b) = buf__printf((b), __VA_ARGS__))
 #define buf_clear(b) ((b) ? buf__hdr(b)->len = 0 : 0)
+#define buf_pop(b) ((b)[--buf__hdr(b)->len])
 
 void *buf__grow(const void *buf, size_t new_len, size_t elem_size);
 char *buf__printf(char *buf, const char *fmt, ...);
@@ -71,6 +75,7 @@ typedef struct Map {
 uint64_t map_get_uint64_from_uint64(Map *map, uint64_t key);
 void map_put_uint64_from_uint64(Map *map, uint64_t key, uint64_t val);
 void map_grow(Map *map, size_t new_cap);
+void map_free(Map *map);
 void *map_get(Map *map, const void *key);
 void map_put(Map *map, const void *key, void *val);
 void *map_get_from_uint64(Map *map, uint64_t key);
@@ -86,10 +91,35 @@ typedef struct Intern {
     char str[];
 } Intern;
 
+// The intern table is shared by all threads and guarded by intern_mutex. Each
+// thread keeps its own intern_cache of hash to Intern chain so that names it
+// has seen before are found without taking the lock.
 Arena intern_arena;
 Map interns;
 size_t intern_memory_usage;
+Mutex intern_mutex = MUTEX_INIT;
+THREAD_LOCAL Map intern_cache;
 
 const char *str_intern_range(const char *start, const char *end);
 const char *str_intern(const char *str);
-bool str_islower(const char *str);
\ No newline at end of file
+const char *str_interned(const char *str);
+bool str_islower(const char *str);
+// Value union
+
+typedef union Val {
+    bool b;
+    char c;
+    unsigned char uc;
+    signed char sc;
+    short s;
+    unsigned short us;
+    int i;
+    unsigned u;
+    long l;
+    unsigned long ul;
+    long long ll;
+    unsigned long long ull;
+    float f;
+    double d;
+    uintptr_t p;
+} Val;
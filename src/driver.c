@@ -0,0 +1,707 @@
+#include "driver.h"
+
+// number of worker threads, 0 for one per core
+int flag_num_jobs = 0;
+
+// directories searched for non-relative imports, "." if there are none
+const char **flag_import_paths = NULL;
+
+static Pool *compile_pool;
+
+// every module by interned absolute path; guarded by module_mutex while the
+// pool runs, like the graph fields of SourceFile
+static Map module_table;
+static SourceFile **module_list;
+static Mutex module_mutex = MUTEX_INIT;
+
+// PreloadedModules by interned absolute path
+static Map preloaded_modules;
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static bool has_source_extension(const char *path) {
+    size_t len = strlen(path);
+    return len > 3 && strcmp(path + len - 3, ".cr") == 0;
+}
+
+// Adds a file, or every .cr file under a directory in sorted order, as an
+// interned path.
+static void add_source_paths(const char ***paths, const char *path) {
+    if (!os_is_dir(path)) {
+        buf_push(*paths, str_intern(path));
+        return;
+    }
+    char **names = os_list_dir(path);
+    qsort(names, buf_len(names), sizeof(char *), compare_paths);
+    for (size_t i = 0; i < buf_len(names); i++) {
+        char *child = strf("%s/%s", path, names[i]);
+        if (os_is_dir(child) || has_source_extension(child)) {
+            add_source_paths(paths, child);
+        }
+        free(child);
+        free(names[i]);
+    }
+    buf_free(names);
+}
+
+// Has the module at full_path, when it's loaded, take decls and errors (which
+// it copies) instead of reading and parsing the file. Call before compiling.
+static void preload_module(const char *full_path, Decls *decls, Error *errors, const char *buf) {
+    PreloadedModule *module = xmalloc(sizeof(PreloadedModule));
+    *module = (PreloadedModule){decls, NULL, buf};
+    for (Error *it = errors; it != buf_end(errors); it++) {
+        buf_push(module->errors, *it);
+    }
+    map_put(&preloaded_modules, full_path, module);
+}
+
+// A file whose size and mtime are in the cache index is loaded without reading
+// it. Otherwise it's read and may still match a cached blob by content.
+static bool load_file_cached(SourceFile *file) {
+    phase_push(PHASE_CACHE);
+    bool hit = false;
+    if (!file->buf) {
+        file->stat_key = cache_stat_key(file->path);
+        hit = file->stat_key && cache_load_index(file->stat_key, &file->content_key)
+            && cache_load_blob(file->content_key, file->path, &file->decls, &file->errors);
+    } else {
+        file->content_key = cache_content_key(file->buf, strlen(file->buf));
+        hit = cache_load_blob(file->content_key, file->path, &file->decls, &file->errors);
+        if (hit && file->stat_key) {
+            cache_store_index(file->stat_key, file->content_key);
+        }
+        file->cache_store = !hit;
+    }
+    phase_pop();
+    return hit;
+}
+
+static void load_file_task(void *arg) {
+    SourceFile *file = arg;
+    PreloadedModule *preloaded = map_get(&preloaded_modules, file->full_path);
+    if (preloaded) {
+        file->decls = preloaded->decls;
+        file->errors = preloaded->errors;
+        if (flag_cache_dir) {
+            file->content_key = cache_content_key(preloaded->buf, strlen(preloaded->buf));
+        }
+        file_parsed(file);
+        return;
+    }
+    bool use_cache = flag_cache_dir != NULL;
+    if (use_cache && load_file_cached(file)) {
+        STATS_ADD(cache_hits, 1);
+        file_parsed(file);
+        return;
+    }
+    phase_push(PHASE_LOAD);
+    file->buf = read_file(file->path);
+    phase_pop();
+    if (!file->buf) {
+        error((SrcPos){.name = file->path}, "Could not read file");
+        file->errors = errors;
+        errors = NULL;
+        file_parsed(file);
+        return;
+    }
+    if (use_cache && load_file_cached(file)) {
+        STATS_ADD(cache_hits, 1);
+        file_parsed(file);
+        return;
+    }
+    STATS_ADD(cache_misses, use_cache);
+    size_t len = strlen(file->buf);
+    int num_jobs = (int)(len / PARSE_CHUNK_SIZE) + 1;
+    file->jobs = split_parse_jobs(file->path, file->buf, num_jobs);
+    file->jobs_left = (int)buf_len(file->jobs);
+    for (ParseJob *it = file->jobs; it != buf_end(file->jobs); it++) {
+        buf_push(file->parse_tasks, (ParseTask){file, it});
+    }
+    // the last job to finish frees the tasks, maybe before this loop ends
+    ParseTask *tasks = file->parse_tasks;
+    size_t num_tasks = buf_len(tasks);
+    for (size_t i = 0; i < num_tasks; i++) {
+        pool_submit(compile_pool, parse_job_task, &tasks[i]);
+    }
+}
+
+// The last job of a file to finish merges them all.
+static void parse_job_task(void *arg) {
+    ParseTask *task = arg;
+    SourceFile *file = task->file;
+    parse_job(task->job);
+    mutex_lock(&module_mutex);
+    bool last = --file->jobs_left == 0;
+    mutex_unlock(&module_mutex);
+    if (last) {
+        file->decls = merge_parse_jobs(file->jobs);
+        file->jobs = NULL;
+        buf_free(file->parse_tasks);
+        file->errors = errors;
+        errors = NULL;
+        file_parsed(file);
+    }
+}
+
+static void store_file_task(void *arg) {
+    SourceFile *file = arg;
+    phase_push(PHASE_CACHE);
+    if (file->cache_store) {
+        cache_store_blob(file->content_key, file->decls, file->errors, buf_len(file->errors));
+        if (file->stat_key) {
+            cache_store_index(file->stat_key, file->content_key);
+        }
+    }
+    if (file->const_store) {
+        cache_store_consts(file->const_key, file->decls);
+    }
+    phase_pop();
+}
+
+// Looks up the module for path, creating it if it's new. The caller holds
+// module_mutex or runs before the pool.
+static SourceFile *add_module(const char *path, bool *is_new) {
+    char *full_path = os_full_path(path);
+    const char *key = str_intern(full_path ? full_path : path);
+    free(full_path);
+    SourceFile *file = map_get(&module_table, key);
+    *is_new = !file;
+    if (!file) {
+        file = xcalloc(1, sizeof(SourceFile));
+        file->path = str_intern(path);
+        file->full_path = key;
+        map_put(&module_table, key, file);
+        buf_push(module_list, file);
+    }
+    return file;
+}
+
+static char *import_name(Decl *decl) {
+    char *name = NULL;
+    buf_printf(name, "%s", decl->import.is_relative ? "." : "");
+    for (size_t i = 0; i < decl->import.num_names; i++) {
+        buf_printf(name, "%s%s", i ? "." : "", decl->import.names[i]);
+    }
+    return name;
+}
+
+// import a.b is the file a/b.cr under one of the import paths, and import .a.b
+// is a/b.cr next to the importing file. Returns a malloc'd path, or NULL.
+static char *resolve_import(SourceFile *file, Decl *decl) {
+    char *rel_path = NULL;
+    for (size_t i = 0; i < decl->import.num_names; i++) {
+        buf_printf(rel_path, "%s%s", i ? "/" : "", decl->import.names[i]);
+    }
+    buf_printf(rel_path, ".cr");
+    const char **dirs = NULL;
+    char *file_dir = NULL;
+    if (decl->import.is_relative) {
+        const char *slash = strrchr(file->path, '/');
+        file_dir = slash ? strf("%.*s", (int)(slash - file->path), file->path) : strf(".");
+        buf_push(dirs, file_dir);
+    } else if (flag_import_paths) {
+        for (size_t i = 0; i < buf_len(flag_import_paths); i++) {
+            buf_push(dirs, flag_import_paths[i]);
+        }
+    } else {
+        buf_push(dirs, ".");
+    }
+    char *found = NULL;
+    for (size_t i = 0; i < buf_len(dirs) && !found; i++) {
+        char *path = strcmp(dirs[i], ".") == 0 ? strf("%s", rel_path) : strf("%s/%s", dirs[i], rel_path);
+        FileStat st;
+        if (os_stat(path, &st) && !os_is_dir(path)) {
+            found = path;
+        } else {
+            free(path);
+        }
+    }
+    free(file_dir);
+    buf_free(dirs);
+    buf_free(rel_path);
+    return found;
+}
+
+// Moves the errors reported so far on this thread to the end of *out.
+static void take_errors(Error **out) {
+    for (Error *it = errors; it != buf_end(errors); it++) {
+        buf_push(*out, *it);
+    }
+    buf_free(errors);
+}
+
+// Resolves the imports of a module that just got its Decls, loads the new
+// modules among them and starts its check if they're all checked already.
+static void file_parsed(SourceFile *file) {
+    phase_push(PHASE_IMPORTS);
+    char **paths = NULL;
+    Decl **imports = NULL;
+    Decls *decls = file->decls;
+    for (size_t i = 0; decls && i < decls->num_decls; i++) {
+        Decl *decl = decls->decls[i];
+        if (decl->kind != DECL_IMPORT) {
+            continue;
+        }
+        char *path = resolve_import(file, decl);
+        if (!path) {
+            char *name = import_name(decl);
+            error(decl->pos, "Cannot find module '%s'", name);
+            buf_free(name);
+            continue;
+        }
+        buf_push(paths, path);
+        buf_push(imports, decl);
+    }
+    take_errors(&file->check_errors);
+
+    mutex_lock(&module_mutex);
+    for (size_t i = 0; i < buf_len(paths); i++) {
+        bool is_new;
+        SourceFile *dep = add_module(paths[i], &is_new);
+        if (is_new) {
+            pool_submit(compile_pool, load_file_task, dep);
+        }
+        buf_push(file->deps, dep);
+        buf_push(file->dep_imports, imports[i]);
+        if (!dep->checked) {
+            buf_push(dep->dependents, file);
+            file->deps_left++;
+        }
+    }
+    file->parsed = true;
+    bool ready = file->deps_left == 0;
+    mutex_unlock(&module_mutex);
+    if (ready) {
+        pool_submit(compile_pool, check_file_task, file);
+    }
+
+    for (size_t i = 0; i < buf_len(paths); i++) {
+        free(paths[i]);
+    }
+    buf_free(paths);
+    buf_free(imports);
+    phase_pop();
+}
+
+// The const values of a module depend on its source and on the values of
+// everything it imports.
+static uint64_t const_cache_key(SourceFile *file) {
+    if (!file->content_key || !file->decls) {
+        return 0;
+    }
+    uint64_t key = hash_mix(file->content_key, CACHE_SECTION_CONSTS);
+    for (size_t i = 0; i < buf_len(file->deps); i++) {
+        if (!file->deps[i]->checked || !file->deps[i]->const_key) {
+            return 0;
+        }
+        key = hash_mix(key, file->deps[i]->const_key);
+    }
+    return key;
+}
+
+// Checks what a module takes from the modules it imports, which have all
+// been checked already unless they are on an import cycle, resolves the names
+// it uses, then evaluates its constants, or loads them from the cache.
+static void check_file(SourceFile *file) {
+    phase_push(PHASE_IMPORTS);
+    ModuleScope *scope = &file->scope;
+    for (size_t i = 0; i < buf_len(file->deps); i++) {
+        Decls *dep_decls = file->deps[i]->decls;
+        Decl *import = file->dep_imports[i];
+        if (!dep_decls) {
+            continue;
+        }
+        for (size_t k = 0; import->import.import_all && k < dep_decls->num_decls; k++) {
+            Decl *decl = dep_decls->decls[k];
+            if (decl->name) {
+                map_put(&scope->imports, decl->name, decl);
+            }
+        }
+        for (size_t j = 0; j < import->import.num_items; j++) {
+            ImportItem *item = &import->import.items[j];
+            Decl *found = NULL;
+            for (size_t k = 0; k < dep_decls->num_decls && !found; k++) {
+                if (dep_decls->decls[k]->name == item->name) {
+                    found = dep_decls->decls[k];
+                }
+            }
+            if (found) {
+                map_put(&scope->imports, item->rename ? item->rename : item->name, found);
+            } else {
+                char *module = import_name(import);
+                error(import->pos, "Module '%s' has no declaration '%s'", module, item->name);
+                buf_free(module);
+            }
+        }
+    }
+    phase_pop();
+    if (file->decls) {
+        for (size_t i = 0; i < file->decls->num_decls; i++) {
+            Decl *decl = file->decls->decls[i];
+            if (decl->name) {
+                map_put(&scope->decls, decl->name, decl);
+            }
+        }
+        resolve_module(file->decls, scope);
+        file->const_key = flag_cache_dir ? const_cache_key(file) : 0;
+        bool loaded = false;
+        if (file->const_key) {
+            phase_push(PHASE_CACHE);
+            loaded = cache_load_consts(file->const_key, file->decls);
+            phase_pop();
+        }
+        // consts loaded from the cache are skipped, but fns still need stubs
+        eval_module(file->decls, scope);
+        file->const_store = file->const_key && !loaded && !buf_len(errors) && !buf_len(file->check_errors);
+    }
+    take_errors(&file->check_errors);
+}
+
+static void check_file_task(void *arg) {
+    SourceFile *file = arg;
+    check_file(file);
+    SourceFile **ready = NULL;
+    mutex_lock(&module_mutex);
+    file->checked = true;
+    for (size_t i = 0; i < buf_len(file->dependents); i++) {
+        SourceFile *dependent = file->dependents[i];
+        if (--dependent->deps_left == 0) {
+            buf_push(ready, dependent);
+        }
+    }
+    mutex_unlock(&module_mutex);
+    for (size_t i = 0; i < buf_len(ready); i++) {
+        pool_submit(compile_pool, check_file_task, ready[i]);
+    }
+    buf_free(ready);
+}
+
+// Depth-first search over the unchecked modules: an edge back to a module on
+// the current path closes a cycle. path holds the modules on the path.
+static void find_import_cycles(SourceFile *file, Map *state, SourceFile ***path) {
+    enum { UNVISITED, ON_PATH, DONE };
+    map_put_uint64(state, file, ON_PATH);
+    buf_push(*path, file);
+    for (size_t i = 0; i < buf_len(file->deps); i++) {
+        SourceFile *dep = file->deps[i];
+        if (dep->checked) {
+            continue;
+        }
+        uint64_t dep_state = map_get_uint64(state, dep);
+        if (dep_state == UNVISITED) {
+            find_import_cycles(dep, state, path);
+        } else if (dep_state == ON_PATH) {
+            char *cycle = NULL;
+            size_t start = buf_len(*path);
+            while ((*path)[start - 1] != dep) {
+                start--;
+            }
+            for (size_t j = start - 1; j < buf_len(*path); j++) {
+                buf_printf(cycle, "%s -> ", (*path)[j]->path);
+            }
+            buf_printf(cycle, "%s", dep->path);
+            error(file->dep_imports[i]->pos, "Import cycle: %s", cycle);
+            take_errors(&file->check_errors);
+            buf_free(cycle);
+        }
+    }
+    map_put_uint64(state, file, DONE);
+    buf__hdr(*path)->len--;
+}
+
+static void report_import_cycles(void) {
+    Map state = {0};
+    SourceFile **path = NULL;
+    for (size_t i = 0; i < buf_len(module_list); i++) {
+        SourceFile *file = module_list[i];
+        if (!file->checked && !map_get_uint64(&state, file)) {
+            find_import_cycles(file, &state, &path);
+        }
+    }
+    buf_free(path);
+    map_free(&state);
+}
+
+static int compare_modules(const void *a, const void *b) {
+    const SourceFile *x = *(const SourceFile **)a;
+    const SourceFile *y = *(const SourceFile **)b;
+    if (x->is_root != y->is_root) {
+        return x->is_root ? -1 : 1;
+    }
+    if (x->is_root) {
+        return (x->root_index > y->root_index) - (x->root_index < y->root_index);
+    }
+    return strcmp(x->path, y->path);
+}
+
+// Compiles the files at paths and every module they import. Returns all the
+// modules: the given files in order, then the imported ones sorted by path.
+static SourceFile **compile_files(const char **paths, int num_threads) {
+    compile_pool = pool_create(num_threads);
+    // every root is added before its task can start and import another root
+    SourceFile **roots = NULL;
+    for (size_t i = 0; i < buf_len(paths); i++) {
+        bool is_new;
+        SourceFile *file = add_module(paths[i], &is_new);
+        if (is_new) {
+            file->is_root = true;
+            file->root_index = i;
+            buf_push(roots, file);
+        }
+    }
+    for (size_t i = 0; i < buf_len(roots); i++) {
+        pool_submit(compile_pool, load_file_task, roots[i]);
+    }
+    buf_free(roots);
+    pool_run(compile_pool);
+    pool_free(compile_pool);
+    compile_pool = NULL;
+
+    // whatever is left waits on a cycle
+    report_import_cycles();
+    for (size_t i = 0; i < buf_len(module_list); i++) {
+        SourceFile *file = module_list[i];
+        if (!file->checked) {
+            check_file(file);
+            file->checked = true;
+        }
+    }
+
+    SourceFile **files = NULL;
+    for (size_t i = 0; i < buf_len(module_list); i++) {
+        buf_push(files, module_list[i]);
+    }
+    qsort(files, buf_len(files), sizeof(SourceFile *), compare_modules);
+    bool store = false;
+    for (size_t i = 0; i < buf_len(files); i++) {
+        SourceFile *file = files[i];
+        for (Error *it = file->errors; it != buf_end(file->errors); it++) {
+            buf_push(errors, *it);
+        }
+        for (Error *it = file->check_errors; it != buf_end(file->check_errors); it++) {
+            buf_push(errors, *it);
+        }
+        buf_free(file->check_errors);
+        store |= file->cache_store || file->const_store;
+    }
+    // types need every module's consts, and aren't kept in the cache
+    CheckModule *modules = NULL;
+    for (size_t i = 0; i < buf_len(files); i++) {
+        if (files[i]->decls) {
+            buf_push(modules, (CheckModule){files[i]->decls, &files[i]->scope, files[i]->is_root});
+        }
+    }
+    check_program(modules, buf_len(modules), num_threads);
+    buf_free(modules);
+
+    if (store) {
+        compile_pool = pool_create(num_threads);
+        for (size_t i = 0; i < buf_len(files); i++) {
+            if (files[i]->cache_store || files[i]->const_store) {
+                pool_submit(compile_pool, store_file_task, files[i]);
+            }
+        }
+        pool_run(compile_pool);
+        pool_free(compile_pool);
+        compile_pool = NULL;
+    }
+    if (flag_cache_dir) {
+        cache_evict();
+    }
+    return files;
+}
+
+// Writes the C for files, which compiled without errors.
+static bool write_c_file(SourceFile **files, int num_threads) {
+    CModule *modules = NULL;
+    for (size_t i = 0; i < buf_len(files); i++) {
+        if (files[i]->decls) {
+            buf_push(modules, (CModule){files[i]->decls, &files[i]->scope, files[i]->is_root});
+        }
+    }
+    bool to_stdout = strcmp(flag_emit_c_path, "-") == 0;
+    FILE *file = to_stdout ? stdout : fopen(flag_emit_c_path, "wb");
+    bool ok = file != NULL;
+    if (file) {
+        ok = emit_c(file, modules, buf_len(modules), num_threads);
+        ok = (to_stdout ? fflush(file) : fclose(file)) == 0 && ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "crust: cannot write %s\n", flag_emit_c_path);
+    }
+    // don't leave C that won't compile for a build to pick up
+    if ((!ok || num_errors()) && file && !to_stdout) {
+        remove(flag_emit_c_path);
+    }
+    buf_free(modules);
+    return ok;
+}
+
+// The bytes of a --simd target's vectors, or 0 if there's no such target.
+static int simd_target_bytes(const char *name) {
+    for (size_t i = 0; i < sizeof(simd_targets) / sizeof(*simd_targets); i++) {
+        if (strcmp(name, simd_targets[i].name) == 0) {
+            return simd_targets[i].bytes;
+        }
+    }
+    return 0;
+}
+
+// A --specialize-budget, or -1 if num isn't one.
+static int parse_specialize_budget(const char *num) {
+    char *end;
+    long n = strtol(num, &end, 10);
+    return !*num || *end || n < 0 || n > INT_MAX ? -1 : (int)n;
+}
+
+// Prints what --print-consts and --print-layouts ask for to stdout.
+static void print_decl_info(SourceFile **files) {
+    char *out = NULL;
+    for (size_t i = 0; flag_print_consts && i < buf_len(files); i++) {
+        print_consts(&out, files[i]->decls);
+    }
+    for (size_t i = 0; flag_print_layouts && i < buf_len(files); i++) {
+        print_layouts(&out, files[i]->decls);
+    }
+    if (out) {
+        fwrite(out, 1, buf_len(out), stdout);
+    }
+    buf_free(out);
+}
+
+static void print_usage(void) {
+    fprintf(stderr,
+        "usage: crust [options] <file or directory>...\n"
+        "  -j <n>           use n threads (default: one per core)\n"
+        "  -I <dir>         search dir for imports (default: .)\n"
+        "  --json-errors    stream diagnostics as JSON lines to stderr\n"
+        "  --lazy-fn-bodies parse, resolve and check only the fn bodies the\n"
+        "                   program reaches (ignored with --cache-dir)\n"
+        "  --print-consts   print the value of every top-level const\n"
+        "  --print-layouts  print the size of every struct and union and where\n"
+        "                   its fields are\n"
+        "  -o <file>        write the program as C to file, or to stdout for -\n"
+        "  --simd <target>  size map and reduce vectors for sse2, avx2 or avx512\n"
+        "                   (default: sse2)\n"
+        "  --specialize-budget <n>\n"
+        "                   AST nodes of generic instances to make before calls\n"
+        "                   use a shared version where one fits (default 4096)\n"
+        "  --cache-dir <dir> reuse parse results and const values stored in dir\n"
+        "  --cache-size <mb> trim the cache dir to this size (default 256)\n"
+        "  --time-report[=json]\n"
+        "                   print time per phase and counters\n"
+        "  --server <sock>  run as a compile server on a Unix domain socket\n"
+        "  --connect <sock> <args>...\n"
+        "                   have the server at sock compile args, which may\n"
+        "                   also be --stats or --shutdown\n");
+}
+
+static int driver_main(int argc, const char **argv) {
+    uint64_t start_ns = os_time_ns();
+    init_keywords();
+    const char *server_path = NULL;
+    const char **paths = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "-j", 2) == 0) {
+            const char *num = arg[2] ? arg + 2 : (i + 1 < argc ? argv[++i] : "");
+            char *end;
+            long n = strtol(num, &end, 10);
+            if (!*num || *end || n < 1) {
+                fprintf(stderr, "crust: invalid thread count '%s'\n", num);
+                return 1;
+            }
+            flag_num_jobs = (int)n;
+        } else if (strcmp(arg, "--time-report") == 0) {
+            flag_time_report = TIME_REPORT_TABLE;
+        } else if (strcmp(arg, "--time-report=json") == 0) {
+            flag_time_report = TIME_REPORT_JSON;
+        } else if (strcmp(arg, "-I") == 0 && i + 1 < argc) {
+            buf_push(flag_import_paths, argv[++i]);
+        } else if (strncmp(arg, "-I", 2) == 0 && arg[2]) {
+            buf_push(flag_import_paths, arg + 2);
+        } else if (strcmp(arg, "--cache-dir") == 0 && i + 1 < argc) {
+            flag_cache_dir = argv[++i];
+        } else if (strcmp(arg, "--cache-size") == 0 && i + 1 < argc) {
+            flag_cache_size_mb = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(arg, "-o") == 0 && i + 1 < argc) {
+            flag_emit_c_path = argv[++i];
+        } else if (strcmp(arg, "--simd") == 0 && i + 1 < argc) {
+            const char *target = argv[++i];
+            flag_simd_bytes = simd_target_bytes(target);
+            if (!flag_simd_bytes) {
+                fprintf(stderr, "crust: unknown SIMD target '%s'\n", target);
+                return 1;
+            }
+        } else if (strcmp(arg, "--specialize-budget") == 0 && i + 1 < argc) {
+            const char *num = argv[++i];
+            flag_specialize_budget = parse_specialize_budget(num);
+            if (flag_specialize_budget < 0) {
+                fprintf(stderr, "crust: invalid specialize budget '%s'\n", num);
+                return 1;
+            }
+        } else if (strcmp(arg, "--print-consts") == 0) {
+            flag_print_consts = true;
+        } else if (strcmp(arg, "--print-layouts") == 0) {
+            flag_print_layouts = true;
+        } else if (strcmp(arg, "--json-errors") == 0) {
+            flag_json_errors = true;
+        } else if (strcmp(arg, "--lazy-fn-bodies") == 0) {
+            flag_lazy_fn_bodies = true;
+        } else if (strcmp(arg, "--server") == 0 && i + 1 < argc) {
+            server_path = argv[++i];
+        } else if (strcmp(arg, "--connect") == 0 && i + 1 < argc) {
+            return client_main(argv[i + 1], argc - i - 2, argv + i + 2);
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_usage();
+            return 0;
+        } else if (arg[0] == '-' && arg[1]) {
+            fprintf(stderr, "crust: unknown option '%s'\n", arg);
+            print_usage();
+            return 1;
+        } else {
+            add_source_paths(&paths, arg);
+        }
+    }
+    if (server_path) {
+        return server_main(server_path);
+    }
+    if (!paths) {
+        print_usage();
+        return 1;
+    }
+    if (flag_cache_dir && !os_mkdir(flag_cache_dir)) {
+        fprintf(stderr, "crust: cannot create cache directory %s\n", flag_cache_dir);
+        flag_cache_dir = NULL;
+    }
+    // a cache hit skips parsing altogether, and the cache stores whole files
+    if (flag_cache_dir) {
+        flag_lazy_fn_bodies = false;
+    }
+    int num_threads = flag_num_jobs ? flag_num_jobs : os_num_cores();
+    const_cache_init();
+    type_init();
+    check_reach_init();
+    lazy_body_init();
+    SourceFile **files = compile_files(paths, num_threads);
+    print_decl_info(files);
+    bool write_failed = false;
+    if (flag_emit_c_path && !num_errors()) {
+        write_failed = !write_c_file(files, num_threads);
+    }
+    buf_free(files);
+    buf_free(paths);
+    size_t num_errors_found = num_errors();
+    phase_push(PHASE_DIAGNOSTICS);
+    flush_errors();
+    phase_pop();
+    if (flag_time_report) {
+        char *report = NULL;
+        print_time_report(&report, os_time_ns() - start_ns, flag_time_report);
+        fwrite(report, 1, buf_len(report), stdout);
+        buf_free(report);
+    }
+    return num_errors_found || write_failed ? 1 : 0;
+}
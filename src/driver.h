@@ -0,0 +1,101 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "error.h"
+#include "lex.h"
+#include "ast.h"
+#include "parse.h"
+#include "pool.h"
+#include "bytecode.h"
+#include "cache.h"
+#include "emit.h"
+
+// Compiler driver. Every input file goes through load -> split -> parse as
+// tasks on a work-stealing pool, so a single big file is parsed in chunks in
+// parallel just like many small ones.
+//
+// Files are modules. Once a module is parsed, its imports are resolved and
+// any module not seen before is loaded right away, so the import graph is
+// discovered while parsing goes on. A module is checked once every module it
+// imports has been checked, and finishing a check starts the dependents that
+// were waiting only on it. Modules left unchecked when the pool runs dry are
+// on or behind an import cycle, which is reported before they are checked.
+// The results are gathered in command line order, then the discovered
+// modules by path, which keeps output independent of scheduling.
+
+typedef struct SourceFile SourceFile;
+
+typedef struct ParseTask {
+    SourceFile *file;
+    ParseJob *job;
+} ParseTask;
+
+struct SourceFile {
+    const char *path;
+    // module table key: the interned absolute path
+    const char *full_path;
+    char *buf;
+    // runs of declarations parsed as separate tasks
+    ParseJob *jobs;
+    ParseTask *parse_tasks;
+    int jobs_left;
+    Decls *decls;
+    // load and syntax errors, which are what the cache stores
+    Error *errors;
+    // errors from resolving imports and checking
+    Error *check_errors;
+    // cache keys, see cache.h
+    uint64_t stat_key;
+    uint64_t content_key;
+    // 0 when the consts can't be cached: the file wasn't cached or an import
+    // is on a cycle
+    uint64_t const_key;
+    bool cache_store;
+    bool const_store;
+
+    // import graph; dep_imports[i] is the import decl for deps[i]
+    SourceFile **deps;
+    Decl **dep_imports;
+    SourceFile **dependents;
+    // imported modules not checked yet
+    int deps_left;
+    // top-level names, for lowering the module's fns
+    ModuleScope scope;
+    bool is_root;
+    size_t root_index;
+    bool parsed;
+    bool checked;
+};
+
+// A module parsed before the compile started, which is used instead of
+// reading the file. The compile server preloads the files it keeps parsed.
+typedef struct PreloadedModule {
+    Decls *decls;
+    Error *errors;
+    // the source, for the const cache key
+    const char *buf;
+} PreloadedModule;
+
+// Files are parsed in chunks of about this many bytes.
+#define PARSE_CHUNK_SIZE (256 * 1024)
+
+static void add_source_paths(const char ***paths, const char *path);
+static void preload_module(const char *full_path, Decls *decls, Error *errors, const char *buf);
+static bool load_file_cached(SourceFile *file);
+static void load_file_task(void *arg);
+static void store_file_task(void *arg);
+static void parse_job_task(void *arg);
+static SourceFile *add_module(const char *path, bool *is_new);
+static char *resolve_import(SourceFile *file, Decl *decl);
+static void file_parsed(SourceFile *file);
+static void check_file(SourceFile *file);
+static void check_file_task(void *arg);
+static void report_import_cycles(void);
+static SourceFile **compile_files(const char **paths, int num_threads);
+static bool write_c_file(SourceFile **files, int num_threads);
+static int simd_target_bytes(const char *name);
+static int parse_specialize_budget(const char *num);
+static void print_decl_info(SourceFile **files);
+static void print_usage(void);
+static int driver_main(int argc, const char **argv);
@@ -0,0 +1,3034 @@
+#include "emit.h"
+
+// C name of every top-level Decl, interned, and the scope of the module it's
+// in
+static Map c_names;
+static Map c_decl_scopes;
+// every fn instance, as hash of (decl, types) to CInstance chain, and in the
+// order they were reached
+static Map c_instances;
+static CInstance **c_instance_list;
+static Arena c_instance_arena;
+// set during the discovery pass, the only time instances are added
+static bool c_discovering;
+// instances the discovery pass has reached and is yet to walk or has walked,
+// in the order they were reached; likewise the global vars, which are also
+// in c_reached_vars
+static CInstance **c_reach_queue;
+static Decl **c_var_queue;
+static Map c_reached_vars;
+// generic fn to its CShared, once asked for
+static Map c_shared_fns;
+// AST nodes in the instances made of fns with a shared version
+static size_t c_specialized_size;
+// every instance calls go through a shared version for, in the order they
+// were reached, which name the tables to write
+static CInstance **c_table_list;
+// names that can't be used as they are: C keywords and what the prelude
+// declares
+static Map c_reserved;
+static CVectorType c_vector_types[C_NUM_VECTOR_TYPES];
+// interned vector type name to its CType + 1
+static Map c_vector_names;
+static const char *c_builtin_names[NUM_C_BUILTINS];
+// some source names a vector type, or may use a kernel
+static bool c_uses_vectors;
+// lane types of the vector types, in the order of c_vector_types
+static const BcType c_vector_lanes[] = {BC_I8, BC_I16, BC_I32, BC_I64, BC_U8, BC_U16, BC_U32, BC_U64, BC_F32, BC_F64};
+static const int c_vector_sizes[] = {16, 32, 64};
+// pointer types' names in C, in source and in instance names
+static const char *c_ptr_type_names[NUM_BC_TYPES];
+static const char *c_ptr_source_names[NUM_BC_TYPES];
+static const char *c_ptr_mangled_names[NUM_BC_TYPES];
+// every struct and union, in the order of layout_list, which puts the ones a
+// struct contains before it, and the CType + 1 of each decl
+static CStruct *c_structs;
+static Map c_struct_types;
+// every kernel, as hash of (kind, decl, element type) to CKernel chain, and
+// in the order they were reached
+static Map c_kernels;
+static CKernel **c_kernel_list;
+
+static const char *c_type_names[] = {
+    [BC_VOID] = "void",
+    [BC_BOOL] = "bool",
+    [BC_I8] = "int8_t",
+    [BC_I16] = "int16_t",
+    [BC_I32] = "int32_t",
+    [BC_I64] = "int64_t",
+    [BC_U8] = "uint8_t",
+    [BC_U16] = "uint16_t",
+    [BC_U32] = "uint32_t",
+    [BC_U64] = "uint64_t",
+    [BC_F32] = "float",
+    [BC_F64] = "double",
+};
+
+static const char *c_reserved_names[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum",
+    "extern", "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return",
+    "short", "signed", "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void",
+    "volatile", "while", "_Alignas", "_Alignof", "_Atomic", "_Bool", "_Complex", "_Generic",
+    "_Imaginary", "_Noreturn", "_Static_assert", "_Thread_local", "bool", "true", "false", "NULL",
+    "offsetof", "size_t", "ptrdiff_t", "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t",
+    "uint16_t", "uint32_t", "uint64_t", "uintptr_t", "memcpy", "main",
+};
+
+static const char c_prelude[] =
+    "#include <stdbool.h>\n"
+    "#include <stddef.h>\n"
+    "#include <stdint.h>\n";
+
+// Written after the prelude when some struct has bit fields, followed by a
+// CR_SET_BITS for every type of word they are in. The value is shifted as a
+// uint64_t so no bit goes past a promoted int's.
+static const char c_bits_prelude[] =
+    "#define CR_SET_BITS(T) \\\n"
+    "    static inline void cr_set_bits_##T(T *word, T mask, int shift, T value) { \\\n"
+    "        *word = (T)((*word & (T)~mask) | ((T)((uint64_t)value << shift) & mask)); \\\n"
+    "    }\n";
+
+// Written after the prelude when vectors are used, followed by a
+// CR_VECTOR_TYPE for every vector type and then the ops of each.
+static const char c_vector_prelude[] =
+    "#include <string.h>\n"
+    "\n"
+    "#if !defined(CR_SCALAR_VECTORS) && (defined(__GNUC__) || defined(__clang__))\n"
+    "#if defined(__GNUC__) && !defined(__clang__)\n"
+    "#pragma GCC diagnostic ignored \"-Wpsabi\"\n"
+    "#endif\n"
+    "#define CR_LANE(x, i) (x)[i]\n"
+    "#define CR_MAKE(V, ...) ((V){__VA_ARGS__})\n"
+    "#define CR_VECTOR_TYPE(V, T, L) typedef T V __attribute__((vector_size(sizeof(T) * (L))));\n"
+    "#define CR_SPLAT(V, T) static inline V V##_splat(T x) { return (V){0} + x; }\n"
+    "#define CR_UNARY(V, T, name, op) static inline V V##_##name(V a) { return op a; }\n"
+    "#define CR_BINARY(V, T, name, op) static inline V V##_##name(V a, V b) { return a op b; }\n"
+    "#define CR_COMPARE(V, T, M, name, op) static inline M V##_##name(V a, V b) { return (M)(a op b); }\n"
+    "#define CR_SELECT(V, T, M) static inline V V##_select(M m, V a, V b) { \\\n"
+    "    m = (M)(m != 0); return (V)(((M)a & m) | ((M)b & ~m)); }\n"
+    "#define CR_SHUFFLE_FN(V, T)\n"
+    "#define CR_ASSUME_ALIGNED(p, n) __builtin_assume_aligned(p, n)\n"
+    "#if defined(__clang__) || __GNUC__ >= 12\n"
+    "#define CR_SHUFFLE(V, M, v, ...) ((V)__builtin_shufflevector(v, (V){0}, __VA_ARGS__))\n"
+    "#else\n"
+    "#define CR_SHUFFLE(V, M, v, ...) __builtin_shuffle(v, (M){__VA_ARGS__})\n"
+    "#endif\n"
+    "#else\n"
+    "#define CR_LANE(x, i) (x).v[i]\n"
+    "#define CR_MAKE(V, ...) ((V){{__VA_ARGS__}})\n"
+    "#define CR_VECTOR_TYPE(V, T, L) typedef struct V { T v[L]; } V;\n"
+    "#define CR_FOR_LANES(V, T) for (size_t i = 0; i < sizeof(V) / sizeof(T); i++)\n"
+    "#define CR_SPLAT(V, T) static inline V V##_splat(T x) { V r; CR_FOR_LANES(V, T) r.v[i] = x; return r; }\n"
+    "#define CR_UNARY(V, T, name, op) static inline V V##_##name(V a) { \\\n"
+    "    V r; CR_FOR_LANES(V, T) r.v[i] = (T)(op a.v[i]); return r; }\n"
+    "#define CR_BINARY(V, T, name, op) static inline V V##_##name(V a, V b) { \\\n"
+    "    V r; CR_FOR_LANES(V, T) r.v[i] = (T)(a.v[i] op b.v[i]); return r; }\n"
+    "#define CR_COMPARE(V, T, M, name, op) static inline M V##_##name(V a, V b) { \\\n"
+    "    M r; CR_FOR_LANES(V, T) r.v[i] = a.v[i] op b.v[i] ? -1 : 0; return r; }\n"
+    "#define CR_SELECT(V, T, M) static inline V V##_select(M m, V a, V b) { \\\n"
+    "    V r; CR_FOR_LANES(V, T) r.v[i] = m.v[i] ? a.v[i] : b.v[i]; return r; }\n"
+    "#define CR_SHUFFLE_FN(V, T) static inline V V##_shuffle(V a, const int *lanes) { \\\n"
+    "    V r; CR_FOR_LANES(V, T) r.v[i] = a.v[lanes[i]]; return r; }\n"
+    "#define CR_SHUFFLE(V, M, v, ...) V##_shuffle(v, (const int[]){__VA_ARGS__})\n"
+    "#define CR_ASSUME_ALIGNED(p, n) (p)\n"
+    "#endif\n"
+    "#define CR_MEMORY(V, T) \\\n"
+    "    static inline V V##_load(const T *p) { V r; memcpy(&r, p, sizeof(r)); return r; } \\\n"
+    "    static inline void V##_store_aligned(T *p, V v) { memcpy(CR_ASSUME_ALIGNED(p, sizeof(V)), &v, sizeof(V)); }\n"
+    "#define CR_REDUCE(V, T) \\\n"
+    "    static inline bool V##_any(V m) { \\\n"
+    "        for (size_t i = 0; i < sizeof(V) / sizeof(T); i++) { if (CR_LANE(m, i)) return true; } return false; } \\\n"
+    "    static inline bool V##_all(V m) { \\\n"
+    "        for (size_t i = 0; i < sizeof(V) / sizeof(T); i++) { if (!CR_LANE(m, i)) return false; } return true; }\n"
+    "#define CR_VECTOR_OPS(V, T, M) \\\n"
+    "    CR_SPLAT(V, T) CR_UNARY(V, T, neg, -) CR_BINARY(V, T, add, +) CR_BINARY(V, T, sub, -) \\\n"
+    "    CR_BINARY(V, T, mul, *) CR_BINARY(V, T, div, /) CR_COMPARE(V, T, M, eq, ==) CR_COMPARE(V, T, M, ne, !=) \\\n"
+    "    CR_COMPARE(V, T, M, lt, <) CR_COMPARE(V, T, M, le, <=) CR_COMPARE(V, T, M, gt, >) \\\n"
+    "    CR_COMPARE(V, T, M, ge, >=) CR_SELECT(V, T, M) CR_SHUFFLE_FN(V, T) CR_MEMORY(V, T)\n"
+    "#define CR_INT_VECTOR_OPS(V, T, M) \\\n"
+    "    CR_VECTOR_OPS(V, T, M) CR_UNARY(V, T, not, ~) CR_BINARY(V, T, mod, %) CR_BINARY(V, T, and, &) \\\n"
+    "    CR_BINARY(V, T, or, |) CR_BINARY(V, T, xor, ^) CR_BINARY(V, T, shl, <<) CR_BINARY(V, T, shr, >>) \\\n"
+    "    CR_REDUCE(V, T)\n";
+
+// Helper each operator on vectors calls; the rest don't apply to them.
+static const char *c_vector_ops[NUM_TOKEN_KINDS] = {
+    [TOKEN_ADD] = "add",
+    [TOKEN_SUB] = "sub",
+    [TOKEN_MUL] = "mul",
+    [TOKEN_DIV] = "div",
+    [TOKEN_MOD] = "mod",
+    [TOKEN_AND] = "and",
+    [TOKEN_OR] = "or",
+    [TOKEN_XOR] = "xor",
+    [TOKEN_LSHIFT] = "shl",
+    [TOKEN_RSHIFT] = "shr",
+    [TOKEN_EQ] = "eq",
+    [TOKEN_NOTEQ] = "ne",
+    [TOKEN_LT] = "lt",
+    [TOKEN_GT] = "gt",
+    [TOKEN_LTEQ] = "le",
+    [TOKEN_GTEQ] = "ge",
+};
+
+// Output
+
+static void
+c_flush(CWriter *w) {
+    size_t len = buf_len(w->buf);
+    if (w->file && len && !w->discard) {
+        if (fwrite(w->buf, len, 1, w->file) != 1) {
+            w->failed = true;
+        }
+        STATS_ADD(emit_bytes, len);
+        buf_clear(w->buf);
+    }
+}
+
+static void
+c_write(CWriter *w, const char *str, size_t len) {
+    if (w->discard) {
+        return;
+    }
+    buf_fit(w->buf, buf_len(w->buf) + len);
+    memcpy(w->buf + buf_len(w->buf), str, len);
+    buf__hdr(w->buf)->len += len;
+    if (w->file && buf_len(w->buf) >= EMIT_CHUNK_SIZE) {
+        c_flush(w);
+    }
+}
+
+static void
+c_str(CWriter *w, const char *str) {
+    c_write(w, str, strlen(str));
+}
+
+// For numbers, which are short.
+static void
+c_printf(CWriter *w, const char *fmt, ...) {
+    char text[128];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    assert(n >= 0 && n < (int)sizeof(text));
+    c_write(w, text, (size_t)n);
+}
+
+static void
+c_newline(CEmitter *e) {
+    static const char spaces[] = "                                ";
+    c_write(e->out, "\n", 1);
+    for (int n = e->indent * 4; n > 0; n -= (int)sizeof(spaces) - 1) {
+        c_write(e->out, spaces, n < (int)sizeof(spaces) - 1 ? (size_t)n : sizeof(spaces) - 1);
+    }
+}
+
+static void
+emit_c_literal(CWriter *w, CType type, Val val) {
+    switch (type) {
+    case BC_BOOL:
+        c_str(w, val.ull ? "true" : "false");
+        break;
+    case BC_F32:
+    case BC_F64: {
+        const char *suffix = type == BC_F32 ? "f" : "";
+        if (isnan(val.d)) {
+            c_printf(w, "(0.0%s/0.0%s)", suffix, suffix);
+        } else if (isinf(val.d)) {
+            c_printf(w, "(%s1.0%s/0.0%s)", val.d < 0 ? "-" : "", suffix, suffix);
+        } else {
+            char text[64];
+            snprintf(text, sizeof(text), "%.*g", type == BC_F32 ? 9 : 17, val.d);
+            const char *point = strpbrk(text, ".e") ? "" : ".0";
+            c_printf(w, val.d < 0 ? "(%s%s%s)" : "%s%s%s", text, point, suffix);
+        }
+        break;
+    }
+    case BC_I64:
+        if (val.ll == INT64_MIN) {
+            c_str(w, "(-9223372036854775807LL-1)");
+        } else {
+            c_printf(w, val.ll < 0 ? "(%lldLL)" : "%lldLL", val.ll);
+        }
+        break;
+    case BC_I8:
+    case BC_I16:
+    case BC_I32:
+        if (val.ll == INT32_MIN) {
+            c_str(w, "(-2147483647-1)");
+        } else {
+            c_printf(w, val.ll < 0 ? "(%lld)" : "%lld", val.ll);
+        }
+        break;
+    case BC_U32:
+        c_printf(w, "%lluu", val.ull);
+        break;
+    case BC_U64:
+        c_printf(w, "%lluULL", val.ull);
+        break;
+    default:
+        c_printf(w, "%llu", val.ull);
+        break;
+    }
+}
+
+// Octal escapes are always three digits, so a digit after one can't run into
+// it, and '?' after '?' is escaped so it can't start a trigraph.
+static void
+emit_c_string(CWriter *w, const char *str) {
+    c_write(w, "\"", 1);
+    for (const char *it = str; *it; it++) {
+        unsigned char c = (unsigned char)*it;
+        if (c == '"' || c == '\\' || (c == '?' && it > str && it[-1] == '?')) {
+            char escape[2] = {'\\', (char)c};
+            c_write(w, escape, 2);
+        } else if (c == '\n') {
+            c_write(w, "\\n", 2);
+        } else if (c == '\t') {
+            c_write(w, "\\t", 2);
+        } else if (c < 0x20 || c >= 0x7f) {
+            c_printf(w, "\\%03o", c);
+        } else {
+            c_write(w, it, 1);
+        }
+    }
+    c_write(w, "\"", 1);
+}
+
+// Names and types
+
+// Besides c_reserved, cr_ and CR_ begin the names of the vector helpers.
+static bool
+c_is_reserved(const char *name) {
+    return map_get(&c_reserved, name) != NULL || strncmp(name, "cr_", 3) == 0 || strncmp(name, "CR_", 3) == 0;
+}
+
+// C name for a param or local.
+static const char *
+c_local_name(const char *name) {
+    if (!c_is_reserved(name)) {
+        return name;
+    }
+    char *c_name = strf("%s_", name);
+    const char *interned = str_intern(c_name);
+    free(c_name);
+    return interned;
+}
+
+static CVectorType *
+c_vector(CType type) {
+    assert(C_IS_VECTOR(type));
+    return &c_vector_types[type - C_FIRST_VECTOR];
+}
+
+static CStruct *
+c_struct(CType type) {
+    assert(C_IS_STRUCT(type));
+    return &c_structs[type - C_FIRST_STRUCT];
+}
+
+static const char *
+c_type_name(CType type) {
+    if (C_IS_PTR(type)) {
+        CType elem = C_PTR_ELEM(type);
+        return C_IS_STRUCT(elem) ? c_struct(elem)->ptr_name : c_ptr_type_names[elem];
+    } else if (C_IS_STRUCT(type)) {
+        return c_struct(type)->c_name;
+    }
+    return C_IS_VECTOR(type) ? c_vector(type)->c_name : c_type_names[type];
+}
+
+// The type's name in source, for messages and instance arguments.
+static const char *
+c_source_type_name(CType type) {
+    if (C_IS_PTR(type)) {
+        CType elem = C_PTR_ELEM(type);
+        return C_IS_STRUCT(elem) ? c_struct(elem)->ptr_source_name : c_ptr_source_names[elem];
+    } else if (C_IS_STRUCT(type)) {
+        return c_struct(type)->layout->decl->name;
+    }
+    return C_IS_VECTOR(type) ? c_vector(type)->name : bc_type_names[type];
+}
+
+// The type's part of an instance's name, which unlike its source name is
+// unique: a struct is named like in C.
+static const char *
+c_mangled_type_name(CType type) {
+    if (C_IS_PTR(type)) {
+        CType elem = C_PTR_ELEM(type);
+        return C_IS_STRUCT(elem) ? c_struct(elem)->ptr_mangled_name : c_ptr_mangled_names[elem];
+    }
+    return C_IS_STRUCT(type) ? c_struct(type)->c_name : c_source_type_name(type);
+}
+
+static void c_struct_use(CType type);
+
+// Writes the declaration of name as a type.
+static void
+c_declare(CWriter *w, CType type, const char *name) {
+    if (c_discovering) {
+        c_struct_use(type);
+    }
+    c_str(w, c_type_name(type));
+    if (!C_IS_PTR(type)) {
+        c_write(w, " ", 1);
+    }
+    c_str(w, name);
+}
+
+static CType
+c_ptr_type(CType elem) {
+    return (elem > BC_VOID && elem < NUM_BC_TYPES) || C_IS_STRUCT(elem) ? C_PTR(elem) : NUM_BC_TYPES;
+}
+
+// Marks a vector type as one the prelude defines, along with its mask.
+static void
+c_vector_use(CType type) {
+    CVectorType *vector = c_vector(type);
+    if (vector->c_name) {
+        return;
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "%sx%d", bc_type_names[vector->lane], vector->num_lanes);
+    vector->name = str_intern(name);
+    char *c_name = strf("cr_%s", name);
+    vector->c_name = str_intern(c_name);
+    free(c_name);
+    vector->used = true;
+    map_put_uint64(&c_vector_names, (void *)vector->name, type + 1);
+    c_vector_use(vector->mask);
+}
+
+// The vector of elem as wide as the target's vector registers.
+static CType
+c_simd_type(BcType elem) {
+    int size = 0;
+    while (c_vector_sizes[size] != flag_simd_bytes) {
+        size++;
+    }
+    for (int i = 0; i < (int)(sizeof(c_vector_lanes) / sizeof(*c_vector_lanes)); i++) {
+        if (c_vector_lanes[i] == elem) {
+            return (CType)(C_FIRST_VECTOR + i * (int)(sizeof(c_vector_sizes) / sizeof(*c_vector_sizes)) + size);
+        }
+    }
+    return NUM_BC_TYPES;
+}
+
+// Fills in c_vector_types, in order of lane type and then size, and marks the
+// ones some source names as used. Names no source has interned can't be in
+// any, so that is all it takes to tell; a kernel marks the one it uses.
+static void
+c_vector_init(void) {
+    const int num_sizes = sizeof(c_vector_sizes) / sizeof(*c_vector_sizes);
+    assert(sizeof(c_vector_lanes) / sizeof(*c_vector_lanes) * num_sizes == C_NUM_VECTOR_TYPES);
+    for (int i = 0; i < C_NUM_VECTOR_TYPES; i++) {
+        BcType lane = c_vector_lanes[i / num_sizes];
+        int lane_bytes = bc_type_bits(lane) / 8;
+        // the signed integer lanes of the same width come first, in order
+        int mask_lane = lane_bytes == 1 ? 0 : lane_bytes == 2 ? 1 : lane_bytes == 4 ? 2 : 3;
+        c_vector_types[i] = (CVectorType){
+            .lane = lane,
+            .num_lanes = (u8)(c_vector_sizes[i % num_sizes] / lane_bytes),
+            .mask = (CType)(C_FIRST_VECTOR + mask_lane * num_sizes + i % num_sizes),
+        };
+    }
+    c_builtin_names[C_BUILTIN_SELECT] = "select";
+    c_builtin_names[C_BUILTIN_ANY] = "any";
+    c_builtin_names[C_BUILTIN_ALL] = "all";
+    c_builtin_names[C_BUILTIN_SHUFFLE] = "shuffle";
+    c_builtin_names[C_BUILTIN_MAP] = "map";
+    c_builtin_names[C_BUILTIN_REDUCE] = "reduce";
+    c_uses_vectors = str_interned("map") || str_interned("reduce");
+    for (int i = 0; i < C_NUM_VECTOR_TYPES; i++) {
+        CVectorType *vector = &c_vector_types[i];
+        char name[16];
+        snprintf(name, sizeof(name), "%sx%d", bc_type_names[vector->lane], vector->num_lanes);
+        if (str_interned(name)) {
+            c_vector_use((CType)(C_FIRST_VECTOR + i));
+            c_uses_vectors = true;
+        }
+    }
+    for (int i = C_BUILTIN_SELECT; i < NUM_C_BUILTINS; i++) {
+        c_builtin_names[i] = str_intern(c_builtin_names[i]);
+    }
+    for (int i = BC_BOOL; i < NUM_BC_TYPES && !c_ptr_type_names[i]; i++) {
+        c_ptr_type_names[i] = strf("%s *", c_type_names[i]);
+        c_ptr_source_names[i] = strf("%s*", bc_type_names[i]);
+        c_ptr_mangled_names[i] = strf("%sp", bc_type_names[i]);
+    }
+}
+
+// The type a typespec names outside any generic fn, in the module with scope.
+static CType
+c_named_type(ModuleScope *scope, Typespec *type) {
+    if (type && (type->kind == TYPESPEC_PTR || type->kind == TYPESPEC_ARRAY)) {
+        return c_ptr_type(c_named_type(scope, type->base));
+    }
+    CType result = bc_type_from_typespec(scope, type);
+    if (result == NUM_BC_TYPES && c_uses_vectors && type->kind == TYPESPEC_NAME && type->num_names == 1) {
+        uint64_t vector = map_get_uint64(&c_vector_names, (void *)type->names[0]);
+        if (vector) {
+            return (CType)(vector - 1);
+        }
+    }
+    if (result == NUM_BC_TYPES && scope && type->kind == TYPESPEC_NAME && type->num_names == 1) {
+        Decl *decl = map_get(&scope->decls, type->names[0]);
+        decl = decl ? decl : map_get(&scope->imports, type->names[0]);
+        uint64_t struct_type = decl ? map_get_uint64(&c_struct_types, decl) : 0;
+        if (struct_type) {
+            return (CType)(struct_type - 1);
+        }
+    }
+    return result;
+}
+
+// The type named by type inside decl, whose generic params are bound to
+// types.
+static CType
+c_bound_type(Decl *decl, CType *types, Typespec *type) {
+    if (type && (type->kind == TYPESPEC_PTR || type->kind == TYPESPEC_ARRAY)) {
+        return c_ptr_type(c_bound_type(decl, types, type->base));
+    }
+    if (types && type && type->kind == TYPESPEC_NAME && type->num_names == 1) {
+        for (size_t i = 0; i < decl->fn.num_generics; i++) {
+            if (decl->fn.generics[i].name == type->names[0]) {
+                return types[i];
+            }
+        }
+    }
+    return c_named_type(map_get(&c_decl_scopes, decl), type);
+}
+
+// The CType of a checked type, where an array is a pointer to its first
+// element like everywhere else.
+static CType
+c_type_from_type(Type *type) {
+    switch (type->kind) {
+    case TYPE_SCALAR:
+    case TYPE_ENUM:
+        return type->scalar;
+    case TYPE_VECTOR: {
+        // its name is interned if some source named it
+        const char *name = str_interned(type->name);
+        uint64_t vector = name ? map_get_uint64(&c_vector_names, (void *)name) : 0;
+        return vector ? (CType)(vector - 1) : NUM_BC_TYPES;
+    }
+    case TYPE_PTR:
+    case TYPE_ARRAY:
+        return c_ptr_type(c_type_from_type(type->base));
+    case TYPE_STRUCT:
+    case TYPE_UNION: {
+        uint64_t struct_type = map_get_uint64(&c_struct_types, type->decl);
+        return struct_type ? (CType)(struct_type - 1) : NUM_BC_TYPES;
+    }
+    default:
+        return NUM_BC_TYPES;
+    }
+}
+
+// Marks the struct type is or points to as used, and the ones its fields
+// need.
+static void
+c_struct_use(CType type) {
+    if (C_IS_PTR(type)) {
+        type = C_PTR_ELEM(type);
+    }
+    if (!C_IS_STRUCT(type) || c_struct(type)->used) {
+        return;
+    }
+    Layout *layout = c_struct(type)->layout;
+    c_struct(type)->used = true;
+    for (size_t i = 0; i < layout->num_fields; i++) {
+        c_struct_use(c_type_from_type(layout->fields[i].type));
+    }
+}
+
+static CType
+c_resolve_type(CEmitter *e, Typespec *type) {
+    return e->instance ? c_bound_type(e->instance->decl, e->instance->types, type) : c_named_type(e->scope, type);
+}
+
+static CType
+c_type_from_typespec(CEmitter *e, Typespec *type) {
+    CType result = c_resolve_type(e, type);
+    if (result == NUM_BC_TYPES) {
+        error(type->pos, "Type can't be compiled to C yet");
+    }
+    return result;
+}
+
+static CLocal *
+c_find_local(CEmitter *e, const char *name) {
+    for (size_t i = buf_len(e->locals); i > 0; i--) {
+        if (e->locals[i - 1].name == name) {
+            return &e->locals[i - 1];
+        }
+    }
+    return NULL;
+}
+
+static Decl *
+c_find_decl(ModuleScope *scope, const char *name) {
+    Decl *decl = map_get(&scope->decls, name);
+    return decl ? decl : map_get(&scope->imports, name);
+}
+
+static CType c_global_type(Decl *decl);
+
+// The generic fn a call calls, if it does.
+static Decl *
+c_generic_callee(CEmitter *e, Expr *call) {
+    Expr *callee = call->call.expr;
+    if (callee->kind != EXPR_NAME || c_find_local(e, callee->name)) {
+        return NULL;
+    }
+    Decl *decl = c_find_decl(e->scope, callee->name);
+    return decl && decl->kind == DECL_FUNC && decl->fn.num_generics ? decl : NULL;
+}
+
+// The builtin a call calls, if it does; a vector's type goes in vector.
+// Builtins are only names no local or declaration takes.
+static CBuiltin
+c_builtin_callee(CEmitter *e, Expr *call, CType *vector) {
+    Expr *callee = call->call.expr;
+    if (callee->kind != EXPR_NAME || c_find_local(e, callee->name) || c_find_decl(e->scope, callee->name)) {
+        return C_BUILTIN_NONE;
+    }
+    uint64_t type = c_uses_vectors ? map_get_uint64(&c_vector_names, (void *)callee->name) : 0;
+    if (type) {
+        *vector = (CType)(type - 1);
+        return C_BUILTIN_VECTOR;
+    }
+    for (int i = C_BUILTIN_SELECT; i < NUM_C_BUILTINS; i++) {
+        if (c_builtin_names[i] == callee->name) {
+            return i;
+        }
+    }
+    return C_BUILTIN_NONE;
+}
+
+// The type of left op right when either is a vector, or NUM_BC_TYPES if op
+// can't be used on them. The other may be a scalar, which becomes one value
+// for every lane, but not a float with integer lanes.
+static CType
+c_vector_binary_type(TokenKind op, CType left, CType right) {
+    if (!c_vector_ops[op] || left == NUM_BC_TYPES || right == NUM_BC_TYPES || left == BC_VOID || right == BC_VOID
+        || C_IS_PTR(left) || C_IS_PTR(right) || C_IS_STRUCT(left) || C_IS_STRUCT(right)) {
+        return NUM_BC_TYPES;
+    }
+    CType type = C_IS_VECTOR(left) ? left : right;
+    CType other = C_IS_VECTOR(left) ? right : left;
+    CVectorType *vector = c_vector(type);
+    bool is_float = bc_is_float(vector->lane);
+    if (C_IS_VECTOR(other) ? other != type : bc_is_float(other) && !is_float) {
+        return NUM_BC_TYPES;
+    }
+    if (TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP) {
+        return vector->mask;
+    }
+    bool float_op = op == TOKEN_ADD || op == TOKEN_SUB || op == TOKEN_MUL || op == TOKEN_DIV;
+    return is_float && !float_op ? NUM_BC_TYPES : type;
+}
+
+static bool
+c_is_literal(Expr *expr) {
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    return expr->kind == EXPR_INT || expr->kind == EXPR_FLOAT;
+}
+
+// Infers the type arguments of a call to the generic fn decl from the types
+// of its arguments, into types. Literals only decide a type argument that no
+// other argument does, so max(x, 1) takes its type from x.
+static bool
+c_infer_call(CEmitter *e, Expr *call, Decl *decl, CType *types, bool report) {
+    size_t num_generics = decl->fn.num_generics;
+    for (size_t i = 0; i < num_generics; i++) {
+        types[i] = NUM_BC_TYPES;
+        if (decl->fn.generics[i].is_const) {
+            if (report) {
+                error(call->pos, "Const generic parameters can't be compiled to C yet");
+            }
+            return false;
+        }
+    }
+    if (call->call.num_args != decl->fn.num_params) {
+        if (report) {
+            error(call->pos, "'%s' takes %zu arguments, not %zu", decl->name, decl->fn.num_params, call->call.num_args);
+        }
+        return false;
+    }
+    for (int literals = 0; literals < 2; literals++) {
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            Typespec *param_type = decl->fn.params[i].type;
+            Expr *arg = call->call.args[i];
+            // T* and T[n] bind T to what the argument points to
+            bool is_ptr = param_type->kind == TYPESPEC_PTR || param_type->kind == TYPESPEC_ARRAY;
+            if (is_ptr) {
+                param_type = param_type->base;
+            }
+            if (c_is_literal(arg) != literals || param_type->kind != TYPESPEC_NAME || param_type->num_names != 1) {
+                continue;
+            }
+            for (size_t j = 0; j < num_generics; j++) {
+                if (decl->fn.generics[j].name != param_type->names[0]) {
+                    continue;
+                }
+                CType type = c_expr_type(e, arg);
+                if (is_ptr) {
+                    type = C_IS_PTR(type) ? C_PTR_ELEM(type) : NUM_BC_TYPES;
+                }
+                if (type == NUM_BC_TYPES || type == BC_VOID || (literals && types[j] != NUM_BC_TYPES)) {
+                    break;
+                }
+                if (types[j] != NUM_BC_TYPES && types[j] != type) {
+                    if (report) {
+                        error(arg->pos, "Type argument '%s' of '%s' is both %s and %s", decl->fn.generics[j].name,
+                            decl->name, c_source_type_name(types[j]), c_source_type_name(type));
+                    }
+                    return false;
+                }
+                types[j] = type;
+            }
+        }
+    }
+    for (size_t i = 0; i < num_generics; i++) {
+        if (types[i] == NUM_BC_TYPES) {
+            if (report) {
+                error(call->pos, "Can't infer type argument '%s' of '%s'", decl->fn.generics[i].name, decl->name);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+// Shared versions
+
+static bool c_is_generic_param(Decl *decl, Typespec *type);
+
+static bool
+c_mentions(Typespec *type, const char *name) {
+    if (!type) {
+        return false;
+    }
+    switch (type->kind) {
+    case TYPESPEC_NAME:
+        return type->num_names == 1 && type->names[0] == name;
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            if (c_mentions(type->fn.args[i], name)) {
+                return true;
+            }
+        }
+        return c_mentions(type->fn.ret, name);
+    case TYPESPEC_TUPLE:
+        for (size_t i = 0; i < type->tuple.num_fields; i++) {
+            if (c_mentions(type->tuple.fields[i], name)) {
+                return true;
+            }
+        }
+        return false;
+    default:
+        return c_mentions(type->base, name);
+    }
+}
+
+// Whether name is a param of decl that points to its generic param.
+static bool
+c_is_shared_param(Decl *decl, const char *name) {
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        Typespec *type = decl->fn.params[i].type;
+        if (decl->fn.params[i].name == name) {
+            return (type->kind == TYPESPEC_PTR || type->kind == TYPESPEC_ARRAY) && c_is_generic_param(decl, type->base);
+        }
+    }
+    return false;
+}
+
+// p[i].field, for a param p that points to the generic param.
+static bool
+c_is_shared_access(Decl *decl, Expr *expr) {
+    Expr *base = expr->field.expr;
+    return base->kind == EXPR_INDEX && base->index.expr->kind == EXPR_NAME && c_is_shared_param(decl, base->index.expr->name);
+}
+
+static void c_shared_scan_expr(CShared *shared, Expr *expr);
+static void c_shared_scan_block(CShared *shared, StmtList block);
+
+static void
+c_shared_scan_type(CShared *shared, Typespec *type) {
+    if (c_mentions(type, shared->decl->fn.generics[0].name)) {
+        shared->ok = false;
+    }
+}
+
+// Counts the nodes of expr and collects the fields it uses, and clears ok if
+// it uses a param that points to the generic param any other way, or the
+// generic param itself.
+static void
+c_shared_scan_expr(CShared *shared, Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    Decl *decl = shared->decl;
+    shared->size++;
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        c_shared_scan_expr(shared, expr->paren.expr);
+        break;
+    case EXPR_NAME:
+        if (expr->name == decl->fn.generics[0].name || c_is_shared_param(decl, expr->name)) {
+            shared->ok = false;
+        }
+        break;
+    case EXPR_TUPLE:
+        for (size_t i = 0; i < expr->tuple.num_args; i++) {
+            c_shared_scan_expr(shared, expr->tuple.args[i]);
+        }
+        break;
+    case EXPR_CAST:
+        c_shared_scan_type(shared, expr->cast.type);
+        c_shared_scan_expr(shared, expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        c_shared_scan_expr(shared, expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            c_shared_scan_expr(shared, expr->call.args[i]);
+        }
+        break;
+    case EXPR_INDEX:
+        c_shared_scan_expr(shared, expr->index.expr);
+        c_shared_scan_expr(shared, expr->index.index);
+        break;
+    case EXPR_FIELD: {
+        if (!c_is_shared_access(decl, expr)) {
+            c_shared_scan_expr(shared, expr->field.expr);
+            break;
+        }
+        size_t i = 0;
+        while (i < buf_len(shared->fields) && shared->fields[i] != expr->field.name) {
+            i++;
+        }
+        if (i == buf_len(shared->fields)) {
+            buf_push(shared->fields, expr->field.name);
+        }
+        c_shared_scan_expr(shared, expr->field.expr->index.index);
+        break;
+    }
+    case EXPR_MODIFY:
+        c_shared_scan_expr(shared, expr->modify.expr);
+        break;
+    case EXPR_UNARY:
+        c_shared_scan_expr(shared, expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        c_shared_scan_expr(shared, expr->binary.left);
+        c_shared_scan_expr(shared, expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        c_shared_scan_expr(shared, expr->ternary.cond);
+        c_shared_scan_expr(shared, expr->ternary.then_expr);
+        c_shared_scan_expr(shared, expr->ternary.else_expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        c_shared_scan_expr(shared, expr->sizeof_expr);
+        break;
+    case EXPR_TYPEOF_EXPR:
+        c_shared_scan_expr(shared, expr->typeof_expr);
+        break;
+    case EXPR_ALIGNOF_EXPR:
+        c_shared_scan_expr(shared, expr->alignof_expr);
+        break;
+    case EXPR_SIZEOF_TYPE:
+        c_shared_scan_type(shared, expr->sizeof_type);
+        break;
+    case EXPR_TYPEOF_TYPE:
+        c_shared_scan_type(shared, expr->typeof_type);
+        break;
+    case EXPR_ALIGNOF_TYPE:
+        c_shared_scan_type(shared, expr->alignof_type);
+        break;
+    case EXPR_OFFSETOF:
+        c_shared_scan_type(shared, expr->offsetof_field.type);
+        break;
+    case EXPR_NEW:
+        c_shared_scan_expr(shared, expr->new_expr.alloc);
+        c_shared_scan_expr(shared, expr->new_expr.len);
+        c_shared_scan_expr(shared, expr->new_expr.arg);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+c_shared_scan_stmt(CShared *shared, Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    shared->size++;
+    switch (stmt->kind) {
+    case STMT_RETURN:
+    case STMT_EXPR:
+        c_shared_scan_expr(shared, stmt->expr);
+        break;
+    case STMT_BLOCK:
+        c_shared_scan_block(shared, stmt->block);
+        break;
+    case STMT_IF:
+        c_shared_scan_expr(shared, stmt->if_stmt.cond);
+        c_shared_scan_block(shared, stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            c_shared_scan_expr(shared, stmt->if_stmt.elseifs[i].cond);
+            c_shared_scan_block(shared, stmt->if_stmt.elseifs[i].block);
+        }
+        c_shared_scan_block(shared, stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+        c_shared_scan_expr(shared, stmt->while_stmt.cond);
+        c_shared_scan_block(shared, stmt->while_stmt.block);
+        break;
+    case STMT_FOR:
+        c_shared_scan_stmt(shared, stmt->for_stmt.init);
+        c_shared_scan_expr(shared, stmt->for_stmt.cond);
+        c_shared_scan_stmt(shared, stmt->for_stmt.next);
+        c_shared_scan_block(shared, stmt->for_stmt.block);
+        break;
+    case STMT_ASSIGN:
+        c_shared_scan_expr(shared, stmt->assign.left);
+        c_shared_scan_expr(shared, stmt->assign.right);
+        break;
+    case STMT_INIT:
+        // a local hiding a param would look like it
+        if (c_is_shared_param(shared->decl, stmt->init.name)) {
+            shared->ok = false;
+        }
+        c_shared_scan_type(shared, stmt->init.type);
+        c_shared_scan_expr(shared, stmt->init.expr);
+        break;
+    case STMT_SWITCH:
+        c_shared_scan_expr(shared, stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            for (size_t j = 0; j < c->num_patterns; j++) {
+                c_shared_scan_expr(shared, c->patterns[j]);
+            }
+            c_shared_scan_block(shared, c->block);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+c_shared_scan_block(CShared *shared, StmtList block) {
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        c_shared_scan_stmt(shared, block.stmts[i]);
+    }
+}
+
+// The shared version a generic fn can have, or NULL. Only called while
+// discovering.
+static CShared *
+c_shared_get(Decl *decl) {
+    CShared *shared = map_get(&c_shared_fns, decl);
+    if (shared) {
+        return shared->ok ? shared : NULL;
+    }
+    shared = arena_alloc(&c_instance_arena, sizeof(CShared));
+    *shared = (CShared){.decl = decl};
+    shared->ok = decl->fn.num_generics == 1 && !decl->fn.generics[0].is_const && !decl->fn.has_varargs;
+    if (shared->ok) {
+        const char *name = decl->fn.generics[0].name;
+        bool has_data = false;
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            if (c_is_shared_param(decl, decl->fn.params[i].name)) {
+                has_data = true;
+            } else if (c_mentions(decl->fn.params[i].type, name)) {
+                shared->ok = false;
+            }
+        }
+        shared->ok = shared->ok && has_data && !c_mentions(decl->fn.ret_type, name);
+    }
+    if (shared->ok) {
+        c_shared_scan_block(shared, *parse_decl_fn_body(decl));
+    }
+    map_put(&c_shared_fns, decl, shared);
+    return shared->ok ? shared : NULL;
+}
+
+// Whether the shared version can be called for type: a struct or union with
+// every field it uses as a plain field, of the type the others have it as.
+static bool
+c_shared_fits(CShared *shared, CType type) {
+    if (!C_IS_STRUCT(type)) {
+        return false;
+    }
+    Layout *layout = c_struct(type)->layout;
+    for (size_t i = 0; i < buf_len(shared->fields); i++) {
+        LayoutField *field = layout_find_field(layout, shared->fields[i]);
+        if (!field || field->bits || field->type->kind == TYPE_ARRAY) {
+            return false;
+        }
+        CType field_type = c_type_from_type(field->type);
+        if (field_type == NUM_BC_TYPES || (shared->field_types && shared->field_types[i] != field_type)) {
+            return false;
+        }
+    }
+    if (!shared->field_types) {
+        for (size_t i = 0; i < buf_len(shared->fields); i++) {
+            buf_push(shared->field_types, c_type_from_type(layout_find_field(layout, shared->fields[i])->type));
+        }
+    }
+    return true;
+}
+
+static CInstance *
+c_shared_instance(CShared *shared) {
+    if (!shared->instance) {
+        Decl *decl = shared->decl;
+        CInstance *instance = arena_alloc(&c_instance_arena, sizeof(CInstance));
+        char *c_name = strf("%s__shared", (const char *)map_get(&c_names, decl));
+        *instance = (CInstance){.decl = decl, .c_name = str_intern(c_name), .scope = map_get(&c_decl_scopes, decl), .shared = shared};
+        free(c_name);
+        buf_push(c_instance_list, instance);
+        shared->instance = instance;
+    }
+    return shared->instance;
+}
+
+// The index in the shared version e generates of the field expr uses, if
+// expr is p[i].field; -1 otherwise.
+static int
+c_shared_field(CEmitter *e, Expr *expr) {
+    CShared *shared = e->instance ? e->instance->shared : NULL;
+    if (!shared || !c_is_shared_access(shared->decl, expr)) {
+        return -1;
+    }
+    for (size_t i = 0; i < buf_len(shared->fields); i++) {
+        if (shared->fields[i] == expr->field.name) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+// Queues an instance to be walked, the first time the discovery pass reaches
+// it. Reaching one whose calls go through a shared version reaches that.
+static void
+c_reach(CInstance *instance) {
+    if (instance->via) {
+        instance = c_shared_instance(instance->via);
+    }
+    if (!instance->reached) {
+        instance->reached = true;
+        buf_push(c_reach_queue, instance);
+    }
+}
+
+static void
+c_var_reach(Decl *decl) {
+    if (!map_get(&c_reached_vars, decl)) {
+        map_put(&c_reached_vars, decl, (void *)1);
+        buf_push(c_var_queue, decl);
+    }
+}
+
+// Finds the instance of decl for types, which are NULL for a non-generic fn.
+// New instances are only added while discovering, which reaches whatever it
+// finds.
+static CInstance *
+c_instance_get(Decl *decl, CType *types) {
+    size_t num_args = types ? decl->fn.num_generics : 0;
+    uint64_t hash = hash_ptr(decl);
+    for (size_t i = 0; i < num_args; i++) {
+        hash = hash_mix(hash, types[i]);
+    }
+    hash |= 1;
+    CInstance *first = map_get_from_uint64(&c_instances, hash);
+    for (CInstance *it = first; it; it = it->next) {
+        if (it->decl == decl && (num_args == 0 || memcmp(it->types, types, num_args * sizeof(CType)) == 0)) {
+            if (c_discovering) {
+                c_reach(it);
+            }
+            return it;
+        }
+    }
+    assert(c_discovering || !types);
+    // past the budget, a struct that fits the fn's shared version is called
+    // through it
+    CShared *via = types ? c_shared_get(decl) : NULL;
+    if (via && (c_specialized_size + via->size <= (size_t)flag_specialize_budget || !c_shared_fits(via, types[0]))) {
+        c_specialized_size += via->size;
+        via = NULL;
+    }
+    CInstance *instance = arena_alloc(&c_instance_arena, sizeof(CInstance));
+    *instance = (CInstance){.decl = decl, .num_args = num_args, .scope = map_get(&c_decl_scopes, decl), .next = first};
+    const char *c_name = map_get(&c_names, decl);
+    if (num_args) {
+        instance->types = arena_alloc(&c_instance_arena, num_args * sizeof(CType));
+        instance->args = arena_alloc(&c_instance_arena, num_args * sizeof(const char *));
+        char *name = NULL;
+        buf_printf(name, "%s_", c_name);
+        for (size_t i = 0; i < num_args; i++) {
+            instance->types[i] = types[i];
+            instance->args[i] = str_intern(c_source_type_name(types[i]));
+            buf_printf(name, "_%s", c_mangled_type_name(types[i]));
+        }
+        c_name = str_intern(name);
+        buf_free(name);
+        STATS_ADD(emit_instances, !via);
+    }
+    instance->c_name = c_name;
+    map_put_from_uint64(&c_instances, hash, instance);
+    if (via) {
+        char *table = strf("cr_fields_%s", c_name);
+        instance->c_name = str_intern(table);
+        free(table);
+        instance->via = via;
+        c_struct_use(types[0]);
+        buf_push(c_table_list, instance);
+    } else {
+        buf_push(c_instance_list, instance);
+    }
+    if (c_discovering) {
+        c_reach(instance);
+    }
+    return instance;
+}
+
+// The enum item expr names, like Color.Red, with the enum's base type.
+static EnumItem *
+c_enum_item(CEmitter *e, Expr *expr, CType *type) {
+    Expr *base = expr->field.expr;
+    if (base->kind != EXPR_NAME || c_find_local(e, base->name)) {
+        return NULL;
+    }
+    Decl *decl = c_find_decl(e->scope, base->name);
+    if (!decl || decl->kind != DECL_ENUM) {
+        return NULL;
+    }
+    *type = decl->enum_decl.type ? bc_type_from_typespec(NULL, decl->enum_decl.type) : BC_I32;
+    return find_enum_item(decl, expr->field.name);
+}
+
+// The field of a struct or union expr names, along with its layout.
+static LayoutField *
+c_find_field(CEmitter *e, Expr *expr, Layout **layout) {
+    CType type = c_expr_type(e, expr->field.expr);
+    if (!C_IS_STRUCT(type)) {
+        return NULL;
+    }
+    *layout = c_struct(type)->layout;
+    return layout_find_field(*layout, expr->field.name);
+}
+
+static CType c_expr_type(CEmitter *e, Expr *expr);
+
+// The type of expr worked out from its parts, for generic instances, whose
+// types the checker can't know.
+static CType
+c_derive_expr_type(CEmitter *e, Expr *expr) {
+    Val val;
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return c_expr_type(e, expr->paren.expr);
+    case EXPR_INT:
+    case EXPR_FLOAT:
+        return bc_literal(expr, &val);
+    case EXPR_NAME: {
+        CLocal *local = c_find_local(e, expr->name);
+        if (local) {
+            return local->type;
+        }
+        Decl *decl = c_find_decl(e->scope, expr->name);
+        if (!decl && (strcmp(expr->name, "true") == 0 || strcmp(expr->name, "false") == 0)) {
+            return BC_BOOL;
+        }
+        return decl ? c_global_type(decl) : NUM_BC_TYPES;
+    }
+    case EXPR_CAST:
+        return c_resolve_type(e, expr->cast.type);
+    case EXPR_CALL: {
+        CType vector;
+        switch (c_builtin_callee(e, expr, &vector)) {
+        case C_BUILTIN_VECTOR:
+            return vector;
+        case C_BUILTIN_SELECT:
+            return expr->call.num_args == 3 ? c_expr_type(e, expr->call.args[1]) : NUM_BC_TYPES;
+        case C_BUILTIN_ANY:
+        case C_BUILTIN_ALL:
+            return BC_BOOL;
+        case C_BUILTIN_SHUFFLE:
+            return expr->call.num_args ? c_expr_type(e, expr->call.args[0]) : NUM_BC_TYPES;
+        case C_BUILTIN_MAP:
+            return BC_VOID;
+        case C_BUILTIN_REDUCE: {
+            CType src = expr->call.num_args == 4 ? c_expr_type(e, expr->call.args[2]) : NUM_BC_TYPES;
+            return C_IS_PTR(src) ? C_PTR_ELEM(src) : NUM_BC_TYPES;
+        }
+        default:
+            break;
+        }
+        Decl *generic = c_generic_callee(e, expr);
+        if (generic) {
+            CType types[MAX_GENERICS];
+            if (generic->fn.num_generics > MAX_GENERICS || !c_infer_call(e, expr, generic, types, false)) {
+                return NUM_BC_TYPES;
+            }
+            return c_bound_type(generic, types, generic->fn.ret_type);
+        }
+        Expr *callee = expr->call.expr;
+        Decl *decl = NULL;
+        if (callee->kind == EXPR_NAME && !c_find_local(e, callee->name)) {
+            decl = c_find_decl(e->scope, callee->name);
+        }
+        return decl && decl->kind == DECL_FUNC ? c_named_type(map_get(&c_decl_scopes, decl), decl->fn.ret_type) : NUM_BC_TYPES;
+    }
+    case EXPR_UNARY: {
+        if (expr->unary.op == TOKEN_NOT) {
+            return BC_BOOL;
+        }
+        CType type = c_expr_type(e, expr->unary.expr);
+        if (type == NUM_BC_TYPES || type == BC_VOID || C_IS_PTR(type)) {
+            return C_IS_PTR(type) ? NUM_BC_TYPES : type;
+        }
+        if (C_IS_VECTOR(type)) {
+            bool is_float = bc_is_float(c_vector(type)->lane);
+            return expr->unary.op == TOKEN_SUB || expr->unary.op == TOKEN_ADD || (expr->unary.op == TOKEN_NEG && !is_float) ? type : NUM_BC_TYPES;
+        }
+        return expr->unary.op == TOKEN_SUB || expr->unary.op == TOKEN_NEG || expr->unary.op == TOKEN_ADD ? bc_promote(type) : NUM_BC_TYPES;
+    }
+    case EXPR_MODIFY:
+        return c_expr_type(e, expr->modify.expr);
+    case EXPR_BINARY: {
+        TokenKind op = expr->binary.op;
+        bool is_cmp = TOKEN_FIRST_CMP <= op && op <= TOKEN_LAST_CMP;
+        if (!c_uses_vectors && (is_cmp || op == TOKEN_AND_AND || op == TOKEN_OR_OR)) {
+            return BC_BOOL;
+        }
+        bool is_shift = op == TOKEN_LSHIFT || op == TOKEN_RSHIFT;
+        CType left = c_expr_type(e, expr->binary.left);
+        CType right = c_uses_vectors || !is_shift ? c_expr_type(e, expr->binary.right) : NUM_BC_TYPES;
+        if (C_IS_VECTOR(left) || C_IS_VECTOR(right)) {
+            return c_vector_binary_type(op, left, right);
+        }
+        if (is_cmp || op == TOKEN_AND_AND || op == TOKEN_OR_OR) {
+            return BC_BOOL;
+        }
+        if (C_IS_PTR(left) || C_IS_PTR(right)) {
+            // p + i, p - i and p - q, like in C
+            bool int_right = right < NUM_BC_TYPES && right != BC_VOID && !bc_is_float(right);
+            if (C_IS_PTR(left) && (op == TOKEN_ADD || op == TOKEN_SUB) && int_right) {
+                return left;
+            }
+            return C_IS_PTR(left) && op == TOKEN_SUB && left == right ? BC_I64 : NUM_BC_TYPES;
+        }
+        if (is_shift) {
+            if (C_IS_PTR(left)) {
+                return NUM_BC_TYPES;
+            }
+            return left < NUM_BC_TYPES && left != BC_VOID ? bc_promote(left) : left;
+        }
+        if (left == NUM_BC_TYPES || right == NUM_BC_TYPES || left == BC_VOID || right == BC_VOID) {
+            return NUM_BC_TYPES;
+        }
+        return bc_common_type(left, right);
+    }
+    case EXPR_TERNARY: {
+        CType then_type = c_expr_type(e, expr->ternary.then_expr);
+        CType else_type = c_expr_type(e, expr->ternary.else_expr);
+        if (then_type == NUM_BC_TYPES || else_type == NUM_BC_TYPES) {
+            return NUM_BC_TYPES;
+        }
+        if (then_type == else_type) {
+            return then_type;
+        }
+        if (then_type >= NUM_BC_TYPES || else_type >= NUM_BC_TYPES) {
+            return NUM_BC_TYPES;
+        }
+        return bc_common_type(then_type, else_type);
+    }
+    case EXPR_INDEX: {
+        CType type = c_expr_type(e, expr->index.expr);
+        if (C_IS_PTR(type)) {
+            return C_PTR_ELEM(type);
+        }
+        return C_IS_VECTOR(type) ? c_vector(type)->lane : NUM_BC_TYPES;
+    }
+    case EXPR_FIELD: {
+        int shared_field = c_shared_field(e, expr);
+        if (shared_field >= 0) {
+            return e->instance->shared->field_types[shared_field];
+        }
+        CType type;
+        if (c_enum_item(e, expr, &type)) {
+            return type;
+        }
+        Layout *layout;
+        LayoutField *field = c_find_field(e, expr, &layout);
+        return field ? c_type_from_type(field->type) : NUM_BC_TYPES;
+    }
+    case EXPR_SIZEOF_EXPR:
+    case EXPR_SIZEOF_TYPE:
+    case EXPR_ALIGNOF_TYPE:
+    case EXPR_OFFSETOF:
+        return sizeof(size_t) == 8 ? BC_U64 : BC_U32;
+    default:
+        return NUM_BC_TYPES;
+    }
+}
+
+// The checker's type for expr if it maps to a C type, else one worked out from
+// expr's parts. NUM_BC_TYPES if unknown, which has been reported unless it's a
+// string.
+static CType
+c_expr_type(CEmitter *e, Expr *expr) {
+    CType type = expr->type && !e->instance ? c_type_from_type(expr->type) : NUM_BC_TYPES;
+    return type != NUM_BC_TYPES ? type : c_derive_expr_type(e, expr);
+}
+
+static CType
+c_global_type(Decl *decl) {
+    if (decl->kind == DECL_CONST) {
+        ConstValue *value = const_cache_get(decl, NULL, 0);
+        return value->state == CONST_EVALUATED ? value->type : NUM_BC_TYPES;
+    }
+    return decl->kind == DECL_VAR ? c_type_from_type(check_global_type(decl)) : NUM_BC_TYPES;
+}
+
+// A vector would compile, but as the value of its first lane.
+static void
+c_check_cond(CEmitter *e, Expr *cond) {
+    CType type = c_uses_vectors ? c_expr_type(e, cond) : NUM_BC_TYPES;
+    if (C_IS_VECTOR(type)) {
+        error(cond->pos, "A condition can't be %s; use any or all", c_source_type_name(type));
+    }
+}
+
+// Expressions
+
+// Operands of unary and binary operators are parenthesized whenever they are
+// operators themselves, since our precedence levels aren't C's.
+static void
+emit_c_operand(CEmitter *e, Expr *expr) {
+    bool paren = expr->kind == EXPR_BINARY || expr->kind == EXPR_TERNARY || expr->kind == EXPR_CAST;
+    if (paren) {
+        c_write(e->out, "(", 1);
+    }
+    emit_c_expr(e, expr);
+    if (paren) {
+        c_write(e->out, ")", 1);
+    }
+}
+
+static void
+emit_c_postfix_base(CEmitter *e, Expr *expr) {
+    bool paren = expr->kind != EXPR_NAME && expr->kind != EXPR_PAREN && expr->kind != EXPR_CALL
+        && expr->kind != EXPR_INDEX && expr->kind != EXPR_FIELD;
+    if (paren) {
+        c_write(e->out, "(", 1);
+    }
+    emit_c_expr(e, expr);
+    if (paren) {
+        c_write(e->out, ")", 1);
+    }
+}
+
+static void
+emit_c_name(CEmitter *e, Expr *expr) {
+    const char *name = expr->name;
+    CLocal *local = c_find_local(e, name);
+    if (local) {
+        c_str(e->out, local->c_name);
+        return;
+    }
+    Decl *decl = c_find_decl(e->scope, name);
+    if (!decl) {
+        if (strcmp(name, "true") == 0 || strcmp(name, "false") == 0) {
+            c_str(e->out, name);
+        } else {
+            error(expr->pos, "Unknown name '%s'", name);
+        }
+        return;
+    }
+    if (decl->kind == DECL_CONST) {
+        ConstValue *value = const_cache_get(decl, NULL, 0);
+        if (value->state != CONST_EVALUATED) {
+            error(expr->pos, "Constant '%s' has no value", name);
+            return;
+        }
+        emit_c_literal(e->out, value->type, value->val);
+        return;
+    }
+    const char *c_name = map_get(&c_names, decl);
+    if (!c_name) {
+        error(expr->pos, "'%s' can't be compiled to C yet", name);
+        return;
+    }
+    if (decl->kind == DECL_FUNC && decl->fn.num_generics) {
+        error(expr->pos, "Generic fn '%s' can only be called", name);
+        return;
+    }
+    if (c_discovering && decl->kind == DECL_FUNC) {
+        c_instance_get(decl, NULL);
+    } else if (c_discovering && decl->kind == DECL_VAR) {
+        c_var_reach(decl);
+    }
+    c_str(e->out, c_name);
+}
+
+// The value of an integer literal or const, which lane indices given to
+// shuffle must be.
+static bool
+c_const_int(CEmitter *e, Expr *expr, long long *value) {
+    while (expr->kind == EXPR_PAREN) {
+        expr = expr->paren.expr;
+    }
+    Val val;
+    if (expr->kind == EXPR_INT) {
+        if (bc_literal(expr, &val) == BC_VOID) {
+            return false;
+        }
+        *value = val.ll;
+        return true;
+    }
+    if (expr->kind != EXPR_NAME || c_find_local(e, expr->name)) {
+        return false;
+    }
+    Decl *decl = c_find_decl(e->scope, expr->name);
+    if (!decl || decl->kind != DECL_CONST) {
+        return false;
+    }
+    ConstValue *const_value = const_cache_get(decl, NULL, 0);
+    if (const_value->state != CONST_EVALUATED || const_value->type == BC_BOOL || bc_is_float(const_value->type)) {
+        return false;
+    }
+    *value = const_value->val.ll;
+    return true;
+}
+
+static void
+emit_c_call_args(CEmitter *e, Expr *call) {
+    c_write(e->out, "(", 1);
+    for (size_t i = 0; i < call->call.num_args; i++) {
+        if (i) {
+            c_write(e->out, ", ", 2);
+        }
+        emit_c_expr(e, call->call.args[i]);
+    }
+    c_write(e->out, ")", 1);
+}
+
+// Starts a call of the helper for op on vectors of type.
+static void
+emit_c_vector_call(CEmitter *e, CType type, const char *op) {
+    c_str(e->out, c_vector(type)->c_name);
+    c_write(e->out, "_", 1);
+    c_str(e->out, op);
+    c_write(e->out, "(", 1);
+}
+
+// An operand of an operation on vectors of type, where a scalar is one value
+// for every lane.
+static void
+emit_c_vector_operand(CEmitter *e, CType type, Expr *expr, CType expr_type) {
+    if (C_IS_VECTOR(expr_type)) {
+        emit_c_expr(e, expr);
+        return;
+    }
+    emit_c_vector_call(e, type, "splat");
+    emit_c_expr(e, expr);
+    c_write(e->out, ")", 1);
+}
+
+// expr where a value of type is expected.
+static void
+emit_c_converted(CEmitter *e, CType type, Expr *expr) {
+    if (!C_IS_VECTOR(type)) {
+        emit_c_expr(e, expr);
+        return;
+    }
+    CType expr_type = c_expr_type(e, expr);
+    if (expr_type != type && expr_type != NUM_BC_TYPES
+        && (C_IS_VECTOR(expr_type) || C_IS_PTR(expr_type) || C_IS_STRUCT(expr_type) || expr_type == BC_VOID
+            || (bc_is_float(expr_type) && !bc_is_float(c_vector(type)->lane)))) {
+        error(expr->pos, "Can't convert %s to %s", c_source_type_name(expr_type), c_source_type_name(type));
+    }
+    emit_c_vector_operand(e, type, expr, expr_type);
+}
+
+// left op right as a call of a vector helper, if either is a vector.
+static bool
+emit_c_vector_binary(CEmitter *e, SrcPos pos, TokenKind op, Expr *left, Expr *right) {
+    CType left_type = c_expr_type(e, left);
+    CType right_type = c_expr_type(e, right);
+    if (!C_IS_VECTOR(left_type) && !C_IS_VECTOR(right_type)) {
+        return false;
+    }
+    CType type = C_IS_VECTOR(left_type) ? left_type : right_type;
+    if (c_vector_binary_type(op, left_type, right_type) == NUM_BC_TYPES && left_type != NUM_BC_TYPES && right_type != NUM_BC_TYPES) {
+        error(pos, "Operator %s can't be used on %s and %s", token_kind_name(op), c_source_type_name(left_type), c_source_type_name(right_type));
+    }
+    emit_c_vector_call(e, type, c_vector_ops[op] ? c_vector_ops[op] : "add");
+    emit_c_vector_operand(e, type, left, left_type);
+    c_write(e->out, ", ", 2);
+    emit_c_vector_operand(e, type, right, right_type);
+    c_write(e->out, ")", 1);
+    return true;
+}
+
+static void
+emit_c_vector_unary(CEmitter *e, Expr *expr, CType type) {
+    TokenKind op = expr->unary.op;
+    if (op == TOKEN_ADD) {
+        emit_c_expr(e, expr->unary.expr);
+        return;
+    }
+    if (op == TOKEN_NOT || (op == TOKEN_NEG && bc_is_float(c_vector(type)->lane))) {
+        error(expr->pos, "Operator %s can't be used on %s", token_kind_name(op), c_source_type_name(type));
+    }
+    emit_c_vector_call(e, type, op == TOKEN_NEG ? "not" : "neg");
+    emit_c_expr(e, expr->unary.expr);
+    c_write(e->out, ")", 1);
+}
+
+// The lane values a vector is made from.
+static bool
+c_check_lanes(CEmitter *e, Expr *call, CType vector) {
+    for (size_t i = 0; i < call->call.num_args; i++) {
+        CType type = c_expr_type(e, call->call.args[i]);
+        if (C_IS_VECTOR(type) || C_IS_PTR(type) || C_IS_STRUCT(type) || type == BC_VOID) {
+            error(call->call.args[i]->pos, "Lanes of %s can't be %s", c_source_type_name(vector), c_source_type_name(type));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+c_is_generic_param(Decl *decl, Typespec *type) {
+    return type && type->kind == TYPESPEC_NAME && type->num_names == 1 && type->names[0] == decl->fn.generics[0].name;
+}
+
+// The fn given to map or reduce, which must be a fn<T> whose params and result
+// are all T.
+static Decl *
+c_kernel_fn(CEmitter *e, Expr *expr, const char *builtin) {
+    Decl *decl = NULL;
+    if (expr->kind == EXPR_NAME && !c_find_local(e, expr->name)) {
+        decl = c_find_decl(e->scope, expr->name);
+    }
+    bool ok = decl && decl->kind == DECL_FUNC && decl->fn.num_generics == 1 && !decl->fn.generics[0].is_const
+        && !decl->fn.has_varargs && c_is_generic_param(decl, decl->fn.ret_type);
+    for (size_t i = 0; ok && i < decl->fn.num_params; i++) {
+        ok = c_is_generic_param(decl, decl->fn.params[i].type);
+    }
+    if (!ok) {
+        error(expr->pos, "'%s' takes a fn<T> whose parameters and result are all T", builtin);
+        return NULL;
+    }
+    return decl;
+}
+
+// Finds the kernel of kind for fn and elem. Like instances, new kernels are
+// only added while discovering, along with the two instances of fn they call.
+static CKernel *
+c_kernel_get(CBuiltin kind, Decl *fn, BcType elem) {
+    uint64_t hash = hash_mix(hash_mix(hash_ptr(fn), kind), elem) | 1;
+    CKernel *first = map_get_from_uint64(&c_kernels, hash);
+    for (CKernel *it = first; it; it = it->next) {
+        if (it->kind == kind && it->scalar->decl == fn && it->scalar->types[0] == elem) {
+            return it;
+        }
+    }
+    assert(c_discovering);
+    CKernel *kernel = arena_alloc(&c_instance_arena, sizeof(CKernel));
+    CType type = elem;
+    CType vector_type = c_simd_type(elem);
+    c_vector_use(vector_type);
+    *kernel = (CKernel){
+        .kind = kind,
+        .scalar = c_instance_get(fn, &type),
+        .vector = c_instance_get(fn, &vector_type),
+        .vector_type = vector_type,
+        .next = first,
+    };
+    char *c_name = strf("cr_%s_%s_%s", c_builtin_names[kind], (const char *)map_get(&c_names, fn), bc_type_names[elem]);
+    kernel->c_name = str_intern(c_name);
+    free(c_name);
+    map_put_from_uint64(&c_kernels, hash, kernel);
+    buf_push(c_kernel_list, kernel);
+    STATS_ADD(emit_kernels, 1);
+    return kernel;
+}
+
+// The arrays map and reduce go over, which must all point to the same
+// vectorizable type, given in elem.
+static bool
+c_check_kernel_arrays(CEmitter *e, Expr **arrays, size_t num_arrays, BcType *elem) {
+    CType first = NUM_BC_TYPES;
+    for (size_t i = 0; i < num_arrays; i++) {
+        CType type = c_expr_type(e, arrays[i]);
+        if (type == NUM_BC_TYPES) {
+            return false;
+        }
+        if (!C_IS_PTR(type) || C_PTR_ELEM(type) == BC_BOOL || C_IS_STRUCT(C_PTR_ELEM(type))) {
+            error(arrays[i]->pos, "Expected a pointer to numbers, not %s", c_source_type_name(type));
+            return false;
+        }
+        if (first != NUM_BC_TYPES && type != first) {
+            error(arrays[i]->pos, "Expected %s like the other arrays, not %s", c_source_type_name(first), c_source_type_name(type));
+            return false;
+        }
+        first = type;
+    }
+    *elem = (BcType)C_PTR_ELEM(first);
+    return true;
+}
+
+static bool
+c_check_count(CEmitter *e, Expr *count) {
+    CType type = c_expr_type(e, count);
+    if (type == NUM_BC_TYPES) {
+        return false;
+    }
+    if (C_IS_VECTOR(type) || C_IS_PTR(type) || C_IS_STRUCT(type) || type == BC_VOID || type == BC_BOOL || bc_is_float(type)) {
+        error(count->pos, "The count must be an integer, not %s", c_source_type_name(type));
+        return false;
+    }
+    return true;
+}
+
+static void
+emit_c_builtin(CEmitter *e, Expr *call, CBuiltin builtin, CType vector) {
+    CWriter *out = e->out;
+    Expr **args = call->call.args;
+    size_t num_args = call->call.num_args;
+    const char *name = call->call.expr->name;
+    switch (builtin) {
+    case C_BUILTIN_VECTOR: {
+        CVectorType *type = c_vector(vector);
+        if (num_args != 1 && num_args != type->num_lanes) {
+            error(call->pos, "'%s' takes 1 or %d arguments, not %zu", name, type->num_lanes, num_args);
+            break;
+        }
+        if (!c_check_lanes(e, call, vector)) {
+            break;
+        }
+        if (num_args == 1) {
+            emit_c_vector_call(e, vector, "splat");
+            emit_c_expr(e, args[0]);
+            c_write(out, ")", 1);
+            return;
+        }
+        c_str(out, "CR_MAKE(");
+        c_str(out, type->c_name);
+        for (size_t i = 0; i < num_args; i++) {
+            c_write(out, ", ", 2);
+            emit_c_expr(e, args[i]);
+        }
+        c_write(out, ")", 1);
+        return;
+    }
+    case C_BUILTIN_SELECT: {
+        if (num_args != 3) {
+            error(call->pos, "'%s' takes 3 arguments, not %zu", name, num_args);
+            break;
+        }
+        CType mask = c_expr_type(e, args[0]);
+        CType type = c_expr_type(e, args[1]);
+        CType other = c_expr_type(e, args[2]);
+        if (type < NUM_BC_TYPES && type != BC_VOID) {
+            if (C_IS_VECTOR(mask) || C_IS_PTR(mask) || C_IS_STRUCT(mask) || mask == BC_VOID) {
+                error(args[0]->pos, "The mask for %s is bool, not %s", c_source_type_name(type), c_source_type_name(mask));
+                break;
+            }
+            if (C_IS_VECTOR(other) || C_IS_PTR(other) || C_IS_STRUCT(other) || other == BC_VOID) {
+                error(args[2]->pos, "'%s' can't choose between %s and %s", name, c_source_type_name(type), c_source_type_name(other));
+                break;
+            }
+            c_write(out, "(", 1);
+            emit_c_operand(e, args[0]);
+            c_write(out, " ? ", 3);
+            emit_c_operand(e, args[1]);
+            c_write(out, " : ", 3);
+            emit_c_operand(e, args[2]);
+            c_write(out, ")", 1);
+            return;
+        }
+        if (!C_IS_VECTOR(type)) {
+            if (type != NUM_BC_TYPES) {
+                error(args[1]->pos, "'%s' needs a vector, not %s", name, c_source_type_name(type));
+            }
+            break;
+        }
+        if (mask != NUM_BC_TYPES && mask != c_vector(type)->mask) {
+            error(args[0]->pos, "The mask for %s is %s, not %s", c_source_type_name(type), c_source_type_name(c_vector(type)->mask),
+                c_source_type_name(mask));
+            break;
+        }
+        if (other != type && other != NUM_BC_TYPES
+            && (C_IS_VECTOR(other) || C_IS_PTR(other) || C_IS_STRUCT(other) || other == BC_VOID || (bc_is_float(other) && !bc_is_float(c_vector(type)->lane)))) {
+            error(args[2]->pos, "'%s' can't choose between %s and %s", name, c_source_type_name(type), c_source_type_name(other));
+            break;
+        }
+        emit_c_vector_call(e, type, "select");
+        emit_c_expr(e, args[0]);
+        c_write(out, ", ", 2);
+        emit_c_expr(e, args[1]);
+        c_write(out, ", ", 2);
+        emit_c_vector_operand(e, type, args[2], other);
+        c_write(out, ")", 1);
+        return;
+    }
+    case C_BUILTIN_ANY:
+    case C_BUILTIN_ALL: {
+        if (num_args != 1) {
+            error(call->pos, "'%s' takes 1 argument, not %zu", name, num_args);
+            break;
+        }
+        CType mask = c_expr_type(e, args[0]);
+        if (mask == BC_BOOL) {
+            emit_c_expr(e, args[0]);
+            return;
+        }
+        if (!C_IS_VECTOR(mask) || bc_is_float(c_vector(mask)->lane)) {
+            if (mask != NUM_BC_TYPES) {
+                error(args[0]->pos, "'%s' needs a mask, not %s", name, c_source_type_name(mask));
+            }
+            break;
+        }
+        emit_c_vector_call(e, mask, builtin == C_BUILTIN_ANY ? "any" : "all");
+        emit_c_expr(e, args[0]);
+        c_write(out, ")", 1);
+        return;
+    }
+    case C_BUILTIN_SHUFFLE: {
+        CType type = num_args ? c_expr_type(e, args[0]) : NUM_BC_TYPES;
+        if (!C_IS_VECTOR(type)) {
+            if (!num_args || type != NUM_BC_TYPES) {
+                error(call->pos, "'%s' needs a vector, not %s", name, num_args ? c_source_type_name(type) : "nothing");
+            }
+            break;
+        }
+        CVectorType *vector_type = c_vector(type);
+        if (num_args != 1 + (size_t)vector_type->num_lanes) {
+            error(call->pos, "'%s' of %s takes %d lanes, not %zu", name, vector_type->name, vector_type->num_lanes, num_args - 1);
+            break;
+        }
+        c_str(out, "CR_SHUFFLE(");
+        c_str(out, vector_type->c_name);
+        c_write(out, ", ", 2);
+        c_str(out, c_vector(vector_type->mask)->c_name);
+        c_write(out, ", ", 2);
+        emit_c_expr(e, args[0]);
+        for (size_t i = 1; i < num_args; i++) {
+            long long lane;
+            if (!c_const_int(e, args[i], &lane) || lane < 0 || lane >= vector_type->num_lanes) {
+                error(args[i]->pos, "Lanes given to '%s' must be constants below %d", name, vector_type->num_lanes);
+                return;
+            }
+            c_printf(out, ", %lld", lane);
+        }
+        c_write(out, ")", 1);
+        return;
+    }
+    case C_BUILTIN_MAP:
+    case C_BUILTIN_REDUCE: {
+        bool is_map = builtin == C_BUILTIN_MAP;
+        if (num_args < 4) {
+            error(call->pos, is_map ? "'%s' takes a fn, the destination, the sources and the count"
+                                    : "'%s' takes a fn, the initial value, the source and the count", name);
+            break;
+        }
+        Decl *fn = c_kernel_fn(e, args[0], name);
+        if (!fn) {
+            break;
+        }
+        size_t num_arrays = is_map ? 1 + fn->fn.num_params : 1;
+        if (!is_map && fn->fn.num_params != 2) {
+            error(args[0]->pos, "'%s' takes a fn of 2 parameters, not %zu", name, fn->fn.num_params);
+            break;
+        }
+        if (num_args != 2 + num_arrays + !is_map) {
+            error(call->pos, "'%s' of '%s' takes %zu arguments, not %zu", name, fn->name, 2 + num_arrays + !is_map, num_args);
+            break;
+        }
+        BcType elem;
+        if (!c_check_kernel_arrays(e, args + 1 + !is_map, num_arrays, &elem) || !c_check_count(e, args[num_args - 1])) {
+            break;
+        }
+        if (!is_map) {
+            CType init = c_expr_type(e, args[1]);
+            if (C_IS_VECTOR(init) || C_IS_PTR(init) || C_IS_STRUCT(init) || init == BC_VOID) {
+                error(args[1]->pos, "Expected %s to start from, not %s", c_source_type_name(elem), c_source_type_name(init));
+                break;
+            }
+        }
+        if (c_simd_type(elem) == NUM_BC_TYPES) {
+            error(call->pos, "'%s' has no vector of %s", name, c_source_type_name(elem));
+            break;
+        }
+        c_str(out, c_kernel_get(builtin, fn, elem)->c_name);
+        c_write(out, "(", 1);
+        for (size_t i = 1; i < num_args; i++) {
+            if (i > 1) {
+                c_write(out, ", ", 2);
+            }
+            emit_c_expr(e, args[i]);
+        }
+        c_write(out, ")", 1);
+        return;
+    }
+    default:
+        assert(0);
+        break;
+    }
+    // the arguments still report their own errors, except for the fn map and
+    // reduce take, which can't be used as a value
+    if (builtin == C_BUILTIN_MAP || builtin == C_BUILTIN_REDUCE) {
+        for (size_t i = 1; i < num_args; i++) {
+            emit_c_expr(e, args[i]);
+        }
+        return;
+    }
+    emit_c_call_args(e, call);
+}
+
+static void
+emit_c_call(CEmitter *e, Expr *expr) {
+    CWriter *out = e->out;
+    CType vector;
+    CBuiltin builtin = c_builtin_callee(e, expr, &vector);
+    if (builtin) {
+        emit_c_builtin(e, expr, builtin, vector);
+        return;
+    }
+    Decl *generic = c_generic_callee(e, expr);
+    if (generic) {
+        CType types[MAX_GENERICS];
+        if (generic->fn.num_generics > MAX_GENERICS) {
+            error(expr->pos, "'%s' has more than %d generic parameters", generic->name, MAX_GENERICS);
+        } else if (c_infer_call(e, expr, generic, types, true)) {
+            CInstance *instance = c_instance_get(generic, types);
+            if (instance->via) {
+                // the struct's table goes ahead of the arguments
+                c_printf(out, "%s(%s", c_shared_instance(instance->via)->c_name, instance->c_name);
+                for (size_t i = 0; i < expr->call.num_args; i++) {
+                    c_write(out, ", ", 2);
+                    emit_c_expr(e, expr->call.args[i]);
+                }
+                c_write(out, ")", 1);
+                return;
+            }
+            c_str(out, instance->c_name);
+        }
+    } else {
+        emit_c_postfix_base(e, expr->call.expr);
+    }
+    emit_c_call_args(e, expr);
+}
+
+// p[i].field in a shared version: the struct's size and the field's offset
+// are in the table it was called with.
+static void
+emit_c_shared_field(CEmitter *e, Expr *expr, int index) {
+    Expr *base = expr->field.expr;
+    CLocal *data = c_find_local(e, base->index.expr->name);
+    c_printf(e->out, "(*(%s%s*)((char *)%s + (size_t)(", c_type_name(e->instance->shared->field_types[index]),
+        C_IS_PTR(e->instance->shared->field_types[index]) ? "" : " ", data->c_name);
+    emit_c_expr(e, base->index.index);
+    c_printf(e->out, ") * cr_fields[0] + cr_fields[%d]))", index + 1);
+}
+
+static u64
+c_bits_mask(LayoutField *field) {
+    return ((1ull << field->bits) - 1) << field->shift;
+}
+
+// A bit field's value as type: its bits shifted down out of their word, and
+// sign extended if it's signed.
+static void
+emit_c_bits_read(CEmitter *e, Expr *base, LayoutField *field, CType type) {
+    CWriter *out = e->out;
+    if (field->is_signed) {
+        c_printf(out, "((%s)((int64_t)((uint64_t)", c_type_names[type]);
+        emit_c_postfix_base(e, base);
+        c_printf(out, ".cr_bits%u << %d) >> %d))", field->word, 64 - field->shift - field->bits, 64 - field->bits);
+    } else {
+        c_printf(out, "((%s)((", c_type_names[type]);
+        emit_c_postfix_base(e, base);
+        c_printf(out, ".cr_bits%u >> %d) & 0x%llxu))", field->word, field->shift, (unsigned long long)(c_bits_mask(field) >> field->shift));
+    }
+}
+
+// Whether evaluating expr twice is the same as once.
+static bool
+c_is_pure(Expr *expr) {
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        return c_is_pure(expr->paren.expr);
+    case EXPR_NAME:
+    case EXPR_INT:
+        return true;
+    case EXPR_FIELD:
+        return c_is_pure(expr->field.expr);
+    case EXPR_INDEX:
+        return c_is_pure(expr->index.expr) && c_is_pure(expr->index.index);
+    default:
+        return false;
+    }
+}
+
+// left op= right where left is a bit field, which sets its bits in their word.
+// A compound assignment reads the field first, so left's base is repeated.
+static void
+emit_c_bits_assign(CEmitter *e, Stmt *stmt, Expr *left, Layout *layout, LayoutField *field) {
+    CWriter *out = e->out;
+    Expr *base = left->field.expr;
+    const char *word_type = c_type_names[layout->words[field->word].type];
+    if (stmt->assign.op != TOKEN_ASSIGN && !c_is_pure(base)) {
+        error(stmt->pos, "Operator %s can't be used on bit field '%s' of this expression; assign to it with =",
+            token_kind_name(stmt->assign.op), field->name);
+    }
+    c_printf(out, "cr_set_bits_%s(&", word_type);
+    emit_c_postfix_base(e, base);
+    c_printf(out, ".cr_bits%u, 0x%llxu, %d, (%s)(", field->word, (unsigned long long)c_bits_mask(field), field->shift, word_type);
+    if (stmt->assign.op == TOKEN_ASSIGN) {
+        emit_c_expr(e, stmt->assign.right);
+    } else {
+        emit_c_bits_read(e, base, field, c_type_from_type(field->type));
+        c_write(out, " ", 1);
+        c_str(out, token_kind_name(assign_token_to_binary_token[stmt->assign.op]));
+        c_write(out, " ", 1);
+        emit_c_operand(e, stmt->assign.right);
+    }
+    c_write(out, "))", 2);
+}
+
+static void
+emit_c_expr(CEmitter *e, Expr *expr) {
+    CWriter *out = e->out;
+    Val val;
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        c_write(out, "(", 1);
+        emit_c_expr(e, expr->paren.expr);
+        c_write(out, ")", 1);
+        break;
+    case EXPR_INT:
+    case EXPR_FLOAT: {
+        CType type = bc_literal(expr, &val);
+        emit_c_literal(out, type, val);
+        break;
+    }
+    case EXPR_STR:
+        emit_c_string(out, expr->str_lit.val);
+        break;
+    case EXPR_NAME:
+        emit_c_name(e, expr);
+        break;
+    case EXPR_FIELD: {
+        int shared_field = c_shared_field(e, expr);
+        if (shared_field >= 0) {
+            emit_c_shared_field(e, expr, shared_field);
+            break;
+        }
+        CType type;
+        EnumItem *item = c_enum_item(e, expr, &type);
+        if (item) {
+            emit_c_literal(out, type, (Val){.ll = item->value});
+            break;
+        }
+        Layout *layout;
+        LayoutField *field = c_find_field(e, expr, &layout);
+        if (!field) {
+            error(expr->pos, "Expression can't be compiled to C yet");
+        } else if (field->bits) {
+            emit_c_bits_read(e, expr->field.expr, field, c_type_from_type(field->type));
+        } else {
+            emit_c_postfix_base(e, expr->field.expr);
+            c_write(out, ".", 1);
+            c_str(out, c_local_name(field->name));
+        }
+        break;
+    }
+    case EXPR_CAST: {
+        CType type = c_type_from_typespec(e, expr->cast.type);
+        CType from = c_uses_vectors ? c_expr_type(e, expr->cast.expr) : NUM_BC_TYPES;
+        if (C_IS_VECTOR(type) || C_IS_VECTOR(from)) {
+            if (type != from) {
+                error(expr->pos, "Vectors can't be cast, but can be made with their type's name");
+            }
+            emit_c_expr(e, expr->cast.expr);
+            break;
+        }
+        c_write(out, "(", 1);
+        c_str(out, type < NUM_BC_TYPES ? c_type_names[type] : "int");
+        c_write(out, ")", 1);
+        emit_c_operand(e, expr->cast.expr);
+        break;
+    }
+    case EXPR_CALL:
+        emit_c_call(e, expr);
+        break;
+    case EXPR_UNARY: {
+        CType type = c_uses_vectors ? c_expr_type(e, expr->unary.expr) : NUM_BC_TYPES;
+        if (C_IS_VECTOR(type)) {
+            emit_c_vector_unary(e, expr, type);
+            break;
+        }
+        c_str(out, token_kind_name(expr->unary.op));
+        emit_c_operand(e, expr->unary.expr);
+        break;
+    }
+    case EXPR_MODIFY:
+        if (c_uses_vectors && C_IS_VECTOR(c_expr_type(e, expr->modify.expr))) {
+            error(expr->pos, "Operator %s can't be used on %s", token_kind_name(expr->modify.op),
+                c_source_type_name(c_expr_type(e, expr->modify.expr)));
+        }
+        if (!expr->modify.post) {
+            c_str(out, token_kind_name(expr->modify.op));
+        }
+        emit_c_postfix_base(e, expr->modify.expr);
+        if (expr->modify.post) {
+            c_str(out, token_kind_name(expr->modify.op));
+        }
+        break;
+    case EXPR_BINARY:
+        if (c_uses_vectors && emit_c_vector_binary(e, expr->pos, expr->binary.op, expr->binary.left, expr->binary.right)) {
+            break;
+        }
+        emit_c_operand(e, expr->binary.left);
+        c_write(out, " ", 1);
+        c_str(out, token_kind_name(expr->binary.op));
+        c_write(out, " ", 1);
+        emit_c_operand(e, expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        c_check_cond(e, expr->ternary.cond);
+        emit_c_operand(e, expr->ternary.cond);
+        c_write(out, " ? ", 3);
+        emit_c_operand(e, expr->ternary.then_expr);
+        c_write(out, " : ", 3);
+        emit_c_operand(e, expr->ternary.else_expr);
+        break;
+    case EXPR_INDEX: {
+        CType type = c_expr_type(e, expr->index.expr);
+        CType index_type = c_expr_type(e, expr->index.index);
+        bool bad_index = C_IS_VECTOR(index_type) || C_IS_PTR(index_type) || index_type == BC_VOID || bc_is_float(index_type);
+        if (C_IS_PTR(type)) {
+            if (bad_index) {
+                error(expr->index.index->pos, "Elements are indexed by integers, not %s", c_source_type_name(index_type));
+            }
+            emit_c_postfix_base(e, expr->index.expr);
+            c_write(out, "[", 1);
+            emit_c_expr(e, expr->index.index);
+            c_write(out, "]", 1);
+            break;
+        }
+        if (!C_IS_VECTOR(type)) {
+            size_t num_errors = buf_len(errors);
+            if (type == NUM_BC_TYPES) {
+                emit_c_expr(e, expr->index.expr);
+            }
+            if (buf_len(errors) == num_errors) {
+                error(expr->pos, "Only pointers, arrays and vectors can be indexed");
+            }
+            break;
+        }
+        long long lane;
+        if (bad_index) {
+            error(expr->index.index->pos, "Lanes are indexed by integers, not %s", c_source_type_name(index_type));
+        } else if (c_const_int(e, expr->index.index, &lane) && (lane < 0 || lane >= c_vector(type)->num_lanes)) {
+            error(expr->index.index->pos, "%s has no lane %lld", c_source_type_name(type), lane);
+        }
+        c_str(out, "CR_LANE(");
+        emit_c_expr(e, expr->index.expr);
+        c_write(out, ", ", 2);
+        emit_c_expr(e, expr->index.index);
+        c_write(out, ")", 1);
+        break;
+    }
+    default:
+        error(expr->pos, "Expression can't be compiled to C yet");
+        break;
+    }
+}
+
+// Statements
+
+// Writes [n] for an array typespec.
+static void
+emit_c_array_size(CEmitter *e, Typespec *type) {
+    long long num_elems;
+    if (!c_const_int(e, type->num_elems, &num_elems) || num_elems <= 0) {
+        error(type->num_elems->pos, "Array size must be a positive integer constant");
+        num_elems = 1;
+    }
+    c_printf(e->out, "[%lld]", num_elems);
+}
+
+static bool
+c_is_array(CEmitter *e, Expr *expr) {
+    if (expr->kind != EXPR_NAME) {
+        return false;
+    }
+    CLocal *local = c_find_local(e, expr->name);
+    if (local) {
+        return local->is_array;
+    }
+    Decl *decl = c_find_decl(e->scope, expr->name);
+    return decl && decl->kind == DECL_VAR && decl->var.type && decl->var.type->kind == TYPESPEC_ARRAY;
+}
+
+static void
+emit_c_init(CEmitter *e, Stmt *stmt) {
+    CType type;
+    bool unknown = false;
+    if (stmt->init.type) {
+        type = c_type_from_typespec(e, stmt->init.type);
+    } else {
+        type = stmt->init.expr ? c_expr_type(e, stmt->init.expr) : NUM_BC_TYPES;
+        unknown = type == NUM_BC_TYPES || type == BC_VOID;
+    }
+    if (type == NUM_BC_TYPES) {
+        type = BC_I32;
+    }
+    const char *c_name = c_local_name(stmt->init.name);
+    bool is_array = C_IS_PTR(type) && stmt->init.type && stmt->init.type->kind == TYPESPEC_ARRAY;
+    if (is_array) {
+        c_declare(e->out, C_PTR_ELEM(type), c_name);
+        emit_c_array_size(e, stmt->init.type);
+        c_str(e->out, " = {0}");
+        if (stmt->init.expr) {
+            error(stmt->pos, "Arrays can't be initialized from an expression");
+        }
+        buf_push(e->locals, (CLocal){stmt->init.name, c_name, type, true});
+        return;
+    }
+    c_declare(e->out, type, c_name);
+    c_write(e->out, " = ", 3);
+    size_t num_errors = buf_len(errors);
+    if (stmt->init.expr) {
+        emit_c_converted(e, type, stmt->init.expr);
+    } else if (C_IS_VECTOR(type) || C_IS_STRUCT(type)) {
+        c_str(e->out, "{0}");
+    } else {
+        c_write(e->out, "0", 1);
+    }
+    // an initializer with errors of its own usually is why
+    if (unknown && buf_len(errors) == num_errors) {
+        error(stmt->pos, "Type of '%s' can't be inferred, give it a type", stmt->init.name);
+    }
+    // in scope only after its initializer, like in C
+    buf_push(e->locals, (CLocal){stmt->init.name, c_name, type, false});
+}
+
+// The statements allowed in a for header, without the ';'.
+static void
+emit_c_simple_stmt(CEmitter *e, Stmt *stmt) {
+    switch (stmt->kind) {
+    case STMT_INIT:
+        emit_c_init(e, stmt);
+        break;
+    case STMT_ASSIGN: {
+        if (c_is_array(e, stmt->assign.left)) {
+            error(stmt->pos, "Arrays can't be assigned, only their elements");
+        }
+        Expr *left = stmt->assign.left;
+        while (left->kind == EXPR_PAREN) {
+            left = left->paren.expr;
+        }
+        Layout *layout;
+        LayoutField *field = left->kind == EXPR_FIELD ? c_find_field(e, left, &layout) : NULL;
+        if (field && field->bits) {
+            emit_c_bits_assign(e, stmt, left, layout, field);
+            break;
+        }
+        CType type = c_uses_vectors ? c_expr_type(e, stmt->assign.left) : NUM_BC_TYPES;
+        emit_c_expr(e, stmt->assign.left);
+        if (C_IS_VECTOR(type)) {
+            // vector lvalues are names, so the left side can be repeated
+            c_write(e->out, " = ", 3);
+            if (stmt->assign.op == TOKEN_ASSIGN) {
+                emit_c_converted(e, type, stmt->assign.right);
+            } else {
+                emit_c_vector_binary(e, stmt->pos, assign_token_to_binary_token[stmt->assign.op], stmt->assign.left, stmt->assign.right);
+            }
+            break;
+        }
+        c_write(e->out, " ", 1);
+        c_str(e->out, token_kind_name(stmt->assign.op));
+        c_write(e->out, " ", 1);
+        emit_c_expr(e, stmt->assign.right);
+        break;
+    }
+    case STMT_EXPR:
+        emit_c_expr(e, stmt->expr);
+        break;
+    default:
+        error(stmt->pos, "Statement can't be compiled to C yet");
+        break;
+    }
+}
+
+static void
+emit_c_switch_key(CEmitter *e, CType type, u64 key) {
+    u64 bits = bc_is_signed(type) ? key ^ (1ull << 63) : key;
+    emit_c_literal(e->out, type, (Val){.ull = bits});
+}
+
+// lo <= x && x <= hi, leaving out the bounds every value of x is within.
+static void
+emit_c_switch_range(CEmitter *e, const char *temp, CType type, MatchRange range, MatchDomain *domain) {
+    bool has_lo = range.lo != domain->ranges[0].lo;
+    bool has_hi = range.hi != domain->ranges[domain->num_ranges - 1].hi;
+    if (range.lo == range.hi) {
+        c_printf(e->out, "%s == ", temp);
+        emit_c_switch_key(e, type, range.lo);
+        return;
+    }
+    if (has_lo) {
+        c_printf(e->out, "%s >= ", temp);
+        emit_c_switch_key(e, type, range.lo);
+    }
+    if (has_lo && has_hi) {
+        c_str(e->out, " && ");
+    }
+    if (has_hi) {
+        c_printf(e->out, "%s <= ", temp);
+        emit_c_switch_key(e, type, range.hi);
+    }
+    if (!has_lo && !has_hi) {
+        c_str(e->out, "true");
+    }
+}
+
+// Every path through a node ends in a goto, so nothing falls through to the
+// code after it.
+static void
+emit_c_match_node(CEmitter *e, MatchTree *tree, MatchNode *node, int n, CType *types) {
+    CWriter *out = e->out;
+    if (node->column == MATCH_LEAF) {
+        c_newline(e);
+        if (node->row == MATCH_NO_ROW) {
+            c_printf(out, "goto cr_switch%d_end;", n);
+        } else {
+            c_printf(out, "goto cr_case%d_%u;", n, tree->arms[node->row]);
+        }
+        return;
+    }
+    CType type = types[node->column];
+    MatchDomain *domain = &tree->domains[node->column];
+    char temp[32];
+    snprintf(temp, sizeof(temp), "cr_switch%d_%u", n, node->column);
+    // without an otherwise branch, the widest edge takes what the others don't
+    MatchNode *rest = node->otherwise;
+    size_t rest_edge = SIZE_MAX;
+    for (size_t i = 0; i < node->num_edges && !node->otherwise; i++) {
+        if (rest_edge == SIZE_MAX || node->edges[i].num_keys > node->edges[rest_edge].num_keys) {
+            rest_edge = i;
+            rest = node->edges[i].node;
+        }
+    }
+    bool has_labels = false;
+    for (size_t i = 0; i < node->num_edges; i++) {
+        MatchEdge *edge = &node->edges[i];
+        if (i == rest_edge) {
+            continue;
+        }
+        if (edge->num_keys <= C_MAX_CASE_LABELS) {
+            has_labels = true;
+            continue;
+        }
+        c_newline(e);
+        c_str(out, "if (");
+        for (size_t j = 0; j < edge->num_ranges; j++) {
+            c_str(out, j ? ") || (" : edge->num_ranges > 1 ? "(" : "");
+            emit_c_switch_range(e, temp, type, edge->ranges[j], domain);
+        }
+        c_str(out, edge->num_ranges > 1 ? ")) {" : ") {");
+        e->indent++;
+        emit_c_match_node(e, tree, edge->node, n, types);
+        e->indent--;
+        c_newline(e);
+        c_write(out, "}", 1);
+    }
+    if (has_labels) {
+        c_newline(e);
+        c_printf(out, "switch (%s) {", temp);
+        for (size_t i = 0; i < node->num_edges; i++) {
+            MatchEdge *edge = &node->edges[i];
+            if (i == rest_edge || edge->num_keys > C_MAX_CASE_LABELS) {
+                continue;
+            }
+            for (size_t j = 0; j < edge->num_ranges; j++) {
+                for (u64 key = edge->ranges[j].lo;; key++) {
+                    c_newline(e);
+                    c_str(out, "case ");
+                    emit_c_switch_key(e, type, key);
+                    c_write(out, ":", 1);
+                    if (key == edge->ranges[j].hi) {
+                        break;
+                    }
+                }
+            }
+            e->indent++;
+            emit_c_match_node(e, tree, edge->node, n, types);
+            e->indent--;
+        }
+        c_newline(e);
+        c_str(out, "default:");
+        e->indent++;
+    }
+    if (rest) {
+        emit_c_match_node(e, tree, rest, n, types);
+    } else {
+        // no value gets here
+        c_newline(e);
+        c_printf(out, "goto cr_switch%d_end;", n);
+    }
+    if (has_labels) {
+        e->indent--;
+        c_newline(e);
+        c_write(out, "}", 1);
+    }
+}
+
+// Arms no value reaches aren't generated.
+static void
+emit_c_switch(CEmitter *e, Stmt *stmt) {
+    CWriter *out = e->out;
+    MatchTree *tree = stmt->switch_stmt.tree;
+    if (!tree) {
+        error(stmt->pos, "Statement can't be compiled to C yet");
+        return;
+    }
+    int n = e->num_switches++;
+    Expr *expr = stmt->switch_stmt.expr;
+    bool is_tuple = expr->kind == EXPR_TUPLE;
+    CType types[MATCH_MAX_COLUMNS];
+    c_write(out, "{", 1);
+    e->indent++;
+    for (size_t i = 0; i < tree->num_columns; i++) {
+        Expr *column = is_tuple ? expr->tuple.args[i] : expr;
+        types[i] = c_expr_type(e, column);
+        if (types[i] == NUM_BC_TYPES) {
+            error(column->pos, "Expression can't be compiled to C yet");
+            types[i] = BC_I32;
+        }
+        char temp[32];
+        snprintf(temp, sizeof(temp), "cr_switch%d_%zu", n, i);
+        c_newline(e);
+        c_declare(out, types[i], temp);
+        c_str(out, " = ");
+        emit_c_expr(e, column);
+        c_write(out, ";", 1);
+    }
+    emit_c_match_node(e, tree, tree->root, n, types);
+    for (u32 i = 0; i < stmt->switch_stmt.num_cases; i++) {
+        bool is_reached = false;
+        for (size_t j = 0; j < tree->num_rows; j++) {
+            is_reached |= tree->arms[j] == i && tree->reached[j];
+        }
+        if (!is_reached) {
+            continue;
+        }
+        c_newline(e);
+        c_printf(out, "cr_case%d_%u: ", n, i);
+        emit_c_block(e, stmt->switch_stmt.cases[i].block);
+        c_newline(e);
+        c_printf(out, "goto cr_switch%d_end;", n);
+    }
+    e->indent--;
+    c_newline(e);
+    c_printf(out, "cr_switch%d_end:;", n);
+    c_newline(e);
+    c_write(out, "}", 1);
+}
+
+static void
+emit_c_stmt(CEmitter *e, Stmt *stmt) {
+    CWriter *out = e->out;
+    switch (stmt->kind) {
+    case STMT_RETURN:
+        c_str(out, "return");
+        if (stmt->expr) {
+            c_write(out, " ", 1);
+            bool vector_ret = c_uses_vectors && e->instance;
+            emit_c_converted(e, vector_ret ? c_resolve_type(e, e->instance->decl->fn.ret_type) : NUM_BC_TYPES, stmt->expr);
+        }
+        c_write(out, ";", 1);
+        break;
+    case STMT_BREAK:
+        c_str(out, "break;");
+        break;
+    case STMT_CONTINUE:
+        c_str(out, "continue;");
+        break;
+    case STMT_BLOCK:
+        emit_c_block(e, stmt->block);
+        break;
+    case STMT_IF:
+        c_str(out, "if (");
+        c_check_cond(e, stmt->if_stmt.cond);
+        emit_c_expr(e, stmt->if_stmt.cond);
+        c_write(out, ") ", 2);
+        emit_c_block(e, stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            ElseIf *elseif = &stmt->if_stmt.elseifs[i];
+            c_str(out, " else if (");
+            c_check_cond(e, elseif->cond);
+            emit_c_expr(e, elseif->cond);
+            c_write(out, ") ", 2);
+            emit_c_block(e, elseif->block);
+        }
+        if (stmt->if_stmt.else_block.num_stmts) {
+            c_str(out, " else ");
+            emit_c_block(e, stmt->if_stmt.else_block);
+        }
+        break;
+    case STMT_WHILE:
+        c_str(out, "while (");
+        c_check_cond(e, stmt->while_stmt.cond);
+        emit_c_expr(e, stmt->while_stmt.cond);
+        c_write(out, ") ", 2);
+        emit_c_block(e, stmt->while_stmt.block);
+        break;
+    case STMT_FOR: {
+        size_t num_locals = buf_len(e->locals);
+        c_str(out, "for (");
+        if (stmt->for_stmt.init) {
+            emit_c_simple_stmt(e, stmt->for_stmt.init);
+        }
+        c_write(out, "; ", 2);
+        if (stmt->for_stmt.cond) {
+            c_check_cond(e, stmt->for_stmt.cond);
+            emit_c_expr(e, stmt->for_stmt.cond);
+        }
+        c_write(out, "; ", 2);
+        if (stmt->for_stmt.next) {
+            emit_c_simple_stmt(e, stmt->for_stmt.next);
+        }
+        c_write(out, ") ", 2);
+        emit_c_block(e, stmt->for_stmt.block);
+        buf__hdr(e->locals)->len = num_locals;
+        break;
+    }
+    case STMT_ASSIGN:
+    case STMT_INIT:
+    case STMT_EXPR:
+        emit_c_simple_stmt(e, stmt);
+        c_write(out, ";", 1);
+        break;
+    case STMT_SWITCH:
+        emit_c_switch(e, stmt);
+        break;
+    default:
+        error(stmt->pos, "Statement can't be compiled to C yet");
+        break;
+    }
+}
+
+static void
+emit_c_block(CEmitter *e, StmtList block) {
+    size_t num_locals = buf_len(e->locals);
+    c_write(e->out, "{", 1);
+    e->indent++;
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        c_newline(e);
+        emit_c_stmt(e, block.stmts[i]);
+    }
+    e->indent--;
+    c_newline(e);
+    c_write(e->out, "}", 1);
+    if (e->locals) {
+        buf__hdr(e->locals)->len = num_locals;
+    }
+}
+
+// Declarations
+
+// static ret name(params), adding the params to e's locals.
+static void
+emit_c_fn_header(CEmitter *e, CInstance *instance) {
+    CWriter *out = e->out;
+    Decl *decl = instance->decl;
+    e->instance = instance;
+    e->scope = instance->scope;
+    CType ret_type = decl->fn.ret_type ? c_type_from_typespec(e, decl->fn.ret_type) : BC_VOID;
+    c_str(out, "static ");
+    c_declare(out, ret_type == NUM_BC_TYPES ? BC_VOID : ret_type, instance->c_name);
+    c_write(out, "(", 1);
+    if (instance->shared) {
+        c_str(out, "const size_t *cr_fields");
+    }
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        FuncParam *param = &decl->fn.params[i];
+        if (instance->shared && c_is_shared_param(decl, param->name)) {
+            // what it points to is only known from cr_fields
+            const char *c_name = c_local_name(param->name);
+            c_printf(out, ", void *%s", c_name);
+            buf_push(e->locals, (CLocal){param->name, c_name, NUM_BC_TYPES, false});
+            continue;
+        }
+        CType type = c_type_from_typespec(e, param->type);
+        if (type == NUM_BC_TYPES) {
+            type = BC_I32;
+        }
+        const char *c_name = c_local_name(param->name);
+        if (i || instance->shared) {
+            c_write(out, ", ", 2);
+        }
+        c_declare(out, type, c_name);
+        buf_push(e->locals, (CLocal){param->name, c_name, type, false});
+    }
+    if (decl->fn.has_varargs) {
+        c_str(out, decl->fn.num_params ? ", ..." : "...");
+    } else if (!decl->fn.num_params) {
+        c_str(out, "void");
+    }
+    c_write(out, ")", 1);
+}
+
+static void
+emit_c_fn(CEmitter *e, CInstance *instance) {
+    buf_clear(e->locals);
+    e->num_switches = 0;
+    emit_c_fn_header(e, instance);
+    c_write(e->out, " ", 1);
+    emit_c_block(e, *parse_decl_fn_body(instance->decl));
+    c_write(e->out, "\n\n", 2);
+    buf_clear(e->locals);
+    e->instance = NULL;
+}
+
+static void
+emit_c_kernel_header(CWriter *out, CKernel *kernel) {
+    const char *elem = c_type_names[kernel->scalar->types[0]];
+    if (kernel->kind == C_BUILTIN_MAP) {
+        c_printf(out, "static void %s(%s *dst", kernel->c_name, elem);
+        for (size_t i = 0; i < kernel->scalar->decl->fn.num_params; i++) {
+            c_printf(out, ", const %s *src%zu", elem, i);
+        }
+    } else {
+        c_printf(out, "static %s %s(%s acc, const %s *src", elem, kernel->c_name, elem, elem);
+    }
+    c_str(out, ", int64_t n)");
+}
+
+// One scalar step of a kernel, on element index.
+static void
+emit_c_kernel_step(CWriter *out, CKernel *kernel, const char *index) {
+    if (kernel->kind == C_BUILTIN_MAP) {
+        c_printf(out, "        dst[%s] = %s(", index, kernel->scalar->c_name);
+        for (size_t i = 0; i < kernel->scalar->decl->fn.num_params; i++) {
+            c_printf(out, "%ssrc%zu[%s]", i ? ", " : "", i, index);
+        }
+    } else {
+        c_printf(out, "        acc = %s(acc, src[%s]", kernel->scalar->c_name, index);
+    }
+    c_write(out, ");\n", 3);
+}
+
+// A kernel steps through the elements before the first aligned one, then
+// calls the vector instance of f a vector at a time, and finishes with a
+// switch on the number left, falling through a case for each.
+static void
+emit_c_kernel(CWriter *out, CKernel *kernel) {
+    CVectorType *vector = c_vector(kernel->vector_type);
+    const char *type = vector->c_name;
+    int lanes = vector->num_lanes;
+    bool is_map = kernel->kind == C_BUILTIN_MAP;
+    emit_c_kernel_header(out, kernel);
+    c_str(out, " {\n    int64_t i = 0;\n");
+    c_printf(out, "    for (; i < n && (uintptr_t)(%s + i) %% sizeof(%s) != 0; i++) {\n", is_map ? "dst" : "src", type);
+    emit_c_kernel_step(out, kernel, "i");
+    c_str(out, "    }\n");
+    if (is_map) {
+        c_printf(out, "    for (; n - i >= %d; i += %d) {\n", lanes, lanes);
+        c_printf(out, "        %s_store_aligned(dst + i, %s(", type, kernel->vector->c_name);
+        for (size_t i = 0; i < kernel->scalar->decl->fn.num_params; i++) {
+            c_printf(out, "%s%s_load(src%zu + i)", i ? ", " : "", type, i);
+        }
+        c_str(out, "));\n    }\n");
+    } else {
+        c_printf(out, "    if (n - i >= %d) {\n", lanes);
+        c_printf(out, "        %s lanes = %s_load(src + i);\n", type, type);
+        c_printf(out, "        for (i += %d; n - i >= %d; i += %d) {\n", lanes, lanes, lanes);
+        c_printf(out, "            lanes = %s(lanes, %s_load(src + i));\n        }\n", kernel->vector->c_name, type);
+        c_printf(out, "        for (int j = 0; j < %d; j++) {\n", lanes);
+        c_printf(out, "            acc = %s(acc, CR_LANE(lanes, j));\n        }\n    }\n", kernel->scalar->c_name);
+    }
+    c_str(out, "    switch (n - i) {\n");
+    for (int left = lanes - 1; left > 0; left--) {
+        char index[32];
+        snprintf(index, sizeof(index), left > 1 ? "i + %d" : "i", left - 1);
+        c_printf(out, "    case %d:\n", left);
+        emit_c_kernel_step(out, kernel, index);
+        if (left > 1) {
+            c_str(out, "        /* fallthrough */\n");
+        }
+    }
+    c_str(out, is_map ? "    }\n}\n\n" : "    }\n    return acc;\n}\n\n");
+}
+
+static void
+emit_c_member(CEmitter *e, LayoutField *field) {
+    Type *type = field->type;
+    u32 num_elems = 0;
+    if (type->kind == TYPE_ARRAY) {
+        num_elems = type->num_elems;
+        type = type->base;
+    }
+    CType c_type = c_type_from_type(type);
+    if (c_type == NUM_BC_TYPES) {
+        error(field->pos, "Type of field '%s' can't be compiled to C yet", field->name);
+        c_type = BC_U8;
+    }
+    c_declare(e->out, c_type, c_local_name(field->name));
+    if (num_elems) {
+        c_printf(e->out, "[%u]", num_elems);
+    }
+    c_write(e->out, ";", 1);
+}
+
+// The members of block in order, each after the padding that puts it at its
+// offset, and then the padding up to the block's size.
+static void
+emit_c_members(CEmitter *e, Layout *layout, LayoutBlock *block, int *num_pads) {
+    CWriter *out = e->out;
+    bool is_struct = block->kind == AGGREGATE_STRUCT;
+    u64 end = 0;
+    e->indent++;
+    for (size_t i = 0; i < block->num_units; i++) {
+        LayoutUnit *unit = &block->units[i];
+        if (unit->offset > end) {
+            c_newline(e);
+            c_printf(out, "uint8_t cr_pad%d[%llu];", (*num_pads)++, (unsigned long long)(unit->offset - end));
+        }
+        c_newline(e);
+        switch (unit->kind) {
+        case LAYOUT_FIELD:
+            emit_c_member(e, &layout->fields[unit->index]);
+            break;
+        case LAYOUT_WORD:
+            c_printf(out, "%s cr_bits%u;", c_type_names[layout->words[unit->index].type], unit->index);
+            break;
+        case LAYOUT_BLOCK:
+            c_str(out, unit->block->kind == AGGREGATE_STRUCT ? "struct {" : "union {");
+            emit_c_members(e, layout, unit->block, num_pads);
+            c_newline(e);
+            c_str(out, "};");
+            break;
+        }
+        if (is_struct || unit->size > end) {
+            end = unit->offset + unit->size;
+        }
+    }
+    if (end < block->size) {
+        c_newline(e);
+        // a union's members all start at 0
+        c_printf(out, "uint8_t cr_pad%d[%llu];", (*num_pads)++, (unsigned long long)(is_struct ? block->size - end : block->size));
+    }
+    e->indent--;
+}
+
+// Every used struct and union, after a typedef of each so they can point to
+// each other, with asserts that C put each member where the layout did.
+static void
+emit_c_structs(CEmitter *e) {
+    CWriter *out = e->out;
+    for (size_t i = 0; i < buf_len(c_structs); i++) {
+        if (!c_structs[i].used) {
+            continue;
+        }
+        c_printf(out, "typedef %s %s %s;\n", c_structs[i].layout->root.kind == AGGREGATE_STRUCT ? "struct" : "union",
+            c_structs[i].c_name, c_structs[i].c_name);
+    }
+    for (size_t i = 0; i < buf_len(c_structs); i++) {
+        if (!c_structs[i].used) {
+            continue;
+        }
+        Layout *layout = c_structs[i].layout;
+        const char *c_name = c_structs[i].c_name;
+        int num_pads = 0;
+        c_printf(out, "\n%s %s {", layout->root.kind == AGGREGATE_STRUCT ? "struct" : "union", c_name);
+        emit_c_members(e, layout, &layout->root, &num_pads);
+        c_str(out, "\n};\n");
+        c_printf(out, "_Static_assert(sizeof(%s) == %llu, \"layout of %s\");\n", c_name, (unsigned long long)layout->root.size, c_name);
+        for (size_t j = 0; j < layout->num_fields; j++) {
+            LayoutField *field = &layout->fields[j];
+            if (!field->bits) {
+                c_printf(out, "_Static_assert(offsetof(%s, %s) == %llu, \"layout of %s\");\n", c_name, c_local_name(field->name),
+                    (unsigned long long)field->offset, c_name);
+            }
+        }
+        for (size_t j = 0; j < layout->num_words; j++) {
+            c_printf(out, "_Static_assert(offsetof(%s, cr_bits%zu) == %llu, \"layout of %s\");\n", c_name, j,
+                (unsigned long long)layout->words[j].offset, c_name);
+        }
+    }
+}
+
+// Gives every struct and union its CType, in the order they were laid out.
+static void
+c_struct_init(void) {
+    for (size_t i = 0; i < buf_len(layout_list); i++) {
+        Decl *decl = layout_list[i]->decl;
+        if (i == C_MAX_STRUCTS) {
+            error(decl->pos, "More than %d structs and unions can't be compiled to C", C_MAX_STRUCTS);
+            return;
+        }
+        const char *c_name = map_get(&c_names, decl);
+        buf_push(c_structs, (CStruct){
+            .layout = layout_list[i],
+            .c_name = c_name,
+            .ptr_name = strf("%s *", c_name),
+            .ptr_source_name = strf("%s*", decl->name),
+            .ptr_mangled_name = strf("%sp", c_name),
+        });
+        map_put_uint64(&c_struct_types, decl, C_FIRST_STRUCT + i + 1);
+    }
+}
+
+// The table a shared version is called with for a struct: the struct's size
+// and the offset of each field the shared version uses.
+static void
+emit_c_table(CWriter *out, CInstance *instance) {
+    CShared *shared = instance->via;
+    const char *c_name = c_struct(instance->types[0])->c_name;
+    c_printf(out, "static const size_t %s[] = {sizeof(%s)", instance->c_name, c_name);
+    for (size_t i = 0; i < buf_len(shared->fields); i++) {
+        c_printf(out, ", offsetof(%s, %s)", c_name, c_local_name(shared->fields[i]));
+    }
+    c_str(out, "};\n");
+}
+
+static void
+emit_c_var(CEmitter *e, Decl *decl) {
+    CType type;
+    bool unknown = false;
+    if (decl->var.type) {
+        type = c_type_from_typespec(e, decl->var.type);
+    } else {
+        type = c_global_type(decl);
+        unknown = type == NUM_BC_TYPES || type == BC_VOID;
+    }
+    if (type == NUM_BC_TYPES || type == BC_VOID) {
+        type = BC_I32;
+    }
+    c_str(e->out, "static ");
+    if (C_IS_PTR(type) && decl->var.type && decl->var.type->kind == TYPESPEC_ARRAY) {
+        c_declare(e->out, C_PTR_ELEM(type), map_get(&c_names, decl));
+        emit_c_array_size(e, decl->var.type);
+        if (decl->var.expr) {
+            error(decl->pos, "Arrays can't be initialized from an expression");
+        }
+        c_write(e->out, ";\n", 2);
+        return;
+    }
+    c_declare(e->out, type, map_get(&c_names, decl));
+    size_t num_errors = buf_len(errors);
+    if (decl->var.expr) {
+        c_write(e->out, " = ", 3);
+        emit_c_converted(e, type, decl->var.expr);
+    }
+    if (unknown && buf_len(errors) == num_errors) {
+        error(decl->pos, "Type of '%s' can't be inferred, give it a type", decl->name);
+    }
+    c_write(e->out, ";\n", 2);
+}
+
+// Gives every top-level name its C name. A name declared by one module only
+// keeps it; the others get the index of their module appended.
+static void
+assign_c_names(CModule *modules, size_t num_modules) {
+    for (size_t i = 0; i < sizeof(c_reserved_names) / sizeof(*c_reserved_names); i++) {
+        map_put(&c_reserved, str_intern(c_reserved_names[i]), (void *)1);
+    }
+    Map counts = {0};
+    for (size_t i = 0; i < num_modules; i++) {
+        Decls *decls = modules[i].decls;
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            Decl *decl = decls->decls[j];
+            if (decl->kind == DECL_FUNC || decl->kind == DECL_VAR || decl->kind == DECL_STRUCT || decl->kind == DECL_UNION) {
+                map_put_uint64(&counts, (void *)decl->name, map_get_uint64(&counts, (void *)decl->name) + 1);
+            }
+        }
+    }
+    for (size_t i = 0; i < num_modules; i++) {
+        Decls *decls = modules[i].decls;
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            Decl *decl = decls->decls[j];
+            if (decl->kind != DECL_FUNC && decl->kind != DECL_VAR && decl->kind != DECL_STRUCT && decl->kind != DECL_UNION) {
+                continue;
+            }
+            const char *c_name = decl->name;
+            if (map_get_uint64(&counts, (void *)decl->name) > 1 || c_is_reserved(decl->name)) {
+                char *name = strf("%s__%zu", decl->name, i);
+                c_name = str_intern(name);
+                free(name);
+            }
+            map_put(&c_names, decl, (void *)c_name);
+            map_put(&c_decl_scopes, decl, modules[i].scope);
+        }
+    }
+    map_free(&counts);
+}
+
+// The first root module's main, if one has a main.
+static Decl *
+c_find_main(CModule *modules, size_t num_modules) {
+    const char *main_name = str_intern("main");
+    for (size_t i = 0; i < num_modules && modules[i].is_root; i++) {
+        Decl *decl = map_get(&modules[i].scope->decls, main_name);
+        if (decl && decl->kind == DECL_FUNC && !decl->fn.num_generics) {
+            return decl;
+        }
+    }
+    return NULL;
+}
+
+// The entry point calls main.
+static void
+emit_c_main(CWriter *out, CModule *modules, size_t num_modules) {
+    Decl *decl = c_find_main(modules, num_modules);
+    if (!decl) {
+        return;
+    }
+    if (decl->fn.num_params) {
+        error(decl->pos, "main can't take parameters");
+    }
+    const char *c_name = map_get(&c_names, decl);
+    CType ret_type = c_named_type(map_get(&c_decl_scopes, decl), decl->fn.ret_type);
+    if (C_IS_VECTOR(ret_type)) {
+        error(decl->pos, "main can't return a vector");
+    } else if (C_IS_STRUCT(ret_type)) {
+        error(decl->pos, "main can't return a struct or union");
+    }
+    if (ret_type == BC_VOID) {
+        c_str(out, "int main(void) {\n    ");
+        c_str(out, c_name);
+        c_str(out, "();\n    return 0;\n}\n");
+    } else {
+        c_str(out, "int main(void) {\n    return (int)");
+        c_str(out, c_name);
+        c_str(out, "();\n}\n");
+    }
+}
+
+// The batch's errors are taken back out of this thread's, which on the
+// calling thread already hold the compile's warnings.
+static void
+emit_c_batch_task(void *arg) {
+    CBatch *batch = arg;
+    size_t num_errors_before = buf_len(errors);
+    CWriter out = {0};
+    CEmitter e = {.out = &out};
+    for (size_t i = 0; i < buf_len(batch->fns); i++) {
+        emit_c_fn(&e, batch->fns[i]);
+    }
+    buf_free(e.locals);
+    batch->buf = out.buf;
+    for (size_t i = num_errors_before; i < buf_len(errors); i++) {
+        buf_push(batch->errors, errors[i]);
+    }
+    if (errors) {
+        buf__hdr(errors)->len = num_errors_before;
+    }
+}
+
+// Writes the C for modules to file. False if the file couldn't be written;
+// anything that can't be compiled to C is reported as an error.
+static bool
+emit_c(FILE *file, CModule *modules, size_t num_modules, int num_threads) {
+    phase_push(PHASE_EMIT);
+    c_vector_init();
+    assign_c_names(modules, num_modules);
+    c_struct_init();
+    bool has_generics = false;
+    for (size_t i = 0; i < num_modules; i++) {
+        Decls *decls = modules[i].decls;
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            Decl *decl = decls->decls[j];
+            if (decl->kind == DECL_FUNC && decl->fn.num_generics) {
+                has_generics = true;
+            } else if (decl->kind == DECL_FUNC) {
+                c_instance_get(decl, NULL);
+            }
+        }
+    }
+    CWriter out = {file};
+    CEmitter e = {.out = &out};
+    Decl *entry = c_find_main(modules, num_modules);
+    c_discovering = true;
+    for (size_t i = 0; i < buf_len(c_instance_list); i++) {
+        if (!entry || c_instance_list[i]->decl == entry) {
+            c_reach(c_instance_list[i]);
+        }
+    }
+    for (size_t i = 0; i < num_modules && !entry; i++) {
+        Decls *decls = modules[i].decls;
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            if (decls->decls[j]->kind == DECL_VAR) {
+                c_var_reach(decls->decls[j]);
+            }
+        }
+    }
+    if (entry || has_generics) {
+        // walking a fn or var reaches what it names, which is queued to be
+        // walked in turn; whatever it reports is reported again when it's
+        // generated
+        CWriter discard = {.discard = true};
+        CEmitter walker = {.out = &discard};
+        size_t num_errors_before = buf_len(errors);
+        size_t next_fn = 0;
+        size_t next_var = 0;
+        while (next_fn < buf_len(c_reach_queue) || next_var < buf_len(c_var_queue)) {
+            if (next_fn < buf_len(c_reach_queue)) {
+                emit_c_fn(&walker, c_reach_queue[next_fn++]);
+            } else {
+                Decl *decl = c_var_queue[next_var++];
+                walker.scope = map_get(&c_decl_scopes, decl);
+                emit_c_var(&walker, decl);
+            }
+        }
+        if (errors) {
+            buf__hdr(errors)->len = num_errors_before;
+        }
+        buf_free(walker.locals);
+    }
+    c_discovering = false;
+    if (!entry) {
+        for (size_t i = 0; i < buf_len(c_structs); i++) {
+            c_structs[i].used = true;
+        }
+    }
+    // what nothing reached is dropped, the rest keeps its order
+    size_t num_reached = 0;
+    for (size_t i = 0; i < buf_len(c_instance_list); i++) {
+        if (c_instance_list[i]->reached) {
+            c_instance_list[num_reached++] = c_instance_list[i];
+        }
+    }
+    STATS_ADD(emit_dropped, buf_len(c_instance_list) - num_reached);
+    if (c_instance_list) {
+        buf__hdr(c_instance_list)->len = num_reached;
+    }
+
+    c_str(&out, c_prelude);
+    if (c_uses_vectors) {
+        c_str(&out, c_vector_prelude);
+        for (int i = 0; i < C_NUM_VECTOR_TYPES; i++) {
+            CVectorType *vector = &c_vector_types[i];
+            if (vector->used) {
+                c_printf(&out, "CR_VECTOR_TYPE(%s, %s, %d)\n", vector->c_name, c_type_names[vector->lane], vector->num_lanes);
+            }
+        }
+        for (int i = 0; i < C_NUM_VECTOR_TYPES; i++) {
+            CVectorType *vector = &c_vector_types[i];
+            if (vector->used) {
+                c_printf(&out, "%s(%s, %s, %s)\n", bc_is_float(vector->lane) ? "CR_VECTOR_OPS" : "CR_INT_VECTOR_OPS", vector->c_name,
+                    c_type_names[vector->lane], c_vector(vector->mask)->c_name);
+            }
+        }
+    }
+    bool word_types[NUM_BC_TYPES] = {0};
+    bool has_words = false;
+    for (size_t i = 0; i < buf_len(c_structs); i++) {
+        Layout *layout = c_structs[i].layout;
+        STATS_ADD(emit_dropped, !c_structs[i].used);
+        for (size_t j = 0; j < layout->num_words && c_structs[i].used; j++) {
+            word_types[layout->words[j].type] = has_words = true;
+        }
+    }
+    if (has_words) {
+        c_str(&out, c_bits_prelude);
+        for (BcType type = BC_U8; type <= BC_U64; type++) {
+            if (word_types[type]) {
+                c_printf(&out, "CR_SET_BITS(%s)\n", c_type_names[type]);
+            }
+        }
+    }
+    emit_c_structs(&e);
+    if (c_table_list) {
+        c_write(&out, "\n", 1);
+    }
+    for (size_t i = 0; i < buf_len(c_table_list); i++) {
+        emit_c_table(&out, c_table_list[i]);
+    }
+    c_write(&out, "\n", 1);
+    for (size_t i = 0; i < buf_len(c_instance_list); i++) {
+        emit_c_fn_header(&e, c_instance_list[i]);
+        c_write(&out, ";\n", 2);
+        buf_clear(e.locals);
+        e.instance = NULL;
+    }
+    for (size_t i = 0; i < buf_len(c_kernel_list); i++) {
+        emit_c_kernel_header(&out, c_kernel_list[i]);
+        c_write(&out, ";\n", 2);
+    }
+    for (size_t i = 0; i < num_modules; i++) {
+        Decls *decls = modules[i].decls;
+        e.scope = modules[i].scope;
+        for (size_t j = 0; j < decls->num_decls; j++) {
+            Decl *decl = decls->decls[j];
+            if (decl->kind == DECL_VAR && map_get(&c_reached_vars, decl)) {
+                emit_c_var(&e, decl);
+            } else if (decl->kind == DECL_VAR) {
+                STATS_ADD(emit_dropped, 1);
+            }
+        }
+    }
+    c_write(&out, "\n", 1);
+
+    if (num_threads <= 1) {
+        for (size_t i = 0; i < buf_len(c_instance_list); i++) {
+            emit_c_fn(&e, c_instance_list[i]);
+        }
+    } else {
+        CBatch *batches = NULL;
+        for (size_t i = 0; i < buf_len(c_instance_list); i += EMIT_BATCH_SIZE) {
+            CBatch batch = {0};
+            for (size_t j = i; j < i + EMIT_BATCH_SIZE && j < buf_len(c_instance_list); j++) {
+                buf_push(batch.fns, c_instance_list[j]);
+            }
+            buf_push(batches, batch);
+        }
+        size_t wave = (size_t)num_threads * EMIT_WAVE_BATCHES;
+        Pool *pool = pool_create(num_threads);
+        for (size_t start = 0; start < buf_len(batches); start += wave) {
+            size_t end = start + wave < buf_len(batches) ? start + wave : buf_len(batches);
+            for (size_t i = start; i < end; i++) {
+                pool_submit(pool, emit_c_batch_task, &batches[i]);
+            }
+            pool_run(pool);
+            for (size_t i = start; i < end; i++) {
+                c_write(&out, batches[i].buf, buf_len(batches[i].buf));
+                for (Error *it = batches[i].errors; it != buf_end(batches[i].errors); it++) {
+                    buf_push(errors, *it);
+                }
+                buf_free(batches[i].buf);
+                buf_free(batches[i].errors);
+                buf_free(batches[i].fns);
+            }
+        }
+        pool_free(pool);
+        buf_free(batches);
+    }
+    for (size_t i = 0; i < buf_len(c_kernel_list); i++) {
+        emit_c_kernel(&out, c_kernel_list[i]);
+    }
+    emit_c_main(&out, modules, num_modules);
+    c_flush(&out);
+    buf_free(e.locals);
+    buf_free(out.buf);
+    phase_pop();
+    return !out.failed;
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "error.h"
+#include "lex.h"
+#include "stats.h"
+#include "ast.h"
+#include "parse.h"
+#include "bytecode.h"
+#include "pool.h"
+#include "layout.h"
+
+// C backend. The whole program becomes one C file, written in two passes:
+// first a prelude and a declaration of every fn and global var, then the fn
+// bodies. Since everything is declared up front, bodies can be generated in
+// any order. With more than one thread, runs of fns are generated in parallel,
+// each into a buffer of its own, and the buffers are written out in order a
+// wave at a time. Otherwise text is appended to one buffer that is written out
+// whenever it holds EMIT_CHUNK_SIZE bytes, so the output is never in memory
+// whole.
+//
+// Generic fns are monomorphized: every call of one infers its type arguments
+// from the types of the call's arguments and refers to the instantiation for
+// them in a table keyed by (fn, canonical type arguments), so each is checked
+// and generated once however many calls share it.
+//
+// A generic fn whose one generic param T is only ever what some params point
+// to, p: T*, and whose body only uses those as p[i].field, also has a shared
+// version: one body for every struct T is bound to, which takes a table with
+// the struct's size and the offset of each field it uses ahead of its params,
+// so p[i].field is a load from p + i * size + offset, with the table's entries
+// a single load away. A call of such a fn uses the instance for its struct if
+// there is one already, or makes one if the instances of such fns so far are
+// within --specialize-budget AST nodes; otherwise it calls the shared version
+// with the struct's table. A struct that lacks one of the fields, or has it
+// as a bit field, an array or a type other structs don't, is always
+// specialized.
+//
+// Only what main can reach is generated. A discovery pass first walks main's
+// body without writing anything, adding the fns and instantiations it names
+// and the global vars it uses, and then walks those in turn, so everything
+// reached is known and declared before the first body is written. The structs
+// and unions the walked code declares something as are marked along the way,
+// with the ones their fields need. Consts are literals by then, so they reach
+// nothing. A program without a main keeps every non-generic fn, var and
+// struct, and only walks them when it has generics to find.
+//
+// SIMD vectors are base types, named for their lane type and count like f32x4
+// or u8x32, in every 16, 32 and 64 byte size. Operators apply lane by lane,
+// with a scalar operand taken as that value in every lane, and comparisons
+// give a mask: the signed integer vector of the same shape, each lane all ones
+// or zero. A vector is made with its type's name, from one value for every
+// lane or a value for each, and v[i] is a lane; select(mask, a, b), any(mask),
+// all(mask) and shuffle(v, lane indices...) do the rest. In C every operation
+// is a call of a small inline helper, which the prelude defines on GCC's
+// vector extensions when the C compiler has them and as loops over an array of
+// lanes otherwise, or when CR_SCALAR_VECTORS is defined. Only the vector types
+// some source names or some kernel uses are defined. select, any and all also
+// take scalars, with a bool for the mask, so a generic fn can use them for
+// both.
+//
+// Pointers to scalars, T*, index like in C. An array, T[n], is declared with
+// its n elements and is otherwise a T* to the first, which is also what an
+// array parameter is.
+//
+// map(f, dst, srcs..., n) sets dst[i] = f(srcs[0][i], ...) for every i below
+// n, and reduce(f, init, src, n) folds the n elements of src into init with
+// f. Both take a generic fn<T> whose params and result are all T, and are
+// generated as a kernel fn for each such fn and element type. A kernel calls f
+// instantiated for the vector of the element type that is as wide as the
+// target's vector registers, set with --simd, on all but a few elements: the
+// ones before the first aligned one (of dst for map and of src for reduce),
+// and the ones left at the end, which are taken by an unrolled switch with a
+// case for each count. Those use f instantiated for the element type itself.
+// reduce treats f as associative and commutative, folding the vector lanes
+// separately before combining them, which can change float results.
+//
+// A switch is generated from the decision tree the checker built for it (see
+// match.h): the values it's on go in temporaries, every node of the tree is a
+// C switch on one of them, with a case label for each key of its edges, which
+// C compilers make a jump table when the keys are dense, and every leaf is a
+// goto to its case's body. Edges with more than C_MAX_CASE_LABELS keys are
+// tested with comparisons before the C switch instead. The bodies follow the
+// tree, so a break or continue in one belongs to the enclosing loop, as it
+// does in the source. An enum is its base type, and its items are literals.
+//
+// Structs and unions are laid out by the checker (see layout.h) and written
+// out member by member in that order, with explicit padding wherever the
+// layout leaves a gap and a nested struct or union as an anonymous member, so
+// C puts every member where the layout did; static asserts check each offset
+// and the size. The bit fields sharing a word are one uintN_t member: a read
+// shifts and masks it with the field's constant mask, and an assignment goes
+// through a helper that clears the field's bits and sets them. C's own bit
+// fields aren't used, since where they go is up to the C compiler.
+//
+// Top-level names are kept as they are unless more than one module declares
+// them or they are reserved in C, and then get the module's index appended.
+// Consts are replaced by their evaluated values, so the C compiler sees plain
+// literals. Expressions are typed with the rules compile-time evaluation uses,
+// which are C's usual arithmetic conversions, so the types given to names
+// declared with := match what the consts computed.
+
+#define EMIT_CHUNK_SIZE (64 * 1024)
+// fns generated by one task
+#define EMIT_BATCH_SIZE 64
+// batches per thread generated before they are written out
+#define EMIT_WAVE_BATCHES 4
+// generic params a fn may have
+#define MAX_GENERICS 16
+// keys an edge of a switch's tree may give case labels
+#define C_MAX_CASE_LABELS 16
+#define C_NUM_VECTOR_TYPES 30
+// AST nodes of the instances of fns with a shared version that are made
+// before calls go through the shared version instead
+#define C_SPECIALIZE_BUDGET 4096
+
+#define C_MAX_STRUCTS 16384
+
+// A type in the C backend: a BcType, NUM_BC_TYPES if unknown, C_FIRST_VECTOR
+// + i for c_vector_types[i], or C_FIRST_STRUCT + i for c_structs[i].
+typedef u16 CType;
+
+#define C_FIRST_VECTOR (NUM_BC_TYPES + 1)
+#define C_IS_VECTOR(type) ((type) >= C_FIRST_VECTOR && (type) < C_FIRST_PTR)
+// pointers to each scalar BcType
+#define C_FIRST_PTR (C_FIRST_VECTOR + C_NUM_VECTOR_TYPES)
+#define C_FIRST_STRUCT (C_FIRST_PTR + NUM_BC_TYPES)
+#define C_IS_STRUCT(type) ((type) >= C_FIRST_STRUCT && (type) < C_FIRST_STRUCT_PTR)
+// pointers to each struct
+#define C_FIRST_STRUCT_PTR (C_FIRST_STRUCT + C_MAX_STRUCTS)
+#define C_IS_PTR(type) (((type) >= C_FIRST_PTR && (type) < C_FIRST_STRUCT) || (type) >= C_FIRST_STRUCT_PTR)
+#define C_PTR(elem) ((CType)(C_IS_STRUCT(elem) ? (elem) + C_MAX_STRUCTS : C_FIRST_PTR + (elem)))
+#define C_PTR_ELEM(type) ((CType)((type) >= C_FIRST_STRUCT_PTR ? (type) - C_MAX_STRUCTS : (type) - C_FIRST_PTR))
+
+typedef struct CVectorType {
+    // interned
+    const char *name;
+    const char *c_name;
+    BcType lane;
+    u8 num_lanes;
+    // type comparisons give
+    CType mask;
+    // named by some source or used by a kernel, so the prelude defines it
+    bool used;
+} CVectorType;
+
+typedef struct CStruct {
+    Layout *layout;
+    const char *c_name;
+    // of a pointer to it: in C, in source and in instance names
+    const char *ptr_name;
+    const char *ptr_source_name;
+    const char *ptr_mangled_name;
+    // declared as by some reached code, or needed by one that is
+    bool used;
+} CStruct;
+
+typedef enum CBuiltin {
+    C_BUILTIN_NONE,
+    // a vector type's name, making a vector
+    C_BUILTIN_VECTOR,
+    C_BUILTIN_SELECT,
+    C_BUILTIN_ANY,
+    C_BUILTIN_ALL,
+    C_BUILTIN_SHUFFLE,
+    C_BUILTIN_MAP,
+    C_BUILTIN_REDUCE,
+    NUM_C_BUILTINS,
+} CBuiltin;
+
+typedef struct SimdTarget {
+    const char *name;
+    // size of its vector registers
+    int bytes;
+} SimdTarget;
+
+typedef struct CModule {
+    Decls *decls;
+    // names visible in the module, as built by check_file
+    ModuleScope *scope;
+    bool is_root;
+} CModule;
+
+typedef struct CWriter {
+    // NULL to keep everything in buf
+    FILE *file;
+    char *buf;
+    // drop everything, for the discovery pass
+    bool discard;
+    bool failed;
+} CWriter;
+
+struct CShared;
+
+// A fn as it is generated: either a non-generic fn, or a generic one with
+// its generic params bound to types.
+typedef struct CInstance {
+    Decl *decl;
+    // canonical type arguments as interned type names, and as the types the
+    // generic params are bound to
+    const char **args;
+    CType *types;
+    size_t num_args;
+    const char *c_name;
+    // the scope of the module the fn is in
+    ModuleScope *scope;
+    // found by the discovery pass, so it's generated
+    bool reached;
+    // set for a generic fn's shared version, whose types are NULL
+    struct CShared *shared;
+    // set when calls for these types go through this shared version instead;
+    // such an instance isn't generated, and c_name names the table they pass
+    struct CShared *via;
+    // next entry with the same hash
+    struct CInstance *next;
+} CInstance;
+
+// What a generic fn's shared version needs, see above.
+typedef struct CShared {
+    Decl *decl;
+    // whether decl can have one at all
+    bool ok;
+    // AST nodes in the body, what an instance costs
+    size_t size;
+    // the fields used as p[i].field, in order of first use, and the type
+    // each has in every struct the shared version is called for, which the
+    // first such struct sets
+    const char **fields;
+    CType *field_types;
+    // generated once the first call goes through it
+    CInstance *instance;
+} CShared;
+
+// A map or reduce kernel for one fn and element type.
+typedef struct CKernel {
+    CBuiltin kind;
+    // f for the element type and for its vector
+    CInstance *scalar;
+    CInstance *vector;
+    CType vector_type;
+    const char *c_name;
+    // next entry with the same hash
+    struct CKernel *next;
+} CKernel;
+
+typedef struct CLocal {
+    const char *name;
+    const char *c_name;
+    CType type;
+    // declared with its elements, so it can't be assigned
+    bool is_array;
+} CLocal;
+
+typedef struct CEmitter {
+    CWriter *out;
+    ModuleScope *scope;
+    // fn being generated, which binds the generic params
+    CInstance *instance;
+    // params and locals in scope, innermost last
+    CLocal *locals;
+    int indent;
+    // switches generated in the fn so far, which number their labels
+    int num_switches;
+} CEmitter;
+
+typedef struct CBatch {
+    CInstance **fns;
+    char *buf;
+    Error *errors;
+} CBatch;
+
+const char *flag_emit_c_path = NULL;
+int flag_simd_bytes = 16;
+int flag_specialize_budget = C_SPECIALIZE_BUDGET;
+
+static const SimdTarget simd_targets[] = {
+    {"sse2", 16},
+    {"avx2", 32},
+    {"avx512", 64},
+};
+
+static bool emit_c(FILE *file, CModule *modules, size_t num_modules, int num_threads);
+static CType c_expr_type(CEmitter *e, Expr *expr);
+static void emit_c_expr(CEmitter *e, Expr *expr);
+static void emit_c_stmt(CEmitter *e, Stmt *stmt);
+static void emit_c_block(CEmitter *e, StmtList block);
+static void emit_c_fn(CEmitter *e, CInstance *instance);
@@ -1,16 +1,225 @@
 #include "error.h"
 
-static void print_error(Error *error) {
-    switch (error->kind) {
+static void print_error_message(char **out, Error *err) {
+    switch (err->kind) {
     case ERROR_NONE:
         // Do nothing!
         break;
     case ERROR_EXPECTED:
-        
+        buf_printf(*out, "Expected token %s, got %s", token_kind_name(err->expected.expected_token), err->found);
+        break;
+    case ERROR_UNEXPECTED:
+        buf_printf(*out, "Unexpected token %s in %s", err->found, err->unexpected.context);
+        break;
+    case ERROR_MESSAGE:
+        buf_printf(*out, "%s", err->message);
         break;
-    
     default:
-        printf("Unhandled error!");
+        buf_printf(*out, "Unhandled error!");
         break;
     }
 }
+
+// Renders one diagnostic as a line of text appended to *out.
+static void print_error(char **out, Error *err) {
+    if (err->kind == ERROR_NONE) {
+        return;
+    }
+    const char *name = err->pos.name ? err->pos.name : "<builtin>";
+    buf_printf(*out, "%s(%d): %s: ", name, err->pos.line, err->is_warning ? "warning" : "error");
+    print_error_message(out, err);
+    buf_printf(*out, "\n");
+}
+
+static void buf_json_string(char **out, const char *str) {
+    buf_printf(*out, "\"");
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\') {
+            buf_printf(*out, "\\%c", c);
+        } else if (c == '\n') {
+            buf_printf(*out, "\\n");
+        } else if (c < 0x20) {
+            buf_printf(*out, "\\u%04x", c);
+        } else {
+            buf_push(*out, c);
+        }
+    }
+    buf_printf(*out, "\"");
+}
+
+static const char *error_kind_names[] = {
+    [ERROR_NONE] = "none",
+    [ERROR_EXPECTED] = "expected",
+    [ERROR_UNEXPECTED] = "unexpected",
+    [ERROR_MESSAGE] = "message",
+};
+
+// Renders one diagnostic as a single line JSON object appended to *out:
+// {"file", "offset", "line", "column", "severity", "kind", "message"} plus
+// "expected"/"found" token kinds, "found_text" and a suggested "fix" when known.
+static void print_error_json(char **out, Error *err) {
+    buf_printf(*out, "{\"file\":");
+    buf_json_string(out, err->pos.name ? err->pos.name : "<builtin>");
+    buf_printf(*out, ",\"offset\":%d,\"line\":%d,\"column\":%d,\"severity\":\"%s\",\"kind\":\"%s\",\"corrected\":%s",
+        err->pos.offset, err->pos.line, err->pos.col, err->is_warning ? "warning" : "error",
+        error_kind_names[err->kind], err->corrected ? "true" : "false");
+    char *message = NULL;
+    print_error_message(&message, err);
+    buf_push(message, 0);
+    buf_printf(*out, ",\"message\":");
+    buf_json_string(out, message);
+    buf_free(message);
+    TokenKind found_token = TOKEN_EOF;
+    if (err->kind == ERROR_EXPECTED) {
+        found_token = err->expected.found_token;
+        buf_printf(*out, ",\"expected\":");
+        buf_json_string(out, token_kind_name(err->expected.expected_token));
+    } else if (err->kind == ERROR_UNEXPECTED) {
+        found_token = err->unexpected.found_token;
+    }
+    if (err->kind == ERROR_EXPECTED || err->kind == ERROR_UNEXPECTED) {
+        buf_printf(*out, ",\"found\":");
+        buf_json_string(out, token_kind_name(found_token));
+        buf_printf(*out, ",\"found_text\":");
+        buf_json_string(out, err->found_text ? err->found_text : err->found);
+    }
+    TokenKind expected = err->kind == ERROR_EXPECTED ? err->expected.expected_token : TOKEN_EOF;
+    bool has_spelling = expected > TOKEN_EOF && expected != TOKEN_KEYWORD && expected != TOKEN_INT
+        && expected != TOKEN_FLOAT && expected != TOKEN_STR && expected != TOKEN_NAME;
+    if (has_spelling) {
+        bool replace = err->expected.replaced;
+        buf_printf(*out, ",\"fix\":{\"action\":\"%s\",\"offset\":%d,\"length\":%d,\"text\":",
+            replace ? "replace" : "insert", err->pos.offset, replace ? err->found_len : 0);
+        buf_json_string(out, token_kind_name(expected));
+        buf_printf(*out, "}");
+    }
+    buf_printf(*out, "}\n");
+}
+
+// Adds a diagnostic to errors, and writes it out right away when streaming.
+static void record_error(Error err) {
+    buf_push(errors, err);
+    if (flag_json_errors) {
+        char *line = NULL;
+        print_error_json(&line, &err);
+        mutex_lock(&error_output_mutex);
+        fwrite(line, 1, buf_len(line), stderr);
+        fflush(stderr);
+        mutex_unlock(&error_output_mutex);
+        buf_free(line);
+    }
+}
+
+// Records a syntax error. Errors found while the parser is in panic mode are
+// dropped, since they are almost always caused by the first one.
+static void report_error(Error err) {
+    if (panic_mode) {
+        return;
+    }
+    record_error(err);
+}
+
+// Records a free-form diagnostic, formatting its text into error_arena.
+static void report_message(SrcPos pos, bool is_warning, const char *fmt, va_list args) {
+    va_list size_args;
+    va_copy(size_args, args);
+    size_t n = 1 + vsnprintf(NULL, 0, fmt, size_args);
+    va_end(size_args);
+    char *message = arena_alloc(&error_arena, n);
+    vsnprintf(message, n, fmt, args);
+    record_error((Error){
+        .kind = ERROR_MESSAGE,
+        .pos = pos,
+        .is_warning = is_warning,
+        .message = message,
+    });
+}
+
+static size_t num_errors(void) {
+    size_t n = 0;
+    for (Error *it = errors; it != buf_end(errors); it++) {
+        n += !it->is_warning;
+    }
+    return n;
+}
+
+static int compare_errors(const void *a, const void *b) {
+    const Error *x = *(const Error **)a;
+    const Error *y = *(const Error **)b;
+    const char *x_name = x->pos.name ? x->pos.name : "";
+    const char *y_name = y->pos.name ? y->pos.name : "";
+    if (x_name != y_name) {
+        int cmp = strcmp(x_name, y_name);
+        if (cmp) {
+            return cmp;
+        }
+    }
+    if (x->pos.line != y->pos.line) {
+        return x->pos.line < y->pos.line ? -1 : 1;
+    }
+    // keep the order of detection within a line
+    return x < y ? -1 : x > y;
+}
+
+static bool is_same_error(Error *x, Error *y) {
+    if (x->kind != y->kind || x->is_warning != y->is_warning || x->pos.line != y->pos.line) {
+        return false;
+    }
+    if (x->pos.name != y->pos.name && strcmp(x->pos.name ? x->pos.name : "", y->pos.name ? y->pos.name : "") != 0) {
+        return false;
+    }
+    switch (x->kind) {
+    case ERROR_EXPECTED:
+        return x->expected.expected_token == y->expected.expected_token && strcmp(x->found, y->found) == 0;
+    case ERROR_UNEXPECTED:
+        return x->unexpected.context == y->unexpected.context && strcmp(x->found, y->found) == 0;
+    case ERROR_MESSAGE:
+        return strcmp(x->message, y->message) == 0;
+    default:
+        return true;
+    }
+}
+
+// Sorts, deduplicates and renders every recorded diagnostic as text or JSON
+// lines appended to *out, then clears them.
+static void render_errors(char **out, bool json) {
+    size_t len = buf_len(errors);
+    if (!len) {
+        return;
+    }
+    Error **sorted = xmalloc(len * sizeof(Error *));
+    for (size_t i = 0; i < len; i++) {
+        sorted[i] = &errors[i];
+    }
+    qsort(sorted, len, sizeof(Error *), compare_errors);
+    buf_fit(*out, buf_len(*out) + len * 64);
+    for (size_t i = 0; i < len; i++) {
+        if (i > 0 && is_same_error(sorted[i - 1], sorted[i])) {
+            continue;
+        }
+        if (json) {
+            print_error_json(out, sorted[i]);
+        } else {
+            print_error(out, sorted[i]);
+        }
+    }
+    free(sorted);
+    buf_clear(errors);
+}
+
+// Writes out every recorded diagnostic, then clears them. Streamed
+// diagnostics have already been written.
+static void flush_errors(void) {
+    if (flag_json_errors) {
+        buf_clear(errors);
+        return;
+    }
+    char *out = NULL;
+    render_errors(&out, false);
+    if (out) {
+        fwrite(out, 1, buf_len(out), stdout);
+        fflush(stdout);
+        buf_free(out);
+    }
+}
@@ -7,22 +7,57 @@
 typedef enum ErrorKind {
     ERROR_NONE,
     ERROR_EXPECTED,
+    ERROR_UNEXPECTED,
+    ERROR_MESSAGE,
 } ErrorKind;
 
+// Diagnostics are recorded as Errors when detected and only rendered by
+// flush_errors, which sorts them by position, drops duplicates and writes them
+// all with one fwrite. Warnings are Errors with is_warning set.
 typedef struct Error {
     ErrorKind kind;
     SrcPos pos;
     bool corrected;
+    bool is_warning;
+    // name or kind of the offending token, its text as written (in
+    // error_arena) and its length in the source
+    const char *found;
+    const char *found_text;
+    int found_len;
     
     union {
         struct {
             TokenKind expected_token;
             TokenKind found_token;
+            // the found token was taken to be a misspelling of the expected one
+            bool replaced;
         } expected;
+        struct {
+            TokenKind found_token;
+            const char *context;
+        } unexpected;
+        const char *message;
     };
     
 } Error;
 
-static Error *errors = NULL;
+static THREAD_LOCAL Error *errors = NULL;
+// formatted text of ERROR_MESSAGE records
+static THREAD_LOCAL Arena error_arena;
+
+// Instead of text at exit, write each diagnostic as a JSON object on its own
+// line to stderr as soon as it is recorded, for editors to consume while we
+// run. stdout is left to --print-consts, -o - and the time report.
+bool flag_json_errors = false;
+Mutex error_output_mutex = MUTEX_INIT;
 
-static void print_error(Error *error);
\ No newline at end of file
+static void print_error_message(char **out, Error *err);
+static void print_error(char **out, Error *err);
+static void buf_json_string(char **out, const char *str);
+static void print_error_json(char **out, Error *err);
+static void record_error(Error err);
+static void report_error(Error err);
+static void report_message(SrcPos pos, bool is_warning, const char *fmt, va_list args);
+static size_t num_errors(void);
+static void render_errors(char **out, bool json);
+static void flush_errors(void);
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include "layout.h"
+
+// declared struct or union to its Layout, and every Layout in the order they
+// were computed, which puts the ones a struct contains before it
+static Map layouts;
+static Layout **layout_list;
+
+typedef struct LayoutBitField {
+    u32 field;
+    u8 bits;
+    u32 order;
+} LayoutBitField;
+
+typedef struct LayoutBuilder {
+    Layout *layout;
+    LayoutInput *inputs;
+    size_t num_inputs;
+    size_t next_input;
+    LayoutField *fields;
+    LayoutWord *words;
+    u32 order;
+} LayoutBuilder;
+
+static u64
+layout_align_up(u64 offset, u32 align) {
+    return (offset + align - 1) / align * align;
+}
+
+static BcType
+layout_int_type(int bits, bool is_signed) {
+    if (bits <= 8) {
+        return is_signed ? BC_I8 : BC_U8;
+    } else if (bits <= 16) {
+        return is_signed ? BC_I16 : BC_U16;
+    } else if (bits <= 32) {
+        return is_signed ? BC_I32 : BC_U32;
+    }
+    return is_signed ? BC_I64 : BC_U64;
+}
+
+// Whether name is uN or iN for an N up to 64 that isn't a type's width.
+static bool
+layout_bit_type(const char *name, int *bits, bool *is_signed) {
+    if ((name[0] != 'u' && name[0] != 'i') || name[1] < '1' || name[1] > '9') {
+        return false;
+    }
+    int n = 0;
+    for (const char *it = name + 1; *it; it++) {
+        if (!isdigit((unsigned char)*it) || n > LAYOUT_WORD_BITS) {
+            return false;
+        }
+        n = n * 10 + (*it - '0');
+    }
+    if (n > LAYOUT_WORD_BITS || n == 8 || n == 16 || n == 32 || n == 64) {
+        return false;
+    }
+    *bits = n;
+    *is_signed = name[0] == 'i';
+    return true;
+}
+
+static int
+layout_unit_cmp(const void *a, const void *b) {
+    const LayoutUnit *x = a;
+    const LayoutUnit *y = b;
+    if (x->align != y->align) {
+        return x->align > y->align ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int
+layout_bit_field_cmp(const void *a, const void *b) {
+    const LayoutBitField *x = a;
+    const LayoutBitField *y = b;
+    if (x->bits != y->bits) {
+        return x->bits > y->bits ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+// Puts a bit field at the end of a word.
+static void
+layout_add_bits(LayoutBuilder *b, u32 field, u32 word) {
+    b->fields[field].word = word;
+    b->fields[field].shift = (u8)b->words[word].used_bits;
+    b->words[word].used_bits += b->fields[field].bits;
+}
+
+// Adds a word, and the unit that places it, to units.
+static u32
+layout_add_word(LayoutBuilder *b, LayoutUnit **units, u32 order) {
+    u32 word = (u32)buf_len(b->words);
+    buf_push(b->words, (LayoutWord){0});
+    buf_push(*units, (LayoutUnit){.kind = LAYOUT_WORD, .index = word, .order = order});
+    return word;
+}
+
+// First fit decreasing: widest first, each into the first word with room. A
+// word's unit sorts where the first of its fields in source order would.
+static void
+layout_pack(LayoutBuilder *b, LayoutBitField *bit_fields, LayoutUnit **units) {
+    qsort(bit_fields, buf_len(bit_fields), sizeof(*bit_fields), layout_bit_field_cmp);
+    u32 first_word = (u32)buf_len(b->words);
+    size_t first_unit = buf_len(*units);
+    for (size_t i = 0; i < buf_len(bit_fields); i++) {
+        LayoutBitField *bit_field = &bit_fields[i];
+        u32 word = first_word;
+        while (word < buf_len(b->words) && b->words[word].used_bits + bit_field->bits > LAYOUT_WORD_BITS) {
+            word++;
+        }
+        if (word == buf_len(b->words)) {
+            layout_add_word(b, units, bit_field->order);
+        }
+        LayoutUnit *unit = &(*units)[first_unit + (word - first_word)];
+        unit->order = bit_field->order < unit->order ? bit_field->order : unit->order;
+        layout_add_bits(b, bit_field->field, word);
+    }
+}
+
+static void
+layout_block(LayoutBuilder *b, Aggregate *aggregate, LayoutBlock *block) {
+    bool is_struct = aggregate->kind == AGGREGATE_STRUCT;
+    bool reorder = is_struct && !b->layout->is_ordered;
+    LayoutUnit *units = NULL;
+    LayoutBitField *bit_fields = NULL;
+    u32 open_word = UINT32_MAX;
+    for (size_t i = 0; i < aggregate->num_items; i++) {
+        AggregateItem *item = &aggregate->items[i];
+        u32 order = b->order++;
+        if (item->kind == AGGREGATE_ITEM_SUBAGGREGATE) {
+            LayoutBlock *nested = ast_alloc(sizeof(LayoutBlock));
+            layout_block(b, item->subaggregate, nested);
+            buf_push(units, (LayoutUnit){.kind = LAYOUT_BLOCK, .block = nested, .size = nested->size, .align = nested->align, .order = order});
+            open_word = UINT32_MAX;
+            continue;
+        }
+        for (size_t j = 0; j < item->num_names; j++) {
+            assert(b->next_input < b->num_inputs);
+            LayoutInput *input = &b->inputs[b->next_input++];
+            u32 field = (u32)buf_len(b->fields);
+            buf_push(b->fields, (LayoutField){
+                .pos = item->pos,
+                .name = item->names[j],
+                .type = input->type,
+                .bits = input->bits,
+                .is_signed = input->is_signed,
+            });
+            if (!input->bits) {
+                buf_push(units, (LayoutUnit){.kind = LAYOUT_FIELD, .index = field, .size = input->size, .align = input->align, .order = order});
+                open_word = UINT32_MAX;
+            } else if (reorder) {
+                buf_push(bit_fields, (LayoutBitField){field, input->bits, order});
+            } else {
+                // in a union every bit field has a word of its own
+                if (!is_struct || open_word == UINT32_MAX || b->words[open_word].used_bits + input->bits > LAYOUT_WORD_BITS) {
+                    open_word = layout_add_word(b, &units, order);
+                }
+                layout_add_bits(b, field, open_word);
+            }
+        }
+    }
+    if (bit_fields) {
+        layout_pack(b, bit_fields, &units);
+    }
+    for (size_t i = 0; i < buf_len(units); i++) {
+        if (units[i].kind == LAYOUT_WORD) {
+            LayoutWord *word = &b->words[units[i].index];
+            word->type = layout_int_type(word->used_bits, false);
+            units[i].size = units[i].align = bc_type_bits(word->type) / 8;
+        }
+    }
+    if (reorder && units) {
+        qsort(units, buf_len(units), sizeof(*units), layout_unit_cmp);
+    }
+    u64 size = 0;
+    u32 align = 1;
+    for (size_t i = 0; i < buf_len(units); i++) {
+        LayoutUnit *unit = &units[i];
+        align = unit->align > align ? unit->align : align;
+        if (is_struct) {
+            unit->offset = layout_align_up(size, unit->align);
+            size = unit->offset + unit->size;
+        } else {
+            size = unit->size > size ? unit->size : size;
+        }
+    }
+    // C has no empty structs
+    size = size ? size : 1;
+    *block = (LayoutBlock){
+        .kind = aggregate->kind,
+        .units = ast_dup(units, buf_sizeof(units)),
+        .num_units = buf_len(units),
+        .size = layout_align_up(size, align),
+        .align = align,
+    };
+    buf_free(units);
+    buf_free(bit_fields);
+}
+
+// Turns the offsets of block's units into offsets from the start of the
+// declared struct or union, which block starts at base from.
+static void
+layout_place(Layout *layout, LayoutBlock *block, u64 base) {
+    for (size_t i = 0; i < block->num_units; i++) {
+        LayoutUnit *unit = &block->units[i];
+        switch (unit->kind) {
+        case LAYOUT_FIELD:
+            layout->fields[unit->index].offset = base + unit->offset;
+            break;
+        case LAYOUT_WORD:
+            layout->words[unit->index].offset = base + unit->offset;
+            break;
+        case LAYOUT_BLOCK:
+            layout_place(layout, unit->block, base + unit->offset);
+            break;
+        }
+    }
+}
+
+static Layout *
+layout_compute(Decl *decl, LayoutInput *inputs, size_t num_inputs, bool is_ordered) {
+    Layout *layout = ast_alloc(sizeof(Layout));
+    layout->decl = decl;
+    layout->is_ordered = is_ordered;
+    LayoutBuilder b = {.layout = layout, .inputs = inputs, .num_inputs = num_inputs};
+    layout_block(&b, decl->aggregate, &layout->root);
+    assert(b.next_input == num_inputs);
+    layout->fields = ast_dup(b.fields, buf_sizeof(b.fields));
+    layout->num_fields = buf_len(b.fields);
+    layout->words = ast_dup(b.words, buf_sizeof(b.words));
+    layout->num_words = buf_len(b.words);
+    layout_place(layout, &layout->root, 0);
+    for (size_t i = 0; i < layout->num_fields; i++) {
+        LayoutField *field = &layout->fields[i];
+        if (field->bits) {
+            field->offset = layout->words[field->word].offset;
+        }
+    }
+    buf_free(b.fields);
+    buf_free(b.words);
+    map_put(&layouts, decl, layout);
+    buf_push(layout_list, layout);
+    return layout;
+}
+
+static Layout *
+layout_get(Decl *decl) {
+    return map_get(&layouts, decl);
+}
+
+static LayoutField *
+layout_find_field(Layout *layout, const char *name) {
+    for (size_t i = 0; i < layout->num_fields; i++) {
+        if (layout->fields[i].name == name) {
+            return &layout->fields[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "ast.h"
+#include "bytecode.h"
+
+// Memory layout of structs and unions. The checker gives every field its
+// size and alignment, or its width in bits, and the layout places them; the C
+// backend then writes the struct out member by member at those offsets, with
+// explicit padding, and asserts them, so what is computed here is what runs.
+//
+// A struct's members go in order of alignment, largest first and in source
+// order among equals, which leaves no padding between them, only at the end
+// to round the size up to the alignment. A union's members all start at 0. A
+// struct or union nested in another is placed whole, like any member, and its
+// fields are the outer one's. @ordered on a struct keeps its members in source
+// order instead, each at the next offset its alignment allows, as C would.
+//
+// A field of type uN or iN, for any N up to 64 that isn't a type's width, is a
+// bit field: it takes N bits of a word, which is the smallest of u8, u16, u32
+// and u64 that holds the bit fields packed into it. The bit fields of a struct
+// are packed into as few words as fit them, widest first, and the words are
+// placed like other members; with @ordered, each run of bit fields declared
+// together fills words in order. A field reads as the smallest integer type
+// that holds its bits.
+//
+// A struct only ever stores an enum's items, so an enum field takes only the
+// bits its items need, as a bit field of their width, unless the struct is
+// @ordered or that is all of its base type anyway. A value cast to the enum
+// that isn't one of its items doesn't survive being stored in such a field.
+
+#define LAYOUT_WORD_BITS 64
+
+typedef enum LayoutUnitKind {
+    LAYOUT_FIELD,
+    LAYOUT_WORD,
+    LAYOUT_BLOCK,
+} LayoutUnitKind;
+
+struct LayoutBlock;
+struct Type;
+
+// A member of a block: a field, a word of bit fields or a nested block.
+typedef struct LayoutUnit {
+    LayoutUnitKind kind;
+    // of the field or word in the Layout
+    u32 index;
+    struct LayoutBlock *block;
+    // from the start of the block
+    u64 offset;
+    u64 size;
+    u32 align;
+    // position in the source, which breaks ties between equal alignments
+    u32 order;
+} LayoutUnit;
+
+// A struct or union, either the declared one or one nested in it.
+typedef struct LayoutBlock {
+    AggregateKind kind;
+    // in order of offset
+    LayoutUnit *units;
+    size_t num_units;
+    u64 size;
+    u32 align;
+} LayoutBlock;
+
+typedef struct LayoutWord {
+    // from the start of the declared struct or union, like every offset below
+    u64 offset;
+    // u8, u16, u32 or u64
+    BcType type;
+    u32 used_bits;
+} LayoutWord;
+
+typedef struct LayoutField {
+    SrcPos pos;
+    const char *name;
+    // what the field reads as
+    struct Type *type;
+    u64 offset;
+    // for a bit field, its bits within word, from bit shift up; 0 otherwise
+    u8 bits;
+    u8 shift;
+    bool is_signed;
+    u32 word;
+} LayoutField;
+
+typedef struct Layout {
+    Decl *decl;
+    bool is_ordered;
+    LayoutBlock root;
+    // in source order, including those of nested blocks
+    LayoutField *fields;
+    size_t num_fields;
+    LayoutWord *words;
+    size_t num_words;
+} Layout;
+
+// What the checker says about a field, one for each name of each field item
+// in source order, nested ones included.
+typedef struct LayoutInput {
+    struct Type *type;
+    u64 size;
+    u32 align;
+    // nonzero for a bit field
+    u8 bits;
+    bool is_signed;
+} LayoutInput;
+
+static Layout *layout_compute(Decl *decl, LayoutInput *inputs, size_t num_inputs, bool is_ordered);
+static Layout *layout_get(Decl *decl);
+static LayoutField *layout_find_field(Layout *layout, const char *name);
+static bool layout_bit_type(const char *name, int *bits, bool *is_signed);
+static BcType layout_int_type(int bits, bool is_signed);
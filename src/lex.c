@@ -25,9 +25,11 @@ static const char *token_kind_names[] = {
     [TOKEN_DOT] = ".",
     [TOKEN_AT] = "@",
     [TOKEN_POUND] = "#",
+    [TOKEN_DOTDOT] = "..",
     [TOKEN_ELLIPSIS] = "...",
     [TOKEN_QUESTION] = "?",
     [TOKEN_SEMICOLON] = ";",
+    [TOKEN_RARROW] = "->",
     [TOKEN_KEYWORD] = "keyword",
     [TOKEN_INT] = "int",
     [TOKEN_FLOAT] = "float",
@@ -160,6 +162,7 @@ init_keywords(void) {
     assert_name = str_intern("assert");
     intrinsic_name = str_intern("intrinsic");
     declare_note_name = str_intern("declare_note");
+    ordered_name = str_intern("ordered");
     static_assert_name = str_intern("static_assert");
     void_name = str_intern("void");
 
@@ -175,7 +178,7 @@ is_keyword_name(const char *name) {
 
 static const char *
 token_kind_name(TokenKind kind) {
-    if (kind < sizeof(token_kind_names)/sizeof(*token_kind_names)) {
+    if (kind < sizeof(token_kind_names)/sizeof(*token_kind_names) && token_kind_names[kind]) {
         return token_kind_names[kind];
     } else {
         return "<unknown>";
@@ -189,9 +192,7 @@ warning(SrcPos pos, const char *fmt, ...) {
     }
     va_list args;
     va_start(args, fmt);
-    printf("%s(%d): warning: ", pos.name, pos.line);
-    vprintf(fmt, args);
-    printf("\n");
+    report_message(pos, true, fmt, args);
     va_end(args);
 }
 
@@ -202,9 +203,7 @@ error(SrcPos pos, const char *fmt, ...) {
     }
     va_list args;
     va_start(args, fmt);
-    printf("%s(%d): error: ", pos.name, pos.line);
-    vprintf(fmt, args);
-    printf("\n");
+    report_message(pos, false, fmt, args);
     va_end(args);
 }
 
@@ -217,6 +216,17 @@ token_info(void) {
     }
 }
 
+// The current token as written, copied to error_arena so that a diagnostic
+// doesn't point into the source buffer.
+static const char *
+token_text(void) {
+    size_t len = token.end - token.start;
+    char *text = arena_alloc(&error_arena, len + 1);
+    memcpy(text, token.start, len);
+    text[len] = 0;
+    return text;
+}
+
 static void 
 scan_int(void) {
     int base = 10;
@@ -396,6 +406,7 @@ scan_str(void) {
                 buf_push(str, *stream);
             }
             if (*stream == '\n') {
+                line_start = stream + 1;
                 token.pos.line++;
             }
             stream++;
@@ -470,6 +481,8 @@ static void
 next_token(void) {
 repeat:
     token.start = stream;
+    token.pos.offset = stream_begin_pos.offset + (int)(stream - stream_begin);
+    token.pos.col = (int)(stream - line_start) + (line_start == stream_begin ? stream_begin_pos.col : 1);
     token.mod = 0;
     token.suffix = 0;
     switch (*stream) {
@@ -492,7 +505,7 @@ repeat:
             scan_float();
         } else if (stream[1] == '.' && stream[2] != '.') {
             token.kind = TOKEN_DOTDOT;
-            stream += 3;
+            stream += 2;
         } else if (stream[1] == '.' && stream[2] == '.') {
             token.kind = TOKEN_ELLIPSIS;
             stream += 3;
@@ -505,9 +518,10 @@ repeat:
         while (isdigit(*stream)) {
             stream++;
         }
-        char c = *stream;
+        // 1..5 is a range, not the float 1. followed by .5
+        bool is_float = (stream[0] == '.' && stream[1] != '.') || tolower(stream[0]) == 'e';
         stream = token.start;
-        if (c == '.' || tolower(c) == 'e') {
+        if (is_float) {
             scan_float();
         } else {
             scan_int();
@@ -596,6 +610,7 @@ repeat:
                     stream += 2;
                 } else {
                     if (*stream == '\n') {
+                        line_start = stream + 1;
                         token.pos.line++;
                     }
                     stream++;
@@ -633,21 +648,188 @@ repeat:
         goto repeat;
     }
     token.end = stream;
+    STATS_ADD(tokens[token.kind], 1);
 }
 
 #undef CASE1
 #undef CASE2
 #undef CASE3
 
+// Starts lexing buf, which begins at pos in its file.
 static void 
-init_stream(const char *name, const char *buf) {
+init_stream_at(const char *buf, SrcPos pos) {
     stream = buf;
     line_start = stream;
-    token.pos.name = name ? name : "<string>";
-    token.pos.line = 1;
+    stream_begin = stream;
+    stream_begin_pos = pos;
+    panic_mode = false;
+    token.pos.name = pos.name ? pos.name : "<string>";
+    token.pos.line = pos.line;
+    next_token();
+}
+
+static LexState 
+save_lex_state(void) {
+    return (LexState){token, stream, line_start, stream_begin, stream_begin_pos};
+}
+
+static void 
+restore_lex_state(LexState state) {
+    token = state.token;
+    stream = state.stream;
+    line_start = state.line_start;
+    stream_begin = state.stream_begin;
+    stream_begin_pos = state.stream_begin_pos;
+}
+
+// If str starts a string, char literal or comment, returns the position just
+// past it and counts the newlines it contains into *line and *line_begin.
+// Otherwise returns str unchanged. Used by the character level scanners below,
+// which must not see braces or keywords inside literals and comments.
+static const char *
+skip_literal_or_comment(const char *str, int *line, const char **line_begin) {
+    if (str[0] == '"' && str[1] == '"' && str[2] == '"') {
+        str += 3;
+        while (*str && !(str[0] == '"' && str[1] == '"' && str[2] == '"')) {
+            if (*str++ == '\n') {
+                *line_begin = str;
+                (*line)++;
+            }
+        }
+        return *str ? str + 3 : str;
+    } else if (*str == '"' || *str == '\'') {
+        char quote = *str++;
+        while (*str && *str != quote && *str != '\n') {
+            if (*str == '\\' && str[1] && str[1] != '\n') {
+                str++;
+            }
+            str++;
+        }
+        return *str == quote ? str + 1 : str;
+    } else if (str[0] == '/' && str[1] == '/') {
+        while (*str && *str != '\n') {
+            str++;
+        }
+        return str;
+    } else if (str[0] == '/' && str[1] == '*') {
+        str += 2;
+        int level = 1;
+        while (*str && level > 0) {
+            if (str[0] == '/' && str[1] == '*') {
+                level++;
+                str += 2;
+            } else if (str[0] == '*' && str[1] == '/') {
+                level--;
+                str += 2;
+            } else if (*str++ == '\n') {
+                *line_begin = str;
+                (*line)++;
+            }
+        }
+        return str;
+    }
+    return str;
+}
+
+// Skips the balanced '{' ... '}' that starts at the current token by scanning
+// characters instead of tokens: nothing is interned, allocated or reported.
+// Afterwards the token following the closing '}' is current.
+static void 
+skip_block(void) {
+    assert(is_token(TOKEN_LBRACE));
+    int depth = 1;
+    while (*stream && depth > 0) {
+        const char *next = skip_literal_or_comment(stream, &token.pos.line, &line_start);
+        if (next != stream) {
+            stream = next;
+            continue;
+        }
+        if (*stream == '{') {
+            depth++;
+        } else if (*stream == '}') {
+            depth--;
+        } else if (*stream == '\n') {
+            line_start = stream + 1;
+            token.pos.line++;
+        }
+        stream++;
+    }
+    if (depth > 0) {
+        error_here("Unexpected end of file within block");
+    }
     next_token();
 }
 
+static bool 
+is_decl_keyword(const char *name) {
+    return name == fn_keyword || name == const_keyword || name == var_keyword || name == struct_keyword
+        || name == union_keyword || name == enum_keyword || name == typedef_keyword || name == import_keyword;
+}
+
+// Finds the start of every top-level declaration without tokenizing: a
+// declaration keyword outside any brackets that directly follows the ';' or '}'
+// ending the previous declaration (or the start of the file), or the first of
+// the @notes before it. Only those few names are interned. Used to split a
+// file for parallel parsing.
+static DeclStart *
+scan_decl_starts(const char *buf) {
+    DeclStart *starts = NULL;
+    const char *str = buf;
+    const char *line_begin = buf;
+    int line = 1;
+    int depth = 0;
+    char last = ';';
+    // the '@' of the notes since the last declaration ended
+    DeclStart notes = {0};
+    while (*str) {
+        const char *next = skip_literal_or_comment(str, &line, &line_begin);
+        if (next != str) {
+            str = next;
+            continue;
+        }
+        char c = *str;
+        if (isalpha(c) || c == '_') {
+            const char *start = str;
+            while (isalnum(*str) || *str == '_') {
+                str++;
+            }
+            if (notes.start && last == '@') {
+                // a note's name
+                last = ';';
+                continue;
+            }
+            if (depth == 0 && (last == ';' || last == '}') && is_decl_keyword(str_intern_range(start, str))) {
+                buf_push(starts, notes.start ? notes : (DeclStart){start, line, (int)(start - line_begin) + 1});
+            }
+            notes.start = NULL;
+            last = 'a';
+            continue;
+        }
+        if (c == '@' && depth == 0 && (last == ';' || last == '}')) {
+            if (!notes.start) {
+                notes = (DeclStart){str, line, (int)(str - line_begin) + 1};
+            }
+            last = '@';
+            str++;
+            continue;
+        }
+        if (c == '\n') {
+            line_begin = str + 1;
+            line++;
+        } else if (c == '{' || c == '(' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ')' || c == ']') {
+            depth = depth > 0 ? depth - 1 : 0;
+        }
+        if (!isspace(c)) {
+            last = c;
+            notes.start = NULL;
+        }
+        str++;
+    }
+    return starts;
+}
+
 static bool 
 is_token(TokenKind kind) {
     return token.kind == kind;
@@ -692,12 +874,18 @@ static bool
 expect_token(TokenKind kind, TokenKind *next_token_kind, bool is_recoverable) {
     if (is_token(kind)) {
         next_token();
+        if (kind == TOKEN_SEMICOLON || kind == TOKEN_LBRACE || kind == TOKEN_RBRACE) {
+            panic_mode = false;
+        }
         return true;
     } else if (is_recoverable) {
         Error err = {
             .kind = ERROR_EXPECTED,
             .pos = token.pos,
             .corrected = true,
+            .found = token_info(),
+            .found_text = token_text(),
+            .found_len = (int)(token.end - token.start),
             .expected = {
                 .expected_token = kind,
                 .found_token = token.kind,
@@ -713,7 +901,7 @@ expect_token(TokenKind kind, TokenKind *next_token_kind, bool is_recoverable) {
             i++;
         }
         // assume token is wrong and consume it
-        Token wrong_token = token;
+        err.expected.replaced = true;
         next_token();
         i = 0;
         while (next_token_kind[i]) {
@@ -724,10 +912,21 @@ expect_token(TokenKind kind, TokenKind *next_token_kind, bool is_recoverable) {
             i++;
         }
         end:
-        buf_push(errors, err);
+        report_error(err);
         return true;
     } else {
-        fatal_error_here("Expected token %s, got %s", token_kind_name(kind), token_info());
+        report_error((Error){
+            .kind = ERROR_EXPECTED,
+            .pos = token.pos,
+            .found = token_info(),
+            .found_text = token_text(),
+            .found_len = (int)(token.end - token.start),
+            .expected = {
+                .expected_token = kind,
+                .found_token = token.kind,
+            }
+        });
+        panic_mode = true;
         return false;
     }
 }
\ No newline at end of file
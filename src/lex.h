@@ -41,6 +41,7 @@ const char *complete_name;
 const char *assert_name;
 const char *intrinsic_name;
 const char *declare_note_name;
+const char *ordered_name;
 const char *static_assert_name;
 const char *void_name;
 
@@ -137,6 +138,9 @@ typedef enum TokenSuffix {
 typedef struct SrcPos {
     const char *name;
     int line;
+    int col;
+    // byte offset from the start of the file
+    int offset;
 } SrcPos;
 
 typedef struct Token {
@@ -154,9 +158,35 @@ typedef struct Token {
     };
 } Token;
 
-static Token token;
-static const char *stream;
-static const char *line_start;
+static THREAD_LOCAL Token token;
+static THREAD_LOCAL const char *stream;
+static THREAD_LOCAL const char *line_start;
+// where the current stream began and its position in the file, which is not
+// the start of the file when parsing a range of it
+static THREAD_LOCAL const char *stream_begin;
+static THREAD_LOCAL SrcPos stream_begin_pos;
+
+// set by a syntax error the parser could not correct, cleared once it is back
+// in sync (at a ';', '{' or '}', or when it skips to the next statement or
+// declaration)
+static THREAD_LOCAL bool panic_mode;
+
+// snapshot of the lexer globals, used to parse a nested range of the source
+// (such as a lazily skipped function body) and then resume
+typedef struct LexState {
+    Token token;
+    const char *stream;
+    const char *line_start;
+    const char *stream_begin;
+    SrcPos stream_begin_pos;
+} LexState;
+
+// where a top-level declaration begins, as found by scan_decl_starts
+typedef struct DeclStart {
+    const char *start;
+    int line;
+    int col;
+} DeclStart;
 
 static void init_keywords(void);
 static bool is_keyword_name(const char *name);
@@ -166,17 +196,23 @@ static void error(SrcPos pos, const char *fmt, ...);
 
 #define fatal_error(...) (error(__VA_ARGS__), exit(1))
 #define error_here(...) (error(token.pos, __VA_ARGS__))
-#define warning_here(...) (error(token.pos, __VA_ARGS__))
-#define fatal_error_here(...) (error_here(__VA_ARGS__), exit(1)) // should be abort()
+#define warning_here(...) (warning(token.pos, __VA_ARGS__))
 
 static const char *token_info(void);
+static const char *token_text(void);
 static void scan_int(void);
 static void scan_float(void);
 static int scan_hex_escape(void);
 static void scan_char(void);
 static void scan_str(void);
 static void next_token(void);
-static void init_stream(const char *name, const char *buf);
+static void init_stream_at(const char *buf, SrcPos pos);
+static LexState save_lex_state(void);
+static void restore_lex_state(LexState state);
+static const char *skip_literal_or_comment(const char *str, int *line, const char **line_begin);
+static void skip_block(void);
+static bool is_decl_keyword(const char *name);
+static DeclStart *scan_decl_starts(const char *buf);
 static bool is_token(TokenKind kind);
 static bool is_token_eof(void);
 static bool is_token_name(const char *name);
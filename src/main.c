@@ -1,26 +1,45 @@
 
 // headers
 #include "stdafx.h"
+#include "os.h"
 #include "common.h"
 #include "error.h"
 #include "lex.h"
+#include "stats.h"
 #include "ast.h"
 #include "parse.h"
+#include "reparse.h"
+#include "bytecode.h"
+#include "resolve.h"
+#include "match.h"
+#include "layout.h"
+#include "check.h"
+#include "pool.h"
+#include "cache.h"
+#include "emit.h"
+#include "driver.h"
+#include "server.h"
 
 // source
 #include "common.c"
+#include "os.c"
 #include "error.c"
 #include "lex.c"
+#include "stats.c"
 #include "ast.c"
 #include "parse.c"
+#include "reparse.c"
+#include "bytecode.c"
+#include "resolve.c"
+#include "match.c"
+#include "layout.c"
+#include "check.c"
+#include "pool.c"
+#include "cache.c"
+#include "emit.c"
+#include "driver.c"
+#include "server.c"
 
 i32 main(i32 argc, const char **argv) {
-    init_keywords();
-    char *filename = "../test.cr";
-    char *test_file = read_file(filename);
-    init_stream(filename, test_file);
-
-    //Expr *e = parse_expr();
-    match_keyword(fn_keyword);
-    Decl *d = parse_decl_fn(token.pos);
-}
\ No newline at end of file
+    return driver_main(argc, argv);
+}
@@ -0,0 +1,226 @@
+#include "match.h"
+
+static int
+match_key_cmp(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int
+match_range_cmp(const void *a, const void *b) {
+    return match_key_cmp(&((const MatchRange *)a)->lo, &((const MatchRange *)b)->lo);
+}
+
+// Sorts ranges and merges the ones that overlap or touch, giving how many are
+// left.
+static size_t
+match_merge_ranges(MatchRange *ranges, size_t num_ranges) {
+    qsort(ranges, num_ranges, sizeof(*ranges), match_range_cmp);
+    size_t len = 0;
+    for (size_t i = 0; i < num_ranges; i++) {
+        if (len && ranges[len - 1].hi != UINT64_MAX && ranges[i].lo <= ranges[len - 1].hi + 1) {
+            ranges[len - 1].hi = ranges[i].hi > ranges[len - 1].hi ? ranges[i].hi : ranges[len - 1].hi;
+        } else if (!len || ranges[len - 1].hi != UINT64_MAX) {
+            ranges[len++] = ranges[i];
+        }
+    }
+    return len;
+}
+
+static bool
+match_in_domain(MatchDomain *domain, u64 key) {
+    for (size_t i = 0; i < domain->num_ranges; i++) {
+        if (domain->ranges[i].lo <= key && key <= domain->ranges[i].hi) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+match_same_rows(u32 *a, u32 *b) {
+    return buf_len(a) == buf_len(b) && memcmp(a, b, buf_len(a) * sizeof(*a)) == 0;
+}
+
+// The keys from which a node's edges start: every boundary of the domain and
+// of the rows' ranges. Each key up to the next one starts a segment no
+// boundary crosses, so a row either matches all of a segment or none of it.
+static u64 *
+match_segment_starts(MatchBuilder *b, u32 *rows, size_t num_rows, u32 column) {
+    MatchTree *tree = b->tree;
+    MatchDomain *domain = &tree->domains[column];
+    u64 *starts = NULL;
+    for (size_t i = 0; i < domain->num_ranges; i++) {
+        buf_push(starts, domain->ranges[i].lo);
+        if (domain->ranges[i].hi != UINT64_MAX) {
+            buf_push(starts, domain->ranges[i].hi + 1);
+        }
+    }
+    for (size_t i = 0; i < num_rows; i++) {
+        MatchCell *cell = &b->cells[rows[i] * tree->num_columns + column];
+        if (!cell->any) {
+            buf_push(starts, cell->range.lo);
+            if (cell->range.hi != UINT64_MAX) {
+                buf_push(starts, cell->range.hi + 1);
+            }
+        }
+    }
+    qsort(starts, buf_len(starts), sizeof(*starts), match_key_cmp);
+    size_t len = 0;
+    for (size_t i = 0; i < buf_len(starts); i++) {
+        if (len == 0 || starts[len - 1] != starts[i]) {
+            starts[len++] = starts[i];
+        }
+    }
+    if (starts) {
+        buf__hdr(starts)->len = len;
+    }
+    return starts;
+}
+
+static MatchNode *match_build(MatchBuilder *b, u32 *rows, size_t num_rows, u64 tested);
+
+static MatchNode *
+match_leaf(MatchBuilder *b, u32 *rows, size_t num_rows, u64 tested) {
+    MatchTree *tree = b->tree;
+    MatchNode *node = ast_alloc(sizeof(MatchNode));
+    node->column = MATCH_LEAF;
+    node->row = num_rows ? rows[0] : MATCH_NO_ROW;
+    if (num_rows) {
+        tree->reached[rows[0]] = true;
+    } else if (tree->is_exhaustive) {
+        tree->is_exhaustive = false;
+        for (size_t i = 0; i < tree->num_columns; i++) {
+            tree->missing_any[i] = !(tested & (1ull << i));
+            tree->missing[i] = b->path[i];
+        }
+    }
+    return node;
+}
+
+// Splits rows on column: the rows on each edge, in order, are those matching
+// its keys, and the otherwise branch gets the rows that match anything.
+static MatchNode *
+match_split(MatchBuilder *b, u32 *rows, size_t num_rows, u64 tested, u32 column) {
+    MatchTree *tree = b->tree;
+    MatchDomain *domain = &tree->domains[column];
+    u64 *starts = match_segment_starts(b, rows, num_rows, column);
+    u32 **edge_rows = NULL;
+    MatchRange **edge_ranges = NULL;
+    u32 *segment_rows = NULL;
+    bool has_otherwise = false;
+    u64 otherwise_key = 0;
+    for (size_t i = 0; i < buf_len(starts); i++) {
+        MatchRange segment = {starts[i], i + 1 < buf_len(starts) ? starts[i + 1] - 1 : UINT64_MAX};
+        if (!match_in_domain(domain, segment.lo)) {
+            continue;
+        }
+        bool is_named = false;
+        buf_clear(segment_rows);
+        for (size_t j = 0; j < num_rows; j++) {
+            MatchCell *cell = &b->cells[rows[j] * tree->num_columns + column];
+            if (cell->any || (cell->range.lo <= segment.lo && segment.hi <= cell->range.hi)) {
+                buf_push(segment_rows, rows[j]);
+                is_named |= !cell->any;
+            }
+        }
+        if (!is_named) {
+            if (!has_otherwise) {
+                otherwise_key = segment.lo;
+            }
+            has_otherwise = true;
+            continue;
+        }
+        size_t edge = 0;
+        while (edge < buf_len(edge_rows) && !match_same_rows(edge_rows[edge], segment_rows)) {
+            edge++;
+        }
+        if (edge == buf_len(edge_rows)) {
+            buf_push(edge_rows, segment_rows);
+            buf_push(edge_ranges, NULL);
+            segment_rows = NULL;
+        }
+        MatchRange **ranges = &edge_ranges[edge];
+        if (buf_len(*ranges) && (*ranges)[buf_len(*ranges) - 1].hi + 1 == segment.lo) {
+            (*ranges)[buf_len(*ranges) - 1].hi = segment.hi;
+        } else {
+            buf_push(*ranges, segment);
+        }
+    }
+    MatchNode *node = ast_alloc(sizeof(MatchNode));
+    node->column = column;
+    node->row = MATCH_NO_ROW;
+    node->num_edges = buf_len(edge_rows);
+    node->edges = node->num_edges ? ast_alloc(node->num_edges * sizeof(MatchEdge)) : NULL;
+    tested |= 1ull << column;
+    for (size_t i = 0; i < node->num_edges; i++) {
+        MatchEdge *edge = &node->edges[i];
+        edge->num_ranges = buf_len(edge_ranges[i]);
+        edge->ranges = ast_dup(edge_ranges[i], edge->num_ranges * sizeof(MatchRange));
+        for (size_t j = 0; j < edge->num_ranges; j++) {
+            u64 n = edge->ranges[j].hi - edge->ranges[j].lo;
+            edge->num_keys = n == UINT64_MAX || edge->num_keys + n + 1 < edge->num_keys ? UINT64_MAX : edge->num_keys + n + 1;
+        }
+        b->path[column] = edge->ranges[0].lo;
+        edge->node = match_build(b, edge_rows[i], buf_len(edge_rows[i]), tested);
+        buf_free(edge_rows[i]);
+        buf_free(edge_ranges[i]);
+    }
+    if (has_otherwise) {
+        buf_clear(segment_rows);
+        for (size_t j = 0; j < num_rows; j++) {
+            if (b->cells[rows[j] * tree->num_columns + column].any) {
+                buf_push(segment_rows, rows[j]);
+            }
+        }
+        b->path[column] = otherwise_key;
+        node->otherwise = match_build(b, segment_rows, buf_len(segment_rows), tested);
+    }
+    buf_free(starts);
+    buf_free(edge_rows);
+    buf_free(edge_ranges);
+    buf_free(segment_rows);
+    return node;
+}
+
+// Tests the first column the first row needs, so the first row is picked as
+// soon as what it needs is known.
+static MatchNode *
+match_build(MatchBuilder *b, u32 *rows, size_t num_rows, u64 tested) {
+    MatchTree *tree = b->tree;
+    if (++tree->num_nodes > MATCH_MAX_NODES) {
+        tree->too_big = true;
+    }
+    for (u32 i = 0; !tree->too_big && num_rows && i < tree->num_columns; i++) {
+        if (!(tested & (1ull << i)) && !b->cells[rows[0] * tree->num_columns + i].any) {
+            return match_split(b, rows, num_rows, tested, i);
+        }
+    }
+    return match_leaf(b, rows, num_rows, tested);
+}
+
+static MatchTree *
+match_compile(MatchDomain *domains, size_t num_columns, MatchCell *cells, u32 *arms, size_t num_rows) {
+    assert(num_columns <= MATCH_MAX_COLUMNS);
+    MatchTree *tree = ast_alloc(sizeof(MatchTree));
+    tree->num_columns = num_columns;
+    tree->domains = ast_dup(domains, num_columns * sizeof(MatchDomain));
+    for (size_t i = 0; i < num_columns; i++) {
+        tree->domains[i].ranges = ast_dup(domains[i].ranges, domains[i].num_ranges * sizeof(MatchRange));
+    }
+    tree->num_rows = num_rows;
+    tree->arms = ast_dup(arms, num_rows * sizeof(u32));
+    tree->reached = num_rows ? ast_alloc(num_rows * sizeof(bool)) : NULL;
+    tree->is_exhaustive = true;
+    tree->missing = ast_alloc(num_columns * sizeof(u64));
+    tree->missing_any = ast_alloc(num_columns * sizeof(bool));
+    MatchBuilder b = {.tree = tree, .cells = cells, .path = ast_alloc(num_columns * sizeof(u64))};
+    u32 *rows = NULL;
+    for (u32 i = 0; i < num_rows; i++) {
+        buf_push(rows, i);
+    }
+    tree->root = match_build(&b, rows, num_rows, 0);
+    buf_free(rows);
+    return tree;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "ast.h"
+
+// Decision trees for switch statements. A switch is a matrix with a row for
+// each pattern, in order, and a column for each value it switches on (more
+// than one when it switches on a tuple). The tree tests one column at each
+// node and branches on the value's range, so the first row matching a value
+// is found without testing any column twice on the way. A node splits its
+// column's values at every boundary of the patterns still in play, and values
+// that match exactly the same rows share an edge; values no pattern names go
+// to the node's otherwise branch, and there is none when the edges cover every
+// value the column can have.
+//
+// The tree knows nothing of types. The checker turns values into keys that
+// sort like the values do (signed values have their sign bit flipped) and
+// gives each column the keys it can have: both bools, an integer type's
+// range, or an enum's items. A leaf no row reaches is a value the switch
+// doesn't cover, and a row no leaf picks is never reached, so both come from
+// the same tree the C backend generates code for.
+
+#define MATCH_LEAF UINT32_MAX
+#define MATCH_NO_ROW UINT32_MAX
+#define MATCH_MAX_COLUMNS 64
+// trees bigger than this are reported rather than built
+#define MATCH_MAX_NODES 65536
+
+// keys lo to hi, inclusive
+typedef struct MatchRange {
+    u64 lo;
+    u64 hi;
+} MatchRange;
+
+typedef struct MatchDomain {
+    // sorted and disjoint
+    MatchRange *ranges;
+    size_t num_ranges;
+} MatchDomain;
+
+// one row's pattern for one column
+typedef struct MatchCell {
+    MatchRange range;
+    // `_`, which matches anything
+    bool any;
+} MatchCell;
+
+struct MatchNode;
+
+typedef struct MatchEdge {
+    // sorted and disjoint
+    MatchRange *ranges;
+    size_t num_ranges;
+    // number of keys in the ranges, saturated at UINT64_MAX
+    u64 num_keys;
+    struct MatchNode *node;
+} MatchEdge;
+
+typedef struct MatchNode {
+    // column tested, or MATCH_LEAF
+    u32 column;
+    // the row a leaf picks, or MATCH_NO_ROW when no row matches
+    u32 row;
+    MatchEdge *edges;
+    size_t num_edges;
+    // keys in no edge; NULL when the edges cover the column's domain
+    struct MatchNode *otherwise;
+} MatchNode;
+
+typedef struct MatchTree {
+    MatchNode *root;
+    size_t num_columns;
+    MatchDomain *domains;
+    size_t num_rows;
+    // the arm of the switch each row is a pattern of
+    u32 *arms;
+    // rows some value picks
+    bool *reached;
+    // a value no row matches, when there is one: a key for each column, or
+    // any when the column doesn't matter
+    bool is_exhaustive;
+    u64 *missing;
+    bool *missing_any;
+    size_t num_nodes;
+    bool too_big;
+} MatchTree;
+
+typedef struct MatchBuilder {
+    MatchTree *tree;
+    // row major, num_rows by num_columns
+    MatchCell *cells;
+    // the keys that lead to the node being built, for the columns tested
+    u64 *path;
+} MatchBuilder;
+
+static size_t match_merge_ranges(MatchRange *ranges, size_t num_ranges);
+static MatchTree *match_compile(MatchDomain *domains, size_t num_columns, MatchCell *cells, u32 *arms, size_t num_rows);
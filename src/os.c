@@ -0,0 +1,238 @@
+#include "os.h"
+
+typedef struct ThreadStart {
+    ThreadFunc func;
+    void *arg;
+} ThreadStart;
+
+#ifdef _WIN32
+
+void mutex_lock(Mutex *mutex) {
+    AcquireSRWLockExclusive(mutex);
+}
+
+void mutex_unlock(Mutex *mutex) {
+    ReleaseSRWLockExclusive(mutex);
+}
+
+void cond_wait(Cond *cond, Mutex *mutex) {
+    SleepConditionVariableSRW(cond, mutex, INFINITE, 0);
+}
+
+void cond_signal(Cond *cond) {
+    WakeConditionVariable(cond);
+}
+
+void cond_broadcast(Cond *cond) {
+    WakeAllConditionVariable(cond);
+}
+
+static DWORD WINAPI thread_start(void *arg) {
+    ThreadStart start = *(ThreadStart *)arg;
+    free(arg);
+    start.func(start.arg);
+    return 0;
+}
+
+Thread thread_create(ThreadFunc func, void *arg) {
+    ThreadStart *start = xmalloc(sizeof(ThreadStart));
+    *start = (ThreadStart){func, arg};
+    Thread thread = CreateThread(NULL, 0, thread_start, start, 0, NULL);
+    if (!thread) {
+        fatal("CreateThread failed");
+    }
+    return thread;
+}
+
+void thread_join(Thread thread) {
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+void os_yield(void) {
+    SwitchToThread();
+}
+
+uint64_t os_time_ns(void) {
+    static LARGE_INTEGER frequency;
+    if (!frequency.QuadPart) {
+        QueryPerformanceFrequency(&frequency);
+    }
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    uint64_t ticks = (uint64_t)counter.QuadPart;
+    uint64_t freq = (uint64_t)frequency.QuadPart;
+    return ticks / freq * 1000000000 + ticks % freq * 1000000000 / freq;
+}
+
+int os_num_cores(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+
+bool os_is_dir(const char *path) {
+    DWORD attributes = GetFileAttributesA(path);
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+bool os_stat(const char *path, FileStat *st) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) {
+        return false;
+    }
+    // FILETIME counts 100ns ticks
+    uint64_t ticks = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    st->mtime_ns = ticks * 100;
+    st->size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    return true;
+}
+
+bool os_touch(const char *path) {
+    HANDLE file = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    bool ok = SetFileTime(file, NULL, NULL, &now);
+    CloseHandle(file);
+    return ok;
+}
+
+bool os_mkdir(const char *path) {
+    return CreateDirectoryA(path, NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+char *os_full_path(const char *path) {
+    return _fullpath(NULL, path, 0);
+}
+
+char **os_list_dir(const char *path) {
+    char *pattern = NULL;
+    buf_printf(pattern, "%s\\*", path);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    buf_free(pattern);
+    if (find == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    char **names = NULL;
+    do {
+        if (strcmp(data.cFileName, ".") != 0 && strcmp(data.cFileName, "..") != 0) {
+            size_t len = strlen(data.cFileName);
+            buf_push(names, memcpy(xmalloc(len + 1), data.cFileName, len + 1));
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+    return names;
+}
+
+#else
+
+void mutex_lock(Mutex *mutex) {
+    pthread_mutex_lock(mutex);
+}
+
+void mutex_unlock(Mutex *mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+void cond_wait(Cond *cond, Mutex *mutex) {
+    pthread_cond_wait(cond, mutex);
+}
+
+void cond_signal(Cond *cond) {
+    pthread_cond_signal(cond);
+}
+
+void cond_broadcast(Cond *cond) {
+    pthread_cond_broadcast(cond);
+}
+
+static void *thread_start(void *arg) {
+    ThreadStart start = *(ThreadStart *)arg;
+    free(arg);
+    start.func(start.arg);
+    return NULL;
+}
+
+Thread thread_create(ThreadFunc func, void *arg) {
+    ThreadStart *start = xmalloc(sizeof(ThreadStart));
+    *start = (ThreadStart){func, arg};
+    Thread thread;
+    if (pthread_create(&thread, NULL, thread_start, start) != 0) {
+        fatal("pthread_create failed");
+    }
+    return thread;
+}
+
+void thread_join(Thread thread) {
+    pthread_join(thread, NULL);
+}
+
+void os_yield(void) {
+    sched_yield();
+}
+
+uint64_t os_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int os_num_cores(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+bool os_is_dir(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool os_stat(const char *path, FileStat *st) {
+    struct stat s;
+    if (stat(path, &s) != 0) {
+        return false;
+    }
+#if defined(__APPLE__)
+    st->mtime_ns = (uint64_t)s.st_mtimespec.tv_sec * 1000000000 + s.st_mtimespec.tv_nsec;
+#else
+    st->mtime_ns = (uint64_t)s.st_mtim.tv_sec * 1000000000 + s.st_mtim.tv_nsec;
+#endif
+    st->size = (uint64_t)s.st_size;
+    return true;
+}
+
+bool os_touch(const char *path) {
+    return utimensat(AT_FDCWD, path, NULL, 0) == 0;
+}
+
+bool os_mkdir(const char *path) {
+    return mkdir(path, 0777) == 0 || (errno == EEXIST && os_is_dir(path));
+}
+
+char *os_full_path(const char *path) {
+    return realpath(path, NULL);
+}
+
+char **os_list_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return NULL;
+    }
+    char **names = NULL;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+            size_t len = strlen(entry->d_name);
+            buf_push(names, memcpy(xmalloc(len + 1), entry->d_name, len + 1));
+        }
+    }
+    closedir(dir);
+    return names;
+}
+
+#endif
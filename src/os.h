@@ -0,0 +1,74 @@
+#pragma once
+
+#include "stdafx.h"
+
+// Thin platform layer: threads, mutexes, condition variables, the machine's
+// core count and directory listing.
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+typedef SRWLOCK Mutex;
+#define MUTEX_INIT SRWLOCK_INIT
+
+typedef CONDITION_VARIABLE Cond;
+#define COND_INIT CONDITION_VARIABLE_INIT
+
+typedef HANDLE Thread;
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+
+typedef pthread_mutex_t Mutex;
+#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+
+typedef pthread_cond_t Cond;
+#define COND_INIT PTHREAD_COND_INITIALIZER
+
+typedef pthread_t Thread;
+#endif
+
+typedef void (*ThreadFunc)(void *arg);
+
+typedef struct FileStat {
+    uint64_t mtime_ns;
+    uint64_t size;
+} FileStat;
+
+void mutex_lock(Mutex *mutex);
+void mutex_unlock(Mutex *mutex);
+
+// Unlocks mutex until cond is signalled, then locks it again. Wakeups can be
+// spurious, so wait in a loop on the condition.
+void cond_wait(Cond *cond, Mutex *mutex);
+// wakes one thread waiting on cond
+void cond_signal(Cond *cond);
+// wakes every thread waiting on cond
+void cond_broadcast(Cond *cond);
+
+Thread thread_create(ThreadFunc func, void *arg);
+void thread_join(Thread thread);
+
+void os_yield(void);
+// monotonic clock
+uint64_t os_time_ns(void);
+int os_num_cores(void);
+
+bool os_is_dir(const char *path);
+bool os_stat(const char *path, FileStat *st);
+// sets the file's mtime to now
+bool os_touch(const char *path);
+// true if the directory exists afterwards
+bool os_mkdir(const char *path);
+// absolute form of path as a malloc'd string, or NULL
+char *os_full_path(const char *path);
+// Names of the entries of a directory, other than . and .., as a stretchy
+// buffer of malloc'd strings, or NULL if it cannot be read.
+char **os_list_dir(const char *path);
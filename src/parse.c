@@ -1,5 +1,78 @@
 #include "parse.h"
 
+// skip fn bodies during the declaration parse and parse them on first use
+bool flag_lazy_fn_bodies = false;
+
+// held while a skipped fn body is parsed, so it's parsed once even when
+// several threads ask for it; different bodies parse in parallel
+static Mutex lazy_body_mutexes[LAZY_BODY_SHARDS];
+
+// Reports the current token as unexpected and enters panic mode. The caller
+// returns an error node and parsing resumes at the next statement or
+// declaration boundary.
+static void
+unexpected_token(const char *context) {
+    report_error((Error){
+        .kind = ERROR_UNEXPECTED,
+        .pos = token.pos,
+        .found = token_info(),
+        .found_text = token_text(),
+        .found_len = (int)(token.end - token.start),
+        .unexpected = {
+            .found_token = token.kind,
+            .context = context,
+        }
+    });
+    panic_mode = true;
+}
+
+// Skips the rest of a broken statement: through the next ';' or the end of the
+// next braced block at this nesting level, stopping early at a '}' closing the
+// enclosing block or a keyword that starts a statement.
+static void
+sync_stmt(void) {
+    int depth = 0;
+    while (!is_token_eof()) {
+        if (depth == 0) {
+            if (is_token(TOKEN_RBRACE)) {
+                break;
+            } else if (match_token(TOKEN_SEMICOLON)) {
+                break;
+            } else if (is_keyword(if_keyword) || is_keyword(while_keyword) || is_keyword(for_keyword)
+                || is_keyword(var_keyword) || is_keyword(return_keyword) || is_keyword(break_keyword)
+                || is_keyword(continue_keyword) || is_keyword(switch_keyword)) {
+                break;
+            }
+        }
+        if (is_token(TOKEN_LBRACE)) {
+            depth++;
+        } else if (is_token(TOKEN_RBRACE) && --depth == 0) {
+            next_token();
+            break;
+        }
+        next_token();
+    }
+    panic_mode = false;
+}
+
+// Skips to the next declaration keyword outside any braces.
+static void
+sync_decl(void) {
+    int depth = 0;
+    while (!is_token_eof()) {
+        if (depth == 0 && (is_token(TOKEN_AT) || (is_token(TOKEN_KEYWORD) && is_decl_keyword(token.name)))) {
+            break;
+        }
+        if (is_token(TOKEN_LBRACE)) {
+            depth++;
+        } else if (is_token(TOKEN_RBRACE) && depth > 0) {
+            depth--;
+        }
+        next_token();
+    }
+    panic_mode = false;
+}
+
 // Already parsed
 // v  v  v
 // ( type, type, ...)
@@ -42,22 +115,34 @@ parse_type_base(void) {
         expect_token(TOKEN_RPAREN, (TokenKind []) {0}, false);
         return type;
     }
-    fatal_error_here("Unexpected token %s in type", token_info());
-    return NULL;
+    SrcPos pos = token.pos;
+    unexpected_token("type");
+    return new_typespec(TYPESPEC_ERROR, pos);
 }
 
+// base ('*' | '[' expr ']')*
 // todo: take some flags to limit what types are allowed
 static Typespec *
 parse_type(void) {
     Typespec *type = parse_type_base();
-    //SrcPos pos = token.pos;
-    // todo: subscript/array and bracket and pointers
-    return type;
+    for (;;) {
+        SrcPos pos = token.pos;
+        if (match_token(TOKEN_MUL)) {
+            type = new_typespec_ptr(pos, type);
+        } else if (match_token(TOKEN_LBRACKET)) {
+            Expr *num_elems = parse_expr();
+            expect_token(TOKEN_RBRACKET, (TokenKind []) {0}, false);
+            type = new_typespec_array(pos, type, num_elems);
+        } else {
+            return type;
+        }
+    }
 }
 
+// NULL when the token isn't a name, which is reported
 static const char *
 parse_name(void) {
-    const char *name = token.name;
+    const char *name = is_token(TOKEN_NAME) ? token.name : NULL;
     expect_token(TOKEN_NAME, (TokenKind []) {0}, false);
     return name;
 }
@@ -96,7 +181,6 @@ parse_decl_generic_param(bool is_fn_decl) {
 static Decl *
 parse_decl_fn(SrcPos pos) {
     const char *name = parse_name();
-    // generics go here
     GenericParam *generics = NULL;
     if (match_token(TOKEN_LT)) {
         buf_push(generics, parse_decl_generic_param(true));
@@ -118,13 +202,598 @@ parse_decl_fn(SrcPos pos) {
     if (match_token(TOKEN_RARROW)) {
         ret_type = parse_type();
     }
-    expect_token(TOKEN_LBRACE, (TokenKind []) {TOKEN_RARROW, TOKEN_LBRACE, 0}, true);
-    // BLOCK !
+    if (flag_lazy_fn_bodies && is_token(TOKEN_LBRACE)) {
+        const char *body_start = token.start;
+        SrcPos body_pos = token.pos;
+        skip_block();
+        Decl *decl = new_decl_func(pos, name, generics, buf_len(generics), params, buf_len(params), ret_type, (StmtList){0});
+        decl->fn.body_start = body_start;
+        decl->fn.body_end = token.start;
+        decl->fn.body_pos = body_pos;
+        return decl;
+    }
+    StmtList block = parse_stmt_block();
+    Decl *decl = new_decl_func(pos, name, generics, buf_len(generics), params, buf_len(params), ret_type, block);
+    return decl;
+}
+
+static void
+lazy_body_init(void) {
+    for (size_t i = 0; i < LAZY_BODY_SHARDS; i++) {
+        lazy_body_mutexes[i] = (Mutex)MUTEX_INIT;
+    }
+}
+
+// Parses the body of a fn whose body was skipped by a lazy parse. Safe to call
+// at any point, including in the middle of another parse, and from any thread.
+// Syntax errors in the body go to the caller's errors.
+static StmtList *
+parse_decl_fn_body(Decl *decl) {
+    assert(decl->kind == DECL_FUNC);
+    if (!flag_lazy_fn_bodies) {
+        return &decl->fn.block;
+    }
+    Mutex *mutex = &lazy_body_mutexes[hash_ptr(decl) % LAZY_BODY_SHARDS];
+    mutex_lock(mutex);
+    if (decl->fn.body_start) {
+        phase_push(PHASE_PARSE);
+        LexState state = save_lex_state();
+        bool saved_panic_mode = panic_mode;
+        init_stream_at(decl->fn.body_start, decl->fn.body_pos);
+        decl->fn.block = parse_stmt_block();
+        decl->fn.body_start = NULL;
+        decl->fn.body_end = NULL;
+        panic_mode = saved_panic_mode;
+        restore_lex_state(state);
+        phase_pop();
+    }
+    mutex_unlock(mutex);
+    return &decl->fn.block;
+}
+
+// '{' stmt* '}'
+static StmtList
+parse_stmt_block(void) {
+    SrcPos pos = token.pos;
+    if (!expect_token(TOKEN_LBRACE, (TokenKind []) {0}, false)) {
+        return (StmtList){pos};
+    }
+    Stmt **stmts = NULL;
+    while (!is_token_eof() && !is_token(TOKEN_RBRACE) && !is_block_end_keyword()) {
+        buf_push(stmts, parse_stmt());
+    }
+    expect_token(TOKEN_RBRACE, (TokenKind []) {0}, false);
+    return new_stmt_list(pos, stmts, buf_len(stmts));
+}
+
+// declaration keywords that can't start a statement, so a missing '}' doesn't
+// swallow the next declaration
+static bool 
+is_block_end_keyword(void) {
+    return is_token(TOKEN_KEYWORD) && is_decl_keyword(token.name) && token.name != var_keyword && token.name != const_keyword;
+}
+
+static bool 
+is_assign_op(void) {
+    return TOKEN_FIRST_ASSIGN <= token.kind && token.kind <= TOKEN_LAST_ASSIGN;
+}
+
+// expr | expr assign_op expr | name ':=' expr
+static Stmt *
+parse_simple_stmt(void) {
+    SrcPos pos = token.pos;
+    Expr *expr = parse_expr();
+    if (match_token(TOKEN_COLON_ASSIGN)) {
+        Expr *init = parse_expr();
+        if (expr->kind != EXPR_NAME) {
+            report_error((Error){.kind = ERROR_MESSAGE, .pos = pos, .message = ":= must be preceded by a name"});
+            return new_stmt(STMT_ERROR, pos);
+        }
+        return new_stmt_init(pos, expr->name, NULL, init);
+    } else if (is_assign_op()) {
+        TokenKind op = token.kind;
+        next_token();
+        return new_stmt_assign(pos, op, expr, parse_expr());
+    } else {
+        return new_stmt_expr(pos, expr);
+    }
+}
+
+// Already parsed
+// v
+// if '(' expr ')' block ('else' 'if' '(' expr ')' block)* ('else' block)?
+static Stmt *
+parse_stmt_if(SrcPos pos) {
+    Expr *cond = parse_paren_expr();
+    StmtList then_block = parse_stmt_block();
+    StmtList else_block = {0};
+    ElseIf *elseifs = NULL;
+    while (match_keyword(else_keyword)) {
+        if (!match_keyword(if_keyword)) {
+            else_block = parse_stmt_block();
+            break;
+        }
+        Expr *elseif_cond = parse_paren_expr();
+        StmtList elseif_block = parse_stmt_block();
+        buf_push(elseifs, (ElseIf){elseif_cond, elseif_block});
+    }
+    return new_stmt_if(pos, cond, then_block, elseifs, buf_len(elseifs), else_block);
+}
+
+// Already parsed
+// v
+// for '(' simple_stmt? ';' expr? ';' simple_stmt? ')' block
+static Stmt *
+parse_stmt_for(SrcPos pos) {
+    expect_token(TOKEN_LPAREN, (TokenKind []) {0}, false);
+    Stmt *init = NULL;
+    if (!is_token(TOKEN_SEMICOLON)) {
+        init = parse_simple_stmt();
+    }
+    expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    Expr *cond = NULL;
+    if (!is_token(TOKEN_SEMICOLON)) {
+        cond = parse_expr();
+    }
+    expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    Stmt *next = NULL;
+    if (!is_token(TOKEN_RPAREN)) {
+        next = parse_simple_stmt();
+    }
+    expect_token(TOKEN_RPAREN, (TokenKind []) {0}, false);
+    return new_stmt_for(pos, init, cond, next, parse_stmt_block());
+}
+
+// Already parsed
+// v
+// var name (':' type)? ('=' expr)? ';'
+static Stmt *
+parse_stmt_var(SrcPos pos) {
+    const char *name = parse_name();
+    Typespec *type = NULL;
+    if (match_token(TOKEN_COLON)) {
+        type = parse_type();
+    }
+    Expr *expr = NULL;
+    if (match_token(TOKEN_ASSIGN)) {
+        expr = parse_expr();
+    }
+    expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    return new_stmt_init(pos, name, type, expr);
+}
+
+// '_' | expr | expr '..' expr | '(' pattern (',' pattern)* ')'
+static Expr *
+parse_pattern(void) {
+    SrcPos pos = token.pos;
+    if (match_token(TOKEN_LPAREN)) {
+        Expr *pattern = parse_pattern();
+        if (!match_token(TOKEN_COMMA)) {
+            expect_token(TOKEN_RPAREN, (TokenKind []) {0}, false);
+            return pattern;
+        }
+        Expr **args = NULL;
+        buf_push(args, pattern);
+        while (!is_token(TOKEN_RPAREN) && !is_token_eof()) {
+            buf_push(args, parse_pattern());
+            if (!match_token(TOKEN_COMMA) || panic_mode) {
+                break;
+            }
+        }
+        expect_token(TOKEN_RPAREN, (TokenKind []) {0}, false);
+        Expr *tuple = new_expr_tuple(pos, args, buf_len(args));
+        buf_free(args);
+        return tuple;
+    }
+    Expr *expr = parse_expr();
+    if (is_token(TOKEN_DOTDOT)) {
+        // not new_expr_binary, which would try to fold it
+        Expr *range = new_expr(EXPR_BINARY, token.pos);
+        next_token();
+        range->binary.op = TOKEN_DOTDOT;
+        range->binary.left = expr;
+        range->binary.right = parse_expr();
+        return range;
+    }
+    return expr;
+}
+
+// Already parsed
+// v
+// switch '(' expr ')' '{' case* '}'
+// case = 'case' pattern (',' pattern)* block | 'default' block
+static Stmt *
+parse_stmt_switch(SrcPos pos) {
+    // switch (a, b) is on the tuple, as if it were written switch ((a, b))
+    SrcPos expr_pos = token.pos;
+    expect_token(TOKEN_LPAREN, (TokenKind []) {0}, false);
+    Expr *expr = parse_expr();
+    if (match_token(TOKEN_COMMA)) {
+        Expr **args = NULL;
+        buf_push(args, expr);
+        do {
+            buf_push(args, parse_expr());
+        } while (match_token(TOKEN_COMMA) && !panic_mode);
+        expr = new_expr_tuple(expr_pos, args, buf_len(args));
+        buf_free(args);
+    }
+    expect_token(TOKEN_RPAREN, (TokenKind []) {0}, false);
+    SwitchCase *cases = NULL;
+    if (expect_token(TOKEN_LBRACE, (TokenKind []) {0}, false)) {
+        while (!is_token_eof() && !is_token(TOKEN_RBRACE) && !panic_mode) {
+            SrcPos case_pos = token.pos;
+            Expr **patterns = NULL;
+            bool is_default = false;
+            if (match_keyword(default_keyword)) {
+                is_default = true;
+            } else if (match_keyword(case_keyword)) {
+                do {
+                    buf_push(patterns, parse_pattern());
+                } while (match_token(TOKEN_COMMA) && !panic_mode);
+            } else {
+                unexpected_token("'case' or 'default'");
+                break;
+            }
+            StmtList block = parse_stmt_block();
+            buf_push(cases, (SwitchCase){case_pos, patterns, buf_len(patterns), is_default, block});
+        }
+        expect_token(TOKEN_RBRACE, (TokenKind []) {0}, false);
+    }
+    Stmt *stmt = new_stmt_switch(pos, expr, cases, buf_len(cases));
+    for (size_t i = 0; i < buf_len(cases); i++) {
+        buf_free(cases[i].patterns);
+    }
+    buf_free(cases);
+    return stmt;
+}
+
+static Stmt *
+parse_stmt(void) {
+    SrcPos pos = token.pos;
+    const char *start = token.start;
+    Stmt *stmt;
+    if (match_keyword(if_keyword)) {
+        stmt = parse_stmt_if(pos);
+    } else if (match_keyword(while_keyword)) {
+        Expr *cond = parse_paren_expr();
+        stmt = new_stmt_while(pos, cond, parse_stmt_block());
+    } else if (match_keyword(for_keyword)) {
+        stmt = parse_stmt_for(pos);
+    } else if (match_keyword(var_keyword)) {
+        stmt = parse_stmt_var(pos);
+    } else if (match_keyword(switch_keyword)) {
+        stmt = parse_stmt_switch(pos);
+    } else if (match_keyword(return_keyword)) {
+        Expr *expr = NULL;
+        if (!is_token(TOKEN_SEMICOLON)) {
+            expr = parse_expr();
+        }
+        expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+        stmt = new_stmt_return(pos, expr);
+    } else if (match_keyword(break_keyword)) {
+        expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+        stmt = new_stmt(STMT_BREAK, pos);
+    } else if (match_keyword(continue_keyword)) {
+        expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+        stmt = new_stmt(STMT_CONTINUE, pos);
+    } else if (is_token(TOKEN_LBRACE)) {
+        stmt = new_stmt_block(pos, parse_stmt_block());
+    } else {
+        stmt = parse_simple_stmt();
+        expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    }
+    if (panic_mode) {
+        if (token.start == start && !is_token(TOKEN_RBRACE)) {
+            next_token();
+        }
+        sync_stmt();
+    }
+    return stmt;
+}
+
+// Already parsed
+// v
+// const name (':' type)? '=' expr ';'
+static Decl *
+parse_decl_const(SrcPos pos) {
+    const char *name = parse_name();
+    Typespec *type = NULL;
+    if (match_token(TOKEN_COLON)) {
+        type = parse_type();
+    }
+    expect_token(TOKEN_ASSIGN, (TokenKind []) {0}, false);
+    Expr *expr = parse_expr();
+    expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    return new_decl_const(pos, name, type, expr);
+}
+
+// Already parsed
+// v
+// var name (':' type)? ('=' expr)? ';'
+static Decl *
+parse_decl_var(SrcPos pos) {
+    const char *name = parse_name();
+    Typespec *type = NULL;
+    if (match_token(TOKEN_COLON)) {
+        type = parse_type();
+    }
+    Expr *expr = NULL;
+    if (match_token(TOKEN_ASSIGN)) {
+        expr = parse_expr();
+    }
+    expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    return new_decl_var(pos, name, type, expr);
+}
+
+// Already parsed
+// v
+// enum name (':' type)? '{' item (',' item)* ','? '}'
+// item = name ('=' expr)?
+static Decl *
+parse_decl_enum(SrcPos pos) {
+    const char *name = parse_name();
+    Typespec *type = NULL;
+    if (match_token(TOKEN_COLON)) {
+        type = parse_type();
+    }
+    EnumItem *items = NULL;
+    long long value = 0;
+    expect_token(TOKEN_LBRACE, (TokenKind []) {0}, false);
+    while (!is_token(TOKEN_RBRACE) && !is_token_eof() && !panic_mode) {
+        SrcPos item_pos = token.pos;
+        const char *item_name = parse_name();
+        if (match_token(TOKEN_ASSIGN)) {
+            Expr *expr = parse_expr();
+            Val val;
+            FoldType fold_type = fold_literal(expr, &val);
+            if (fold_type == FOLD_NONE || fold_is_float(fold_type)) {
+                report_error((Error){.kind = ERROR_MESSAGE, .pos = expr->pos, .message = "Enum values must be integer constants"});
+            } else {
+                value = (long long)fold_get_bits(val, fold_type);
+            }
+        }
+        buf_push(items, (EnumItem){item_pos, item_name, value});
+        value++;
+        if (!match_token(TOKEN_COMMA)) {
+            break;
+        }
+    }
     expect_token(TOKEN_RBRACE, (TokenKind []) {0}, false);
-    Decl *decl = new_decl_func(pos, name, params, buf_len(params), ret_type);
+    Decl *decl = new_decl_enum(pos, name, type, items, buf_len(items));
+    buf_free(items);
     return decl;
 }
 
+static Aggregate *parse_aggregate(AggregateKind kind);
+
+// name (',' name)* ':' type ';' | ('struct' | 'union') '{' item* '}'
+static AggregateItem
+parse_aggregate_item(void) {
+    SrcPos pos = token.pos;
+    if (match_keyword(struct_keyword)) {
+        return (AggregateItem){.pos = pos, .kind = AGGREGATE_ITEM_SUBAGGREGATE, .subaggregate = parse_aggregate(AGGREGATE_STRUCT)};
+    }
+    if (match_keyword(union_keyword)) {
+        return (AggregateItem){.pos = pos, .kind = AGGREGATE_ITEM_SUBAGGREGATE, .subaggregate = parse_aggregate(AGGREGATE_UNION)};
+    }
+    const char **names = NULL;
+    do {
+        buf_push(names, parse_name());
+    } while (match_token(TOKEN_COMMA) && !panic_mode);
+    expect_token(TOKEN_COLON, (TokenKind []) {0}, false);
+    Typespec *type = parse_type();
+    expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    AggregateItem item = {
+        .pos = pos,
+        .kind = AGGREGATE_ITEM_FIELD,
+        .names = ast_dup(names, buf_sizeof(names)),
+        .num_names = buf_len(names),
+        .type = type,
+    };
+    buf_free(names);
+    return item;
+}
+
+// '{' item* '}'
+static Aggregate *
+parse_aggregate(AggregateKind kind) {
+    SrcPos pos = token.pos;
+    AggregateItem *items = NULL;
+    expect_token(TOKEN_LBRACE, (TokenKind []) {0}, false);
+    while (!is_token(TOKEN_RBRACE) && !is_token_eof() && !panic_mode) {
+        buf_push(items, parse_aggregate_item());
+    }
+    expect_token(TOKEN_RBRACE, (TokenKind []) {0}, false);
+    Aggregate *aggregate = new_aggregate(pos, kind, items, buf_len(items));
+    buf_free(items);
+    return aggregate;
+}
+
+// Already parsed
+// v
+// ('struct' | 'union') name '{' item* '}'
+static Decl *
+parse_decl_aggregate(SrcPos pos, DeclKind kind) {
+    const char *name = parse_name();
+    Aggregate *aggregate = parse_aggregate(kind == DECL_STRUCT ? AGGREGATE_STRUCT : AGGREGATE_UNION);
+    return new_decl_aggregate(pos, kind, name, aggregate);
+}
+
+// ('@' name)*
+static Notes
+parse_notes(void) {
+    Note *notes = NULL;
+    while (!panic_mode && is_token(TOKEN_AT)) {
+        SrcPos pos = token.pos;
+        next_token();
+        const char *name = parse_name();
+        if (name) {
+            buf_push(notes, (Note){pos, name});
+        }
+    }
+    Notes result = new_notes(notes, buf_len(notes));
+    buf_free(notes);
+    return result;
+}
+
+// Already parsed
+// v
+// import '.'? name ('.' name)* ('{' ('...' | item (',' item)*) '}')? ';'
+// item = name ('=' name)?
+static Decl *
+parse_decl_import(SrcPos pos) {
+    bool is_relative = match_token(TOKEN_DOT);
+    const char **names = NULL;
+    buf_push(names, parse_name());
+    while (match_token(TOKEN_DOT)) {
+        buf_push(names, parse_name());
+    }
+    bool import_all = false;
+    ImportItem *items = NULL;
+    if (match_token(TOKEN_LBRACE)) {
+        while (!is_token(TOKEN_RBRACE) && !is_token_eof()) {
+            if (match_token(TOKEN_ELLIPSIS)) {
+                import_all = true;
+            } else {
+                const char *name = parse_name();
+                const char *rename = NULL;
+                if (match_token(TOKEN_ASSIGN)) {
+                    rename = name;
+                    name = parse_name();
+                }
+                buf_push(items, (ImportItem){name, rename});
+            }
+            if (!match_token(TOKEN_COMMA) || panic_mode) {
+                break;
+            }
+        }
+        expect_token(TOKEN_RBRACE, (TokenKind []) {0}, false);
+    }
+    expect_token(TOKEN_SEMICOLON, (TokenKind []) {0}, false);
+    // an import missing a name has been reported and isn't looked for
+    bool has_names = true;
+    for (size_t i = 0; i < buf_len(names); i++) {
+        has_names = has_names && names[i];
+    }
+    for (size_t i = 0; i < buf_len(items); i++) {
+        has_names = has_names && items[i].name;
+    }
+    Decl *decl = has_names ? new_decl_import(pos, is_relative, names, buf_len(names), import_all, items, buf_len(items))
+        : new_decl(DECL_ERROR, pos, NULL);
+    buf_free(names);
+    buf_free(items);
+    return decl;
+}
+
+static Decl *
+parse_decl(void) {
+    SrcPos pos = token.pos;
+    const char *start = token.start;
+    Decl *decl;
+    Notes notes = parse_notes();
+    if (notes.num_notes) {
+        // the declaration is where its keyword is
+        pos = token.pos;
+    }
+    if (panic_mode) {
+        decl = new_decl(DECL_ERROR, pos, NULL);
+    } else if (match_keyword(fn_keyword)) {
+        decl = parse_decl_fn(pos);
+    } else if (match_keyword(const_keyword)) {
+        decl = parse_decl_const(pos);
+    } else if (match_keyword(var_keyword)) {
+        decl = parse_decl_var(pos);
+    } else if (match_keyword(enum_keyword)) {
+        decl = parse_decl_enum(pos);
+    } else if (match_keyword(struct_keyword)) {
+        decl = parse_decl_aggregate(pos, DECL_STRUCT);
+    } else if (match_keyword(union_keyword)) {
+        decl = parse_decl_aggregate(pos, DECL_UNION);
+    } else if (match_keyword(import_keyword)) {
+        decl = parse_decl_import(pos);
+    } else {
+        unexpected_token("declaration");
+        decl = new_decl(DECL_ERROR, pos, NULL);
+    }
+    decl->notes = notes;
+    if (panic_mode) {
+        if (token.start == start) {
+            next_token();
+        }
+        sync_decl();
+    }
+    return decl;
+}
+
+static void
+parse_job(ParseJob *job) {
+    phase_push(PHASE_PARSE);
+    init_stream_at(job->start, job->pos);
+    while (!is_token_eof() && token.start < job->end) {
+        buf_push(job->decls, parse_decl());
+    }
+    job->errors = errors;
+    errors = NULL;
+    phase_pop();
+}
+
+// Splits the file at top-level declaration boundaries into at most num_jobs
+// runs of about the same size.
+static ParseJob *
+split_parse_jobs(const char *name, const char *buf, int num_jobs) {
+    const char *buf_end = buf + strlen(buf);
+    ParseJob *jobs = NULL;
+    ParseJob job = {.start = buf, .pos = {.name = name, .line = 1, .col = 1}};
+    if (num_jobs > 1) {
+        phase_push(PHASE_SCAN);
+        DeclStart *starts = scan_decl_starts(buf);
+        phase_pop();
+        size_t num_starts = buf_len(starts);
+        size_t next = 1;
+        for (int i = 1; i < num_jobs; i++) {
+            const char *split = buf + (buf_end - buf) * i / num_jobs;
+            while (next < num_starts && starts[next].start < split) {
+                next++;
+            }
+            if (next >= num_starts) {
+                break;
+            }
+            job.end = starts[next].start;
+            buf_push(jobs, job);
+            DeclStart *start = &starts[next];
+            job = (ParseJob){.start = start->start, .pos = {name, start->line, start->col, (int)(start->start - buf)}};
+            next++;
+        }
+        buf_free(starts);
+    }
+    job.end = buf_end;
+    buf_push(jobs, job);
+    return jobs;
+}
+
+// Concatenates the declarations of the jobs in source order, moves their
+// errors to this thread and frees the jobs.
+static Decls *
+merge_parse_jobs(ParseJob *jobs) {
+    phase_push(PHASE_MERGE);
+    Decl **decls = NULL;
+    for (ParseJob *it = jobs; it != buf_end(jobs); it++) {
+        for (Decl **decl = it->decls; decl != buf_end(it->decls); decl++) {
+            buf_push(decls, *decl);
+        }
+        for (Error *error = it->errors; error != buf_end(it->errors); error++) {
+            buf_push(errors, *error);
+        }
+        buf_free(it->decls);
+        buf_free(it->errors);
+    }
+    buf_free(jobs);
+    Decls *result = new_decls(decls, buf_len(decls));
+    buf_free(decls);
+    phase_pop();
+    return result;
+}
+
 static Expr *
 parse_expr_operand(void) {
     SrcPos pos = token.pos;
@@ -156,9 +825,10 @@ parse_expr_operand(void) {
             // tuple!
             Expr **args = NULL;
             buf_push(args, expr);
-            if (!is_token(TOKEN_RPAREN)) {
-                while (match_token(TOKEN_COMMA)) {
-                    buf_push(args, parse_expr());
+            while (!is_token(TOKEN_RPAREN) && !is_token_eof()) {
+                buf_push(args, parse_expr());
+                if (!match_token(TOKEN_COMMA)) {
+                    break;
                 }
             }
             expect_token(TOKEN_RPAREN, (TokenKind []) {0}, false);
@@ -168,8 +838,8 @@ parse_expr_operand(void) {
             return new_expr_paren(pos, expr);
         }
     } else {
-        fatal_error_here("Unexpected token %s in expression", token_info());
-        return NULL;
+        unexpected_token("expression");
+        return new_expr(EXPR_ERROR, pos);
     }
 }
 
@@ -194,9 +864,7 @@ parse_expr_base(void) {
             expr = new_expr_index(pos, expr, index);
         } else if (is_token(TOKEN_DOT)) {
             next_token();
-            const char *field = token.name;
-            expect_token(TOKEN_NAME, (TokenKind []) {0}, false);
-            expr = new_expr_field(pos, expr, field);
+            expr = new_expr_field(pos, expr, parse_name());
         } else {
             assert(is_token(TOKEN_INC) || is_token(TOKEN_DEC));
             TokenKind op = token.kind;
@@ -236,80 +904,62 @@ parse_expr_unary(void) {
     }
 }
 
-static bool 
-is_mul_op(void) {
-    return TOKEN_FIRST_MUL <= token.kind && token.kind <= TOKEN_LAST_MUL;
-}
-
-static Expr *
-parse_expr_mul(void) {
-    Expr *expr = parse_expr_unary();
-    while (is_mul_op()) {
-        SrcPos pos = token.pos;
-        TokenKind op = token.kind;
-        next_token();
-        expr = new_expr_binary(pos, op, expr, parse_expr_unary());
-    }
-    return expr;
-}
-
-static bool 
-is_add_op(void) {
-    return TOKEN_FIRST_ADD <= token.kind && token.kind <= TOKEN_LAST_ADD;
-}
-
-static Expr *
-parse_expr_add(void) {
-    Expr *expr = parse_expr_mul();
-    while (is_add_op()) {
-        SrcPos pos = token.pos;
-        TokenKind op = token.kind;
-        next_token();
-        expr = new_expr_binary(pos, op, expr, parse_expr_mul());
-    }
-    return expr;
-}
+// Binary operator precedence climbing. Every binary operator is looked up in
+// binary_precedence by token kind; higher binds tighter and PREC_NONE ends the
+// expression. All current levels are left associative.
+typedef enum Precedence {
+    PREC_NONE,
+    // reserved for assignment (right associative), ternary and range operators
+    PREC_ASSIGN,
+    PREC_TERNARY,
+    PREC_RANGE,
+    PREC_OR,
+    PREC_AND,
+    PREC_CMP,
+    PREC_ADD,
+    PREC_MUL,
+} Precedence;
 
-static bool 
-is_cmp_op(void) {
-    return TOKEN_FIRST_CMP <= token.kind && token.kind <= TOKEN_LAST_CMP;
-}
+static u8 binary_precedence[NUM_TOKEN_KINDS] = {
+    [TOKEN_MUL] = PREC_MUL,
+    [TOKEN_DIV] = PREC_MUL,
+    [TOKEN_MOD] = PREC_MUL,
+    [TOKEN_AND] = PREC_MUL,
+    [TOKEN_LSHIFT] = PREC_MUL,
+    [TOKEN_RSHIFT] = PREC_MUL,
+    [TOKEN_ADD] = PREC_ADD,
+    [TOKEN_SUB] = PREC_ADD,
+    [TOKEN_XOR] = PREC_ADD,
+    [TOKEN_OR] = PREC_ADD,
+    [TOKEN_EQ] = PREC_CMP,
+    [TOKEN_NOTEQ] = PREC_CMP,
+    [TOKEN_LT] = PREC_CMP,
+    [TOKEN_GT] = PREC_CMP,
+    [TOKEN_LTEQ] = PREC_CMP,
+    [TOKEN_GTEQ] = PREC_CMP,
+    [TOKEN_AND_AND] = PREC_AND,
+    [TOKEN_OR_OR] = PREC_OR,
+};
 
 static Expr *
-parse_expr_cmp(void) {
-    Expr *expr = parse_expr_add();
-    while (is_cmp_op()) {
+parse_expr_binary(int min_prec) {
+    assert(min_prec > PREC_NONE);
+    Expr *expr = parse_expr_unary();
+    for (;;) {
+        int prec = binary_precedence[token.kind];
+        if (prec < min_prec) {
+            return expr;
+        }
         SrcPos pos = token.pos;
         TokenKind op = token.kind;
         next_token();
-        expr = new_expr_binary(pos, op, expr, parse_expr_add());
-    }
-    return expr;
-}
-
-static Expr *
-parse_expr_and(void) {
-    Expr *expr = parse_expr_cmp();
-    while (match_token(TOKEN_AND_AND)) {
-        SrcPos pos = token.pos;
-        expr = new_expr_binary(pos, TOKEN_AND_AND, expr, parse_expr_cmp());
-    }
-    return expr;
-}
-
-static Expr *
-parse_expr_or(void) {
-    Expr *expr = parse_expr_and();
-    while (match_token(TOKEN_OR_OR)) {
-        SrcPos pos = token.pos;
-        expr = new_expr_binary(pos, TOKEN_OR_OR, expr, parse_expr_and());
+        expr = new_expr_binary(pos, op, expr, parse_expr_binary(prec + 1));
     }
-    return expr;
 }
 
 static Expr *
 parse_expr(void) {
-    return parse_expr_or();
+    return parse_expr_binary(PREC_OR);
 }
 
 static Expr *
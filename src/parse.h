@@ -2,9 +2,28 @@
 
 #include "stdafx.h"
 #include "common.h"
+#include "error.h"
 #include "lex.h"
 #include "ast.h"
 
+// One contiguous run of top-level declarations, parsed by one thread. The
+// lexer, the error list and the AST arena are thread local, so each job
+// parses with its own state; only interning is shared.
+typedef struct ParseJob {
+    const char *start;
+    const char *end;
+    SrcPos pos;
+    Decl **decls;
+    Error *errors;
+} ParseJob;
+
+// Skipped fn bodies are parsed under one of these, picked by the decl.
+#define LAZY_BODY_SHARDS 64
+
+static void unexpected_token(const char *context);
+static void sync_stmt(void);
+static void sync_decl(void);
+
 static Typespec *parse_type_tuple(Typespec *type);
 static Typespec *parse_type_base(void);
 static Typespec *parse_type(void);
@@ -12,18 +31,29 @@ static Typespec *parse_type(void);
 static const char *parse_name(void);
 static FuncParam parse_decl_func_param(void);
 static Decl *parse_decl_fn(SrcPos pos);
+static void lazy_body_init(void);
+static StmtList *parse_decl_fn_body(Decl *decl);
+static Decl *parse_decl_const(SrcPos pos);
+static Decl *parse_decl_var(SrcPos pos);
+static Decl *parse_decl_import(SrcPos pos);
+static Decl *parse_decl(void);
+static void parse_job(ParseJob *job);
+static ParseJob *split_parse_jobs(const char *name, const char *buf, int num_jobs);
+static Decls *merge_parse_jobs(ParseJob *jobs);
+
+static StmtList parse_stmt_block(void);
+static bool is_block_end_keyword(void);
+static bool is_assign_op(void);
+static Stmt *parse_simple_stmt(void);
+static Stmt *parse_stmt_if(SrcPos pos);
+static Stmt *parse_stmt_for(SrcPos pos);
+static Stmt *parse_stmt_var(SrcPos pos);
+static Stmt *parse_stmt(void);
 
 static Expr *parse_expr_operand(void);
 static Expr *parse_expr_base(void);
 static bool is_unary_op(void);
 static Expr *parse_expr_unary(void);
-static bool is_mul_op(void);
-static Expr *parse_expr_mul(void);
-static bool is_add_op(void);
-static Expr *parse_expr_add(void);
-static bool is_cmp_op(void);
-static Expr *parse_expr_cmp(void);
-static Expr *parse_expr_and(void);
-static Expr *parse_expr_or(void);
+static Expr *parse_expr_binary(int min_prec);
 static Expr *parse_expr(void);
 static Expr *parse_paren_expr(void);
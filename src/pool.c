@@ -0,0 +1,154 @@
+#include "pool.h"
+
+static THREAD_LOCAL Worker *current_worker;
+
+static void pool_worker_thread(void *arg);
+
+Pool *pool_create(int num_workers) {
+    if (num_workers < 1) {
+        num_workers = 1;
+    }
+    Pool *pool = xcalloc(1, sizeof(Pool));
+    pool->workers = xcalloc(num_workers, sizeof(Worker));
+    pool->num_workers = num_workers;
+    pool->mutex = (Mutex)MUTEX_INIT;
+    pool->wake = (Cond)COND_INIT;
+    for (int i = 0; i < num_workers; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].mutex = (Mutex)MUTEX_INIT;
+    }
+    for (int i = 1; i < num_workers; i++) {
+        buf_push(pool->threads, thread_create(pool_worker_thread, &pool->workers[i]));
+    }
+    return pool;
+}
+
+// From a task the new task goes to the back of its own worker's deque;
+// from outside the pool tasks are dealt out round robin. Helpers start on
+// it right away, without waiting for pool_run.
+void pool_submit(Pool *pool, TaskFunc func, void *arg) {
+    mutex_lock(&pool->mutex);
+    pool->pending++;
+    Worker *worker = current_worker;
+    if (!worker || worker->pool != pool) {
+        worker = &pool->workers[pool->next_worker];
+        pool->next_worker = (pool->next_worker + 1) % pool->num_workers;
+    }
+    mutex_lock(&worker->mutex);
+    buf_push(worker->tasks, (Task){func, arg});
+    mutex_unlock(&worker->mutex);
+    pool->num_submitted++;
+    cond_signal(&pool->wake);
+    mutex_unlock(&pool->mutex);
+}
+
+static bool pool_pop(Worker *worker, Task *task) {
+    bool found = false;
+    mutex_lock(&worker->mutex);
+    if (worker->head < buf_len(worker->tasks)) {
+        *task = buf_pop(worker->tasks);
+        found = true;
+    }
+    if (worker->head == buf_len(worker->tasks)) {
+        worker->head = 0;
+        buf_clear(worker->tasks);
+    }
+    mutex_unlock(&worker->mutex);
+    return found;
+}
+
+static bool pool_steal(Worker *victim, Task *task) {
+    bool found = false;
+    mutex_lock(&victim->mutex);
+    if (victim->head < buf_len(victim->tasks)) {
+        *task = victim->tasks[victim->head++];
+        found = true;
+    }
+    mutex_unlock(&victim->mutex);
+    return found;
+}
+
+// Runs tasks until none are pending. A worker that finds nothing to take
+// sleeps until a task is submitted or the last one finishes; a task pushed
+// after it looked is always one it's woken for, since submits are counted
+// under the pool's mutex.
+static void pool_work(Worker *worker) {
+    Pool *pool = worker->pool;
+    int index = (int)(worker - pool->workers);
+    current_worker = worker;
+    for (;;) {
+        mutex_lock(&pool->mutex);
+        uint64_t seen = pool->num_submitted;
+        mutex_unlock(&pool->mutex);
+        Task task;
+        bool found = pool_pop(worker, &task);
+        for (int i = 1; !found && i < pool->num_workers; i++) {
+            found = pool_steal(&pool->workers[(index + i) % pool->num_workers], &task);
+        }
+        if (found) {
+            task.func(task.arg);
+            mutex_lock(&pool->mutex);
+            if (--pool->pending == 0) {
+                cond_broadcast(&pool->wake);
+            }
+            mutex_unlock(&pool->mutex);
+            continue;
+        }
+        mutex_lock(&pool->mutex);
+        while (pool->pending && pool->num_submitted == seen) {
+            cond_wait(&pool->wake, &pool->mutex);
+        }
+        bool done = pool->pending == 0;
+        mutex_unlock(&pool->mutex);
+        if (done) {
+            break;
+        }
+    }
+    current_worker = NULL;
+}
+
+// A helper works whenever tasks are pending, until the pool is freed.
+static void pool_worker_thread(void *arg) {
+    Worker *worker = arg;
+    Pool *pool = worker->pool;
+    for (;;) {
+        mutex_lock(&pool->mutex);
+        while (!pool->pending && !pool->stopping) {
+            cond_wait(&pool->wake, &pool->mutex);
+        }
+        bool stopping = pool->stopping;
+        mutex_unlock(&pool->mutex);
+        if (stopping) {
+            break;
+        }
+        pool_work(worker);
+    }
+    map_free(&intern_cache);
+    bc_free_thread();
+    resolve_free_thread();
+    stats_flush_thread();
+}
+
+// Runs every submitted task, and every task they submit, to completion. The
+// calling thread works as worker 0.
+void pool_run(Pool *pool) {
+    pool_work(&pool->workers[0]);
+}
+
+// Stops the helpers; every task must have finished.
+void pool_free(Pool *pool) {
+    mutex_lock(&pool->mutex);
+    assert(pool->pending == 0);
+    pool->stopping = true;
+    cond_broadcast(&pool->wake);
+    mutex_unlock(&pool->mutex);
+    for (Thread *it = pool->threads; it != buf_end(pool->threads); it++) {
+        thread_join(*it);
+    }
+    buf_free(pool->threads);
+    for (int i = 0; i < pool->num_workers; i++) {
+        buf_free(pool->workers[i].tasks);
+    }
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "stdafx.h"
+#include "os.h"
+#include "common.h"
+
+// Work-stealing thread pool. Every worker owns a deque of tasks: it pushes and
+// pops at the back, so a task's follow-up work runs next while its data is
+// still in cache, and idle workers steal from the front of the others, which
+// takes the oldest and usually largest pieces of work. Tasks may submit more
+// tasks; pool_run returns once every task has finished. The helper threads
+// live as long as the pool and sleep while there's nothing to take, so one
+// pool can run several batches of tasks in turn.
+
+typedef void (*TaskFunc)(void *arg);
+
+typedef struct Task {
+    TaskFunc func;
+    void *arg;
+} Task;
+
+typedef struct Pool Pool;
+
+typedef struct Worker {
+    Pool *pool;
+    Mutex mutex;
+    // tasks[head..len) are queued
+    Task *tasks;
+    size_t head;
+} Worker;
+
+struct Pool {
+    Worker *workers;
+    int num_workers;
+    int next_worker;
+    Thread *threads;
+    Mutex mutex;
+    // signalled by a submit, by the last task finishing and by pool_free
+    Cond wake;
+    // tasks submitted but not yet finished
+    int pending;
+    // counts submits, so an idle worker can tell whether it missed one
+    uint64_t num_submitted;
+    bool stopping;
+};
+
+Pool *pool_create(int num_workers);
+void pool_submit(Pool *pool, TaskFunc func, void *arg);
+void pool_run(Pool *pool);
+void pool_free(Pool *pool);
@@ -0,0 +1,374 @@
+#include "reparse.h"
+
+// Moving a reused declaration to a different line has to update every SrcPos
+// in it. With lazily parsed fn bodies this only touches the declaration's
+// header, since a skipped body is just a pointer and a position.
+
+static void 
+shift_pos(SrcPos *pos, PosShift shift) {
+    if (pos->line == shift.first_line) {
+        pos->col += shift.cols;
+    }
+    pos->line += shift.lines;
+    pos->offset += shift.bytes;
+}
+
+static void 
+shift_typespec(Typespec *type, PosShift shift) {
+    if (!type) {
+        return;
+    }
+    shift_pos(&type->pos, shift);
+    shift_typespec(type->base, shift);
+    switch (type->kind) {
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            shift_typespec(type->fn.args[i], shift);
+        }
+        shift_typespec(type->fn.ret, shift);
+        break;
+    case TYPESPEC_ARRAY:
+        shift_expr(type->num_elems, shift);
+        break;
+    case TYPESPEC_TUPLE:
+        for (size_t i = 0; i < type->tuple.num_fields; i++) {
+            shift_typespec(type->tuple.fields[i], shift);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void 
+shift_expr(Expr *expr, PosShift shift) {
+    if (!expr) {
+        return;
+    }
+    shift_pos(&expr->pos, shift);
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        shift_expr(expr->paren.expr, shift);
+        break;
+    case EXPR_TUPLE:
+        for (size_t i = 0; i < expr->tuple.num_args; i++) {
+            shift_expr(expr->tuple.args[i], shift);
+        }
+        break;
+    case EXPR_CAST:
+        shift_typespec(expr->cast.type, shift);
+        shift_expr(expr->cast.expr, shift);
+        break;
+    case EXPR_CALL:
+        shift_expr(expr->call.expr, shift);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            shift_expr(expr->call.args[i], shift);
+        }
+        break;
+    case EXPR_INDEX:
+        shift_expr(expr->index.expr, shift);
+        shift_expr(expr->index.index, shift);
+        break;
+    case EXPR_FIELD:
+        shift_expr(expr->field.expr, shift);
+        break;
+    case EXPR_UNARY:
+        shift_expr(expr->unary.expr, shift);
+        break;
+    case EXPR_BINARY:
+        shift_expr(expr->binary.left, shift);
+        shift_expr(expr->binary.right, shift);
+        break;
+    case EXPR_TERNARY:
+        shift_expr(expr->ternary.cond, shift);
+        shift_expr(expr->ternary.then_expr, shift);
+        shift_expr(expr->ternary.else_expr, shift);
+        break;
+    case EXPR_MODIFY:
+        shift_expr(expr->modify.expr, shift);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        shift_expr(expr->sizeof_expr, shift);
+        break;
+    case EXPR_SIZEOF_TYPE:
+        shift_typespec(expr->sizeof_type, shift);
+        break;
+    case EXPR_TYPEOF_EXPR:
+        shift_expr(expr->typeof_expr, shift);
+        break;
+    case EXPR_TYPEOF_TYPE:
+        shift_typespec(expr->typeof_type, shift);
+        break;
+    case EXPR_ALIGNOF_EXPR:
+        shift_expr(expr->alignof_expr, shift);
+        break;
+    case EXPR_ALIGNOF_TYPE:
+        shift_typespec(expr->alignof_type, shift);
+        break;
+    case EXPR_OFFSETOF:
+        shift_typespec(expr->offsetof_field.type, shift);
+        break;
+    case EXPR_NEW:
+        shift_expr(expr->new_expr.alloc, shift);
+        shift_expr(expr->new_expr.len, shift);
+        shift_expr(expr->new_expr.arg, shift);
+        break;
+    default:
+        break;
+    }
+}
+
+static void 
+shift_stmt_list(StmtList *block, PosShift shift) {
+    shift_pos(&block->pos, shift);
+    for (size_t i = 0; i < block->num_stmts; i++) {
+        shift_stmt(block->stmts[i], shift);
+    }
+}
+
+static void 
+shift_stmt(Stmt *stmt, PosShift shift) {
+    if (!stmt) {
+        return;
+    }
+    shift_pos(&stmt->pos, shift);
+    switch (stmt->kind) {
+    case STMT_RETURN:
+    case STMT_EXPR:
+        shift_expr(stmt->expr, shift);
+        break;
+    case STMT_BLOCK:
+        shift_stmt_list(&stmt->block, shift);
+        break;
+    case STMT_IF:
+        shift_expr(stmt->if_stmt.cond, shift);
+        shift_stmt_list(&stmt->if_stmt.then_block, shift);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            shift_expr(stmt->if_stmt.elseifs[i].cond, shift);
+            shift_stmt_list(&stmt->if_stmt.elseifs[i].block, shift);
+        }
+        shift_stmt_list(&stmt->if_stmt.else_block, shift);
+        break;
+    case STMT_WHILE:
+        shift_expr(stmt->while_stmt.cond, shift);
+        shift_stmt_list(&stmt->while_stmt.block, shift);
+        break;
+    case STMT_FOR:
+        shift_stmt(stmt->for_stmt.init, shift);
+        shift_expr(stmt->for_stmt.cond, shift);
+        shift_stmt(stmt->for_stmt.next, shift);
+        shift_stmt_list(&stmt->for_stmt.block, shift);
+        break;
+    case STMT_ASSIGN:
+        shift_expr(stmt->assign.left, shift);
+        shift_expr(stmt->assign.right, shift);
+        break;
+    case STMT_INIT:
+        shift_typespec(stmt->init.type, shift);
+        shift_expr(stmt->init.expr, shift);
+        break;
+    case STMT_SWITCH:
+        shift_expr(stmt->switch_stmt.expr, shift);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            shift_pos(&c->pos, shift);
+            for (size_t j = 0; j < c->num_patterns; j++) {
+                shift_expr(c->patterns[j], shift);
+            }
+            shift_stmt_list(&c->block, shift);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+shift_aggregate(Aggregate *aggregate, PosShift shift) {
+    shift_pos(&aggregate->pos, shift);
+    for (size_t i = 0; i < aggregate->num_items; i++) {
+        AggregateItem *item = &aggregate->items[i];
+        shift_pos(&item->pos, shift);
+        if (item->kind == AGGREGATE_ITEM_FIELD) {
+            shift_typespec(item->type, shift);
+        } else if (item->kind == AGGREGATE_ITEM_SUBAGGREGATE) {
+            shift_aggregate(item->subaggregate, shift);
+        }
+    }
+}
+
+static void 
+shift_decl(Decl *decl, PosShift shift) {
+    shift_pos(&decl->pos, shift);
+    for (size_t i = 0; i < decl->notes.num_notes; i++) {
+        shift_pos(&decl->notes.notes[i].pos, shift);
+    }
+    switch (decl->kind) {
+    case DECL_FUNC:
+        for (size_t i = 0; i < decl->fn.num_generics; i++) {
+            shift_pos(&decl->fn.generics[i].pos, shift);
+            shift_typespec(decl->fn.generics[i].type, shift);
+        }
+        for (size_t i = 0; i < decl->fn.num_params; i++) {
+            shift_pos(&decl->fn.params[i].pos, shift);
+            shift_typespec(decl->fn.params[i].type, shift);
+        }
+        shift_typespec(decl->fn.ret_type, shift);
+        if (decl->fn.body_start) {
+            shift_pos(&decl->fn.body_pos, shift);
+        } else {
+            shift_stmt_list(&decl->fn.block, shift);
+        }
+        break;
+    case DECL_VAR:
+        shift_typespec(decl->var.type, shift);
+        shift_expr(decl->var.expr, shift);
+        break;
+    case DECL_CONST:
+        shift_typespec(decl->const_decl.type, shift);
+        shift_expr(decl->const_decl.expr, shift);
+        break;
+    case DECL_TYPEDEF:
+        shift_typespec(decl->typedef_decl.type, shift);
+        break;
+    case DECL_ENUM:
+        shift_typespec(decl->enum_decl.type, shift);
+        for (size_t i = 0; i < decl->enum_decl.num_items; i++) {
+            shift_pos(&decl->enum_decl.items[i].pos, shift);
+        }
+        break;
+    case DECL_STRUCT:
+    case DECL_UNION:
+        shift_aggregate(decl->aggregate, shift);
+        break;
+    default:
+        break;
+    }
+}
+
+// Reparses buf, a new version of the file (which now owns it), reusing the
+// unchanged declarations of the previous version. Decls returned by earlier
+// calls must no longer be used, since reused ones are moved in place. The
+// syntax errors of the whole file are appended to errors as usual.
+static Decls *
+reparse_file(ParsedFile *file, char *buf) {
+    if (!flag_lazy_fn_bodies) {
+        for (size_t i = 0; i < buf_len(file->bufs); i++) {
+            free(file->bufs[i]);
+        }
+        buf_clear(file->bufs);
+    }
+    buf_push(file->bufs, buf);
+
+    // old ranges by hash, with a chain for ranges with identical text
+    size_t num_old_ranges = buf_len(file->ranges);
+    Map old_ranges = {0};
+    size_t *next_same = xcalloc(num_old_ranges + 1, sizeof(size_t));
+    bool *reused = xcalloc(num_old_ranges + 1, sizeof(bool));
+    for (size_t i = num_old_ranges; i > 0; i--) {
+        ParsedRange *old = &file->ranges[i - 1];
+        next_same[i] = map_get_uint64_from_uint64(&old_ranges, old->hash);
+        map_put_uint64_from_uint64(&old_ranges, old->hash, i);
+    }
+
+    phase_push(PHASE_SCAN);
+    DeclStart *starts = scan_decl_starts(buf);
+    phase_pop();
+    size_t num_starts = buf_len(starts);
+    const char *buf_end = buf + strlen(buf);
+    ParsedRange *ranges = NULL;
+    Decl **decls = NULL;
+    file->num_reused = 0;
+    file->num_parsed = 0;
+    for (size_t i = 0; i <= num_starts; i++) {
+        // the first range also covers anything before the first keyword
+        const char *start = i == 0 ? buf : starts[i - 1].start;
+        SrcPos pos = {file->name, 1, 1, 0};
+        if (i > 0) {
+            pos = (SrcPos){file->name, starts[i - 1].line, starts[i - 1].col, (int)(start - buf)};
+        }
+        const char *end = i < num_starts ? starts[i].start : buf_end;
+        if (i == 0 && num_starts > 0 && start == end) {
+            continue;
+        }
+        size_t len = end - start;
+        uint64_t hash = hash_mix(hash_bytes(start, len), len);
+        hash = hash ? hash : 1;
+        size_t old_index = map_get_uint64_from_uint64(&old_ranges, hash);
+        while (old_index && file->ranges[old_index - 1].len != len) {
+            old_index = next_same[old_index];
+        }
+        ParsedRange range;
+        if (old_index) {
+            range = file->ranges[old_index - 1];
+            reused[old_index] = true;
+            map_put_uint64_from_uint64(&old_ranges, hash, next_same[old_index]);
+            PosShift shift = {
+                .first_line = range.pos.line,
+                .lines = pos.line - range.pos.line,
+                .cols = pos.col - range.pos.col,
+                .bytes = pos.offset - range.pos.offset,
+            };
+            if (shift.lines || shift.cols || shift.bytes) {
+                for (size_t j = 0; j < range.num_decls; j++) {
+                    shift_decl(range.decls[j], shift);
+                }
+                for (size_t j = 0; j < range.num_errors; j++) {
+                    shift_pos(&range.errors[j].pos, shift);
+                }
+                range.pos = pos;
+            }
+            for (size_t j = 0; j < range.num_errors; j++) {
+                record_error(range.errors[j]);
+            }
+            file->num_reused++;
+        } else {
+            Error *saved_errors = errors;
+            errors = NULL;
+            Decl **range_decls = NULL;
+            phase_push(PHASE_PARSE);
+            init_stream_at(start, pos);
+            while (!is_token_eof() && token.start < end) {
+                buf_push(range_decls, parse_decl());
+            }
+            phase_pop();
+            range = (ParsedRange){
+                .hash = hash,
+                .len = len,
+                .pos = pos,
+                .decls = ast_dup(range_decls, buf_sizeof(range_decls)),
+                .num_decls = buf_len(range_decls),
+                .errors = errors ? memdup(errors, buf_sizeof(errors)) : NULL,
+                .num_errors = buf_len(errors),
+            };
+            for (size_t j = 0; j < range.num_errors; j++) {
+                buf_push(saved_errors, range.errors[j]);
+            }
+            buf_free(errors);
+            errors = saved_errors;
+            buf_free(range_decls);
+            file->num_parsed++;
+        }
+        buf_push(ranges, range);
+        for (size_t j = 0; j < range.num_decls; j++) {
+            buf_push(decls, range.decls[j]);
+        }
+    }
+
+    // ranges that weren't reused are gone for good
+    for (size_t i = 1; i <= num_old_ranges; i++) {
+        if (!reused[i]) {
+            free(file->ranges[i - 1].errors);
+        }
+    }
+    buf_free(file->ranges);
+    file->ranges = ranges;
+    buf_free(starts);
+    free(next_same);
+    free(reused);
+    map_free(&old_ranges);
+
+    Decls *result = new_decls(decls, buf_len(decls));
+    buf_free(decls);
+    return result;
+}
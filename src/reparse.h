@@ -0,0 +1,50 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "error.h"
+#include "lex.h"
+#include "ast.h"
+
+// Incremental reparsing for watch mode and editors. A file is split at its
+// top-level declaration boundaries and each range of source text is hashed.
+// On the next parse, a range whose text is unchanged reuses the Decls (and
+// syntax errors) from last time, shifted to its new line, and only the
+// changed ranges are lexed and parsed again.
+
+typedef struct ParsedRange {
+    uint64_t hash;
+    size_t len;
+    SrcPos pos;
+    Decl **decls;
+    size_t num_decls;
+    Error *errors;
+    size_t num_errors;
+} ParsedRange;
+
+typedef struct ParsedFile {
+    const char *name;
+    // the buffer the file was last parsed from, and with lazy fn bodies every
+    // earlier one too, since skipped bodies in reused Decls point into them
+    char **bufs;
+    ParsedRange *ranges;
+    size_t num_reused;
+    size_t num_parsed;
+} ParsedFile;
+
+// how positions in a reused range move; columns only change on its first line
+typedef struct PosShift {
+    int first_line;
+    int lines;
+    int cols;
+    int bytes;
+} PosShift;
+
+static void shift_pos(SrcPos *pos, PosShift shift);
+static void shift_typespec(Typespec *type, PosShift shift);
+static void shift_expr(Expr *expr, PosShift shift);
+static void shift_stmt_list(StmtList *block, PosShift shift);
+static void shift_stmt(Stmt *stmt, PosShift shift);
+static void shift_decl(Decl *decl, PosShift shift);
+
+static Decls *reparse_file(ParsedFile *file, char *buf);
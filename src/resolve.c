@@ -0,0 +1,478 @@
+#include "resolve.h"
+
+static THREAD_LOCAL Resolver resolver;
+
+// Names that mean something without being declared. They aren't interned up
+// front, since the C backend takes an interned builtin name to mean some
+// source uses it.
+static const char *builtin_names[] = {
+    "true", "false",
+    // C backend builtins, see emit.h
+    "select", "any", "all", "shuffle", "map", "reduce",
+};
+
+// A vector type's name, like f32x4, in the C backend's 16, 32 or 64 bytes.
+static bool
+is_vector_type_name(const char *name) {
+    for (BcType lane = BC_I8; lane <= BC_F64; lane++) {
+        size_t len = strlen(bc_type_names[lane]);
+        if (strncmp(name, bc_type_names[lane], len) != 0 || name[len] != 'x' || !isdigit((unsigned char)name[len + 1])) {
+            continue;
+        }
+        char *end;
+        long lanes = strtol(name + len + 1, &end, 10);
+        long bytes = lanes * bc_type_bits(lane) / 8;
+        return !*end && name[len + 1] != '0' && (bytes == 16 || bytes == 32 || bytes == 64);
+    }
+    return false;
+}
+
+// Only asked about names nothing declares, which are rare.
+static bool
+is_builtin_name(const char *name) {
+    for (size_t i = 0; i < sizeof(builtin_names) / sizeof(*builtin_names); i++) {
+        if (strcmp(name, builtin_names[i]) == 0) {
+            return true;
+        }
+    }
+    return is_vector_type_name(name);
+}
+
+static ResolveSlot *
+resolve_slot(Resolver *r, const char *name) {
+    size_t mask = r->num_slots - 1;
+    for (size_t i = hash_ptr(name) & mask;; i = (i + 1) & mask) {
+        ResolveSlot *slot = &r->slots[i];
+        if (slot->name == name || !slot->name) {
+            return slot;
+        }
+    }
+}
+
+static void
+resolve_grow(Resolver *r) {
+    ResolveSlot *old_slots = r->slots;
+    size_t old_num_slots = r->num_slots;
+    r->num_slots = old_num_slots ? old_num_slots * 2 : RESOLVE_MIN_SLOTS;
+    r->slots = xcalloc(r->num_slots, sizeof(ResolveSlot));
+    for (size_t i = 0; i < old_num_slots; i++) {
+        if (old_slots[i].name) {
+            *resolve_slot(r, old_slots[i].name) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+// Binds name in the innermost scope.
+static void
+resolve_bind(Resolver *r, const char *name) {
+    if ((r->num_names + 1) * 2 > r->num_slots) {
+        resolve_grow(r);
+    }
+    ResolveSlot *slot = resolve_slot(r, name);
+    if (!slot->name) {
+        *slot = (ResolveSlot){name, RESOLVE_NONE};
+        r->num_names++;
+    }
+    buf_push(r->bindings, (Binding){name, slot->binding});
+    slot->binding = (u32)(buf_len(r->bindings) - 1);
+}
+
+// Leaves the scopes entered since the stack was height bindings high.
+static void
+resolve_pop(Resolver *r, size_t height) {
+    while (buf_len(r->bindings) > height) {
+        Binding binding = buf_pop(r->bindings);
+        resolve_slot(r, binding.name)->binding = binding.shadowed;
+    }
+}
+
+static bool
+resolve_is_bound(Resolver *r, const char *name) {
+    if (!r->num_slots) {
+        return false;
+    }
+    ResolveSlot *slot = resolve_slot(r, name);
+    return slot->name && slot->binding != RESOLVE_NONE;
+}
+
+// Edit distance between a and b, where swapping two neighbouring characters
+// is one edit, or more than max once it must be.
+static size_t
+name_distance(const char *a, size_t a_len, const char *b, size_t b_len, size_t max) {
+    if ((a_len > b_len ? a_len - b_len : b_len - a_len) > max) {
+        return max + 1;
+    }
+    size_t rows[3][RESOLVE_MAX_NAME_LEN + 1];
+    size_t *prev2 = rows[0], *prev = rows[1], *row = rows[2];
+    for (size_t j = 0; j <= b_len; j++) {
+        prev[j] = j;
+    }
+    for (size_t i = 1; i <= a_len; i++) {
+        row[0] = i;
+        size_t row_min = i;
+        for (size_t j = 1; j <= b_len; j++) {
+            size_t cost = a[i - 1] != b[j - 1];
+            size_t best = prev[j - 1] + cost;
+            if (prev[j] + 1 < best) {
+                best = prev[j] + 1;
+            }
+            if (row[j - 1] + 1 < best) {
+                best = row[j - 1] + 1;
+            }
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] && prev2[j - 2] + 1 < best) {
+                best = prev2[j - 2] + 1;
+            }
+            row[j] = best;
+            if (best < row_min) {
+                row_min = best;
+            }
+        }
+        if (row_min > max) {
+            return max + 1;
+        }
+        size_t *oldest = prev2;
+        prev2 = prev;
+        prev = row;
+        row = oldest;
+    }
+    return prev[b_len];
+}
+
+typedef struct Suggestion {
+    const char *name;
+    size_t len;
+    size_t max;
+    const char *best;
+    size_t best_distance;
+} Suggestion;
+
+static void
+suggest(Suggestion *s, const char *candidate) {
+    size_t len = strlen(candidate);
+    if (len > RESOLVE_MAX_NAME_LEN) {
+        return;
+    }
+    size_t distance = name_distance(s->name, s->len, candidate, len, s->max);
+    // ties go to the first name in byte order, which doesn't depend on
+    // where anything was allocated
+    if (distance < s->best_distance || (distance == s->best_distance && s->best && strcmp(candidate, s->best) < 0)) {
+        s->best = candidate;
+        s->best_distance = distance;
+    }
+}
+
+static void
+suggest_from_map(Suggestion *s, Map *map) {
+    for (size_t i = 0; i < map->cap; i++) {
+        if (map->keys[i]) {
+            suggest(s, (const char *)(uintptr_t)map->keys[i]);
+        }
+    }
+}
+
+// The name in scope closest to name, if any is close enough to be a likely
+// misspelling of it. Only called for errors, so it can afford to look at
+// every name there is.
+static const char *
+resolve_suggestion(Resolver *r, const char *name) {
+    size_t len = strlen(name);
+    if (len > RESOLVE_MAX_NAME_LEN) {
+        return NULL;
+    }
+    Suggestion s = {.name = name, .len = len, .max = (len + 2) / 4};
+    s.best_distance = s.max + 1;
+    for (size_t i = 0; i < buf_len(r->bindings); i++) {
+        suggest(&s, r->bindings[i].name);
+    }
+    suggest_from_map(&s, &r->scope->decls);
+    suggest_from_map(&s, &r->scope->imports);
+    for (size_t i = 0; i < sizeof(builtin_names) / sizeof(*builtin_names); i++) {
+        suggest(&s, builtin_names[i]);
+    }
+    return s.best;
+}
+
+static void
+resolve_name(Resolver *r, SrcPos pos, const char *name) {
+    if (resolve_is_bound(r, name) || map_get(&r->scope->decls, name) || map_get(&r->scope->imports, name)
+        || is_builtin_name(name)) {
+        return;
+    }
+    const char *suggestion = resolve_suggestion(r, name);
+    if (suggestion) {
+        error(pos, "Unknown name '%s'; did you mean '%s'?", name, suggestion);
+    } else {
+        error(pos, "Unknown name '%s'", name);
+    }
+}
+
+static void resolve_expr(Resolver *r, Expr *expr);
+
+// Array sizes are the only names in a type that are values.
+static void
+resolve_typespec(Resolver *r, Typespec *type) {
+    if (!type) {
+        return;
+    }
+    switch (type->kind) {
+    case TYPESPEC_ARRAY:
+        resolve_expr(r, type->num_elems);
+        break;
+    case TYPESPEC_FUNC:
+        for (size_t i = 0; i < type->fn.num_args; i++) {
+            resolve_typespec(r, type->fn.args[i]);
+        }
+        resolve_typespec(r, type->fn.ret);
+        break;
+    case TYPESPEC_TUPLE:
+        for (size_t i = 0; i < type->tuple.num_fields; i++) {
+            resolve_typespec(r, type->tuple.fields[i]);
+        }
+        break;
+    default:
+        break;
+    }
+    resolve_typespec(r, type->base);
+}
+
+static void
+resolve_expr(Resolver *r, Expr *expr) {
+    if (!expr) {
+        return;
+    }
+    switch (expr->kind) {
+    case EXPR_PAREN:
+        resolve_expr(r, expr->paren.expr);
+        break;
+    case EXPR_NAME:
+        resolve_name(r, expr->pos, expr->name);
+        break;
+    case EXPR_TUPLE:
+        for (size_t i = 0; i < expr->tuple.num_args; i++) {
+            resolve_expr(r, expr->tuple.args[i]);
+        }
+        break;
+    case EXPR_CAST:
+        resolve_typespec(r, expr->cast.type);
+        resolve_expr(r, expr->cast.expr);
+        break;
+    case EXPR_CALL:
+        resolve_expr(r, expr->call.expr);
+        for (size_t i = 0; i < expr->call.num_args; i++) {
+            resolve_expr(r, expr->call.args[i]);
+        }
+        break;
+    case EXPR_INDEX:
+        resolve_expr(r, expr->index.expr);
+        resolve_expr(r, expr->index.index);
+        break;
+    case EXPR_FIELD:
+        resolve_expr(r, expr->field.expr);
+        break;
+    case EXPR_MODIFY:
+        resolve_expr(r, expr->modify.expr);
+        break;
+    case EXPR_UNARY:
+        resolve_expr(r, expr->unary.expr);
+        break;
+    case EXPR_BINARY:
+        resolve_expr(r, expr->binary.left);
+        resolve_expr(r, expr->binary.right);
+        break;
+    case EXPR_TERNARY:
+        resolve_expr(r, expr->ternary.cond);
+        resolve_expr(r, expr->ternary.then_expr);
+        resolve_expr(r, expr->ternary.else_expr);
+        break;
+    case EXPR_SIZEOF_EXPR:
+        resolve_expr(r, expr->sizeof_expr);
+        break;
+    case EXPR_TYPEOF_EXPR:
+        resolve_expr(r, expr->typeof_expr);
+        break;
+    case EXPR_ALIGNOF_EXPR:
+        resolve_expr(r, expr->alignof_expr);
+        break;
+    case EXPR_SIZEOF_TYPE:
+        resolve_typespec(r, expr->sizeof_type);
+        break;
+    case EXPR_TYPEOF_TYPE:
+        resolve_typespec(r, expr->typeof_type);
+        break;
+    case EXPR_ALIGNOF_TYPE:
+        resolve_typespec(r, expr->alignof_type);
+        break;
+    case EXPR_OFFSETOF:
+        resolve_typespec(r, expr->offsetof_field.type);
+        break;
+    case EXPR_NEW:
+        resolve_expr(r, expr->new_expr.alloc);
+        resolve_expr(r, expr->new_expr.len);
+        resolve_expr(r, expr->new_expr.arg);
+        break;
+    default:
+        break;
+    }
+}
+
+static void resolve_block(Resolver *r, StmtList block);
+
+static void
+resolve_pattern(Resolver *r, Expr *pattern) {
+    if (is_pattern_wildcard(pattern)) {
+        return;
+    } else if (pattern->kind == EXPR_TUPLE) {
+        for (size_t i = 0; i < pattern->tuple.num_args; i++) {
+            resolve_pattern(r, pattern->tuple.args[i]);
+        }
+    } else {
+        resolve_expr(r, pattern);
+    }
+}
+
+static void
+resolve_stmt(Resolver *r, Stmt *stmt) {
+    if (!stmt) {
+        return;
+    }
+    switch (stmt->kind) {
+    case STMT_RETURN:
+    case STMT_EXPR:
+        resolve_expr(r, stmt->expr);
+        break;
+    case STMT_BLOCK:
+        resolve_block(r, stmt->block);
+        break;
+    case STMT_IF:
+        resolve_expr(r, stmt->if_stmt.cond);
+        resolve_block(r, stmt->if_stmt.then_block);
+        for (size_t i = 0; i < stmt->if_stmt.num_elseifs; i++) {
+            resolve_expr(r, stmt->if_stmt.elseifs[i].cond);
+            resolve_block(r, stmt->if_stmt.elseifs[i].block);
+        }
+        resolve_block(r, stmt->if_stmt.else_block);
+        break;
+    case STMT_WHILE:
+        resolve_expr(r, stmt->while_stmt.cond);
+        resolve_block(r, stmt->while_stmt.block);
+        break;
+    case STMT_FOR: {
+        // the init's names are in scope until the loop ends
+        size_t height = buf_len(r->bindings);
+        resolve_stmt(r, stmt->for_stmt.init);
+        resolve_expr(r, stmt->for_stmt.cond);
+        resolve_stmt(r, stmt->for_stmt.next);
+        resolve_block(r, stmt->for_stmt.block);
+        resolve_pop(r, height);
+        break;
+    }
+    case STMT_ASSIGN:
+        resolve_expr(r, stmt->assign.left);
+        resolve_expr(r, stmt->assign.right);
+        break;
+    case STMT_INIT:
+        // x := x refers to the x outside
+        resolve_typespec(r, stmt->init.type);
+        resolve_expr(r, stmt->init.expr);
+        resolve_bind(r, stmt->init.name);
+        break;
+    case STMT_SWITCH:
+        resolve_expr(r, stmt->switch_stmt.expr);
+        for (size_t i = 0; i < stmt->switch_stmt.num_cases; i++) {
+            SwitchCase *c = &stmt->switch_stmt.cases[i];
+            for (size_t j = 0; j < c->num_patterns; j++) {
+                resolve_pattern(r, c->patterns[j]);
+            }
+            resolve_block(r, c->block);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+resolve_block(Resolver *r, StmtList block) {
+    size_t height = buf_len(r->bindings);
+    for (size_t i = 0; i < block.num_stmts; i++) {
+        resolve_stmt(r, block.stmts[i]);
+    }
+    resolve_pop(r, height);
+}
+
+static void
+resolve_fn(Resolver *r, Decl *decl) {
+    for (size_t i = 0; i < decl->fn.num_generics; i++) {
+        resolve_bind(r, decl->fn.generics[i].name);
+    }
+    for (size_t i = 0; i < decl->fn.num_params; i++) {
+        resolve_typespec(r, decl->fn.params[i].type);
+        resolve_bind(r, decl->fn.params[i].name);
+    }
+    resolve_typespec(r, decl->fn.ret_type);
+    resolve_block(r, *parse_decl_fn_body(decl));
+    resolve_pop(r, 0);
+}
+
+static void
+resolve_aggregate(Resolver *r, Aggregate *aggregate) {
+    for (size_t i = 0; i < aggregate->num_items; i++) {
+        AggregateItem *item = &aggregate->items[i];
+        if (item->kind == AGGREGATE_ITEM_FIELD) {
+            resolve_typespec(r, item->type);
+        } else if (item->kind == AGGREGATE_ITEM_SUBAGGREGATE) {
+            resolve_aggregate(r, item->subaggregate);
+        }
+    }
+}
+
+static void
+resolve_module(Decls *decls, ModuleScope *scope) {
+    phase_push(PHASE_RESOLVE);
+    Resolver *r = &resolver;
+    r->scope = scope;
+    for (size_t i = 0; i < decls->num_decls; i++) {
+        Decl *decl = decls->decls[i];
+        switch (decl->kind) {
+        case DECL_FUNC:
+            if (!flag_lazy_fn_bodies) {
+                resolve_fn(r, decl);
+            }
+            break;
+        case DECL_VAR:
+            resolve_typespec(r, decl->var.type);
+            resolve_expr(r, decl->var.expr);
+            break;
+        case DECL_CONST:
+            resolve_typespec(r, decl->const_decl.type);
+            resolve_expr(r, decl->const_decl.expr);
+            break;
+        case DECL_STRUCT:
+        case DECL_UNION:
+            resolve_aggregate(r, decl->aggregate);
+            break;
+        default:
+            break;
+        }
+    }
+    r->scope = NULL;
+    phase_pop();
+}
+
+static void
+resolve_lazy_fn(Decl *decl, ModuleScope *scope) {
+    phase_push(PHASE_RESOLVE);
+    Resolver *r = &resolver;
+    r->scope = scope;
+    resolve_fn(r, decl);
+    r->scope = NULL;
+    phase_pop();
+}
+
+static void
+resolve_free_thread(void) {
+    free(resolver.slots);
+    buf_free(resolver.bindings);
+    resolver = (Resolver){0};
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "stdafx.h"
+#include "common.h"
+#include "error.h"
+#include "lex.h"
+#include "stats.h"
+#include "ast.h"
+#include "parse.h"
+#include "bytecode.h"
+
+// Name resolution. Every name used by a module's fns, vars and consts is
+// looked up when the module is checked, before anything is evaluated, so a
+// misspelled name is reported, with the closest name in scope as a suggestion,
+// whether or not the code using it ever runs at compile time or is generated.
+//
+// Names are interned, so their pointers are the keys. Params, generic params
+// and locals go in one open-addressed table from name to the innermost binding
+// of it, backed by a stack of bindings that each remember the one they shadow.
+// Entering a scope is taking the height of the stack and leaving it pops back
+// to that height, putting back what the popped bindings shadowed, so a scope
+// costs nothing beyond its own names. The table and the stack belong to the
+// thread and are kept from one fn to the next, so resolution only allocates
+// while they grow to fit the largest fn. A name that isn't bound there is
+// looked up in the module's declarations, then its imports, then the
+// builtins.
+//
+// Only names used as values are resolved; the backends look up type names.
+//
+// With lazy fn bodies, a module's fns are left out and each is resolved by
+// resolve_lazy_fn once the checker reaches it, so a fn nothing uses is never
+// parsed.
+
+// names longer than this get no suggestions
+#define RESOLVE_MAX_NAME_LEN 64
+#define RESOLVE_MIN_SLOTS 256
+#define RESOLVE_NONE UINT32_MAX
+
+typedef struct Binding {
+    const char *name;
+    // the binding this one shadows, or RESOLVE_NONE
+    u32 shadowed;
+} Binding;
+
+typedef struct ResolveSlot {
+    const char *name;
+    // innermost binding of name, or RESOLVE_NONE once out of scope
+    u32 binding;
+} ResolveSlot;
+
+typedef struct Resolver {
+    ModuleScope *scope;
+    // names stay in the table once added, so it's never probed past a
+    // removed entry
+    ResolveSlot *slots;
+    size_t num_slots;
+    size_t num_names;
+    Binding *bindings;
+} Resolver;
+
+static bool is_builtin_name(const char *name);
+static void resolve_module(Decls *decls, ModuleScope *scope);
+static void resolve_lazy_fn(Decl *decl, ModuleScope *scope);
+static void resolve_free_thread(void);
@@ -0,0 +1,409 @@
+#include "server.h"
+
+#ifndef _WIN32
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+// ServerFiles by interned absolute path
+static Map server_files;
+static ServerFile **server_file_list;
+static ServerStats server_stats;
+
+static bool write_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static char *read_all(int fd) {
+    char *buf = NULL;
+    char chunk[4096];
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            buf_push(buf, chunk[i]);
+        }
+    }
+    buf_push(buf, 0);
+    return buf;
+}
+
+// Looks up the file for path, creating it if it's new. Files go by their
+// absolute path, which is also the name diagnostics use.
+static ServerFile *server_get_file(const char *path) {
+    char *full_path = os_full_path(path);
+    const char *key = str_intern(full_path ? full_path : path);
+    free(full_path);
+    ServerFile *file = map_get(&server_files, key);
+    if (!file) {
+        file = xcalloc(1, sizeof(ServerFile));
+        file->path = key;
+        file->parsed.name = key;
+        map_put(&server_files, key, file);
+        buf_push(server_file_list, file);
+    }
+    return file;
+}
+
+// Checks the file against the disk. Returns true if it has new contents in
+// file->buf that need to be reparsed.
+static bool server_refresh_file(ServerFile *file) {
+    FileStat st;
+    bool exists = os_stat(file->path, &st);
+    if (exists && file->decls && st.mtime_ns == file->stat.mtime_ns && st.size == file->stat.size) {
+        return false;
+    }
+    char *buf = exists ? read_file(file->path) : NULL;
+    if (!buf) {
+        buf_free(file->errors);
+        error((SrcPos){.name = file->path}, "Could not read file");
+        file->errors = errors;
+        errors = NULL;
+        file->decls = NULL;
+        file->stat = (FileStat){0};
+        return false;
+    }
+    server_stats.files_read++;
+    file->stat = st;
+    uint64_t hash = hash_bytes(buf, strlen(buf));
+    if (file->decls && hash == file->hash) {
+        // touched but unchanged
+        free(buf);
+        return false;
+    }
+    file->hash = hash;
+    file->buf = buf;
+    return true;
+}
+
+static void server_reparse_task(void *arg) {
+    ServerFile *file = arg;
+    buf_free(file->errors);
+    file->decls = reparse_file(&file->parsed, file->buf);
+    file->buf = NULL;
+    file->errors = errors;
+    errors = NULL;
+}
+
+// Brings every file the server knows up to date, parsing the changed ones on
+// the pool. Files an earlier request imported are included, since this one may
+// import them too.
+static void server_refresh_files(void) {
+    ServerFile **changed = NULL;
+    Pool *pool = pool_create(flag_num_jobs ? flag_num_jobs : os_num_cores());
+    for (size_t i = 0; i < buf_len(server_file_list); i++) {
+        if (server_refresh_file(server_file_list[i])) {
+            buf_push(changed, server_file_list[i]);
+            pool_submit(pool, server_reparse_task, server_file_list[i]);
+        }
+    }
+    pool_run(pool);
+    pool_free(pool);
+    for (size_t i = 0; i < buf_len(changed); i++) {
+        server_stats.files_reparsed++;
+        server_stats.ranges_reused += changed[i]->parsed.num_reused;
+        server_stats.ranges_parsed += changed[i]->parsed.num_parsed;
+    }
+    buf_free(changed);
+}
+
+// Runs in the child: compiles the request as driver_main would, with the files
+// the server has parsed preloaded. The C for -o - and the diagnostics go to fd,
+// and the path of every module compiled to modules_fd. Returns the exit code.
+static int server_compile(ServerRequest *request, int fd, int modules_fd) {
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    if (chdir(request->cwd) != 0) {
+        printf("crust: cannot change to directory %s\n", request->cwd);
+        fflush(stdout);
+        return 1;
+    }
+    flag_import_paths = request->import_paths;
+    flag_emit_c_path = request->emit_c_path;
+    flag_cache_dir = request->cache_dir;
+    flag_simd_bytes = request->simd_bytes;
+    flag_specialize_budget = request->specialize_budget;
+    flag_print_consts = request->print_consts;
+    flag_print_layouts = request->print_layouts;
+    flag_time_report = request->time_report;
+    for (size_t i = 0; i < buf_len(server_file_list); i++) {
+        ServerFile *file = server_file_list[i];
+        if (file->decls) {
+            // the last buffer is the one it was parsed from
+            const char *buf = file->parsed.bufs[buf_len(file->parsed.bufs) - 1];
+            preload_module(file->path, file->decls, file->errors, buf);
+        }
+    }
+    if (flag_cache_dir && !os_mkdir(flag_cache_dir)) {
+        printf("crust: cannot create cache directory %s\n", flag_cache_dir);
+        flag_cache_dir = NULL;
+    }
+    int num_threads = flag_num_jobs ? flag_num_jobs : os_num_cores();
+    const_cache_init();
+    type_init();
+    SourceFile **files = compile_files(request->paths, num_threads);
+    print_decl_info(files);
+    bool write_failed = false;
+    if (flag_emit_c_path && !num_errors()) {
+        write_failed = !write_c_file(files, num_threads);
+    }
+    size_t num_errors_found = num_errors();
+    char *out = NULL;
+    render_errors(&out, request->json);
+    if (out) {
+        fwrite(out, 1, buf_len(out), stdout);
+    }
+    buf_clear(out);
+    if (flag_time_report) {
+        print_time_report(&out, os_time_ns() - request->start_ns, flag_time_report);
+        fwrite(out, 1, buf_len(out), stdout);
+        buf_clear(out);
+    }
+    fflush(stdout);
+    for (size_t i = 0; i < buf_len(files); i++) {
+        buf_printf(out, "%s\n", files[i]->full_path);
+    }
+    write_all(modules_fd, out, buf_len(out));
+    buf_free(out);
+    buf_free(files);
+    return num_errors_found || write_failed ? 1 : 0;
+}
+
+// Brings the files up to date, then compiles the request in a child process
+// that replies to fd. Returns the exit code for the client.
+static int server_check(ServerRequest *request, int fd) {
+    for (size_t i = 0; i < buf_len(request->paths); i++) {
+        request->paths[i] = server_get_file(request->paths[i])->path;
+    }
+    server_refresh_files();
+    int modules_pipe[2];
+    pid_t pid = -1;
+    if (pipe(modules_pipe) == 0) {
+        pid = fork();
+        if (pid < 0) {
+            close(modules_pipe[0]);
+            close(modules_pipe[1]);
+        }
+    }
+    if (pid < 0) {
+        const char *message = "crust: cannot start a compile\n";
+        write_all(fd, message, strlen(message));
+        return 1;
+    }
+    if (pid == 0) {
+        close(modules_pipe[0]);
+        _exit(server_compile(request, fd, modules_pipe[1]));
+    }
+    close(modules_pipe[1]);
+    char *modules = read_all(modules_pipe[0]);
+    close(modules_pipe[0]);
+    for (char *line = modules; *line;) {
+        char *end = strchr(line, '\n');
+        if (!end) {
+            break;
+        }
+        *end = 0;
+        server_get_file(line);
+        line = end + 1;
+    }
+    buf_free(modules);
+    int wait_status;
+    if (waitpid(pid, &wait_status, 0) != pid || !WIFEXITED(wait_status)) {
+        return 1;
+    }
+    return WEXITSTATUS(wait_status);
+}
+
+// Answers one request. Returns false when the server should shut down.
+static bool server_handle(int fd) {
+    char *text = read_all(fd);
+    server_stats.requests++;
+    const char **args = NULL;
+    for (char *line = text; *line;) {
+        char *end = strchr(line, '\n');
+        if (end) {
+            *end = 0;
+        }
+        buf_push(args, line);
+        line = end ? end + 1 : line + strlen(line);
+    }
+    ServerRequest request = {
+        .cwd = buf_len(args) ? args[0] : ".",
+        .simd_bytes = flag_simd_bytes,
+        .specialize_budget = flag_specialize_budget,
+        .start_ns = os_time_ns(),
+    };
+    char *out = NULL;
+    int status = 0;
+    bool keep_running = true;
+    for (size_t i = 1; i < buf_len(args); i++) {
+        const char *arg = args[i];
+        if (strcmp(arg, "--json-errors") == 0) {
+            request.json = true;
+        } else if (strcmp(arg, "-I") == 0 && i + 1 < buf_len(args)) {
+            buf_push(request.import_paths, args[++i]);
+        } else if (strncmp(arg, "-I", 2) == 0 && arg[2]) {
+            buf_push(request.import_paths, arg + 2);
+        } else if (strcmp(arg, "-o") == 0 && i + 1 < buf_len(args)) {
+            request.emit_c_path = args[++i];
+        } else if (strcmp(arg, "--cache-dir") == 0 && i + 1 < buf_len(args)) {
+            request.cache_dir = args[++i];
+        } else if (strcmp(arg, "--simd") == 0 && i + 1 < buf_len(args)) {
+            const char *target = args[++i];
+            request.simd_bytes = simd_target_bytes(target);
+            if (!request.simd_bytes) {
+                buf_printf(out, "crust: unknown SIMD target '%s'\n", target);
+                status = 1;
+            }
+        } else if (strcmp(arg, "--specialize-budget") == 0 && i + 1 < buf_len(args)) {
+            const char *num = args[++i];
+            request.specialize_budget = parse_specialize_budget(num);
+            if (request.specialize_budget < 0) {
+                buf_printf(out, "crust: invalid specialize budget '%s'\n", num);
+                status = 1;
+            }
+        } else if (strcmp(arg, "--print-consts") == 0) {
+            request.print_consts = true;
+        } else if (strcmp(arg, "--print-layouts") == 0) {
+            request.print_layouts = true;
+        } else if (strcmp(arg, "--time-report") == 0) {
+            request.time_report = TIME_REPORT_TABLE;
+        } else if (strcmp(arg, "--time-report=json") == 0) {
+            request.time_report = TIME_REPORT_JSON;
+        } else if (strcmp(arg, "--stats") == 0) {
+            buf_printf(out, "files %zu\nrequests %zu\nfiles read %zu\nfiles reparsed %zu\nranges reused %zu\nranges parsed %zu\n",
+                buf_len(server_file_list), server_stats.requests, server_stats.files_read,
+                server_stats.files_reparsed, server_stats.ranges_reused, server_stats.ranges_parsed);
+        } else if (strcmp(arg, "--shutdown") == 0) {
+            keep_running = false;
+        } else if (arg[0] == '-') {
+            buf_printf(out, "crust: unknown option '%s'\n", arg);
+            status = 1;
+        } else {
+            char *path = arg[0] == '/' ? strf("%s", arg) : strf("%s/%s", request.cwd, arg);
+            add_source_paths(&request.paths, path);
+            free(path);
+        }
+    }
+    if (request.paths && status == 0) {
+        // the child's reply comes after what we have so far
+        write_all(fd, out, buf_len(out));
+        buf_clear(out);
+        status = server_check(&request, fd);
+    }
+    buf_printf(out, "status %d\n", status);
+    write_all(fd, out, buf_len(out));
+    buf_free(out);
+    buf_free(request.paths);
+    buf_free(request.import_paths);
+    buf_free(args);
+    buf_free(text);
+    return keep_running;
+}
+
+static bool make_socket_addr(const char *socket_path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "crust: socket path too long: %s\n", socket_path);
+        return false;
+    }
+    strcpy(addr->sun_path, socket_path);
+    return true;
+}
+
+static int server_main(const char *socket_path) {
+    struct sockaddr_un addr;
+    if (!make_socket_addr(socket_path, &addr)) {
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+        fprintf(stderr, "crust: cannot listen on %s\n", socket_path);
+        return 1;
+    }
+    // diagnostics go back to the client, never to our stdout
+    flag_json_errors = false;
+    // reparsing frees the old buffers, which skipped fn bodies would point into
+    flag_lazy_fn_bodies = false;
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        bool keep_running = server_handle(fd);
+        close(fd);
+        if (!keep_running) {
+            break;
+        }
+    }
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
+
+static int client_main(const char *socket_path, int argc, const char **argv) {
+    struct sockaddr_un addr;
+    if (!make_socket_addr(socket_path, &addr)) {
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "crust: cannot connect to %s\n", socket_path);
+        return 1;
+    }
+    char cwd[4096];
+    char *request = NULL;
+    buf_printf(request, "%s\n", getcwd(cwd, sizeof(cwd)) ? cwd : ".");
+    for (int i = 0; i < argc; i++) {
+        buf_printf(request, "%s\n", argv[i]);
+    }
+    bool sent = write_all(fd, request, buf_len(request));
+    buf_free(request);
+    shutdown(fd, SHUT_WR);
+    char *reply = sent ? read_all(fd) : NULL;
+    close(fd);
+    // the status is the last line
+    char *status = NULL;
+    if (reply && buf_len(reply) >= 2) {
+        status = reply + buf_len(reply) - 2;
+        while (status > reply && status[-1] != '\n') {
+            status--;
+        }
+    }
+    if (!status || strncmp(status, "status ", 7) != 0) {
+        fprintf(stderr, "crust: no reply from %s\n", socket_path);
+        buf_free(reply);
+        return 1;
+    }
+    fwrite(reply, 1, status - reply, stdout);
+    fflush(stdout);
+    int code = atoi(status + 7);
+    buf_free(reply);
+    return code;
+}
+
+#else
+
+static int server_main(const char *socket_path) {
+    fprintf(stderr, "crust: the compile server needs Unix domain sockets\n");
+    return 1;
+}
+
+static int client_main(const char *socket_path, int argc, const char **argv) {
+    fprintf(stderr, "crust: the compile server needs Unix domain sockets\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "stdafx.h"
+#include "os.h"
+#include "common.h"
+#include "error.h"
+#include "reparse.h"
+#include "driver.h"
+
+// Compile server. `crust --server <socket>` stays resident and keeps the
+// keyword table, the interner, every parsed file and its diagnostics in
+// memory. `crust --connect <socket> <args>...` sends its working directory
+// and arguments over the Unix domain socket and prints the reply, so build
+// systems pay the startup cost once. A file is read again only when its size
+// or mtime changed, and reparsed (incrementally) only when its content hash
+// changed.
+//
+// A request is the client's working directory and then one argument per
+// line, ended by shutting down the write side of the socket. The reply is
+// the rendered diagnostics followed by a last line "status <exit code>".
+// Requests take paths and -I, -o, --cache-dir, --json-errors, --simd,
+// --specialize-budget, --print-consts, --print-layouts and --time-report as on
+// the command line, or --stats or --shutdown.
+//
+// The server only parses. Each compile runs in a child forked from it, which
+// resolves imports, checks and evaluates the server's parsed files as the
+// command line would and writes to the client itself, so nothing it does is
+// left behind for the next request. The child sends back the path of every
+// module it compiled, and the server keeps the imported ones parsed as well.
+
+typedef struct ServerRequest {
+    const char *cwd;
+    const char **paths;
+    const char **import_paths;
+    const char *emit_c_path;
+    const char *cache_dir;
+    bool json;
+    int simd_bytes;
+    int specialize_budget;
+    bool print_consts;
+    bool print_layouts;
+    TimeReport time_report;
+    uint64_t start_ns;
+} ServerRequest;
+
+typedef struct ServerFile {
+    const char *path;
+    FileStat stat;
+    uint64_t hash;
+    // new contents read by this request, to be reparsed
+    char *buf;
+    ParsedFile parsed;
+    Decls *decls;
+    // diagnostics of the last parse, or of the failed read
+    Error *errors;
+} ServerFile;
+
+typedef struct ServerStats {
+    size_t requests;
+    size_t files_read;
+    size_t files_reparsed;
+    size_t ranges_reused;
+    size_t ranges_parsed;
+} ServerStats;
+
+static ServerFile *server_get_file(const char *path);
+static bool server_refresh_file(ServerFile *file);
+static void server_reparse_task(void *arg);
+static void server_refresh_files(void);
+static int server_compile(ServerRequest *request, int fd, int modules_fd);
+static int server_check(ServerRequest *request, int fd);
+static bool server_handle(int fd);
+static int server_main(const char *socket_path);
+static int client_main(const char *socket_path, int argc, const char **argv);
@@ -0,0 +1,123 @@
+#include "stats.h"
+
+static const char *phase_names[] = {
+    [PHASE_CACHE] = "cache",
+    [PHASE_LOAD] = "load",
+    [PHASE_SCAN] = "scan",
+    [PHASE_PARSE] = "parse",
+    [PHASE_MERGE] = "merge",
+    [PHASE_IMPORTS] = "imports",
+    [PHASE_RESOLVE] = "resolve",
+    [PHASE_EVAL] = "eval",
+    [PHASE_CHECK] = "check",
+    [PHASE_EMIT] = "emit",
+    [PHASE_DIAGNOSTICS] = "diagnostics",
+};
+
+// Charges the time since the last switch to the phase being left, so nested
+// phases are not counted twice.
+static void phase_push(Phase phase) {
+    if (!flag_time_report) {
+        return;
+    }
+    uint64_t now = os_time_ns();
+    PhaseTimer *timer = &phase_timer;
+    if (timer->depth > 0) {
+        thread_stats.phase_ns[timer->stack[timer->depth - 1]] += now - timer->last_ns;
+    }
+    assert(timer->depth < MAX_PHASE_DEPTH);
+    timer->stack[timer->depth++] = phase;
+    timer->last_ns = now;
+    thread_stats.phase_calls[phase]++;
+}
+
+static void phase_pop(void) {
+    if (!flag_time_report) {
+        return;
+    }
+    uint64_t now = os_time_ns();
+    PhaseTimer *timer = &phase_timer;
+    assert(timer->depth > 0);
+    thread_stats.phase_ns[timer->stack[--timer->depth]] += now - timer->last_ns;
+    timer->last_ns = now;
+}
+
+static void stats_flush_thread(void) {
+    uint64_t *from = (uint64_t *)&thread_stats;
+    uint64_t *to = (uint64_t *)&total_stats;
+    mutex_lock(&stats_mutex);
+    for (size_t i = 0; i < sizeof(Stats) / sizeof(uint64_t); i++) {
+        to[i] += from[i];
+    }
+    mutex_unlock(&stats_mutex);
+    memset(&thread_stats, 0, sizeof(thread_stats));
+}
+
+static void print_time_report(char **out, uint64_t wall_ns, TimeReport format) {
+    stats_flush_thread();
+    Stats *stats = &total_stats;
+    uint64_t total_ns = 0;
+    for (int i = 0; i < NUM_PHASES; i++) {
+        total_ns += stats->phase_ns[i];
+    }
+    if (format == TIME_REPORT_JSON) {
+        buf_printf(*out, "{\"wall_ns\":%" PRIu64 ",\"phases\":{", wall_ns);
+        for (int i = 0; i < NUM_PHASES; i++) {
+            buf_printf(*out, "%s\"%s\":{\"calls\":%" PRIu64 ",\"ns\":%" PRIu64 "}", i ? "," : "",
+                phase_names[i], stats->phase_calls[i], stats->phase_ns[i]);
+        }
+        buf_printf(*out, "},\"tokens\":{");
+        bool first = true;
+        for (int i = 0; i < NUM_TOKEN_KINDS; i++) {
+            if (stats->tokens[i]) {
+                buf_printf(*out, "%s", first ? "" : ",");
+                buf_json_string(out, token_kind_name(i));
+                buf_printf(*out, ":%" PRIu64, stats->tokens[i]);
+                first = false;
+            }
+        }
+        buf_printf(*out, "},\"intern\":{\"cache_hits\":%" PRIu64 ",\"hits\":%" PRIu64 ",\"misses\":%" PRIu64 "}",
+            stats->intern_cache_hits, stats->intern_hits, stats->intern_misses);
+        buf_printf(*out, ",\"arena\":{\"bytes\":%" PRIu64 ",\"blocks\":%" PRIu64 "},\"map_grows\":%" PRIu64,
+            stats->arena_bytes, stats->arena_blocks, stats->map_grows);
+        buf_printf(*out, ",\"cache\":{\"hits\":%" PRIu64 ",\"misses\":%" PRIu64 "}",
+            stats->cache_hits, stats->cache_misses);
+        buf_printf(*out, ",\"eval\":{\"consts\":%" PRIu64 ",\"loaded\":%" PRIu64 ",\"funcs\":%" PRIu64 ",\"instrs\":%" PRIu64 "}",
+            stats->consts_evaluated, stats->consts_loaded, stats->bc_funcs, stats->bc_instrs);
+        buf_printf(*out, ",\"emit\":{\"bytes\":%" PRIu64 ",\"instances\":%" PRIu64 ",\"kernels\":%" PRIu64 ",\"dropped\":%" PRIu64 "}}\n",
+            stats->emit_bytes, stats->emit_instances, stats->emit_kernels, stats->emit_dropped);
+        return;
+    }
+    buf_printf(*out, "%-18s %12s %12s %7s\n", "phase", "calls", "time (ms)", "%");
+    for (int i = 0; i < NUM_PHASES; i++) {
+        buf_printf(*out, "%-18s %12" PRIu64 " %12.3f %6.1f%%\n", phase_names[i], stats->phase_calls[i],
+            stats->phase_ns[i] / 1e6, total_ns ? 100.0 * stats->phase_ns[i] / total_ns : 0.0);
+    }
+    buf_printf(*out, "%-18s %12s %12.3f\n", "all threads", "", total_ns / 1e6);
+    buf_printf(*out, "%-18s %12s %12.3f\n\n", "wall", "", wall_ns / 1e6);
+    uint64_t num_tokens = 0;
+    buf_printf(*out, "%-18s %12s\n", "token", "count");
+    for (int i = 0; i < NUM_TOKEN_KINDS; i++) {
+        if (stats->tokens[i]) {
+            buf_printf(*out, "%-18s %12" PRIu64 "\n", token_kind_name(i), stats->tokens[i]);
+            num_tokens += stats->tokens[i];
+        }
+    }
+    buf_printf(*out, "%-18s %12" PRIu64 "\n\n", "all tokens", num_tokens);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "intern cache hits", stats->intern_cache_hits);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "intern hits", stats->intern_hits);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "intern misses", stats->intern_misses);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "arena bytes", stats->arena_bytes);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "arena blocks", stats->arena_blocks);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "map grows", stats->map_grows);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "cache hits", stats->cache_hits);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "cache misses", stats->cache_misses);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "consts evaluated", stats->consts_evaluated);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "consts loaded", stats->consts_loaded);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "bytecode fns", stats->bc_funcs);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "bytecode instrs", stats->bc_instrs);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "C bytes", stats->emit_bytes);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "generic instances", stats->emit_instances);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "array kernels", stats->emit_kernels);
+    buf_printf(*out, "%-18s %12" PRIu64 "\n", "dead decls dropped", stats->emit_dropped);
+}
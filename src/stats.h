@@ -0,0 +1,87 @@
+#pragma once
+
+#include "stdafx.h"
+#include "os.h"
+#include "common.h"
+#include "lex.h"
+
+// Instrumentation for --time-report. Each thread times the phases it runs
+// and bumps its own counters without locking; the totals are folded into
+// total_stats when a worker thread exits and before the report is printed.
+// Everything is a no-op unless flag_time_report is set.
+
+typedef enum TimeReport {
+    TIME_REPORT_NONE,
+    TIME_REPORT_TABLE,
+    TIME_REPORT_JSON,
+} TimeReport;
+
+typedef enum Phase {
+    PHASE_CACHE,
+    PHASE_LOAD,
+    // finding top-level declaration boundaries to split files at
+    PHASE_SCAN,
+    // lexing and interning included: they run a token at a time, which is too
+    // fine grained to time without slowing them down
+    PHASE_PARSE,
+    PHASE_MERGE,
+    // resolving and checking imports
+    PHASE_IMPORTS,
+    // looking up the names used in fns, vars and consts
+    PHASE_RESOLVE,
+    // lowering to bytecode and running it
+    PHASE_EVAL,
+    // type checking fn bodies and vars
+    PHASE_CHECK,
+    // generating C
+    PHASE_EMIT,
+    PHASE_DIAGNOSTICS,
+    NUM_PHASES,
+} Phase;
+
+typedef struct Stats {
+    // time spent in each phase, excluding the phases nested inside it
+    uint64_t phase_ns[NUM_PHASES];
+    uint64_t phase_calls[NUM_PHASES];
+    uint64_t tokens[NUM_TOKEN_KINDS];
+    // found in the thread's intern_cache, found in the shared table, new
+    uint64_t intern_cache_hits;
+    uint64_t intern_hits;
+    uint64_t intern_misses;
+    uint64_t arena_bytes;
+    uint64_t arena_blocks;
+    uint64_t map_grows;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t consts_evaluated;
+    uint64_t consts_loaded;
+    uint64_t bc_funcs;
+    uint64_t bc_instrs;
+    uint64_t emit_bytes;
+    uint64_t emit_instances;
+    uint64_t emit_kernels;
+    // fns, vars and structs nothing reaches
+    uint64_t emit_dropped;
+} Stats;
+
+#define MAX_PHASE_DEPTH 16
+
+typedef struct PhaseTimer {
+    Phase stack[MAX_PHASE_DEPTH];
+    int depth;
+    uint64_t last_ns;
+} PhaseTimer;
+
+TimeReport flag_time_report = TIME_REPORT_NONE;
+
+static THREAD_LOCAL Stats thread_stats;
+static THREAD_LOCAL PhaseTimer phase_timer;
+static Stats total_stats;
+static Mutex stats_mutex = MUTEX_INIT;
+
+#define STATS_ADD(field, n) (flag_time_report ? (void)(thread_stats.field += (n)) : (void)0)
+
+static void phase_push(Phase phase);
+static void phase_pop(void);
+static void stats_flush_thread(void);
+static void print_time_report(char **out, uint64_t wall_ns, TimeReport format);
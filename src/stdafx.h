@@ -8,6 +8,10 @@
 
 #define __USE_MINGW_ANSI_STDIO 1
 #define _CRT_SECURE_NO_WARNINGS
+// glibc hides POSIX declarations under -std=c11
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
 
 #ifdef __llvm__ 
 #pragma clang diagnostic ignored "-Wmissing-braces"
@@ -27,6 +31,12 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Builds the compiler and runs every fixture, printing the ones that fail.
+#
+#   errors/*.cr  compiled, with the options a first line "// options: ..."
+#                gives; the diagnostics must be the .expected next to it
+#   cache/*.cr   compiled twice into a new --cache-dir, the second time from
+#                the cache; the diagnostics must be the .expected both times
+#   json/*.cr    compiled with --json-errors and --print-consts; the JSON on
+#                stderr must be the .expected, and stdout only the consts
+#   run/*.cr     compiled to C, which is built and must exit 0
+#   server/*.cr  compiled by a compile server, with the options a first line
+#                "// options: ..." gives; the output must be the .expected
+#                and the exit code the command line's
+#
+# CC and CFLAGS pick the C compiler for both; set UPDATE=1 to write the
+# .expected files from the current output instead.
+
+cd "$(dirname "$0")" || exit 1
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:--O1}
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+crust="$tmp/crust"
+if ! $CC -std=c11 $CFLAGS -pthread -o "$crust" ../src/main.c; then
+    echo "FAIL build"
+    exit 1
+fi
+failed=0
+passed=0
+
+fail() {
+    echo "FAIL $1"
+    failed=$((failed + 1))
+}
+
+# check <fixture> <output file>
+check() {
+    expected="${1%.cr}.expected"
+    if [ -n "$UPDATE" ]; then
+        cp "$2" "$expected"
+    fi
+    if cmp -s "$2" "$expected"; then
+        return 0
+    fi
+    diff "$expected" "$2" | head -20
+    return 1
+}
+
+for f in errors/*.cr; do
+    [ -e "$f" ] || continue
+    options=$(sed -n '1s|^// options: ||p' "$f")
+    (cd errors && "$crust" $options "${f#errors/}") > "$tmp/out" 2>&1
+    if check "$f" "$tmp/out"; then passed=$((passed + 1)); else fail "$f"; fi
+done
+
+for f in cache/*.cr; do
+    [ -e "$f" ] || continue
+    rm -rf "$tmp/cache"
+    (cd cache && "$crust" --cache-dir "$tmp/cache" "${f#cache/}") > "$tmp/out" 2>&1
+    (cd cache && "$crust" --cache-dir "$tmp/cache" "${f#cache/}") > "$tmp/out2" 2>&1
+    if check "$f" "$tmp/out" && UPDATE= check "$f" "$tmp/out2"; then passed=$((passed + 1)); else fail "$f"; fi
+done
+
+for f in json/*.cr; do
+    [ -e "$f" ] || continue
+    (cd json && "$crust" --json-errors --print-consts "${f#json/}") > "$tmp/out" 2> "$tmp/err"
+    if check "$f" "$tmp/err" && ! grep -v "): const " "$tmp/out"; then
+        passed=$((passed + 1))
+    else
+        fail "$f"
+    fi
+done
+
+for f in run/*.cr; do
+    [ -e "$f" ] || continue
+    if (cd run && "$crust" "${f#run/}" -o "$tmp/out.c") > "$tmp/out" 2>&1 \
+        && $CC -std=c11 -w -o "$tmp/prog" "$tmp/out.c" && "$tmp/prog"; then
+        passed=$((passed + 1))
+    else
+        cat "$tmp/out"
+        fail "$f"
+    fi
+done
+
+"$crust" --server "$tmp/sock" &
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    [ -S "$tmp/sock" ] && break
+    sleep 0.2
+done
+# the server names files by their absolute path
+dir=$(cd server && pwd -P)
+for f in server/*.cr; do
+    [ -e "$f" ] || continue
+    options=$(sed -n '1s|^// options: ||p' "$f")
+    (cd server && "$crust" $options "${f#server/}") > "$tmp/out" 2>&1
+    cli_status=$?
+    (cd server && "$crust" --connect "$tmp/sock" $options "${f#server/}") > "$tmp/out2" 2>&1
+    server_status=$?
+    sed "s|$dir/||" "$tmp/out2" > "$tmp/out3"
+    if check "$f" "$tmp/out" && UPDATE= check "$f" "$tmp/out3" && [ "$cli_status" -eq "$server_status" ]; then
+        passed=$((passed + 1))
+    else
+        echo "exit code $cli_status from the command line, $server_status from the server"
+        fail "$f"
+    fi
+done
+"$crust" --connect "$tmp/sock" --shutdown > /dev/null
+wait
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]